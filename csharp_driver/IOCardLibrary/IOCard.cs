@@ -1,25 +1,46 @@
 ﻿using CommandMessenger;
+using CommandMessenger.Transport;
 using CommandMessenger.Transport.Serial;
 
 namespace Spark.Slot.IO
 {
-	public class IOCard
+	public partial class IOCard
 	{
 		public enum Commands
 		{
 			CMD_ACK = 0x00,
 			CMD_GET_INFO = 0x01,
 			CMD_GET_KEY_MASKS = 0x02,
+			CMD_SYNC_CLOCK = 0x03,
 			CMD_GET_KEYS = 0x10,
 			CMD_SET_OUTPUT = 0x11,
 			CMD_GET_COIN_COUNTER = 0x20,
 			CMD_RESET_COIN_COINTER = 0x21,
 			CMD_TICK_AUDIT_COUNTER = 0x30,
+			CMD_GET_AUDIT_BACKLOG = 0x31,
 			CMD_EJECT_COIN = 0x40,
 			CMD_SET_TRACK_LEVEL = 0x41,
 			CMD_SET_EJECT_TIMEOUT = 0x42,
+			CMD_QUEUE_EJECT_COIN = 0x43,
+			CMD_GET_EJECT_STATS = 0x44,
 			CMD_READ_STORAGE = 0x50,
+			CMD_STREAM_READ_STORAGE = 0x51,
+			CMD_STREAM_CREDIT = 0x52,
+			CMD_GET_INTEGRITY_MAP = 0x53,
+			CMD_KV_GET = 0x54,
+			CMD_STREAM_ABORT = 0x57,
 			CMD_WRITE_STORAGE = 0x58,
+			CMD_STREAM_WRITE_BEGIN = 0x59,
+			CMD_STREAM_WRITE_CHUNK = 0x5A,
+			CMD_STREAM_WRITE_END = 0x5B,
+			CMD_KV_PUT = 0x5C,
+			CMD_KV_DELETE = 0x5D,
+			CMD_KV_FORMAT = 0x5E,
+			CMD_GET_CMD_STATS = 0x60,
+			CMD_GET_PERSIST_STATS = 0x61,
+			CMD_GET_TASK_STATS = 0x62,
+			CMD_LOAD_TEST = 0x70,
+			CMD_GET_LOAD_TEST_STATS = 0x71,
 			CMD_REBOOT = 0xFF
 		}
 
@@ -27,10 +48,28 @@ namespace Spark.Slot.IO
 		{
 			EVT_GET_INFO_RESULT = 0x01,
 			EVT_KEY_MASKS_RESULT = 0x02,
+			EVT_SYNC_CLOCK_RESULT = 0x03,
 			EVT_KEYS_RESULT = 0x10,
 			EVT_COIN_COUNTER_RESULT = 0x20,
+			EVT_AUDIT_BACKLOG_RESULT = 0x31,
+			EVT_EJECT_RESULT = 0x40,
+			EVT_EJECT_STATS_RESULT = 0x44,
 			EVT_READ_STORAGE_RESULT = 0x50,
+			EVT_STREAM_READ_CHUNK = 0x51,
+			EVT_STREAM_READ_END = 0x52,
+			EVT_INTEGRITY_MAP_RESULT = 0x53,
+			EVT_KV_GET_RESULT = 0x54,
 			EVT_WRITE_STORAGE_RESULT = 0x58,
+			EVT_STREAM_WRITE_BEGIN_RESULT = 0x59,
+			EVT_STREAM_WRITE_ACK = 0x5A,
+			EVT_STREAM_WRITE_RESULT = 0x5B,
+			EVT_KV_PUT_RESULT = 0x5C,
+			EVT_KV_DELETE_RESULT = 0x5D,
+			EVT_KV_FORMAT_RESULT = 0x5E,
+			EVT_CMD_STATS_RESULT = 0x60,
+			EVT_PERSIST_STATS_RESULT = 0x61,
+			EVT_TASK_STATS_RESULT = 0x62,
+			EVT_LOAD_TEST_RESULT = 0x70,
 			EVT_BOOT = 0x80,
 			EVT_DEBUG = 0xFE,
 			EVT_ERROR = 0xFF
@@ -46,6 +85,19 @@ namespace Spark.Slot.IO
 			ERR_TOO_LONG = 0x05,
 			ERR_NOT_A_COUNTER = 0x06,
 			ERR_OUT_OF_RANGE = 0x07,
+			ERR_EJECT_QUEUE_FULL = 0x08,
+			ERR_EJECT_SLOW = 0x09,
+			ERR_STREAM_BUSY = 0x0A,
+			ERR_NO_STREAM = 0x0B,
+			ERR_STREAM_SEQUENCE = 0x0C,
+			ERR_STREAM_CHECKSUM = 0x0D,
+			ERR_STREAM_OUT_OF_RANGE = 0x0E,
+			ERR_KV_FULL = 0x0F,
+			ERR_KV_INVALID = 0x10,
+			ERR_KV_CORRUPTED = 0x11,
+			ERR_STORAGE_CORRUPTED = 0x12,
+			ERR_LOAD_TEST_DENIED = 0x13,
+			ERR_KV_UNFORMATTED = 0x14,
 			ERR_UNKNOWN_COMMAND = 0xFF
 		}
 
@@ -55,6 +107,22 @@ namespace Spark.Slot.IO
 			ActiveHigh = 0x01
 		}
 
+		public enum LoadTestMode
+		{
+			/// <summary>
+			/// stops the test, the inputs are read from the chain again.
+			/// </summary>
+			Off = 0x00,
+			/// <summary>
+			/// random keys at random intervals, the given rates on average.
+			/// </summary>
+			Random = 0x01,
+			/// <summary>
+			/// presses then releases every key in order, at the given rate.
+			/// </summary>
+			Pattern = 0x02
+		}
+
 		/// <summary>
 		/// queues a GET_INFO command
 		/// </summary>
@@ -68,7 +136,31 @@ namespace Spark.Slot.IO
 		{
 			if (IsConnected)
 			{
-				mMessenger.SendCommand(new SendCommand((int)Commands.CMD_GET_INFO), queuePosition);
+				mLink.Send(new IOCardCommand((int)Commands.CMD_GET_INFO), queuePosition);
+				return true;
+			}
+			return false;
+		}
+
+		/// <summary>
+		/// queues a SYNC_CLOCK command, the result is fed into <see cref="Clock"/>.
+		/// </summary>
+		/// <remarks>
+		/// there is no need to call this manually unless <see cref="SyncInterval"/> is set to 0.
+		/// </remarks>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.InFrontQueue</c>.
+		/// </param>
+		public bool QuerySyncClock(SendQueue queuePosition = SendQueue.InFrontQueue)
+		{
+			if (IsConnected)
+			{
+				var cmd = new IOCardCommand((int)Commands.CMD_SYNC_CLOCK);
+				cmd.AddBinArgument(mClock.Ping());
+				mLink.Send(cmd, queuePosition);
 				return true;
 			}
 			return false;
@@ -89,10 +181,71 @@ namespace Spark.Slot.IO
 		{
 			if (IsConnected)
 			{
-				var cmd = new SendCommand((int)Commands.CMD_EJECT_COIN);
+				var cmd = new IOCardCommand((int)Commands.CMD_EJECT_COIN);
+				cmd.AddBinArgument(track);
+				cmd.AddBinArgument(count);
+				mLink.Send(cmd, queuePosition);
+				return true;
+			}
+			return false;
+		}
+
+		/// <summary>
+		/// queues a QUEUE_EJECT_COIN command
+		/// </summary>
+		/// <remarks>
+		/// Unlike EJECT_COIN, the card doesn't refuse the request if it's still paying out, the request is appended to
+		/// the track's payout queue (up to 4 requests including the one being paid out) and the motor keeps running
+		/// until the queue is empty. <see cref="OnEjectResult"/> is fired for each request when it's done, or dropped
+		/// because of a timeout, a missing ACK or an EJECT_COIN with 0 coins.
+		/// </remarks>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="track"><c>CoinTrack</c> indicates which track to eject</param>
+		/// <param name="requestId">id reported back with the result, 0xFF is reserved.</param>
+		/// <param name="count">number of coins to be ejected.</param>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.AtEndQueue</c>, so the requests reach the card in order.
+		/// </param>
+		public bool QueryQueueEjectCoin(byte track, byte requestId, byte count, SendQueue queuePosition = SendQueue.AtEndQueue)
+		{
+			if (IsConnected)
+			{
+				var cmd = new IOCardCommand((int)Commands.CMD_QUEUE_EJECT_COIN);
 				cmd.AddBinArgument(track);
+				cmd.AddBinArgument(requestId);
 				cmd.AddBinArgument(count);
-				mMessenger.SendCommand(cmd, queuePosition);
+				mLink.Send(cmd, queuePosition);
+				return true;
+			}
+			return false;
+		}
+
+		/// <summary>
+		/// queues a GET_EJECT_STATS command
+		/// </summary>
+		/// <remarks>
+		/// The card measures the interval between coins while the motor is running, and uses the estimate to cut the
+		/// SSR right when the final coin of a payout is expected, instead of after it's debounced. A coin taking twice
+		/// the average interval is reported with an ERR_EJECT_SLOW error, long before the eject timeout fires.
+		/// </remarks>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="track"><c>CoinTrack</c> indicates which track to get</param>
+		/// <param name="reset">clear the min / max and the counters on the card after they're sent.</param>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.AtEndQueue</c>.
+		/// </param>
+		public bool QueryGetEjectStats(byte track, bool reset = false, SendQueue queuePosition = SendQueue.AtEndQueue)
+		{
+			if (IsConnected)
+			{
+				var cmd = new IOCardCommand((int)Commands.CMD_GET_EJECT_STATS);
+				cmd.AddBinArgument(track);
+				cmd.AddBinArgument(reset);
+				mLink.Send(cmd, queuePosition);
 				return true;
 			}
 			return false;
@@ -112,9 +265,9 @@ namespace Spark.Slot.IO
 		{
 			if (IsConnected)
 			{
-				var cmd = new SendCommand((int)Commands.CMD_GET_COIN_COUNTER);
+				var cmd = new IOCardCommand((int)Commands.CMD_GET_COIN_COUNTER);
 				cmd.AddBinArgument(track);
-				mMessenger.SendCommand(cmd, queuePosition);
+				mLink.Send(cmd, queuePosition);
 				return true;
 			}
 			return false;
@@ -133,7 +286,7 @@ namespace Spark.Slot.IO
 		{
 			if (IsConnected)
 			{
-				mMessenger.SendCommand(new SendCommand((int)Commands.CMD_GET_KEYS), queuePosition);
+				mLink.Send(new IOCardCommand((int)Commands.CMD_GET_KEYS), queuePosition);
 				return true;
 			}
 			return false;
@@ -152,7 +305,7 @@ namespace Spark.Slot.IO
 		{
 			if (IsConnected)
 			{
-				mMessenger.SendCommand(new SendCommand((int)Commands.CMD_GET_KEY_MASKS), queuePosition);
+				mLink.Send(new IOCardCommand((int)Commands.CMD_GET_KEY_MASKS), queuePosition);
 				return true;
 			}
 			return false;
@@ -175,39 +328,106 @@ namespace Spark.Slot.IO
 		{
 			if (IsConnected)
 			{
-				var cmd = new SendCommand((int)Commands.CMD_SET_EJECT_TIMEOUT);
+				var cmd = new IOCardCommand((int)Commands.CMD_SET_EJECT_TIMEOUT);
 				cmd.AddBinArgument(track);
 				cmd.AddBinArgument(timeout);
-				mMessenger.SendCommand(cmd, queuePosition);
+				mLink.Send(cmd, queuePosition);
 				return true;
 			}
 			return false;
 		}
 
 		/// <summary>
-		/// queues a SET_OUTPUT command
+		/// queues a SET_OUTPUT command, or with <see cref="CoalesceOutputs"/> merges the outputs into the ones the next
+		/// <see cref="FlushOutputs"/> sends.
 		/// </summary>
-		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
-		/// <param name="outputs">Outputs.</param>
+		/// <returns><c>true</c>, if the command was queued or merged, <c>false</c> otherwise.</returns>
+		/// <param name="outputs">
+		/// Outputs, one byte per 74HC595 in the chain. Bytes beyond the chain width (the length of
+		/// <see cref="KeyMasksEventArgs.OutputMasks"/>) are ignored by the card.
+		/// </param>
 		/// <param name="queuePosition">
 		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
 		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
-		/// <c>SendQueue.AtEndQueue</c>.
+		/// <c>SendQueue.AtEndQueue</c>. Ignored when coalescing.
 		/// </param>
 		public bool QuerySetOutput(byte[] outputs, SendQueue queuePosition = SendQueue.AtEndQueue)
 		{
 			if (IsConnected)
 			{
-				var cmd = new SendCommand((int)Commands.CMD_SET_OUTPUT);
-				cmd.AddBinArgument((byte)outputs.Length);
-				foreach (var b in outputs)
-					cmd.AddBinArgument(b);
-				mMessenger.SendCommand(cmd, queuePosition);
+				if (outputs.Length > MAX_OUTPUT_BYTES)
+					throw new System.ArgumentException("Too many outputs.", "outputs");
+
+				if (mCoalesceOutputs)
+				{
+					// like the card does, the bytes given replace the first ones, the others are left alone.
+					lock (mOutputLock)
+					{
+						System.Array.Copy(outputs, mOutputs, outputs.Length);
+						mOutputsLength = System.Math.Max(mOutputsLength, outputs.Length);
+						++mOutputStats.Requests;
+					}
+					return true;
+				}
+
+				// keep the shadow right in case coalescing is turned on later.
+				lock (mOutputLock)
+				{
+					System.Array.Copy(outputs, mOutputs, outputs.Length);
+					System.Array.Copy(outputs, mSentOutputs, outputs.Length);
+					mSentOutputsLength = System.Math.Max(mSentOutputsLength, outputs.Length);
+					++mOutputStats.Requests;
+					++mOutputStats.Frames;
+					_sendOutputs(outputs, outputs.Length, queuePosition);
+				}
 				return true;
 			}
 			return false;
 		}
 
+		/// <summary>
+		/// sends the outputs merged by <see cref="QuerySetOutput"/> since the last flush as a single SET_OUTPUT, if
+		/// they are not what the card has already. Call it once per frame, or set <see cref="OutputFlushInterval"/>.
+		/// </summary>
+		/// <returns><c>true</c>, if a command was queued.</returns>
+		public bool FlushOutputs(SendQueue queuePosition = SendQueue.AtEndQueue)
+		{
+			if (!IsConnected)
+				return false;
+
+			int length;
+			lock (mOutputLock)
+			{
+				if (mOutputsLength == 0)
+					return false;
+				length = mOutputsLength;
+				bool changed = length > mSentOutputsLength;
+				for (int i = 0; !changed && i < length; ++i)
+					changed = mOutputs[i] != mSentOutputs[i];
+				if (!changed)
+				{
+					++mOutputStats.Suppressed;
+					mOutputsLength = 0;
+					return false;
+				}
+				System.Array.Copy(mOutputs, mSentOutputs, length);
+				mSentOutputsLength = System.Math.Max(mSentOutputsLength, length);
+				mOutputsLength = 0;
+				++mOutputStats.Frames;
+				_sendOutputs(mSentOutputs, length, queuePosition);
+			}
+			return true;
+		}
+
+		void _sendOutputs(byte[] outputs, int length, SendQueue queuePosition)
+		{
+			var cmd = new IOCardCommand((int)Commands.CMD_SET_OUTPUT);
+			cmd.AddBinArgument((byte)length);
+			for (int i = 0; i < length; ++i)
+				cmd.AddBinArgument(outputs[i]);
+			mLink.Send(cmd, queuePosition);
+		}
+
 		/// <summary>
 		/// queues a SET_TRACK_LEVEL command
 		/// </summary>
@@ -223,10 +443,10 @@ namespace Spark.Slot.IO
 		{
 			if (IsConnected)
 			{
-				var cmd = new SendCommand((int)Commands.CMD_SET_TRACK_LEVEL);
+				var cmd = new IOCardCommand((int)Commands.CMD_SET_TRACK_LEVEL);
 				cmd.AddBinArgument(track);
 				cmd.AddBinArgument((byte)level);
-				mMessenger.SendCommand(cmd, queuePosition);
+				mLink.Send(cmd, queuePosition);
 				return true;
 			}
 			return false;
@@ -247,10 +467,33 @@ namespace Spark.Slot.IO
 		{
 			if (IsConnected)
 			{
-				var cmd = new SendCommand((int)Commands.CMD_TICK_AUDIT_COUNTER);
+				var cmd = new IOCardCommand((int)Commands.CMD_TICK_AUDIT_COUNTER);
 				cmd.AddBinArgument(counter);
 				cmd.AddBinArgument(ticks);
-				mMessenger.SendCommand(cmd, queuePosition);
+				mLink.Send(cmd, queuePosition);
+				return true;
+			}
+			return false;
+		}
+
+		/// <summary>
+		/// queues a GET_AUDIT_BACKLOG command, the meter ticks not pulsed yet are sent with
+		/// <see cref="OnAuditBacklogResult"/>.
+		/// </summary>
+		/// <remarks>
+		/// The card checkpoints the backlog to the FRAM as it changes, and resumes it after a reset.
+		/// </remarks>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.AtEndQueue</c>.
+		/// </param>
+		public bool QueryGetAuditBacklog(SendQueue queuePosition = SendQueue.AtEndQueue)
+		{
+			if (IsConnected)
+			{
+				mLink.Send(new IOCardCommand((int)Commands.CMD_GET_AUDIT_BACKLOG), queuePosition);
 				return true;
 			}
 			return false;
@@ -271,12 +514,12 @@ namespace Spark.Slot.IO
 		{
 			if (IsConnected)
 			{
-				var cmd = new SendCommand((int)Commands.CMD_WRITE_STORAGE);
+				var cmd = new IOCardCommand((int)Commands.CMD_WRITE_STORAGE);
 				cmd.AddBinArgument(address);
 				cmd.AddBinArgument((byte)data.Length);
 				for (int i = 0; i < data.Length; ++i)
 					cmd.AddBinArgument(data[i]);
-				mMessenger.SendCommand(cmd, queuePosition);
+				mLink.Send(cmd, queuePosition);
 				return true;
 			}
 			return false;
@@ -297,151 +540,938 @@ namespace Spark.Slot.IO
 		{
 			if (IsConnected)
 			{
-				var cmd = new SendCommand((int)Commands.CMD_READ_STORAGE);
+				var cmd = new IOCardCommand((int)Commands.CMD_READ_STORAGE);
 				cmd.AddBinArgument(address);
 				cmd.AddBinArgument(length);
-				mMessenger.SendCommand(cmd, queuePosition);
+				mLink.Send(cmd, queuePosition);
 				return true;
 			}
 			return false;
 		}
 
 		/// <summary>
-		/// queues a RESET_COIN_COUNTER command
+		/// queues a STREAM_READ_STORAGE command
 		/// </summary>
-		/// <returns><c>true</c>, if reset coin counter was queryed, <c>false</c> otherwise.</returns>
-		/// <param name="track"><c>CoinTrack</c> indicates which track to reset</param>
+		/// <remarks>
+		/// The card streams the range with <see cref="OnStreamReadChunk"/> events, up to 32 bytes each, one per credit.
+		/// Return the credits with <see cref="QueryStreamCredit"/> as the chunks are consumed to keep the stream going.
+		/// <see cref="OnStreamReadEnd"/> comes after the last chunk with the CRC of the whole range. Only one stream,
+		/// read or write, can be active at a time. <see cref="IOCardStorageTransfer"/> does all of this.
+		/// </remarks>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="address">first byte to read.</param>
+		/// <param name="length">number of bytes to read.</param>
+		/// <param name="credits">number of chunks the card can send before it has to wait for more credits.</param>
 		/// <param name="queuePosition">
 		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
 		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
-		/// <c>SendQueue.InFrontQueue</c>.
+		/// <c>SendQueue.AtEndQueue</c>.
 		/// </param>
-		public bool QueryResetCoinCounter(byte track, SendQueue queuePosition = SendQueue.InFrontQueue)
+		public bool QueryStreamReadStorage(ushort address, ushort length, byte credits, SendQueue queuePosition = SendQueue.AtEndQueue)
 		{
 			if (IsConnected)
 			{
-				var cmd = new SendCommand((int)Commands.CMD_RESET_COIN_COINTER);
-				cmd.AddBinArgument(track);
-				mMessenger.SendCommand(cmd, queuePosition);
+				var cmd = new IOCardCommand((int)Commands.CMD_STREAM_READ_STORAGE);
+				cmd.AddBinArgument(address);
+				cmd.AddBinArgument(length);
+				cmd.AddBinArgument(credits);
+				mLink.Send(cmd, queuePosition);
 				return true;
 			}
 			return false;
 		}
 
-		public bool QueueReboot(SendQueue queuePosition = SendQueue.InFrontQueue)
+		/// <summary>
+		/// queues a STREAM_CREDIT command
+		/// </summary>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="credits">number of chunks consumed.</param>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.InFrontQueue</c>.
+		/// </param>
+		public bool QueryStreamCredit(byte credits, SendQueue queuePosition = SendQueue.InFrontQueue)
 		{
 			if (IsConnected)
 			{
-				mMessenger.SendCommand(new SendCommand((int)Commands.CMD_REBOOT), queuePosition);
+				var cmd = new IOCardCommand((int)Commands.CMD_STREAM_CREDIT);
+				cmd.AddBinArgument(credits);
+				mLink.Send(cmd, queuePosition);
 				return true;
 			}
 			return false;
 		}
 
 		/// <summary>
-		/// Connect to the IOCard with the specified port and baudrate.
+		/// queues a STREAM_ABORT command, stops the active stream without any further events.
 		/// </summary>
-		/// <param name="port">Port, ex. "COM10" on Windows, or "/dev/ttyUSB0" on Linux</param>
-		/// <param name="baudrate">Baudrate.</param>
-		/// <exception cref="System.InvalidOperationException">Thrown on connection fails (already connected, port busy, etc.)</exception>
-		public void Connect(string port, int baudrate)
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.InFrontQueue</c>.
+		/// </param>
+		public bool QueryStreamAbort(SendQueue queuePosition = SendQueue.InFrontQueue)
 		{
-			lock (this)
+			if (IsConnected)
 			{
-				if (mMessenger != null)
-					throw new System.InvalidOperationException("Already connected.");
-
-				var messenger = new CmdMessenger(
-					new SerialTransport { CurrentSerialSettings = { PortName = port, BaudRate = baudrate, DtrEnable = false } },
-					512
-				);
-				if (messenger.Connect())
-				{
-					mMessenger = messenger;
-					_attachCallbacks();
-					if (OnConnected != null)
-						OnConnected(this, System.EventArgs.Empty);
-					return;
-				}
-
-				throw new System.InvalidOperationException("Connecting failed for unknown reason.");
+				mLink.Send(new IOCardCommand((int)Commands.CMD_STREAM_ABORT), queuePosition);
+				return true;
 			}
+			return false;
 		}
 
 		/// <summary>
-		/// Disconnect from the IOCard
+		/// queues a STREAM_WRITE_BEGIN command
 		/// </summary>
-		public bool Disconnect()
+		/// <remarks>
+		/// The card answers with <see cref="OnStreamWriteBeginResult"/>, telling how many chunks can be in flight. Send
+		/// the chunks in order with <see cref="QueryStreamWriteChunk"/>, each one is acked with
+		/// <see cref="OnStreamWriteAck"/>. A bad chunk is refused with ERR_STREAM_SEQUENCE or ERR_STREAM_CHECKSUM, resend
+		/// from the last ack. Finish with <see cref="QueryStreamWriteEnd"/>, the card reads the range back and reports
+		/// with <see cref="OnStreamWriteResult"/>.
+		/// </remarks>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="address">first byte to write.</param>
+		/// <param name="length">number of bytes to write.</param>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.AtEndQueue</c>.
+		/// </param>
+		public bool QueryStreamWriteBegin(ushort address, ushort length, SendQueue queuePosition = SendQueue.AtEndQueue)
 		{
-			lock (this)
+			if (IsConnected)
 			{
-				if (IsConnected)
-				{
-					var status = mMessenger.Disconnect();
-					if (status)
-					{
-						mMessenger = null;
-						if (OnDisconnected != null)
-							OnDisconnected(this, System.EventArgs.Empty);
-					}
-					return status;
-				}
-				return false;
+				var cmd = new IOCardCommand((int)Commands.CMD_STREAM_WRITE_BEGIN);
+				cmd.AddBinArgument(address);
+				cmd.AddBinArgument(length);
+				mLink.Send(cmd, queuePosition);
+				return true;
 			}
+			return false;
 		}
 
-		void _attachCallbacks()
+		/// <summary>
+		/// queues a STREAM_WRITE_CHUNK command
+		/// </summary>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="address">address of the first byte in the chunk.</param>
+		/// <param name="data">buffer holding the data.</param>
+		/// <param name="offset">offset of the chunk in <paramref name="data"/>.</param>
+		/// <param name="count">number of bytes in the chunk, up to 32.</param>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.AtEndQueue</c>, so the chunks reach the card in order.
+		/// </param>
+		public bool QueryStreamWriteChunk(ushort address, byte[] data, int offset, int count, SendQueue queuePosition = SendQueue.AtEndQueue)
 		{
-			mMessenger.Attach((int)Events.EVT_GET_INFO_RESULT, (receivedCommand) =>
+			if (IsConnected)
 			{
-				string manufacturer = receivedCommand.ReadBinStringArg();
-				string product = receivedCommand.ReadBinStringArg();
-				string version = receivedCommand.ReadBinStringArg();
-				uint protocol = receivedCommand.ReadBinUInt32Arg();
+				var cmd = new IOCardCommand((int)Commands.CMD_STREAM_WRITE_CHUNK);
+				cmd.AddBinArgument(address);
+				cmd.AddBinArgument((byte)count);
+				for (int i = 0; i < count; ++i)
+					cmd.AddBinArgument(data[offset + i]);
+				cmd.AddBinArgument(IOCardStorageTransfer.Crc8(data, offset, count));
+				mLink.Send(cmd, queuePosition);
+				return true;
+			}
+			return false;
+		}
 
-				if (OnGetInfoResult != null)
-					OnGetInfoResult(this, new GetInfoResultEventArgs(receivedCommand.TimeStamp, manufacturer, product, version, protocol));
-			});
-			mMessenger.Attach((int)Events.EVT_BOOT, (receivedCommand) =>
+		/// <summary>
+		/// queues a STREAM_WRITE_END command
+		/// </summary>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="crc">
+		/// <see cref="IOCardStorageTransfer.Crc16(byte[], int, int, ushort)"/> of the whole range, checked against what
+		/// the card reads back.
+		/// </param>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.AtEndQueue</c>.
+		/// </param>
+		public bool QueryStreamWriteEnd(ushort crc, SendQueue queuePosition = SendQueue.AtEndQueue)
+		{
+			if (IsConnected)
 			{
-				uint protocol = receivedCommand.ReadBinUInt32Arg();
+				var cmd = new IOCardCommand((int)Commands.CMD_STREAM_WRITE_END);
+				cmd.AddBinArgument(crc);
+				mLink.Send(cmd, queuePosition);
+				return true;
+			}
+			return false;
+		}
 
-				if (OnBoot != null)
-					OnBoot(this, new BootEventArgs(receivedCommand.TimeStamp, protocol));
-			});
-			mMessenger.Attach((int)Events.EVT_COIN_COUNTER_RESULT, (receivedCommand) =>
+		/// <summary>
+		/// queues a GET_INTEGRITY_MAP command
+		/// </summary>
+		/// <remarks>
+		/// The card checks the user area against a CRC per block in the background, and answers with
+		/// <see cref="OnIntegrityMapResult"/> telling which blocks didn't match on the last check. A block is also
+		/// reported with ERR_STORAGE_CORRUPTED when it goes bad, and is good again once it's written. The CRC table is
+		/// at <see cref="USER_STORAGE_END"/>, so the card only checks once <see cref="QueryKvFormat"/> formatted it.
+		/// </remarks>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.AtEndQueue</c>.
+		/// </param>
+		public bool QueryGetIntegrityMap(SendQueue queuePosition = SendQueue.AtEndQueue)
+		{
+			if (IsConnected)
 			{
-				// ACK this event so ejection don't get interruptted.
-				if (IsConnected)
-					mMessenger.SendCommand(new SendCommand((int)Commands.CMD_ACK), SendQueue.InFrontQueue);
+				mLink.Send(new IOCardCommand((int)Commands.CMD_GET_INTEGRITY_MAP), queuePosition);
+				return true;
+			}
+			return false;
+		}
 
-				byte track = receivedCommand.ReadBinByteArg();
-				uint coins = receivedCommand.ReadBinUInt32Arg();
+		/// <summary>
+		/// the first byte READ/WRITE_STORAGE and the streams can reach, below it are the card's own banks.
+		/// </summary>
+		public const int USER_STORAGE_BEGIN = 0x0200;
+		/// <summary>
+		/// where the user area ends once the key/value store is formatted, <c>CONF_ADDR_USER_END</c> in the firmware.
+		/// the rest of the FRAM is the card's then, see <see cref="QueryKvFormat"/>.
+		/// </summary>
+		public const int USER_STORAGE_END = 0x3700;
+		/// <summary>
+		/// where the user area ends on a card without the key/value store, the end of the FRAM.
+		/// </summary>
+		public const int STORAGE_END = 0x4000;
 
-				if (OnCoinCounterResult != null)
-					OnCoinCounterResult(this, new CoinCounterResultEventArgs(receivedCommand.TimeStamp, track, coins));
-			});
-			mMessenger.Attach((int)Events.EVT_KEY_MASKS_RESULT, (receivedCommand) =>
-			{
-				var count = receivedCommand.ReadBinByteArg();
-				var masks = new byte[count];
-				for (int i = 0; i < count; ++i)
-					masks[i] = receivedCommand.ReadBinByteArg();
+		/// <summary>
+		/// maximum length of a value in the card's key/value store.
+		/// </summary>
+		public const int KV_MAX_VALUE_LENGTH = 32;
 
-				if (OnKeyMasks != null)
-					OnKeyMasks(this, new KeyMasksEventArgs(receivedCommand.TimeStamp, masks));
-			});
-			mMessenger.Attach((int)Events.EVT_KEYS_RESULT, (receivedCommand) =>
+		/// <summary>
+		/// queues a KV_FORMAT command, the card answers with <see cref="OnKvFormatResult"/>.
+		/// </summary>
+		/// <remarks>
+		/// The key/value store and the CRC table of <see cref="QueryGetIntegrityMap"/> take the top of the FRAM, from
+		/// <see cref="USER_STORAGE_END"/> to <see cref="STORAGE_END"/>, so a card only has them once it's been
+		/// formatted: the data a title kept there is lost. Until then KV_GET/PUT/DELETE answer ERR_KV_UNFORMATTED, the
+		/// user area isn't checked, and it goes up to <see cref="STORAGE_END"/>. Copy what's above <see cref="USER_STORAGE_END"/> elsewhere first. The card refuses
+		/// with ERR_STREAM_BUSY while a stream is running.
+		/// </remarks>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="format">
+		/// format the store, erasing the keys if it's there already. <c>false</c> only asks whether it's there.
+		/// </param>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.AtEndQueue</c>.
+		/// </param>
+		public bool QueryKvFormat(bool format, SendQueue queuePosition = SendQueue.AtEndQueue)
+		{
+			if (IsConnected)
 			{
-				var count = receivedCommand.ReadBinByteArg();
-				var keys = new byte[count];
-				for (int i = 0; i < count; ++i)
-					keys[i] = receivedCommand.ReadBinByteArg();
-
-				if (OnKeys != null)
-					OnKeys(this, new KeysEventArgs(receivedCommand.TimeStamp, keys));
-			});
-			mMessenger.Attach((int)Events.EVT_WRITE_STORAGE_RESULT, (receivedCommand) =>
+				var cmd = new IOCardCommand((int)Commands.CMD_KV_FORMAT);
+				cmd.AddBinArgument(format ? KV_FORMAT_GUARD : (ushort)0);
+				mLink.Send(cmd, queuePosition);
+				return true;
+			}
+			return false;
+		}
+		// the card only formats with this, so a corrupted frame can't do it.
+		const ushort KV_FORMAT_GUARD = 0x4B46;
+
+		/// <summary>
+		/// queues a KV_GET command, the card answers with <see cref="OnKvGetResult"/>.
+		/// </summary>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="key">key of the value, 0xFFFF is reserved.</param>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.AtEndQueue</c>.
+		/// </param>
+		public bool QueryKvGet(ushort key, SendQueue queuePosition = SendQueue.AtEndQueue)
+		{
+			if (IsConnected)
+			{
+				var cmd = new IOCardCommand((int)Commands.CMD_KV_GET);
+				cmd.AddBinArgument(key);
+				mLink.Send(cmd, queuePosition);
+				return true;
+			}
+			return false;
+		}
+
+		/// <summary>
+		/// queues a KV_PUT command
+		/// </summary>
+		/// <remarks>
+		/// The card appends the value to its log and answers with <see cref="OnKvPutResult"/> once it is on the FRAM.
+		/// When the log is full the card answers with ERR_KV_FULL, retry a bit later if the card is compacting.
+		/// </remarks>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="key">key of the value, 0xFFFF is reserved.</param>
+		/// <param name="value">the value, up to <see cref="KV_MAX_VALUE_LENGTH"/> bytes.</param>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.AtEndQueue</c>.
+		/// </param>
+		public bool QueryKvPut(ushort key, byte[] value, SendQueue queuePosition = SendQueue.AtEndQueue)
+		{
+			if (IsConnected)
+			{
+				var cmd = new IOCardCommand((int)Commands.CMD_KV_PUT);
+				cmd.AddBinArgument(key);
+				cmd.AddBinArgument((byte)value.Length);
+				foreach (var b in value)
+					cmd.AddBinArgument(b);
+				mLink.Send(cmd, queuePosition);
+				return true;
+			}
+			return false;
+		}
+
+		/// <summary>
+		/// queues a KV_DELETE command, the card answers with <see cref="OnKvDeleteResult"/>.
+		/// </summary>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="key">key of the value.</param>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.AtEndQueue</c>.
+		/// </param>
+		public bool QueryKvDelete(ushort key, SendQueue queuePosition = SendQueue.AtEndQueue)
+		{
+			if (IsConnected)
+			{
+				var cmd = new IOCardCommand((int)Commands.CMD_KV_DELETE);
+				cmd.AddBinArgument(key);
+				mLink.Send(cmd, queuePosition);
+				return true;
+			}
+			return false;
+		}
+
+		/// <summary>
+		/// queues a RESET_COIN_COUNTER command
+		/// </summary>
+		/// <returns><c>true</c>, if reset coin counter was queryed, <c>false</c> otherwise.</returns>
+		/// <param name="track"><c>CoinTrack</c> indicates which track to reset</param>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.InFrontQueue</c>.
+		/// </param>
+		public bool QueryResetCoinCounter(byte track, SendQueue queuePosition = SendQueue.InFrontQueue)
+		{
+			if (IsConnected)
+			{
+				var cmd = new IOCardCommand((int)Commands.CMD_RESET_COIN_COINTER);
+				cmd.AddBinArgument(track);
+				mLink.Send(cmd, queuePosition);
+				return true;
+			}
+			return false;
+		}
+
+		/// <summary>
+		/// queues a GET_CMD_STATS command, answered with <see cref="OnCommandStatsResult"/>.
+		/// </summary>
+		/// <remarks>
+		/// The card sends its table a few commands at a time, the next pages are asked for as they come in and the
+		/// event is raised once with all of them.
+		/// </remarks>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="reset">clear the counters on the card after they're sent.</param>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.AtEndQueue</c>.
+		/// </param>
+		public bool QueryGetCommandStats(bool reset = false, SendQueue queuePosition = SendQueue.AtEndQueue)
+		{
+			mCommandStatsReset = reset;
+			return _queryCommandStatsPage(0, queuePosition);
+		}
+
+		bool _queryCommandStatsPage(byte first, SendQueue queuePosition)
+		{
+			if (IsConnected)
+			{
+				var cmd = new IOCardCommand((int)Commands.CMD_GET_CMD_STATS);
+				cmd.AddBinArgument(mCommandStatsReset);
+				cmd.AddBinArgument(first);
+				mLink.Send(cmd, queuePosition);
+				return true;
+			}
+			return false;
+		}
+
+		/// <summary>
+		/// queues a GET_PERSIST_STATS command, answered with <see cref="OnPersistStatsResult"/>.
+		/// </summary>
+		/// <remarks>
+		/// A card with the power-fail warning keeps the coin counters in RAM, writes them back every 250ms (after each
+		/// coin while a hopper pays out), and flushes them to the FRAM with the meter ticks not pulsed yet when the
+		/// supply goes. The flush times tell whether the hold-up capacitors last long enough. The card then goes on
+		/// with its outputs off until the supply is back, and sends the result on its own when it goes and comes back.
+		/// </remarks>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="reset">clear the counters on the card after they're sent, the flush times too.</param>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.AtEndQueue</c>.
+		/// </param>
+		public bool QueryGetPersistStats(bool reset = false, SendQueue queuePosition = SendQueue.AtEndQueue)
+		{
+			if (IsConnected)
+			{
+				var cmd = new IOCardCommand((int)Commands.CMD_GET_PERSIST_STATS);
+				cmd.AddBinArgument(reset);
+				mLink.Send(cmd, queuePosition);
+				return true;
+			}
+			return false;
+		}
+
+		/// <summary>
+		/// queues a GET_TASK_STATS command, answered with <see cref="OnTaskStatsResult"/>.
+		/// </summary>
+		/// <remarks>
+		/// The card's main loop is a table of tasks: the input scan and the meters run at a fixed rate, the serial and
+		/// the FRAM work fill the gaps between them, within their time budget. Overruns and misses tell a budget or a
+		/// period that doesn't hold on the card.
+		/// The card sends one task at a time, the next ones are asked for as they come in and the event is raised once
+		/// with all of them.
+		/// </remarks>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="reset">clear the counters on the card after they're sent.</param>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.AtEndQueue</c>.
+		/// </param>
+		public bool QueryGetTaskStats(bool reset = false, SendQueue queuePosition = SendQueue.AtEndQueue)
+		{
+			mTaskStatsReset = reset;
+			return _queryTaskStats(0, queuePosition);
+		}
+
+		bool _queryTaskStats(byte task, SendQueue queuePosition)
+		{
+			if (IsConnected)
+			{
+				var cmd = new IOCardCommand((int)Commands.CMD_GET_TASK_STATS);
+				cmd.AddBinArgument(mTaskStatsReset);
+				cmd.AddBinArgument(task);
+				mLink.Send(cmd, queuePosition);
+				return true;
+			}
+			return false;
+		}
+		// the flag of a task that runs at its period, in GET_TASK_STATS' answer.
+		const byte TASK_REALTIME = 0x01;
+
+		/// <summary>
+		/// queues a LOAD_TEST command
+		/// </summary>
+		/// <remarks>
+		/// <para>
+		/// The card stops reading the keys and the sensors, and generates key changes and coins on insert track 1
+		/// instead, going through the debouncing and the events like the real ones, so the software on the host can be
+		/// stress tested without anyone at the cabinet. The generated coins don't change the coin counters and don't
+		/// tick the meters, the CoinCounterResult of a generated coin counts the coins since the test started. Real
+		/// coins and keys are ignored during the test.
+		/// </para>
+		/// <para>
+		/// The hoppers stay off during the test, EJECT_COIN and QUEUE_EJECT_COIN are refused with
+		/// ERR_LOAD_TEST_DENIED, and so is the test while a hopper is paying out.
+		/// </para>
+		/// <para>
+		/// <see cref="OnLoadTestResult"/> is fired when the test starts, when it's over, and on
+		/// <see cref="QueryGetLoadTestStats"/>.
+		/// </para>
+		/// </remarks>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="mode">how the keys are generated, <c>LoadTestMode.Off</c> stops the test.</param>
+		/// <param name="keyRate">key changes per second, 0 for none.</param>
+		/// <param name="coinRate">
+		/// coins per second, 0 for none. The coins have to be long enough for the debouncing, so the card doesn't go
+		/// faster than about 30 coins per second.
+		/// </param>
+		/// <param name="duration">in seconds, the test is over after that. 0 or anything above 3600 is 3600.</param>
+		/// <param name="seed">seeds the random generator, the same seed gives the same sequence.</param>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.InFrontQueue</c>.
+		/// </param>
+		public bool QueryLoadTest(LoadTestMode mode, ushort keyRate, ushort coinRate, ushort duration, ushort seed = 1, SendQueue queuePosition = SendQueue.InFrontQueue)
+		{
+			if (IsConnected)
+			{
+				var cmd = new IOCardCommand((int)Commands.CMD_LOAD_TEST);
+				cmd.AddBinArgument(LOAD_TEST_GUARD);
+				cmd.AddBinArgument((byte)mode);
+				cmd.AddBinArgument(keyRate);
+				cmd.AddBinArgument(coinRate);
+				cmd.AddBinArgument(duration);
+				cmd.AddBinArgument(seed);
+				mLink.Send(cmd, queuePosition);
+				return true;
+			}
+			return false;
+		}
+		// the card only starts a load test with this, so a corrupted frame can't do it.
+		const ushort LOAD_TEST_GUARD = 0x4C54;
+
+		/// <summary>
+		/// queues a GET_LOAD_TEST_STATS command, the counters of the test running, or of the last one, are sent with
+		/// <see cref="OnLoadTestResult"/>.
+		/// </summary>
+		/// <returns><c>true</c>, if the command was queued, <c>false</c> otherwise.</returns>
+		/// <param name="queuePosition">
+		/// position of the command to be placed, either <c>SendQueue.InFrontQueue</c> to place the command in front of
+		/// the queue, or <c>SendQueue.AtEndQueue</c> to place the command at the end of the queue. Defaults to
+		/// <c>SendQueue.AtEndQueue</c>.
+		/// </param>
+		public bool QueryGetLoadTestStats(SendQueue queuePosition = SendQueue.AtEndQueue)
+		{
+			if (IsConnected)
+			{
+				mLink.Send(new IOCardCommand((int)Commands.CMD_GET_LOAD_TEST_STATS), queuePosition);
+				return true;
+			}
+			return false;
+		}
+
+		public bool QueueReboot(SendQueue queuePosition = SendQueue.InFrontQueue)
+		{
+			if (IsConnected)
+			{
+				mLink.Send(new IOCardCommand((int)Commands.CMD_REBOOT), queuePosition);
+				return true;
+			}
+			return false;
+		}
+
+		/// <summary>
+		/// Connect to the IOCard with the specified port and baudrate.
+		/// </summary>
+		/// <param name="port">Port, ex. "COM10" on Windows, or "/dev/ttyUSB0" on Linux</param>
+		/// <param name="baudrate">Baudrate.</param>
+		/// <remarks>
+		/// The traffic is written into <see cref="CapturePath"/> if it's set.
+		/// </remarks>
+		/// <exception cref="System.InvalidOperationException">Thrown on connection fails (already connected, port busy, etc.)</exception>
+		public void Connect(string port, int baudrate)
+		{
+			ConnectPort(new SerialTransport { CurrentSerialSettings = { PortName = port, BaudRate = baudrate, DtrEnable = false } });
+		}
+
+		// like Connect(port, baudrate) with the port's transport given, see IOCardHub.
+		internal void ConnectPort(ITransport port)
+		{
+			var transport = port;
+			IOCardCaptureWriter capture = null;
+			if (mCapturePath != null)
+			{
+				capture = new IOCardCaptureWriter(mCapturePath);
+				transport = new IOCardRecordingTransport(transport, capture);
+			}
+			// outside the recording so the ACKs are captured too.
+			if (mFastAck)
+				transport = new IOCardAckTransport(transport);
+
+			try
+			{
+				Connect(transport);
+				mCapture = capture;
+			}
+			catch
+			{
+				if (capture != null)
+					capture.Dispose();
+				throw;
+			}
+		}
+
+		/// <summary>
+		/// Connect to the IOCard over the given transport, for example a <see cref="IOCardReplayTransport"/> to parse a
+		/// capture again.
+		/// </summary>
+		/// <param name="transport">Transport.</param>
+		/// <exception cref="System.InvalidOperationException">Thrown on connection fails (already connected, port busy, etc.)</exception>
+		public void Connect(ITransport transport)
+		{
+			lock (this)
+			{
+				if (mLink != null)
+					throw new System.InvalidOperationException("Already connected.");
+
+				// in a hub the frames are parsed and dispatched on the hub's thread, not on two more of the card's.
+				var link = mInHub ? (IOCardLink)new IOCardDirectLink(transport) : new IOCardMessengerLink(transport);
+				if (link.Connect())
+				{
+					mLink = link;
+					mAckTransport = transport as IOCardAckTransport;
+					mClock.Reset();
+					_attachCallbacks();
+					_startSyncTimer();
+					_startOutputTimer();
+					if (OnConnected != null)
+						OnConnected(this, System.EventArgs.Empty);
+					return;
+				}
+
+				throw new System.InvalidOperationException("Connecting failed for unknown reason.");
+			}
+		}
+
+		/// <summary>
+		/// Disconnect from the IOCard
+		/// </summary>
+		public bool Disconnect()
+		{
+			lock (this)
+			{
+				if (IsConnected)
+				{
+					var status = mLink.Disconnect();
+					if (status)
+					{
+						_stopSyncTimer();
+						_stopOutputTimer();
+						mLink = null;
+						mAckTransport = null;
+						if (mCapture != null)
+						{
+							mCapture.Dispose();
+							mCapture = null;
+						}
+						if (OnDisconnected != null)
+							OnDisconnected(this, System.EventArgs.Empty);
+					}
+					return status;
+				}
+				return false;
+			}
+		}
+
+		// the hub's thread keeps the time of the cards in it, see IOCardHub.
+		void _startSyncTimer()
+		{
+			if (mSyncInterval > 0 && !mInHub)
+				mSyncTimer = new System.Threading.Timer((state) => QuerySyncClock(), null, 0, mSyncInterval);
+		}
+
+		void _stopSyncTimer()
+		{
+			if (mSyncTimer != null)
+			{
+				mSyncTimer.Dispose();
+				mSyncTimer = null;
+			}
+		}
+
+		void _startOutputTimer()
+		{
+			// the card's outputs are unknown, the first flush always sends.
+			lock (mOutputLock)
+			{
+				mOutputsLength = 0;
+				mSentOutputsLength = 0;
+			}
+			if (mOutputFlushInterval > 0 && !mInHub)
+				mOutputTimer = new System.Threading.Timer((state) => FlushOutputs(), null, mOutputFlushInterval, mOutputFlushInterval);
+		}
+
+		void _stopOutputTimer()
+		{
+			if (mOutputTimer != null)
+			{
+				mOutputTimer.Dispose();
+				mOutputTimer = null;
+			}
+		}
+
+		T _stamp<T>(T e, uint device, bool hasLatency, long latency) where T : EventArgs
+		{
+			e.DeviceMicros = device;
+			e.HasDeviceTime = true;
+			e.HasLatency = hasLatency;
+			e.Latency = latency;
+			return e;
+		}
+
+		void _recordAck(uint device, long acked)
+		{
+			long happened;
+			if (!mClock.TryToHost(device, out happened))
+				return;
+
+			var roundTrip = acked - happened;
+			lock (mAckLock)
+			{
+				if (mAckRoundTrip.Count == 0 || roundTrip < mAckRoundTrip.Min)
+					mAckRoundTrip.Min = roundTrip;
+				if (mAckRoundTrip.Count == 0 || roundTrip > mAckRoundTrip.Max)
+					mAckRoundTrip.Max = roundTrip;
+				mAckRoundTrip.Last = roundTrip;
+				mAckRoundTrip.Total += roundTrip;
+				++mAckRoundTrip.Count;
+			}
+		}
+
+		void _queue(ref IOCardEvent e)
+		{
+			var events = mEvents;
+			if (events != null)
+			{
+				e.Card = mHubIndex;
+				events.Enqueue(ref e);
+			}
+		}
+
+		// the events go into the hub's queue from now on, tagged with the card's index, and the hub sends the
+		// SYNC_CLOCK and flushes the outputs.
+		internal void JoinHub(byte index, IOCardEventQueue events)
+		{
+			mHubIndex = index;
+			mEvents = events;
+			mInHub = true;
+		}
+
+		// the args of the frequent events, new ones unless ReuseEventArgs is set. only called from the messenger's
+		// thread.
+
+		KeysEventArgs _keysEventArgs(long timestamp, int count)
+		{
+			if (!mReuseEventArgs)
+				return new KeysEventArgs(timestamp, new byte[count]);
+			if (mKeysEventArgs == null || mKeysEventArgs.Keys.Length != count)
+				mKeysEventArgs = new KeysEventArgs(timestamp, new byte[count]);
+			else
+				mKeysEventArgs._reuse(timestamp);
+			return mKeysEventArgs;
+		}
+
+		CoinCounterResultEventArgs _coinCounterResultEventArgs(long timestamp, byte track, uint coins)
+		{
+			if (!mReuseEventArgs)
+				return new CoinCounterResultEventArgs(timestamp, track, coins);
+			if (mCoinCounterResultEventArgs == null)
+				mCoinCounterResultEventArgs = new CoinCounterResultEventArgs(timestamp, track, coins);
+			var e = mCoinCounterResultEventArgs;
+			e._reuse(timestamp);
+			e.Track = track;
+			e.Coins = coins;
+			return e;
+		}
+
+		EjectResultEventArgs _ejectResultEventArgs(long timestamp, byte track, byte requestId, byte requested, byte remaining)
+		{
+			if (!mReuseEventArgs)
+				return new EjectResultEventArgs(timestamp, track, requestId, requested, remaining);
+			if (mEjectResultEventArgs == null)
+				mEjectResultEventArgs = new EjectResultEventArgs(timestamp, track, requestId, requested, remaining);
+			var e = mEjectResultEventArgs;
+			e._reuse(timestamp);
+			e.Track = track;
+			e.RequestId = requestId;
+			e.Requested = requested;
+			e.Remaining = remaining;
+			return e;
+		}
+
+		// a buffer per length, so `Data.Length` is still the length of the data.
+		byte[] _buffer(int length)
+		{
+			if (!mReuseEventArgs)
+				return new byte[length];
+			if (mBuffers[length] == null)
+				mBuffers[length] = new byte[length];
+			return mBuffers[length];
+		}
+
+		void _attachCallbacks()
+		{
+			mLink.Attach((int)Events.EVT_GET_INFO_RESULT, (receivedCommand) =>
+			{
+				string manufacturer = receivedCommand.ReadBinStringArg();
+				string product = receivedCommand.ReadBinStringArg();
+				string version = receivedCommand.ReadBinStringArg();
+				uint protocol = receivedCommand.ReadBinUInt32Arg();
+
+				if (OnGetInfoResult != null)
+					OnGetInfoResult(this, new GetInfoResultEventArgs(receivedCommand.TimeStamp, manufacturer, product, version, protocol));
+			});
+			mLink.Attach((int)Events.EVT_BOOT, (receivedCommand) =>
+			{
+				uint protocol = receivedCommand.ReadBinUInt32Arg();
+
+				// micros() starts all over again after a reboot.
+				mClock.Reset();
+
+				// the card comes back with its outputs off, whatever it was sent before. forget the sent shadow and
+				// mark the whole merged state dirty, so the next flush puts it back.
+				lock (mOutputLock)
+				{
+					mOutputsLength = System.Math.Max(mOutputsLength, mSentOutputsLength);
+					mSentOutputsLength = 0;
+				}
+
+				var queued = new IOCardEvent { Kind = IOCardEvent.Kinds.Boot, TimeStamp = receivedCommand.TimeStamp };
+				_queue(ref queued);
+
+				if (OnBoot != null)
+					OnBoot(this, new BootEventArgs(receivedCommand.TimeStamp, protocol));
+			});
+			mLink.Attach((int)Events.EVT_SYNC_CLOCK_RESULT, (receivedCommand) =>
+			{
+				var host = IOCardClock.Now;
+				var sequence = receivedCommand.ReadBinUInt32Arg();
+				var device = receivedCommand.ReadBinUInt32Arg();
+
+				if (mClock.Pong(sequence, device, host) && OnSyncClockResult != null)
+					OnSyncClockResult(this, new SyncClockResultEventArgs(receivedCommand.TimeStamp, sequence, device, mClock.RoundTrip, mClock.Skew));
+			});
+			mLink.Attach((int)Events.EVT_COIN_COUNTER_RESULT, (receivedCommand) =>
+			{
+				var host = IOCardClock.Now;
+
+				// ACK this event so ejection don't get interruptted, the ack transport did already if there's one.
+				var ackTransport = mAckTransport;
+				if (ackTransport == null && IsConnected)
+					mLink.Send(new IOCardCommand((int)Commands.CMD_ACK), SendQueue.InFrontQueue);
+
+				byte track = receivedCommand.ReadBinByteArg();
+				uint coins = receivedCommand.ReadBinUInt32Arg();
+				uint device = receivedCommand.ReadBinUInt32Arg();
+				long acked;
+				if (ackTransport != null && ackTransport.TakeAckTime(out acked))
+					_recordAck(device, acked);
+				if (mLoadTestRunning)
+					++mLoadTestCoins;
+				long latency;
+				var hasLatency = mClock.Record(device, host, out latency);
+
+				var queued = new IOCardEvent
+				{
+					Kind = IOCardEvent.Kinds.CoinCounter,
+					TimeStamp = receivedCommand.TimeStamp,
+					DeviceMicros = device,
+					HasLatency = hasLatency,
+					Latency = latency,
+					Track = track,
+					Coins = coins
+				};
+				_queue(ref queued);
+
+				if (OnCoinCounterResult != null)
+					OnCoinCounterResult(this, _stamp(_coinCounterResultEventArgs(receivedCommand.TimeStamp, track, coins), device, hasLatency, latency));
+			});
+			mLink.Attach((int)Events.EVT_EJECT_RESULT, (receivedCommand) =>
+			{
+				var host = IOCardClock.Now;
+				var track = receivedCommand.ReadBinByteArg();
+				var requestId = receivedCommand.ReadBinByteArg();
+				var requested = receivedCommand.ReadBinByteArg();
+				var remaining = receivedCommand.ReadBinByteArg();
+				var device = receivedCommand.ReadBinUInt32Arg();
+				long latency;
+				var hasLatency = mClock.Record(device, host, out latency);
+
+				var queued = new IOCardEvent
+				{
+					Kind = IOCardEvent.Kinds.Eject,
+					TimeStamp = receivedCommand.TimeStamp,
+					DeviceMicros = device,
+					HasLatency = hasLatency,
+					Latency = latency,
+					Track = track,
+					RequestId = requestId,
+					Requested = requested,
+					Remaining = remaining
+				};
+				_queue(ref queued);
+
+				if (OnEjectResult != null)
+					OnEjectResult(this, _stamp(_ejectResultEventArgs(receivedCommand.TimeStamp, track, requestId, requested, remaining), device, hasLatency, latency));
+			});
+			mLink.Attach((int)Events.EVT_EJECT_STATS_RESULT, (receivedCommand) =>
+			{
+				var track = receivedCommand.ReadBinByteArg();
+				var samples = receivedCommand.ReadBinUInt16Arg();
+				var average = receivedCommand.ReadBinUInt32Arg();
+				var deviation = receivedCommand.ReadBinUInt32Arg();
+				var min = receivedCommand.ReadBinUInt32Arg();
+				var max = receivedCommand.ReadBinUInt32Arg();
+				var slow = receivedCommand.ReadBinUInt16Arg();
+				var cuts = receivedCommand.ReadBinUInt16Arg();
+				var misses = receivedCommand.ReadBinUInt16Arg();
+
+				if (OnEjectStatsResult != null)
+					OnEjectStatsResult(this, new EjectStatsResultEventArgs(receivedCommand.TimeStamp, track, samples, average, deviation, min, max, slow, cuts, misses));
+			});
+			mLink.Attach((int)Events.EVT_KEY_MASKS_RESULT, (receivedCommand) =>
+			{
+				var count = receivedCommand.ReadBinByteArg();
+				var masks = new byte[count];
+				for (int i = 0; i < count; ++i)
+					masks[i] = receivedCommand.ReadBinByteArg();
+				count = receivedCommand.ReadBinByteArg();
+				var outputMasks = new byte[count];
+				for (int i = 0; i < count; ++i)
+					outputMasks[i] = receivedCommand.ReadBinByteArg();
+
+				if (OnKeyMasks != null)
+					OnKeyMasks(this, new KeyMasksEventArgs(receivedCommand.TimeStamp, masks, outputMasks));
+			});
+			mLink.Attach((int)Events.EVT_KEYS_RESULT, (receivedCommand) =>
+			{
+				var host = IOCardClock.Now;
+				var count = receivedCommand.ReadBinByteArg();
+				// the args only if someone listens, the queue takes the keys packed.
+				var e = OnKeys != null ? _keysEventArgs(receivedCommand.TimeStamp, count) : null;
+				ulong packed = 0;
+				for (int i = 0; i < count; ++i)
+				{
+					var key = receivedCommand.ReadBinByteArg();
+					if (i < IOCardEvent.MAX_KEY_BYTES)
+						packed |= (ulong)key << (i * 8);
+					if (e != null)
+						e.Keys[i] = key;
+				}
+				var device = receivedCommand.ReadBinUInt32Arg();
+				if (mLoadTestRunning)
+					++mLoadTestKeys;
+				long latency;
+				var hasLatency = mClock.Record(device, host, out latency);
+
+				var queued = new IOCardEvent
+				{
+					Kind = IOCardEvent.Kinds.Keys,
+					TimeStamp = receivedCommand.TimeStamp,
+					DeviceMicros = device,
+					HasLatency = hasLatency,
+					Latency = latency,
+					KeyBytes = (byte)System.Math.Min((int)count, IOCardEvent.MAX_KEY_BYTES),
+					Keys = packed
+				};
+				_queue(ref queued);
+
+				if (e != null && OnKeys != null)
+					OnKeys(this, _stamp(e, device, hasLatency, latency));
+			});
+			mLink.Attach((int)Events.EVT_WRITE_STORAGE_RESULT, (receivedCommand) =>
 			{
 				var address = receivedCommand.ReadBinUInt16Arg();
 				var length = receivedCommand.ReadBinByteArg();
@@ -449,19 +1479,267 @@ namespace Spark.Slot.IO
 				if (OnWriteStorageResult != null)
 					OnWriteStorageResult(this, new WriteStorageResultEventArgs(receivedCommand.TimeStamp, address, length));
 			});
-			mMessenger.Attach((int)Events.EVT_READ_STORAGE_RESULT, (receivedCommand) =>
+			mLink.Attach((int)Events.EVT_READ_STORAGE_RESULT, (receivedCommand) =>
 			{
 				var address = receivedCommand.ReadBinUInt16Arg();
 				var length = receivedCommand.ReadBinByteArg();
-				var data = new byte[length];
+				var data = _buffer(length);
 				for (int i = 0; i < length; ++i)
 					data[i] = receivedCommand.ReadBinByteArg();
 
 				if (OnReadStorageResult != null)
-					OnReadStorageResult(this, new ReadStorageResultEventArgs(receivedCommand.TimeStamp, address, data));
+				{
+					ReadStorageResultEventArgs e;
+					if (mReuseEventArgs)
+					{
+						if (mReadStorageResultEventArgs == null)
+							mReadStorageResultEventArgs = new ReadStorageResultEventArgs(receivedCommand.TimeStamp, address, data);
+						e = mReadStorageResultEventArgs;
+						e._reuse(receivedCommand.TimeStamp);
+						e.Address = address;
+						e.Data = data;
+					}
+					else
+						e = new ReadStorageResultEventArgs(receivedCommand.TimeStamp, address, data);
+					OnReadStorageResult(this, e);
+				}
+			});
+			mLink.Attach((int)Events.EVT_STREAM_READ_CHUNK, (receivedCommand) =>
+			{
+				var address = receivedCommand.ReadBinUInt16Arg();
+				var length = receivedCommand.ReadBinByteArg();
+				var data = _buffer(length);
+				for (int i = 0; i < length; ++i)
+					data[i] = receivedCommand.ReadBinByteArg();
+				var crc = receivedCommand.ReadBinByteArg();
+
+				if (OnStreamReadChunk != null)
+				{
+					StreamReadChunkEventArgs e;
+					if (mReuseEventArgs)
+					{
+						if (mStreamReadChunkEventArgs == null)
+							mStreamReadChunkEventArgs = new StreamReadChunkEventArgs(receivedCommand.TimeStamp, address, data, crc);
+						e = mStreamReadChunkEventArgs;
+						e._reuse(receivedCommand.TimeStamp);
+						e.Address = address;
+						e.Data = data;
+						e.Crc = crc;
+					}
+					else
+						e = new StreamReadChunkEventArgs(receivedCommand.TimeStamp, address, data, crc);
+					OnStreamReadChunk(this, e);
+				}
+			});
+			mLink.Attach((int)Events.EVT_STREAM_READ_END, (receivedCommand) =>
+			{
+				var address = receivedCommand.ReadBinUInt16Arg();
+				var length = receivedCommand.ReadBinUInt16Arg();
+				var crc = receivedCommand.ReadBinUInt16Arg();
+
+				if (OnStreamReadEnd != null)
+					OnStreamReadEnd(this, new StreamRangeEventArgs(receivedCommand.TimeStamp, address, length, crc));
+			});
+			mLink.Attach((int)Events.EVT_STREAM_WRITE_BEGIN_RESULT, (receivedCommand) =>
+			{
+				var address = receivedCommand.ReadBinUInt16Arg();
+				var length = receivedCommand.ReadBinUInt16Arg();
+				var window = receivedCommand.ReadBinByteArg();
+
+				if (OnStreamWriteBeginResult != null)
+					OnStreamWriteBeginResult(this, new StreamWriteBeginResultEventArgs(receivedCommand.TimeStamp, address, length, window));
+			});
+			mLink.Attach((int)Events.EVT_STREAM_WRITE_ACK, (receivedCommand) =>
+			{
+				var next = receivedCommand.ReadBinUInt16Arg();
+
+				if (OnStreamWriteAck != null)
+					OnStreamWriteAck(this, new StreamWriteAckEventArgs(receivedCommand.TimeStamp, next));
+			});
+			mLink.Attach((int)Events.EVT_STREAM_WRITE_RESULT, (receivedCommand) =>
+			{
+				var address = receivedCommand.ReadBinUInt16Arg();
+				var length = receivedCommand.ReadBinUInt16Arg();
+				var crc = receivedCommand.ReadBinUInt16Arg();
+				var good = receivedCommand.ReadBinBoolArg();
+
+				if (OnStreamWriteResult != null)
+					OnStreamWriteResult(this, new StreamWriteResultEventArgs(receivedCommand.TimeStamp, address, length, crc, good));
+			});
+			mLink.Attach((int)Events.EVT_INTEGRITY_MAP_RESULT, (receivedCommand) =>
+			{
+				var address = receivedCommand.ReadBinUInt16Arg();
+				var blockSize = receivedCommand.ReadBinByteArg();
+				var blocks = receivedCommand.ReadBinByteArg();
+				var isSealed = receivedCommand.ReadBinBoolArg();
+				var passes = receivedCommand.ReadBinUInt16Arg();
+				var map = new byte[(blocks + 7) / 8];
+				for (int i = 0; i < map.Length; ++i)
+					map[i] = receivedCommand.ReadBinByteArg();
+
+				if (OnIntegrityMapResult != null)
+					OnIntegrityMapResult(this, new IntegrityMapResultEventArgs(receivedCommand.TimeStamp, address, blockSize, blocks, isSealed, passes, map));
+			});
+			mLink.Attach((int)Events.EVT_KV_GET_RESULT, (receivedCommand) =>
+			{
+				var key = receivedCommand.ReadBinUInt16Arg();
+				var found = receivedCommand.ReadBinBoolArg();
+				var length = receivedCommand.ReadBinByteArg();
+				var value = new byte[length];
+				for (int i = 0; i < length; ++i)
+					value[i] = receivedCommand.ReadBinByteArg();
+
+				if (OnKvGetResult != null)
+					OnKvGetResult(this, new KvGetResultEventArgs(receivedCommand.TimeStamp, key, found ? value : null));
+			});
+			mLink.Attach((int)Events.EVT_KV_PUT_RESULT, (receivedCommand) =>
+			{
+				var key = receivedCommand.ReadBinUInt16Arg();
+				var length = receivedCommand.ReadBinByteArg();
+				var free = receivedCommand.ReadBinUInt16Arg();
+
+				if (OnKvPutResult != null)
+					OnKvPutResult(this, new KvPutResultEventArgs(receivedCommand.TimeStamp, key, length, free));
+			});
+			mLink.Attach((int)Events.EVT_KV_DELETE_RESULT, (receivedCommand) =>
+			{
+				var key = receivedCommand.ReadBinUInt16Arg();
+				var found = receivedCommand.ReadBinBoolArg();
+
+				if (OnKvDeleteResult != null)
+					OnKvDeleteResult(this, new KvDeleteResultEventArgs(receivedCommand.TimeStamp, key, found));
+			});
+			mLink.Attach((int)Events.EVT_KV_FORMAT_RESULT, (receivedCommand) =>
+			{
+				var formatted = receivedCommand.ReadBinBoolArg();
+				var userEnd = receivedCommand.ReadBinUInt16Arg();
+				var free = receivedCommand.ReadBinUInt16Arg();
+
+				if (OnKvFormatResult != null)
+					OnKvFormatResult(this, new KvFormatResultEventArgs(receivedCommand.TimeStamp, formatted, userEnd, free));
+			});
+			mLink.Attach((int)Events.EVT_CMD_STATS_RESULT, (receivedCommand) =>
+			{
+				var slots = receivedCommand.ReadBinByteArg();
+				var buckets = receivedCommand.ReadBinByteArg();
+				var first = receivedCommand.ReadBinByteArg();
+				var page = receivedCommand.ReadBinByteArg();
+				if (first == 0 || mCommandStats == null || mCommandStats.Length != slots)
+					mCommandStats = new CommandStat[slots];
+				var stats = mCommandStats;
+				for (int i = first; i < first + page; ++i)
+				{
+					var command = receivedCommand.ReadBinByteArg();
+					var count = receivedCommand.ReadBinUInt16Arg();
+					var total = receivedCommand.ReadBinUInt32Arg();
+					var max = receivedCommand.ReadBinUInt16Arg();
+					var histogram = new ushort[buckets];
+					for (int b = 0; b < buckets; ++b)
+						histogram[b] = receivedCommand.ReadBinUInt16Arg();
+					stats[i] = new CommandStat(command, count, total, max, histogram);
+				}
+
+				// the rest of the table first
+				if (page != 0 && first + page < slots && _queryCommandStatsPage((byte)(first + page), SendQueue.InFrontQueue))
+					return;
+				mCommandStats = null;
+
+				if (OnCommandStatsResult != null)
+					OnCommandStatsResult(this, new CommandStatsResultEventArgs(receivedCommand.TimeStamp, stats));
+			});
+			mLink.Attach((int)Events.EVT_AUDIT_BACKLOG_RESULT, (receivedCommand) =>
+			{
+				var count = receivedCommand.ReadBinByteArg();
+				var pending = new uint[count];
+				var checkpointed = new uint[count];
+				for (int i = 0; i < count; ++i)
+				{
+					pending[i] = receivedCommand.ReadBinUInt32Arg();
+					checkpointed[i] = receivedCommand.ReadBinUInt32Arg();
+				}
+				var writes = receivedCommand.ReadBinUInt32Arg();
+
+				if (OnAuditBacklogResult != null)
+					OnAuditBacklogResult(this, new AuditBacklogResultEventArgs(receivedCommand.TimeStamp, pending, checkpointed, writes));
 			});
-			mMessenger.Attach((int)Events.EVT_ERROR, (receivedCommand) =>
+			mLink.Attach((int)Events.EVT_PERSIST_STATS_RESULT, (receivedCommand) =>
 			{
+				var enabled = receivedCommand.ReadBinBoolArg();
+				var restored = receivedCommand.ReadBinBoolArg();
+				var flushes = receivedCommand.ReadBinUInt16Arg();
+				var last = receivedCommand.ReadBinUInt16Arg();
+				var max = receivedCommand.ReadBinUInt16Arg();
+				var changes = receivedCommand.ReadBinUInt32Arg();
+				var writeBacks = receivedCommand.ReadBinUInt32Arg();
+				var powerFailed = receivedCommand.ReadBinBoolArg();
+
+				if (OnPersistStatsResult != null)
+					OnPersistStatsResult(this, new PersistStatsResultEventArgs(receivedCommand.TimeStamp, enabled, restored,
+						flushes, last, max, changes, writeBacks, powerFailed));
+			});
+			mLink.Attach((int)Events.EVT_TASK_STATS_RESULT, (receivedCommand) =>
+			{
+				var passes = receivedCommand.ReadBinUInt32Arg();
+				var idle = receivedCommand.ReadBinUInt32Arg();
+				var count = receivedCommand.ReadBinByteArg();
+				var i = receivedCommand.ReadBinByteArg();
+				// the loop counters are the ones sent with the first task
+				if (i == 0 || mTaskStats == null || mTaskStats.Length != count)
+				{
+					mTaskStats = new TaskStat[count];
+					mTaskStatsPasses = passes;
+					mTaskStatsIdle = idle;
+				}
+				var tasks = mTaskStats;
+				if (i < count)
+				{
+					var flags = receivedCommand.ReadBinByteArg();
+					var period = receivedCommand.ReadBinUInt16Arg();
+					var budget = receivedCommand.ReadBinUInt16Arg();
+					var runs = receivedCommand.ReadBinUInt32Arg();
+					var total = receivedCommand.ReadBinUInt32Arg();
+					var max = receivedCommand.ReadBinUInt16Arg();
+					var overruns = receivedCommand.ReadBinUInt16Arg();
+					var misses = receivedCommand.ReadBinUInt16Arg();
+					tasks[i] = new TaskStat(i, (flags & TASK_REALTIME) != 0, period, budget, runs, total, max,
+						overruns, misses);
+				}
+
+				// the other tasks first
+				if (i + 1 < count && _queryTaskStats((byte)(i + 1), SendQueue.InFrontQueue))
+					return;
+				mTaskStats = null;
+
+				if (OnTaskStatsResult != null)
+					OnTaskStatsResult(this, new TaskStatsResultEventArgs(receivedCommand.TimeStamp, mTaskStatsPasses,
+						mTaskStatsIdle, tasks));
+			});
+			mLink.Attach((int)Events.EVT_LOAD_TEST_RESULT, (receivedCommand) =>
+			{
+				var mode = (LoadTestMode)receivedCommand.ReadBinByteArg();
+				var elapsed = receivedCommand.ReadBinUInt32Arg();
+				var loops = receivedCommand.ReadBinUInt32Arg();
+				var keyEdges = receivedCommand.ReadBinUInt32Arg();
+				var keyEvents = receivedCommand.ReadBinUInt32Arg();
+				var coins = receivedCommand.ReadBinUInt32Arg();
+				var coinEvents = receivedCommand.ReadBinUInt32Arg();
+				var txStalls = receivedCommand.ReadBinUInt32Arg();
+
+				// a test that just started, count what comes from now on.
+				if (mode != LoadTestMode.Off && elapsed == 0)
+				{
+					mLoadTestKeys = 0;
+					mLoadTestCoins = 0;
+				}
+				mLoadTestRunning = mode != LoadTestMode.Off;
+
+				if (OnLoadTestResult != null)
+					OnLoadTestResult(this, new LoadTestResultEventArgs(receivedCommand.TimeStamp, mode, elapsed, loops,
+						keyEdges, keyEvents, coins, coinEvents, txStalls, mLoadTestKeys, mLoadTestCoins));
+			});
+			mLink.Attach((int)Events.EVT_ERROR, (receivedCommand) =>
+			{
+				var host = IOCardClock.Now;
 				ErrorEventArgs e = null;
 				var err = (Errors)receivedCommand.ReadBinByteArg();
 				switch (err)
@@ -480,6 +1758,63 @@ namespace Spark.Slot.IO
 							e = new ErrorEjectTimeoutEventArgs(receivedCommand.TimeStamp, err, track, coins);
 						}
 						break;
+					case Errors.ERR_EJECT_QUEUE_FULL:
+						{
+							var track = receivedCommand.ReadBinByteArg();
+							var requestId = receivedCommand.ReadBinByteArg();
+							e = new ErrorEjectQueueFullEventArgs(receivedCommand.TimeStamp, err, track, requestId);
+						}
+						break;
+					case Errors.ERR_EJECT_SLOW:
+						{
+							var track = receivedCommand.ReadBinByteArg();
+							var elapsed = receivedCommand.ReadBinUInt32Arg();
+							var average = receivedCommand.ReadBinUInt32Arg();
+							e = new ErrorEjectSlowEventArgs(receivedCommand.TimeStamp, err, track, elapsed, average);
+						}
+						break;
+					case Errors.ERR_STREAM_BUSY:
+					case Errors.ERR_NO_STREAM:
+						e = new ErrorEventArgs(receivedCommand.TimeStamp, err);
+						break;
+					case Errors.ERR_STREAM_SEQUENCE:
+						{
+							var expected = receivedCommand.ReadBinUInt16Arg();
+							var address = receivedCommand.ReadBinUInt16Arg();
+							e = new ErrorStreamSequenceEventArgs(receivedCommand.TimeStamp, err, expected, address);
+						}
+						break;
+					case Errors.ERR_STREAM_CHECKSUM:
+						e = new ErrorStreamChecksumEventArgs(receivedCommand.TimeStamp, err, receivedCommand.ReadBinUInt16Arg());
+						break;
+					case Errors.ERR_STREAM_OUT_OF_RANGE:
+						{
+							var address = receivedCommand.ReadBinUInt16Arg();
+							var length = receivedCommand.ReadBinUInt16Arg();
+							e = new ErrorStreamOutOfRangeEventArgs(receivedCommand.TimeStamp, err, address, length);
+						}
+						break;
+					case Errors.ERR_KV_FULL:
+						{
+							var key = receivedCommand.ReadBinUInt16Arg();
+							var free = receivedCommand.ReadBinUInt16Arg();
+							e = new ErrorKvFullEventArgs(receivedCommand.TimeStamp, err, key, free);
+						}
+						break;
+					case Errors.ERR_KV_INVALID:
+						{
+							var key = receivedCommand.ReadBinUInt16Arg();
+							var length = receivedCommand.ReadBinByteArg();
+							e = new ErrorKvInvalidEventArgs(receivedCommand.TimeStamp, err, key, length);
+						}
+						break;
+					case Errors.ERR_KV_CORRUPTED:
+					case Errors.ERR_KV_UNFORMATTED:
+						e = new ErrorKvEventArgs(receivedCommand.TimeStamp, err, receivedCommand.ReadBinUInt16Arg());
+						break;
+					case Errors.ERR_STORAGE_CORRUPTED:
+						e = new ErrorStorageCorruptedEventArgs(receivedCommand.TimeStamp, err, receivedCommand.ReadBinUInt16Arg());
+						break;
 					case Errors.ERR_NOT_A_TRACK:
 						e = new ErrorNotATrackEventArgs(receivedCommand.TimeStamp, err, receivedCommand.ReadBinByteArg());
 						break;
@@ -503,6 +1838,9 @@ namespace Spark.Slot.IO
 							e = new ErrorOutOfRangeEventArgs(receivedCommand.TimeStamp, err, address, length);
 						}
 						break;
+					case Errors.ERR_LOAD_TEST_DENIED:
+						e = new ErrorLoadTestDeniedEventArgs(receivedCommand.TimeStamp, err, receivedCommand.ReadBinByteArg());
+						break;
 					case Errors.ERR_UNKNOWN_COMMAND:
 						e = new ErrorUnknownCommandEventArgs(receivedCommand.TimeStamp, err, receivedCommand.ReadBinByteArg());
 						break;
@@ -510,25 +1848,278 @@ namespace Spark.Slot.IO
 						e = new ErrorUnknownErrorEventArgs(receivedCommand.TimeStamp, err, receivedCommand.ReadBinByteArg());
 						break;
 				}
+				var device = receivedCommand.ReadBinUInt32Arg();
+				long latency;
+				var hasLatency = mClock.Record(device, host, out latency);
+				_stamp(e, device, hasLatency, latency);
+
+				var trackError = e as ErrorTrackEventArgs;
+				var queued = new IOCardEvent
+				{
+					Kind = IOCardEvent.Kinds.Error,
+					TimeStamp = e.TimeStamp,
+					DeviceMicros = device,
+					HasLatency = e.HasLatency,
+					Latency = e.Latency,
+					Error = err,
+					Track = trackError != null ? trackError.Track : (byte)0
+				};
+				_queue(ref queued);
 
 				if (OnError != null)
 					OnError(this, e);
 			});
-			mMessenger.Attach((int)Events.EVT_DEBUG, (receivedCommand) =>
+			mLink.Attach((int)Events.EVT_DEBUG, (receivedCommand) =>
 			{
 				if (OnDebug != null)
 					OnDebug(this, new DebugEventArgs(receivedCommand.TimeStamp, receivedCommand.ReadBinStringArg()));
 			});
-			mMessenger.Attach((receivedCommand) =>
+			mLink.Attach((receivedCommand) =>
 			{
 				if (OnUnknown != null)
-					OnUnknown(this, new UnknownEventArgs(receivedCommand.TimeStamp, receivedCommand));
+					OnUnknown(this, new UnknownEventArgs(receivedCommand.TimeStamp, receivedCommand.CmdId, receivedCommand.RawString, receivedCommand.Command));
 			});
 		}
 
-		public bool IsConnected { get { lock (this) { return mMessenger != null; } } }
+		public bool IsConnected { get { lock (this) { return mLink != null; } } }
+
+		/// <summary>
+		/// Frames received since the card's been connected whose events have been raised, 0 when it's not connected.
+		/// </summary>
+		public long FramesHandled
+		{
+			get
+			{
+				lock (this)
+					return mLink != null ? mLink.Handled : 0;
+			}
+		}
+
+		/// <summary>
+		/// Blocks until <paramref name="count"/> frames received since the card's been connected have had their events
+		/// raised, for example all the frames a <see cref="IOCardReplayTransport"/> played.
+		/// </summary>
+		/// <returns><c>false</c> if it timed out, or the card's not connected.</returns>
+		public bool WaitForFrames(long count, int millisecondsTimeout = System.Threading.Timeout.Infinite)
+		{
+			IOCardLink link;
+			lock (this)
+				link = mLink;
+			return link != null && link.WaitHandled(count, millisecondsTimeout);
+		}
+
+		/// <summary>
+		/// The clock mapping device time to host time, also holds the end-to-end latency statistics.
+		/// </summary>
+		public IOCardClock Clock { get { return mClock; } }
+
+		/// <summary>
+		/// Interval between SYNC_CLOCK commands in milliseconds, 0 disables automatic synchronization. Takes effect on
+		/// next <see cref="Connect(string, int)"/>.
+		/// </summary>
+		public int SyncInterval
+		{
+			get { return mSyncInterval; }
+			set { mSyncInterval = value; }
+		}
+		const int DEFAULT_SYNC_INTERVAL = 1000;
+
+		/// <summary>
+		/// Capture file the traffic with the card is written into, replaced if it's there, <c>null</c> to capture
+		/// nothing. Takes effect on next <see cref="Connect(string, int)"/>, and is closed on
+		/// <see cref="Disconnect"/>. See <see cref="IOCardCapture"/> for the format.
+		/// </summary>
+		public string CapturePath
+		{
+			get { return mCapturePath; }
+			set { mCapturePath = value; }
+		}
+
+		/// <summary>
+		/// Counters of the SET_OUTPUT coalescing.
+		/// </summary>
+		public struct OutputStats
+		{
+			/// <summary>
+			/// <see cref="QuerySetOutput"/> calls.
+			/// </summary>
+			public long Requests;
+			/// <summary>
+			/// SET_OUTPUT commands sent.
+			/// </summary>
+			public long Frames;
+			/// <summary>
+			/// flushes that sent nothing, the outputs were what the card had already.
+			/// </summary>
+			public long Suppressed;
+			/// <summary>
+			/// calls per command sent, 1.0 without coalescing.
+			/// </summary>
+			public double CoalescingRatio { get { return Frames == 0 ? 0.0 : (double)Requests / Frames; } }
+		}
+
+		/// <summary>
+		/// the SET_OUTPUT length is a byte.
+		/// </summary>
+		public const int MAX_OUTPUT_BYTES = 255;
+
+		/// <summary>
+		/// When <c>true</c>, <see cref="QuerySetOutput"/> only updates a shadow of the outputs, and
+		/// <see cref="FlushOutputs"/> sends the final state in one SET_OUTPUT, nothing if it's not changed. Defaults
+		/// to <c>false</c>, every call is a command. After a BOOT event the next flush sends the whole state again.
+		/// </summary>
+		public bool CoalesceOutputs
+		{
+			get { return mCoalesceOutputs; }
+			set { mCoalesceOutputs = value; }
+		}
+
+		/// <summary>
+		/// Interval between automatic <see cref="FlushOutputs"/> in milliseconds, 0 (the default) leaves it to the
+		/// caller. Takes effect on next <see cref="Connect(string, int)"/>.
+		/// </summary>
+		public int OutputFlushInterval
+		{
+			get { return mOutputFlushInterval; }
+			set { mOutputFlushInterval = value; }
+		}
+
+		public OutputStats OutputCounters { get { lock (mOutputLock) return mOutputStats; } }
+
+		public void ResetOutputCounters()
+		{
+			lock (mOutputLock)
+				mOutputStats = new OutputStats();
+		}
+
+		/// <summary>
+		/// When <c>true</c> (the default), <see cref="Connect(string, int)"/> puts an <see cref="IOCardAckTransport"/>
+		/// in front of the serial port, and the ACKs of COIN_COUNTER_RESULT are sent as soon as the frame comes in,
+		/// instead of after it's parsed. Takes effect on next <see cref="Connect(string, int)"/>.
+		/// </summary>
+		public bool FastAck
+		{
+			get { return mFastAck; }
+			set { mFastAck = value; }
+		}
+
+		/// <summary>
+		/// Microseconds from a coin is counted on the card to its ACK is written by the <see cref="IOCardAckTransport"/>,
+		/// once <see cref="Clock"/> is synchronized. What the card's TIMEOUT_NACK sees is that plus the 2 bytes of the
+		/// ACK on the wire, size it from <see cref="IOCardClock.LatencyStats.Max"/>.
+		/// </summary>
+		public IOCardClock.LatencyStats AckRoundTrip { get { lock (mAckLock) return mAckRoundTrip; } }
+
+		/// <summary>
+		/// reset <see cref="AckRoundTrip"/>.
+		/// </summary>
+		public void ResetAckRoundTrip()
+		{
+			lock (mAckLock)
+				mAckRoundTrip = new IOCardClock.LatencyStats();
+		}
+
+		/// <summary>
+		/// Size of the queue <see cref="PollEvents(IOCardEvent[], int, int)"/> drains, 0 (the default) queues nothing.
+		/// Changing it drops what's queued.
+		/// </summary>
+		public int PollCapacity
+		{
+			get
+			{
+				var events = mEvents;
+				return events == null ? 0 : events.Capacity;
+			}
+			set { mEvents = value > 0 ? new IOCardEventQueue(value) : null; }
+		}
+
+		/// <summary>
+		/// Events dropped because nobody drained the queue in time, see <see cref="PollCapacity"/>.
+		/// </summary>
+		public long DroppedEvents
+		{
+			get
+			{
+				var events = mEvents;
+				return events == null ? 0 : events.Dropped;
+			}
+		}
+
+		/// <summary>
+		/// Moves the KEYS, COIN_COUNTER_RESULT, EJECT_RESULT, ERROR and BOOT events received since the last call
+		/// into <paramref name="buffer"/>, oldest first. They are queued besides the <c>On*</c> events, only when
+		/// <see cref="PollCapacity"/> is set.
+		/// </summary>
+		/// <returns>the number of events moved.</returns>
+		/// <remarks>
+		/// Allocates nothing, meant to be called from the game loop with the same buffer every frame.
+		/// </remarks>
+		public int PollEvents(IOCardEvent[] buffer, int offset, int count)
+		{
+			var events = mEvents;
+			return events == null ? 0 : events.Drain(buffer, offset, count);
+		}
+
+		public int PollEvents(IOCardEvent[] buffer)
+		{
+			return PollEvents(buffer, 0, buffer.Length);
+		}
+
+		/// <summary>
+		/// When <c>true</c>, the args of <see cref="OnKeys"/>, <see cref="OnCoinCounterResult"/>,
+		/// <see cref="OnEjectResult"/>, <see cref="OnReadStorageResult"/> and <see cref="OnStreamReadChunk"/>, and
+		/// their arrays, are the same objects every time, so receiving them allocates nothing. They are only valid in
+		/// the handler then, copy what's needed later. Defaults to <c>false</c>.
+		/// </summary>
+		public bool ReuseEventArgs
+		{
+			get { return mReuseEventArgs; }
+			set { mReuseEventArgs = value; }
+		}
 
-		CmdMessenger mMessenger;
+		IOCardLink mLink;
+		readonly IOCardClock mClock = new IOCardClock();
+		int mSyncInterval = DEFAULT_SYNC_INTERVAL;
+		System.Threading.Timer mSyncTimer;
+		string mCapturePath;
+		IOCardCaptureWriter mCapture;
+		bool mFastAck = true;
+		volatile bool mCoalesceOutputs;
+		int mOutputFlushInterval;
+		System.Threading.Timer mOutputTimer;
+		readonly object mOutputLock = new object();
+		// what's merged since the last flush, and what the card was sent.
+		readonly byte[] mOutputs = new byte[MAX_OUTPUT_BYTES];
+		int mOutputsLength;
+		readonly byte[] mSentOutputs = new byte[MAX_OUTPUT_BYTES];
+		int mSentOutputsLength;
+		OutputStats mOutputStats;
+		volatile IOCardAckTransport mAckTransport;
+		readonly object mAckLock = new object();
+		IOCardClock.LatencyStats mAckRoundTrip;
+		volatile bool mCommandStatsReset;
+		// the pages of GET_CMD_STATS received so far, only touched by the messenger's thread.
+		CommandStat[] mCommandStats;
+		volatile bool mTaskStatsReset;
+		// the tasks of GET_TASK_STATS received so far, only touched by the messenger's thread.
+		TaskStat[] mTaskStats;
+		uint mTaskStatsPasses;
+		uint mTaskStatsIdle;
+		// events received since the load test started, only touched by the messenger's thread.
+		bool mLoadTestRunning;
+		uint mLoadTestKeys;
+		uint mLoadTestCoins;
+		volatile IOCardEventQueue mEvents;
+		byte mHubIndex;
+		volatile bool mInHub;
+		volatile bool mReuseEventArgs;
+		// reused when mReuseEventArgs is set, only touched by the messenger's thread.
+		KeysEventArgs mKeysEventArgs;
+		CoinCounterResultEventArgs mCoinCounterResultEventArgs;
+		EjectResultEventArgs mEjectResultEventArgs;
+		ReadStorageResultEventArgs mReadStorageResultEventArgs;
+		StreamReadChunkEventArgs mStreamReadChunkEventArgs;
+		readonly byte[][] mBuffers = new byte[256][];
 
 		#region "Events and EventArgs"
 
@@ -536,11 +2127,29 @@ namespace Spark.Slot.IO
 		public event System.EventHandler OnDisconnected;
 		public event System.EventHandler<GetInfoResultEventArgs> OnGetInfoResult;
 		public event System.EventHandler<BootEventArgs> OnBoot;
+		public event System.EventHandler<SyncClockResultEventArgs> OnSyncClockResult;
 		public event System.EventHandler<CoinCounterResultEventArgs> OnCoinCounterResult;
+		public event System.EventHandler<EjectResultEventArgs> OnEjectResult;
+		public event System.EventHandler<EjectStatsResultEventArgs> OnEjectStatsResult;
 		public event System.EventHandler<KeysEventArgs> OnKeys;
 		public event System.EventHandler<KeyMasksEventArgs> OnKeyMasks;
 		public event System.EventHandler<WriteStorageResultEventArgs> OnWriteStorageResult;
 		public event System.EventHandler<ReadStorageResultEventArgs> OnReadStorageResult;
+		public event System.EventHandler<StreamReadChunkEventArgs> OnStreamReadChunk;
+		public event System.EventHandler<StreamRangeEventArgs> OnStreamReadEnd;
+		public event System.EventHandler<StreamWriteBeginResultEventArgs> OnStreamWriteBeginResult;
+		public event System.EventHandler<StreamWriteAckEventArgs> OnStreamWriteAck;
+		public event System.EventHandler<StreamWriteResultEventArgs> OnStreamWriteResult;
+		public event System.EventHandler<IntegrityMapResultEventArgs> OnIntegrityMapResult;
+		public event System.EventHandler<KvGetResultEventArgs> OnKvGetResult;
+		public event System.EventHandler<KvPutResultEventArgs> OnKvPutResult;
+		public event System.EventHandler<KvDeleteResultEventArgs> OnKvDeleteResult;
+		public event System.EventHandler<KvFormatResultEventArgs> OnKvFormatResult;
+		public event System.EventHandler<CommandStatsResultEventArgs> OnCommandStatsResult;
+		public event System.EventHandler<AuditBacklogResultEventArgs> OnAuditBacklogResult;
+		public event System.EventHandler<PersistStatsResultEventArgs> OnPersistStatsResult;
+		public event System.EventHandler<TaskStatsResultEventArgs> OnTaskStatsResult;
+		public event System.EventHandler<LoadTestResultEventArgs> OnLoadTestResult;
 		public event System.EventHandler<ErrorEventArgs> OnError;
 		public event System.EventHandler<UnknownEventArgs> OnUnknown;
 		public event System.EventHandler<DebugEventArgs> OnDebug;
@@ -550,6 +2159,27 @@ namespace Spark.Slot.IO
 			System.DateTime? mDateTime;
 
 			public long TimeStamp { get; internal set; }
+
+			/// <summary>
+			/// <c>true</c> if the card put a timestamp on this event.
+			/// </summary>
+			public bool HasDeviceTime { get; internal set; }
+
+			/// <summary>
+			/// the card's <c>micros()</c> when the event happened, valid only if <see cref="HasDeviceTime"/>.
+			/// </summary>
+			public uint DeviceMicros { get; internal set; }
+
+			/// <summary>
+			/// <c>true</c> if the card's clock was synchronized when the event came in, see <see cref="Latency"/>.
+			/// </summary>
+			public bool HasLatency { get; internal set; }
+
+			/// <summary>
+			/// microseconds from the event happened on the card to it's been processed by the driver, valid only if
+			/// <see cref="HasLatency"/>. it can be slightly negative, within the sync's accuracy.
+			/// </summary>
+			public long Latency { get; internal set; }
 			public System.DateTime DateTime
 			{
 				get
@@ -567,6 +2197,16 @@ namespace Spark.Slot.IO
 			{
 				TimeStamp = timestamp;
 			}
+
+			internal void _reuse(long timestamp)
+			{
+				mDateTime = null;
+				TimeStamp = timestamp;
+				HasDeviceTime = false;
+				DeviceMicros = 0;
+				HasLatency = false;
+				Latency = 0;
+			}
 		}
 
 		public class BootEventArgs : EventArgs
@@ -580,6 +2220,23 @@ namespace Spark.Slot.IO
 			}
 		}
 
+		public class SyncClockResultEventArgs : EventArgs
+		{
+			public uint Sequence { get; private set; }
+			public long RoundTrip { get; private set; }
+			public double Skew { get; private set; }
+
+			public SyncClockResultEventArgs(long timestamp, uint sequence, uint device, long roundTrip, double skew) :
+				base(timestamp)
+			{
+				Sequence = sequence;
+				DeviceMicros = device;
+				HasDeviceTime = true;
+				RoundTrip = roundTrip;
+				Skew = skew;
+			}
+		}
+
 		public class GetInfoResultEventArgs : EventArgs
 		{
 			public string Manufacturer { get; private set; }
@@ -610,14 +2267,83 @@ namespace Spark.Slot.IO
 			}
 		}
 
+		public class EjectResultEventArgs : EventArgs
+		{
+			public byte Track { get; internal set; }
+			public byte RequestId { get; internal set; }
+			public byte Requested { get; internal set; }
+			public byte Remaining { get; internal set; }
+			public bool Completed { get { return Remaining == 0; } }
+
+			public EjectResultEventArgs(long timestamp, byte track, byte requestId, byte requested, byte remaining) :
+				base(timestamp)
+			{
+				Track = track;
+				RequestId = requestId;
+				Requested = requested;
+				Remaining = remaining;
+			}
+		}
+
+		public class EjectStatsResultEventArgs : EventArgs
+		{
+			public byte Track { get; internal set; }
+			/// <summary>
+			/// number of intervals the estimate is built from, reset when a predictive cut-off misses the final coin.
+			/// </summary>
+			public ushort Samples { get; internal set; }
+			public uint AverageMicros { get; internal set; }
+			/// <summary>
+			/// mean absolute deviation of the interval, the cut-off is only used when it's below 1/4 of the average.
+			/// </summary>
+			public uint DeviationMicros { get; internal set; }
+			public uint MinMicros { get; internal set; }
+			public uint MaxMicros { get; internal set; }
+			/// <summary>
+			/// number of coins took twice the average interval.
+			/// </summary>
+			public ushort SlowCoins { get; internal set; }
+			/// <summary>
+			/// number of payouts the SSR was cut before the final coin is debounced.
+			/// </summary>
+			public ushort Cuts { get; internal set; }
+			/// <summary>
+			/// number of predictive cut-offs the final coin didn't show up, and the motor is powered again.
+			/// </summary>
+			public ushort Misses { get; internal set; }
+
+			public EjectStatsResultEventArgs(long timestamp, byte track, ushort samples, uint average, uint deviation, uint min, uint max, ushort slow, ushort cuts, ushort misses) :
+				base(timestamp)
+			{
+				Track = track;
+				Samples = samples;
+				AverageMicros = average;
+				DeviationMicros = deviation;
+				MinMicros = min;
+				MaxMicros = max;
+				SlowCoins = slow;
+				Cuts = cuts;
+				Misses = misses;
+			}
+		}
+
 		public class KeyMasksEventArgs : EventArgs
 		{
+			/// <summary>
+			/// one byte per 74HC165 in the chain, bits set are keys.
+			/// </summary>
 			public byte[] KeyMasks { get; internal set; }
 
-			public KeyMasksEventArgs(long timestamp, byte[] masks) :
+			/// <summary>
+			/// one byte per 74HC595 in the chain, bits set can be changed with SET_OUTPUT.
+			/// </summary>
+			public byte[] OutputMasks { get; internal set; }
+
+			public KeyMasksEventArgs(long timestamp, byte[] masks, byte[] outputMasks) :
 				base(timestamp)
 			{
 				KeyMasks = masks;
+				OutputMasks = outputMasks;
 			}
 		}
 
@@ -658,6 +2384,480 @@ namespace Spark.Slot.IO
 			}
 		}
 
+		public class StreamReadChunkEventArgs : EventArgs
+		{
+			public ushort Address { get; internal set; }
+			public byte[] Data { get; internal set; }
+			/// <summary>
+			/// <see cref="IOCardStorageTransfer.Crc8(byte[], int, int)"/> of the data, computed by the card.
+			/// </summary>
+			public byte Crc { get; internal set; }
+			public bool IsGood { get { return IOCardStorageTransfer.Crc8(Data, 0, Data.Length) == Crc; } }
+
+			public StreamReadChunkEventArgs(long timestamp, ushort address, byte[] data, byte crc) :
+				base(timestamp)
+			{
+				Address = address;
+				Data = data;
+				Crc = crc;
+			}
+		}
+
+		public class StreamRangeEventArgs : EventArgs
+		{
+			public ushort Address { get; internal set; }
+			public ushort Length { get; internal set; }
+			/// <summary>
+			/// <see cref="IOCardStorageTransfer.Crc16(byte[], int, int, ushort)"/> of the range, computed by the card.
+			/// </summary>
+			public ushort Crc { get; internal set; }
+
+			public StreamRangeEventArgs(long timestamp, ushort address, ushort length, ushort crc) :
+				base(timestamp)
+			{
+				Address = address;
+				Length = length;
+				Crc = crc;
+			}
+		}
+
+		public class StreamWriteBeginResultEventArgs : EventArgs
+		{
+			public ushort Address { get; internal set; }
+			public ushort Length { get; internal set; }
+			/// <summary>
+			/// number of chunks can be in flight before waiting for an ack.
+			/// </summary>
+			public byte Window { get; internal set; }
+
+			public StreamWriteBeginResultEventArgs(long timestamp, ushort address, ushort length, byte window) :
+				base(timestamp)
+			{
+				Address = address;
+				Length = length;
+				Window = window;
+			}
+		}
+
+		public class StreamWriteAckEventArgs : EventArgs
+		{
+			/// <summary>
+			/// everything before this address is written.
+			/// </summary>
+			public ushort Next { get; internal set; }
+
+			public StreamWriteAckEventArgs(long timestamp, ushort next) :
+				base(timestamp)
+			{
+				Next = next;
+			}
+		}
+
+		public class StreamWriteResultEventArgs : StreamRangeEventArgs
+		{
+			/// <summary>
+			/// <c>true</c> if what the card read back matches the CRC given with STREAM_WRITE_END.
+			/// </summary>
+			public bool IsGood { get; internal set; }
+
+			public StreamWriteResultEventArgs(long timestamp, ushort address, ushort length, ushort crc, bool good) :
+				base(timestamp, address, length, crc)
+			{
+				IsGood = good;
+			}
+		}
+
+		public class IntegrityMapResultEventArgs : EventArgs
+		{
+			/// <summary>
+			/// address of the first block.
+			/// </summary>
+			public ushort Address { get; internal set; }
+			public byte BlockSize { get; internal set; }
+			public byte Blocks { get; internal set; }
+			/// <summary>
+			/// <c>false</c> while the card is still building the CRC table, nothing is checked until then.
+			/// </summary>
+			public bool IsSealed { get; internal set; }
+			/// <summary>
+			/// complete passes over the user area since the card booted.
+			/// </summary>
+			public ushort Passes { get; internal set; }
+			/// <summary>
+			/// a bit per block, LSB first, set when the block didn't match its CRC.
+			/// </summary>
+			public byte[] Map { get; internal set; }
+
+			public IntegrityMapResultEventArgs(long timestamp, ushort address, byte blockSize, byte blocks, bool isSealed, ushort passes, byte[] map) :
+				base(timestamp)
+			{
+				Address = address;
+				BlockSize = blockSize;
+				Blocks = blocks;
+				IsSealed = isSealed;
+				Passes = passes;
+				Map = map;
+			}
+
+			public bool IsCorrupted(int block)
+			{
+				return (Map[block >> 3] & (1 << (block & 0x07))) != 0;
+			}
+
+			/// <summary>
+			/// addresses of the blocks that didn't match their CRC.
+			/// </summary>
+			public ushort[] CorruptedAddresses
+			{
+				get
+				{
+					var addresses = new System.Collections.Generic.List<ushort>();
+					for (int i = 0; i < Blocks; ++i)
+						if (IsCorrupted(i))
+							addresses.Add((ushort)(Address + i * BlockSize));
+					return addresses.ToArray();
+				}
+			}
+		}
+
+		public class KvGetResultEventArgs : EventArgs
+		{
+			public ushort Key { get; internal set; }
+			/// <summary>
+			/// the value, <c>null</c> if the key isn't in the store.
+			/// </summary>
+			public byte[] Value { get; internal set; }
+
+			public KvGetResultEventArgs(long timestamp, ushort key, byte[] value) :
+				base(timestamp)
+			{
+				Key = key;
+				Value = value;
+			}
+		}
+
+		public class KvPutResultEventArgs : EventArgs
+		{
+			public ushort Key { get; internal set; }
+			public byte Length { get; internal set; }
+			/// <summary>
+			/// bytes left in the store's log.
+			/// </summary>
+			public ushort Free { get; internal set; }
+
+			public KvPutResultEventArgs(long timestamp, ushort key, byte length, ushort free) :
+				base(timestamp)
+			{
+				Key = key;
+				Length = length;
+				Free = free;
+			}
+		}
+
+		public class KvDeleteResultEventArgs : EventArgs
+		{
+			public ushort Key { get; internal set; }
+			/// <summary>
+			/// <c>false</c> if the key wasn't in the store.
+			/// </summary>
+			public bool Found { get; internal set; }
+
+			public KvDeleteResultEventArgs(long timestamp, ushort key, bool found) :
+				base(timestamp)
+			{
+				Key = key;
+				Found = found;
+			}
+		}
+
+		public class KvFormatResultEventArgs : EventArgs
+		{
+			/// <summary>
+			/// the card has the key/value store, and checks the user area.
+			/// </summary>
+			public bool IsFormatted { get; internal set; }
+			/// <summary>
+			/// end of the user area, <see cref="USER_STORAGE_END"/> with the store, <see cref="STORAGE_END"/> without.
+			/// </summary>
+			public ushort UserEnd { get; internal set; }
+			/// <summary>
+			/// bytes left in the store's log.
+			/// </summary>
+			public ushort Free { get; internal set; }
+
+			public KvFormatResultEventArgs(long timestamp, bool formatted, ushort userEnd, ushort free) :
+				base(timestamp)
+			{
+				IsFormatted = formatted;
+				UserEnd = userEnd;
+				Free = free;
+			}
+		}
+
+		public class CommandStat
+		{
+			/// <summary>
+			/// the command, <c>0xFF</c> for all the commands the card doesn't keep track of individually. the card
+			/// times the commands going to the FRAM and the heavy ones on their own.
+			/// </summary>
+			public byte Command { get; private set; }
+			/// <summary>
+			/// stops at 65535, the card stops counting the command then, reset the statistics.
+			/// </summary>
+			public ushort Count { get; private set; }
+			/// <summary>
+			/// in steps of 32us, each call rounded to the nearest. the card stops counting the command at 2097120us,
+			/// reset the statistics.
+			/// </summary>
+			public uint TotalMicros { get; private set; }
+			public ushort MaxMicros { get; private set; }
+			/// <summary>
+			/// handler time histogram, bucket N counts calls took less than <c>128 * 4^N</c> us, the last bucket
+			/// counts everything else.
+			/// </summary>
+			public ushort[] Histogram { get; private set; }
+			public double AverageMicros { get { return Count == 0 ? 0.0 : (double)TotalMicros / Count; } }
+
+			public CommandStat(byte command, ushort count, uint total, ushort max, ushort[] histogram)
+			{
+				Command = command;
+				Count = count;
+				TotalMicros = total;
+				MaxMicros = max;
+				Histogram = histogram;
+			}
+		}
+
+		public class CommandStatsResultEventArgs : EventArgs
+		{
+			public CommandStat[] Stats { get; internal set; }
+
+			public CommandStatsResultEventArgs(long timestamp, CommandStat[] stats) :
+				base(timestamp)
+			{
+				Stats = stats;
+			}
+		}
+
+		public class AuditBacklogResultEventArgs : EventArgs
+		{
+			/// <summary>
+			/// meter ticks not pulsed yet, by counter.
+			/// </summary>
+			public uint[] Pending { get; internal set; }
+			/// <summary>
+			/// the backlog as the card's FRAM has it, what it resumes after a reset. it follows
+			/// <see cref="Pending"/> within a few loops of the card.
+			/// </summary>
+			public uint[] Checkpointed { get; internal set; }
+			/// <summary>
+			/// checkpoints written since the card booted.
+			/// </summary>
+			public uint Writes { get; internal set; }
+
+			public AuditBacklogResultEventArgs(long timestamp, uint[] pending, uint[] checkpointed, uint writes) :
+				base(timestamp)
+			{
+				Pending = pending;
+				Checkpointed = checkpointed;
+				Writes = writes;
+			}
+		}
+
+		public class PersistStatsResultEventArgs : EventArgs
+		{
+			/// <summary>
+			/// the card's built with the power-fail warning, the counters are written to the FRAM right away otherwise.
+			/// </summary>
+			public bool IsEnabled { get; internal set; }
+			/// <summary>
+			/// the card booted from what the last power failure flushed.
+			/// </summary>
+			public bool IsRestored { get; internal set; }
+			/// <summary>
+			/// power failures flushed, kept across resets like the flush times.
+			/// </summary>
+			public ushort Flushes { get; internal set; }
+			/// <summary>
+			/// time from the warning to the counters in the FRAM in us, of the last flush.
+			/// </summary>
+			public ushort LastFlushMicros { get; internal set; }
+			/// <summary>
+			/// the worst flush, what the hold-up capacitors have to last for.
+			/// </summary>
+			public ushort MaxFlushMicros { get; internal set; }
+			/// <summary>
+			/// counter updates kept in RAM.
+			/// </summary>
+			public uint Changes { get; internal set; }
+			/// <summary>
+			/// times the counters kept in RAM were written back to the FRAM.
+			/// </summary>
+			public uint WriteBacks { get; internal set; }
+			/// <summary>
+			/// the supply is under the threshold, or not back for long: the outputs are held off, the hoppers stopped
+			/// and the meters wait.
+			/// </summary>
+			public bool IsPowerFailed { get; internal set; }
+
+			public PersistStatsResultEventArgs(long timestamp, bool enabled, bool restored, ushort flushes,
+				ushort lastFlush, ushort maxFlush, uint changes, uint writeBacks, bool powerFailed) :
+				base(timestamp)
+			{
+				IsEnabled = enabled;
+				IsRestored = restored;
+				Flushes = flushes;
+				LastFlushMicros = lastFlush;
+				MaxFlushMicros = maxFlush;
+				Changes = changes;
+				WriteBacks = writeBacks;
+				IsPowerFailed = powerFailed;
+			}
+		}
+
+		public class TaskStat
+		{
+			/// <summary>
+			/// the task's place in the card's table, the input scan is 0, then the meters, the serial, the counters'
+			/// and meter ticks' journal, the storage stream, the key-value store and the scrubber.
+			/// </summary>
+			public byte Task { get; private set; }
+			/// <summary>
+			/// runs every <see cref="PeriodMicros"/>, the others fill the gaps in between.
+			/// </summary>
+			public bool IsRealtime { get; private set; }
+			/// <summary>
+			/// 0 for a task that runs whenever it fits.
+			/// </summary>
+			public ushort PeriodMicros { get; private set; }
+			public ushort BudgetMicros { get; private set; }
+			public uint Runs { get; private set; }
+			public uint TotalMicros { get; private set; }
+			public ushort MaxMicros { get; private set; }
+			/// <summary>
+			/// runs that took longer than <see cref="BudgetMicros"/>.
+			/// </summary>
+			public ushort Overruns { get; private set; }
+			/// <summary>
+			/// a realtime task that started a whole period late, or another one that didn't get to run between two
+			/// realtime passes.
+			/// </summary>
+			public ushort Misses { get; private set; }
+			public double AverageMicros { get { return Runs == 0 ? 0.0 : (double)TotalMicros / Runs; } }
+
+			public TaskStat(byte task, bool realtime, ushort period, ushort budget, uint runs, uint total, ushort max,
+				ushort overruns, ushort misses)
+			{
+				Task = task;
+				IsRealtime = realtime;
+				PeriodMicros = period;
+				BudgetMicros = budget;
+				Runs = runs;
+				TotalMicros = total;
+				MaxMicros = max;
+				Overruns = overruns;
+				Misses = misses;
+			}
+		}
+
+		public class TaskStatsResultEventArgs : EventArgs
+		{
+			/// <summary>
+			/// iterations of the card's main loop.
+			/// </summary>
+			public uint Passes { get; internal set; }
+			/// <summary>
+			/// iterations where no task was due, the CPU the card has left.
+			/// </summary>
+			public uint Idle { get; internal set; }
+			public TaskStat[] Tasks { get; internal set; }
+
+			public TaskStatsResultEventArgs(long timestamp, uint passes, uint idle, TaskStat[] tasks) :
+				base(timestamp)
+			{
+				Passes = passes;
+				Idle = idle;
+				Tasks = tasks;
+			}
+		}
+
+		public class LoadTestResultEventArgs : EventArgs
+		{
+			/// <summary>
+			/// <c>LoadTestMode.Off</c> once the test is over.
+			/// </summary>
+			public LoadTestMode Mode { get; internal set; }
+			/// <summary>
+			/// time since the test started in us, or how long the last one took.
+			/// </summary>
+			public uint Elapsed { get; internal set; }
+			/// <summary>
+			/// input scans of the card during the test, one every 500us.
+			/// </summary>
+			public uint Loops { get; internal set; }
+			/// <summary>
+			/// key changes generated.
+			/// </summary>
+			public uint KeyEdges { get; internal set; }
+			/// <summary>
+			/// KEYS events the card sent.
+			/// </summary>
+			public uint KeyEvents { get; internal set; }
+			/// <summary>
+			/// coins generated.
+			/// </summary>
+			public uint Coins { get; internal set; }
+			/// <summary>
+			/// COIN_COUNTER_RESULT events the card sent, less than <see cref="Coins"/> if the debouncing missed some.
+			/// </summary>
+			public uint CoinEvents { get; internal set; }
+			/// <summary>
+			/// loops that started with the card's UART buffer nearly full, that is the link holding the card back.
+			/// </summary>
+			public uint TxStalls { get; internal set; }
+			/// <summary>
+			/// KEYS events received since the test started.
+			/// </summary>
+			public uint KeysReceived { get; internal set; }
+			/// <summary>
+			/// COIN_COUNTER_RESULT events received since the test started.
+			/// </summary>
+			public uint CoinsReceived { get; internal set; }
+
+			/// <summary>
+			/// events the card sent but never arrived, exact once the test is over, a few events might still be on
+			/// the way otherwise.
+			/// </summary>
+			public long DroppedFrames
+			{
+				get { return (long)KeyEvents - KeysReceived + (long)CoinEvents - CoinsReceived; }
+			}
+
+			/// <summary>
+			/// events the card sent per second.
+			/// </summary>
+			public double EventsPerSecond
+			{
+				get { return Elapsed == 0 ? 0 : ((double)KeyEvents + CoinEvents) * 1000000 / Elapsed; }
+			}
+
+			public LoadTestResultEventArgs(long timestamp, LoadTestMode mode, uint elapsed, uint loops, uint keyEdges,
+				uint keyEvents, uint coins, uint coinEvents, uint txStalls, uint keysReceived, uint coinsReceived) :
+				base(timestamp)
+			{
+				Mode = mode;
+				Elapsed = elapsed;
+				Loops = loops;
+				KeyEdges = keyEdges;
+				KeyEvents = keyEvents;
+				Coins = coins;
+				CoinEvents = coinEvents;
+				TxStalls = txStalls;
+				KeysReceived = keysReceived;
+				CoinsReceived = coinsReceived;
+			}
+		}
+
 		public class ErrorEventArgs : EventArgs
 		{
 			public Errors ErrorCode { get; internal set; }
@@ -702,6 +2902,109 @@ namespace Spark.Slot.IO
 			}
 		}
 
+		public class ErrorEjectQueueFullEventArgs : ErrorTrackEventArgs
+		{
+			public byte RequestId { get; internal set; }
+
+			public ErrorEjectQueueFullEventArgs(long timestamp, Errors error, byte track, byte requestId) :
+				base(timestamp, error, track)
+			{
+				RequestId = requestId;
+			}
+		}
+
+		public class ErrorEjectSlowEventArgs : ErrorTrackEventArgs
+		{
+			/// <summary>
+			/// time since the last coin, in microseconds.
+			/// </summary>
+			public uint ElapsedMicros { get; internal set; }
+			public uint AverageMicros { get; internal set; }
+
+			public ErrorEjectSlowEventArgs(long timestamp, Errors error, byte track, uint elapsed, uint average) :
+				base(timestamp, error, track)
+			{
+				ElapsedMicros = elapsed;
+				AverageMicros = average;
+			}
+		}
+
+		public class ErrorStreamSequenceEventArgs : ErrorEventArgs
+		{
+			/// <summary>
+			/// address of the chunk the card is waiting for, resend from here.
+			/// </summary>
+			public ushort Expected { get; internal set; }
+			public ushort Address { get; internal set; }
+
+			public ErrorStreamSequenceEventArgs(long timestamp, Errors error, ushort expected, ushort address) :
+				base(timestamp, error)
+			{
+				Expected = expected;
+				Address = address;
+			}
+		}
+
+		public class ErrorStreamChecksumEventArgs : ErrorEventArgs
+		{
+			public ushort Address { get; internal set; }
+
+			public ErrorStreamChecksumEventArgs(long timestamp, Errors error, ushort address) :
+				base(timestamp, error)
+			{
+				Address = address;
+			}
+		}
+
+		public class ErrorStreamOutOfRangeEventArgs : ErrorEventArgs
+		{
+			public ushort Address { get; internal set; }
+			public ushort Length { get; internal set; }
+
+			public ErrorStreamOutOfRangeEventArgs(long timestamp, Errors error, ushort address, ushort length) :
+				base(timestamp, error)
+			{
+				Address = address;
+				Length = length;
+			}
+		}
+
+		public class ErrorKvEventArgs : ErrorEventArgs
+		{
+			public ushort Key { get; internal set; }
+
+			public ErrorKvEventArgs(long timestamp, Errors error, ushort key) :
+				base(timestamp, error)
+			{
+				Key = key;
+			}
+		}
+
+		public class ErrorKvFullEventArgs : ErrorKvEventArgs
+		{
+			/// <summary>
+			/// bytes left in the store's log.
+			/// </summary>
+			public ushort Free { get; internal set; }
+
+			public ErrorKvFullEventArgs(long timestamp, Errors error, ushort key, ushort free) :
+				base(timestamp, error, key)
+			{
+				Free = free;
+			}
+		}
+
+		public class ErrorKvInvalidEventArgs : ErrorKvEventArgs
+		{
+			public byte Length { get; internal set; }
+
+			public ErrorKvInvalidEventArgs(long timestamp, Errors error, ushort key, byte length) :
+				base(timestamp, error, key)
+			{
+				Length = length;
+			}
+		}
+
 		public class ErrorNotATrackEventArgs : ErrorTrackEventArgs
 		{
 			public ErrorNotATrackEventArgs(long timestamp, Errors error, byte track) :
@@ -732,6 +3035,20 @@ namespace Spark.Slot.IO
 			}
 		}
 
+		public class ErrorStorageCorruptedEventArgs : ErrorEventArgs
+		{
+			/// <summary>
+			/// address of the block that doesn't match its CRC.
+			/// </summary>
+			public ushort Address { get; internal set; }
+
+			public ErrorStorageCorruptedEventArgs(long timestamp, Errors error, ushort address) :
+				base(timestamp, error)
+			{
+				Address = address;
+			}
+		}
+
 		public class ErrorTooLongEventArgs : ErrorEventArgs
 		{
 			public byte DesiredLength { get; internal set; }
@@ -758,6 +3075,20 @@ namespace Spark.Slot.IO
 			}
 		}
 
+		public class ErrorLoadTestDeniedEventArgs : ErrorEventArgs
+		{
+			/// <summary>
+			/// the command refused, LOAD_TEST when the test couldn't start, or an eject while it's running.
+			/// </summary>
+			public Commands Command { get; internal set; }
+
+			public ErrorLoadTestDeniedEventArgs(long timestamp, Errors error, byte command) :
+				base(timestamp, error)
+			{
+				Command = (Commands)command;
+			}
+		}
+
 		public class ErrorUnknownCommandEventArgs : ErrorEventArgs
 		{
 			public ushort Command { get; internal set; }
@@ -793,11 +3124,19 @@ namespace Spark.Slot.IO
 
 		public class UnknownEventArgs : EventArgs
 		{
+			public int CommandId { get; internal set; }
+			public string RawString { get; internal set; }
+			/// <summary>
+			/// CmdMessenger's command, <c>null</c> for a card in an <see cref="IOCardHub"/>, its frames aren't parsed by
+			/// CmdMessenger.
+			/// </summary>
 			public ReceivedCommand Command { get; internal set; }
 
-			public UnknownEventArgs(long timestamp, ReceivedCommand command) :
+			public UnknownEventArgs(long timestamp, int commandId, string rawString, ReceivedCommand command) :
 				base(timestamp)
 			{
+				CommandId = commandId;
+				RawString = rawString;
 				Command = command;
 			}
 		}
@@ -0,0 +1,185 @@
+using System;
+using System.Collections.Generic;
+using CommandMessenger.Transport;
+
+namespace Spark.Slot.IO
+{
+	/// <summary>
+	/// Sends the ACK of a COIN_COUNTER_RESULT the moment the frame's header comes in, before the messenger queues and
+	/// parses it, so a busy parser or a slow subscriber can't let the card's TIMEOUT_NACK stop the hopper.
+	/// </summary>
+	/// <remarks>
+	/// The ACK is written straight into the transport, it only waits for a frame the messenger is writing right then,
+	/// not for the messenger's send queue.
+	/// </remarks>
+	public class IOCardAckTransport : ITransport
+	{
+		/// <summary>
+		/// ACKs sent and not matched with a parsed COIN_COUNTER_RESULT yet, older ones are forgotten.
+		/// </summary>
+		public const int MAX_PENDING_ACKS = 16;
+
+		/// <param name="transport">the transport doing the real work, disposed with this one.</param>
+		public IOCardAckTransport(ITransport transport)
+		{
+			mTransport = transport;
+			mTransport.DataReceived += Transport_DataReceived;
+		}
+
+		public void Dispose()
+		{
+			mTransport.DataReceived -= Transport_DataReceived;
+			mTransport.Dispose();
+		}
+
+		/// <summary>
+		/// ACKs sent so far.
+		/// </summary>
+		public long Acks { get { lock (mPending) return mAcks; } }
+
+		public bool Connect()
+		{
+			lock (mPending)
+			{
+				mPendingLength = 0;
+				mAckTimes.Clear();
+				mAtFrameStart = true;
+				mEscaped = false;
+				mId = 0;
+			}
+			return mTransport.Connect();
+		}
+
+		public bool Disconnect() { return mTransport.Disconnect(); }
+		public bool IsConnected() { return mTransport.IsConnected(); }
+		public bool IsSaturated() { return mTransport.IsSaturated(); }
+
+		public byte[] Read()
+		{
+			lock (mPending)
+			{
+				var data = new byte[mPendingLength];
+				Array.Copy(mPending, data, mPendingLength);
+				mPendingLength = 0;
+				return data;
+			}
+		}
+
+		public void Write(byte[] buffer)
+		{
+			lock (mWriteLock)
+				mTransport.Write(buffer);
+		}
+
+		public event EventHandler DataReceived;
+
+		/// <summary>
+		/// takes the time the oldest unmatched ACK was written, on <see cref="IOCardClock.Now"/>, called for every
+		/// COIN_COUNTER_RESULT parsed.
+		/// </summary>
+		internal bool TakeAckTime(out long time)
+		{
+			lock (mPending)
+			{
+				if (mAckTimes.Count == 0)
+				{
+					time = 0;
+					return false;
+				}
+				time = mAckTimes.Dequeue();
+				return true;
+			}
+		}
+
+		void Transport_DataReceived(object sender, EventArgs e)
+		{
+			var data = mTransport.Read();
+			if (data == null || data.Length == 0)
+				return;
+
+			int acks = 0;
+			lock (mPending)
+			{
+				acks = _scan(data);
+				if (mPending.Length < mPendingLength + data.Length)
+					Array.Resize(ref mPending, Math.Max(mPending.Length * 2, mPendingLength + data.Length));
+				Array.Copy(data, 0, mPending, mPendingLength, data.Length);
+				mPendingLength += data.Length;
+			}
+
+			for (; acks > 0; --acks)
+			{
+				lock (mWriteLock)
+					mTransport.Write(ACK);
+				var now = IOCardClock.Now;
+				lock (mPending)
+				{
+					++mAcks;
+					if (mAckTimes.Count == MAX_PENDING_ACKS)
+						mAckTimes.Dequeue();
+					mAckTimes.Enqueue(now);
+				}
+			}
+
+			var handler = DataReceived;
+			if (handler != null)
+				handler(this, e);
+		}
+
+		// follows the frames' boundaries, returns the number of COIN_COUNTER_RESULT headers seen.
+		int _scan(byte[] data)
+		{
+			int found = 0;
+			foreach (var b in data)
+			{
+				if (mEscaped)
+				{
+					mEscaped = false;
+					mAtFrameStart = false;
+				}
+				else if (b == ESCAPE)
+				{
+					mEscaped = true;
+				}
+				else if (b == COMMAND_SEPARATOR)
+				{
+					mAtFrameStart = true;
+					mId = 0;
+				}
+				else if (mAtFrameStart)
+				{
+					if (b >= '0' && b <= '9')
+						mId = mId * 10 + (b - '0');
+					else if (b == FIELD_SEPARATOR)
+					{
+						if (mId == (int)IOCard.Events.EVT_COIN_COUNTER_RESULT)
+							++found;
+						mAtFrameStart = false;
+					}
+					else if (b != '\r' && b != '\n')
+						mAtFrameStart = false;
+					// the id is short, anything longer is noise.
+					if (mId > 0xFFFF)
+						mAtFrameStart = false;
+				}
+			}
+			return found;
+		}
+
+		// CmdMessenger's defaults, what the firmware uses.
+		const byte FIELD_SEPARATOR = (byte)',';
+		const byte COMMAND_SEPARATOR = (byte)';';
+		const byte ESCAPE = (byte)'/';
+		static readonly byte[] ACK = { (byte)'0', COMMAND_SEPARATOR };
+
+		readonly ITransport mTransport;
+		readonly object mWriteLock = new object();
+		byte[] mPending = new byte[512];
+		int mPendingLength;
+		readonly Queue<long> mAckTimes = new Queue<long>(MAX_PENDING_ACKS);
+		long mAcks;
+		bool mAtFrameStart = true;
+		bool mEscaped;
+		int mId;
+	}
+}
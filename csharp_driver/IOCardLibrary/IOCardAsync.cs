@@ -0,0 +1,449 @@
+using System;
+using System.Collections.Generic;
+using System.Threading;
+using System.Threading.Tasks;
+using CommandMessenger;
+
+namespace Spark.Slot.IO
+{
+	/// <summary>
+	/// <c>Task</c> based requests, the replies are matched with the requests so many can be in flight at once.
+	/// </summary>
+	/// <remarks>
+	/// <para>
+	/// The card handles the commands in order and answers each with exactly one result or error, so the replies are
+	/// matched first in first out, per command and per track, address or key. All the requests are queued at the end
+	/// of the send queue to keep that order.
+	/// </para>
+	/// <para>
+	/// A KEYS or COIN_COUNTER_RESULT the card sends on its own completes a pending <see cref="GetKeysAsync"/> or
+	/// <see cref="GetCoinCounterAsync"/> too, with the same answer it would have got. The results of the
+	/// fire-and-forget <c>Query*</c> methods are told apart by address where there is one, don't mix them with
+	/// requests of the same kind otherwise.
+	/// </para>
+	/// <para>
+	/// A request timed out or cancelled keeps its place and its slot, the command is still in the card's queue, its
+	/// reply is dropped when it comes in. It's forgotten once a younger request got its reply, the card lost it, or
+	/// when the card reboots.
+	/// </para>
+	/// <para>
+	/// The tasks are completed on the thread pool, so a continuation never holds up the messenger's thread, or the
+	/// thread of an <see cref="IOCardHub"/> reading all the cards.
+	/// </para>
+	/// </remarks>
+	public partial class IOCard
+	{
+		/// <summary>
+		/// Requests in flight at most, the others wait for a slot before they are sent, so the card's 64 bytes
+		/// receive buffer isn't overrun. Takes effect on the first request.
+		/// </summary>
+		public int MaxOutstandingRequests
+		{
+			get { return mMaxOutstandingRequests; }
+			set { mMaxOutstandingRequests = value; }
+		}
+		const int DEFAULT_MAX_OUTSTANDING_REQUESTS = 8;
+
+		/// <summary>
+		/// Milliseconds a request waits for its reply before it fails with a <see cref="TimeoutException"/>, not
+		/// counting the wait for a slot. <c>Timeout.Infinite</c> waits forever.
+		/// </summary>
+		public int RequestTimeout
+		{
+			get { return mRequestTimeout; }
+			set { mRequestTimeout = value; }
+		}
+		const int DEFAULT_REQUEST_TIMEOUT = 2000;
+
+		/// <summary>
+		/// The card refused a request with an error.
+		/// </summary>
+		public class RequestFailedException : Exception
+		{
+			public ErrorEventArgs Error { get; private set; }
+
+			public RequestFailedException(ErrorEventArgs error) :
+				base(string.Format("The card replied {0}.", error.ErrorCode))
+			{
+				Error = error;
+			}
+		}
+
+		public Task<GetInfoResultEventArgs> GetInfoAsync(CancellationToken cancellationToken = default(CancellationToken))
+		{
+			return _request<GetInfoResultEventArgs>(_lane(Commands.CMD_GET_INFO), null,
+				() => QueryGetInfo(SendQueue.AtEndQueue), cancellationToken);
+		}
+
+		public Task<KeyMasksEventArgs> GetKeyMasksAsync(CancellationToken cancellationToken = default(CancellationToken))
+		{
+			return _request<KeyMasksEventArgs>(_lane(Commands.CMD_GET_KEY_MASKS), null,
+				() => QueryGetKeyMasks(SendQueue.AtEndQueue), cancellationToken);
+		}
+
+		/// <returns>the keys, one byte per 74HC165 in the chain.</returns>
+		public Task<byte[]> GetKeysAsync(CancellationToken cancellationToken = default(CancellationToken))
+		{
+			return _request<byte[]>(_lane(Commands.CMD_GET_KEYS), null,
+				() => QueryGetKeys(SendQueue.AtEndQueue), cancellationToken);
+		}
+
+		/// <returns>the coins counted on the track.</returns>
+		public Task<uint> GetCoinCounterAsync(byte track, CancellationToken cancellationToken = default(CancellationToken))
+		{
+			return _request<uint>(_lane(Commands.CMD_GET_COIN_COUNTER, track), null,
+				() => QueryGetCoinCounter(track, SendQueue.AtEndQueue), cancellationToken);
+		}
+
+		/// <summary>
+		/// reads the coin counters of all the <paramref name="tracks"/>, all the requests in flight at once.
+		/// </summary>
+		public Task<uint[]> GetCoinCountersAsync(byte[] tracks, CancellationToken cancellationToken = default(CancellationToken))
+		{
+			var requests = new Task<uint>[tracks.Length];
+			for (int i = 0; i < tracks.Length; ++i)
+				requests[i] = GetCoinCounterAsync(tracks[i], cancellationToken);
+			return Task.WhenAll(requests);
+		}
+
+		public Task<EjectStatsResultEventArgs> GetEjectStatsAsync(byte track, bool reset = false, CancellationToken cancellationToken = default(CancellationToken))
+		{
+			return _request<EjectStatsResultEventArgs>(_lane(Commands.CMD_GET_EJECT_STATS, track), null,
+				() => QueryGetEjectStats(track, reset, SendQueue.AtEndQueue), cancellationToken);
+		}
+
+		public Task<CommandStat[]> GetCommandStatsAsync(bool reset = false, CancellationToken cancellationToken = default(CancellationToken))
+		{
+			return _request<CommandStat[]>(_lane(Commands.CMD_GET_CMD_STATS), null,
+				() => QueryGetCommandStats(reset, SendQueue.AtEndQueue), cancellationToken);
+		}
+
+		/// <returns>the bytes read, <paramref name="length"/> is at most <see cref="MAX_STORAGE_BYTES"/>.</returns>
+		public Task<byte[]> ReadStorageAsync(ushort address, byte length, CancellationToken cancellationToken = default(CancellationToken))
+		{
+			return _request<byte[]>(_lane(Commands.CMD_READ_STORAGE), new StorageMatch(Commands.CMD_READ_STORAGE, address, length),
+				() => QueryReadStorage(address, length, SendQueue.AtEndQueue), cancellationToken);
+		}
+
+		/// <summary>
+		/// reads any length, split into <see cref="MAX_STORAGE_BYTES"/> requests all in flight at once.
+		/// </summary>
+		public async Task<byte[]> ReadStorageRangeAsync(ushort address, int length, CancellationToken cancellationToken = default(CancellationToken))
+		{
+			var chunks = new List<Task<byte[]>>();
+			for (int offset = 0; offset < length; offset += MAX_STORAGE_BYTES)
+				chunks.Add(ReadStorageAsync((ushort)(address + offset), (byte)Math.Min(MAX_STORAGE_BYTES, length - offset), cancellationToken));
+
+			var data = new byte[length];
+			for (int i = 0; i < chunks.Count; ++i)
+			{
+				var chunk = await chunks[i].ConfigureAwait(false);
+				Buffer.BlockCopy(chunk, 0, data, i * MAX_STORAGE_BYTES, chunk.Length);
+			}
+			return data;
+		}
+
+		/// <param name="data">at most <see cref="MAX_STORAGE_BYTES"/>.</param>
+		public Task<WriteStorageResultEventArgs> WriteStorageAsync(ushort address, byte[] data, CancellationToken cancellationToken = default(CancellationToken))
+		{
+			return _request<WriteStorageResultEventArgs>(_lane(Commands.CMD_READ_STORAGE), new StorageMatch(Commands.CMD_WRITE_STORAGE, address, data.Length),
+				() => QueryWriteStorage(address, data, SendQueue.AtEndQueue), cancellationToken);
+		}
+
+		/// <returns>the value, <c>null</c> if the key isn't in the store.</returns>
+		public Task<byte[]> KvGetAsync(ushort key, CancellationToken cancellationToken = default(CancellationToken))
+		{
+			return _request<byte[]>(_lane(Commands.CMD_KV_GET, key), null,
+				() => QueryKvGet(key, SendQueue.AtEndQueue), cancellationToken);
+		}
+
+		/// <summary>
+		/// READ_STORAGE and WRITE_STORAGE take that many bytes at most, MAX_BYTES_LENGTH in the firmware.
+		/// </summary>
+		public const int MAX_STORAGE_BYTES = 64;
+
+		// --- matching ---------------------------------------------------------------------------------------------
+
+		// READ_STORAGE and WRITE_STORAGE share a lane, their errors don't tell which one failed.
+		class StorageMatch
+		{
+			public readonly Commands Command;
+			public readonly ushort Address;
+			public readonly int Length;
+
+			public StorageMatch(Commands command, ushort address, int length)
+			{
+				Command = command;
+				Address = address;
+				Length = length;
+			}
+		}
+
+		abstract class AsyncRequest
+		{
+			public long Sequence;
+			public int Lane;
+			public object Match;
+			public IOCard Card;
+			public CancellationTokenSource Timeout;
+			public CancellationTokenRegistration Registration;
+			int mClaimed;
+
+			// only one of the reply, the error, the timeout or the cancellation gets through.
+			protected bool _claim()
+			{
+				return Interlocked.CompareExchange(ref mClaimed, 1, 0) == 0;
+			}
+
+			// gives the slot back once the request is out of its lane, the card is done with the command then.
+			public void Release()
+			{
+				Card.mRequestSlots.Release();
+			}
+
+			protected void _dispose()
+			{
+				Registration.Dispose();
+				if (Timeout != null)
+					Timeout.Dispose();
+			}
+
+			public bool IsClaimed { get { return Volatile.Read(ref mClaimed) != 0; } }
+
+			public abstract bool Fail(Exception exception);
+			public abstract bool Cancel(bool timedOut);
+		}
+
+		class AsyncRequest<T> : AsyncRequest
+		{
+			public readonly TaskCompletionSource<T> Source = new TaskCompletionSource<T>();
+
+			public bool Complete(T result)
+			{
+				if (!_claim())
+					return false;
+				ThreadPool.QueueUserWorkItem((state) => { _dispose(); Source.TrySetResult(result); });
+				return true;
+			}
+
+			public override bool Fail(Exception exception)
+			{
+				if (!_claim())
+					return false;
+				ThreadPool.QueueUserWorkItem((state) => { _dispose(); Source.TrySetException(exception); });
+				return true;
+			}
+
+			public override bool Cancel(bool timedOut)
+			{
+				if (!_claim())
+					return false;
+				ThreadPool.QueueUserWorkItem((state) =>
+				{
+					_dispose();
+					if (timedOut)
+						Source.TrySetException(new TimeoutException("The card didn't reply in time."));
+					else
+						Source.TrySetCanceled();
+				});
+				return true;
+			}
+		}
+
+		static int _lane(Commands command, int key = 0)
+		{
+			return ((int)command << 16) | (key & 0xFFFF);
+		}
+
+		async Task<T> _request<T>(int lane, object match, Func<bool> send, CancellationToken cancellationToken)
+		{
+			_attachAsync();
+			await mRequestSlots.WaitAsync(cancellationToken).ConfigureAwait(false);
+
+			var request = new AsyncRequest<T> { Lane = lane, Match = match, Card = this };
+			if (mRequestTimeout != Timeout.Infinite)
+			{
+				request.Timeout = CancellationTokenSource.CreateLinkedTokenSource(cancellationToken);
+				request.Timeout.CancelAfter(mRequestTimeout);
+				request.Registration = request.Timeout.Token.Register(() => request.Cancel(!cancellationToken.IsCancellationRequested));
+			}
+			else
+				request.Registration = cancellationToken.Register(() => request.Cancel(false));
+
+			lock (mLanes)
+			{
+				request.Sequence = ++mRequestSequence;
+				// sent under the lock so the order on the wire is the order in the lanes, the reply can't be taken
+				// before it's queued.
+				if (send())
+				{
+					Queue<AsyncRequest> queue;
+					if (!mLanes.TryGetValue(lane, out queue))
+						mLanes[lane] = queue = new Queue<AsyncRequest>();
+					queue.Enqueue(request);
+				}
+				else
+				{
+					request.Fail(new InvalidOperationException("Not connected."));
+					request.Release();
+				}
+			}
+
+			return await request.Source.Task.ConfigureAwait(false);
+		}
+
+		// the oldest request of the lane if it accepts `match`, null if there's none or if it's been timed out or
+		// cancelled, then the reply is its own and it's dropped.
+		AsyncRequest _take(int lane, Func<AsyncRequest, bool> match = null)
+		{
+			lock (mLanes)
+			{
+				Queue<AsyncRequest> queue;
+				if (!mLanes.TryGetValue(lane, out queue))
+					return null;
+				_skipLost(queue);
+				if (queue.Count == 0 || (match != null && !match(queue.Peek())))
+					return null;
+				var request = queue.Dequeue();
+				request.Release();
+				if (request.Sequence > mRepliedSequence)
+					mRepliedSequence = request.Sequence;
+				return request.IsClaimed ? null : request;
+			}
+		}
+
+		// the card replies in order, a request given up on and older than one replied to won't get its reply.
+		void _skipLost(Queue<AsyncRequest> queue)
+		{
+			while (queue.Count != 0 && queue.Peek().IsClaimed && queue.Peek().Sequence < mRepliedSequence)
+				queue.Dequeue().Release();
+		}
+
+		void _complete<T>(int lane, T result, Func<AsyncRequest, bool> match = null)
+		{
+			var request = _take(lane, match) as AsyncRequest<T>;
+			if (request != null)
+				request.Complete(result);
+		}
+
+		void _fail(int lane, ErrorEventArgs error)
+		{
+			var request = _take(lane);
+			if (request != null)
+				request.Fail(new RequestFailedException(error));
+		}
+
+		// the oldest request in any of the lanes, for errors that only tell the command or the track.
+		void _failOldest(Func<int, bool> lanes, ErrorEventArgs error)
+		{
+			int oldest = 0;
+			long sequence = long.MaxValue;
+			lock (mLanes)
+			{
+				foreach (var pair in mLanes)
+				{
+					if (!lanes(pair.Key))
+						continue;
+					_skipLost(pair.Value);
+					if (pair.Value.Count != 0 && pair.Value.Peek().Sequence < sequence)
+					{
+						sequence = pair.Value.Peek().Sequence;
+						oldest = pair.Key;
+					}
+				}
+			}
+			if (sequence != long.MaxValue)
+				_fail(oldest, error);
+		}
+
+		// the commands in flight are gone with the connection or with a reboot of the card.
+		void _failAllRequests(string reason)
+		{
+			var failed = new List<AsyncRequest>();
+			lock (mLanes)
+			{
+				foreach (var queue in mLanes.Values)
+					failed.AddRange(queue);
+				mLanes.Clear();
+			}
+			foreach (var request in failed)
+			{
+				request.Fail(new InvalidOperationException(reason));
+				request.Release();
+			}
+		}
+
+		void _attachAsync()
+		{
+			lock (mLanes)
+			{
+				if (mRequestSlots != null)
+					return;
+				mRequestSlots = new SemaphoreSlim(mMaxOutstandingRequests);
+			}
+
+			OnDisconnected += (sender, e) => _failAllRequests("Disconnected.");
+			OnBoot += (sender, e) => _failAllRequests("The card rebooted.");
+			OnGetInfoResult += (sender, e) => _complete(_lane(Commands.CMD_GET_INFO), e);
+			OnKeyMasks += (sender, e) => _complete(_lane(Commands.CMD_GET_KEY_MASKS), e);
+			OnKeys += (sender, e) => _complete(_lane(Commands.CMD_GET_KEYS), (byte[])e.Keys.Clone());
+			OnCoinCounterResult += (sender, e) => _complete(_lane(Commands.CMD_GET_COIN_COUNTER, e.Track), e.Coins);
+			OnEjectStatsResult += (sender, e) => _complete(_lane(Commands.CMD_GET_EJECT_STATS, e.Track), e);
+			OnCommandStatsResult += (sender, e) => _complete(_lane(Commands.CMD_GET_CMD_STATS), e.Stats);
+			OnKvGetResult += (sender, e) => _complete(_lane(Commands.CMD_KV_GET, e.Key), e.Value);
+			OnReadStorageResult += (sender, e) =>
+			{
+				// the Data may be reused, see ReuseEventArgs
+				var data = (byte[])e.Data.Clone();
+				_complete(_lane(Commands.CMD_READ_STORAGE), data, (request) =>
+				{
+					var match = (StorageMatch)request.Match;
+					return match.Command == Commands.CMD_READ_STORAGE && match.Address == e.Address && match.Length == data.Length;
+				});
+			};
+			OnWriteStorageResult += (sender, e) => _complete(_lane(Commands.CMD_READ_STORAGE), e, (request) =>
+			{
+				var match = (StorageMatch)request.Match;
+				return match.Command == Commands.CMD_WRITE_STORAGE && match.Address == e.Address && match.Length == e.Length;
+			});
+			OnError += (sender, e) =>
+			{
+				switch (e.ErrorCode)
+				{
+					case Errors.ERR_NOT_A_TRACK:
+						{
+							var track = ((ErrorNotATrackEventArgs)e).Track;
+							_failOldest((lane) => lane == _lane(Commands.CMD_GET_COIN_COUNTER, track) || lane == _lane(Commands.CMD_GET_EJECT_STATS, track), e);
+						}
+						break;
+					case Errors.ERR_PROTECTED_STORAGE:
+					case Errors.ERR_TOO_LONG:
+					case Errors.ERR_OUT_OF_RANGE:
+						_fail(_lane(Commands.CMD_READ_STORAGE), e);
+						break;
+					case Errors.ERR_KV_INVALID:
+					case Errors.ERR_KV_CORRUPTED:
+					case Errors.ERR_KV_UNFORMATTED:
+						_fail(_lane(Commands.CMD_KV_GET, ((ErrorKvEventArgs)e).Key), e);
+						break;
+					case Errors.ERR_UNKNOWN_COMMAND:
+						{
+							var command = (int)((ErrorUnknownCommandEventArgs)e).Command;
+							// the storage lane is READ_STORAGE's
+							if (command == (int)Commands.CMD_WRITE_STORAGE)
+								command = (int)Commands.CMD_READ_STORAGE;
+							_failOldest((lane) => (lane >> 16) == command, e);
+						}
+						break;
+				}
+			};
+		}
+
+		int mMaxOutstandingRequests = DEFAULT_MAX_OUTSTANDING_REQUESTS;
+		int mRequestTimeout = DEFAULT_REQUEST_TIMEOUT;
+		SemaphoreSlim mRequestSlots;
+		readonly Dictionary<int, Queue<AsyncRequest>> mLanes = new Dictionary<int, Queue<AsyncRequest>>();
+		long mRequestSequence;
+		long mRepliedSequence;
+	}
+}
@@ -0,0 +1,245 @@
+using System;
+using System.Collections.Generic;
+using System.IO;
+
+namespace Spark.Slot.IO
+{
+	/// <summary>
+	/// A capture of the raw serial traffic with a card, both directions, as the transport read and wrote it.
+	/// </summary>
+	/// <remarks>
+	/// <para>
+	/// The file starts with a header:
+	/// <c>"IOCP"</c>, a version byte, 3 reserved bytes, then the wall clock time the capture started, as 64-bit
+	/// microseconds since the unix epoch, little endian.
+	/// </para>
+	/// <para>
+	/// Then a record per read or write: a byte telling the <see cref="Direction"/>, the microseconds since the previous
+	/// record (since the capture started for the first one) on the monotonic <see cref="IOCardClock.Now"/>, the length,
+	/// and the bytes. The time and the length are unsigned LEB128 varints, so a record costs 3 bytes plus the data most
+	/// of the time.
+	/// </para>
+	/// <para>
+	/// The bytes are kept in the chunks the transport handed them over, so a frame split across reads replays split
+	/// the same way.
+	/// </para>
+	/// </remarks>
+	public static class IOCardCapture
+	{
+		public enum Direction : byte
+		{
+			FromCard = 0x00,
+			ToCard = 0x01
+		}
+
+		public struct Record
+		{
+			public Direction Direction;
+			/// <summary>
+			/// microseconds since the capture started.
+			/// </summary>
+			public long Time;
+			public byte[] Data;
+		}
+
+		internal static readonly byte[] MAGIC = { (byte)'I', (byte)'O', (byte)'C', (byte)'P' };
+		internal const byte VERSION = 1;
+	}
+
+	/// <summary>
+	/// Writes a capture, see <see cref="IOCardCapture"/> for the format. Safe to call from the transport's threads.
+	/// </summary>
+	public class IOCardCaptureWriter : IDisposable
+	{
+		/// <summary>
+		/// how long a record may sit in the buffer, in microseconds, so a crash doesn't lose more than that.
+		/// </summary>
+		public const long FLUSH_INTERVAL = 1000000;
+
+		public IOCardCaptureWriter(string path) :
+			this(new FileStream(path, FileMode.Create, FileAccess.Write, FileShare.Read, 65536))
+		{
+		}
+
+		public IOCardCaptureWriter(Stream stream)
+		{
+			mStream = stream;
+			mLast = IOCardClock.Now;
+			mFlushed = mLast;
+
+			var header = new byte[16];
+			Array.Copy(IOCardCapture.MAGIC, header, IOCardCapture.MAGIC.Length);
+			header[4] = IOCardCapture.VERSION;
+			var epoch = (DateTime.UtcNow.Ticks - new DateTime(1970, 1, 1, 0, 0, 0, DateTimeKind.Utc).Ticks) / 10;
+			for (int i = 0; i < 8; ++i)
+				header[8 + i] = (byte)(epoch >> (i * 8));
+			mStream.Write(header, 0, header.Length);
+		}
+
+		public void Dispose()
+		{
+			lock (this)
+			{
+				if (mStream != null)
+				{
+					mStream.Dispose();
+					mStream = null;
+				}
+			}
+		}
+
+		/// <summary>
+		/// bytes of data captured so far, not counting the framing.
+		/// </summary>
+		public long Bytes { get { lock (this) return mBytes; } }
+
+		/// <summary>
+		/// records a read or a write, now.
+		/// </summary>
+		public void Write(IOCardCapture.Direction direction, byte[] data, int offset, int count)
+		{
+			lock (this)
+			{
+				if (mStream == null)
+					return;
+
+				var now = IOCardClock.Now;
+				int length = 0;
+				mHeader[length++] = (byte)direction;
+				length = _putVarint(mHeader, length, now - mLast);
+				length = _putVarint(mHeader, length, count);
+				mStream.Write(mHeader, 0, length);
+				mStream.Write(data, offset, count);
+				mLast = now;
+				mBytes += count;
+
+				if (now - mFlushed > FLUSH_INTERVAL)
+				{
+					mStream.Flush();
+					mFlushed = now;
+				}
+			}
+		}
+
+		static int _putVarint(byte[] buffer, int offset, long value)
+		{
+			do
+			{
+				var b = (byte)(value & 0x7F);
+				value >>= 7;
+				buffer[offset++] = value != 0 ? (byte)(b | 0x80) : b;
+			} while (value != 0);
+			return offset;
+		}
+
+		Stream mStream;
+		readonly byte[] mHeader = new byte[1 + 10 + 10];
+		long mLast;
+		long mFlushed;
+		long mBytes;
+	}
+
+	/// <summary>
+	/// Reads a capture written by <see cref="IOCardCaptureWriter"/>, a record at a time.
+	/// </summary>
+	public class IOCardCaptureReader : IDisposable
+	{
+		public IOCardCaptureReader(string path) :
+			this(new FileStream(path, FileMode.Open, FileAccess.Read, FileShare.ReadWrite, 65536))
+		{
+		}
+
+		/// <exception cref="System.IO.InvalidDataException">Thrown when the stream isn't a capture.</exception>
+		public IOCardCaptureReader(Stream stream)
+		{
+			mStream = stream;
+			var header = new byte[16];
+			if (!_readFully(header, header.Length))
+				throw new InvalidDataException("Not a capture, too short.");
+			for (int i = 0; i < IOCardCapture.MAGIC.Length; ++i)
+				if (header[i] != IOCardCapture.MAGIC[i])
+					throw new InvalidDataException("Not a capture, bad magic.");
+			if (header[4] != IOCardCapture.VERSION)
+				throw new InvalidDataException(string.Format("Unsupported capture version {0}.", header[4]));
+
+			long epoch = 0;
+			for (int i = 0; i < 8; ++i)
+				epoch |= (long)header[8 + i] << (i * 8);
+			Started = new DateTime(1970, 1, 1, 0, 0, 0, DateTimeKind.Utc).AddTicks(epoch * 10);
+		}
+
+		public void Dispose()
+		{
+			mStream.Dispose();
+		}
+
+		/// <summary>
+		/// wall clock time the capture started, in UTC.
+		/// </summary>
+		public DateTime Started { get; private set; }
+
+		/// <summary>
+		/// reads the next record.
+		/// </summary>
+		/// <returns><c>false</c> at the end of the capture, a record cut short by a crash is the end too.</returns>
+		public bool Read(out IOCardCapture.Record record)
+		{
+			record = new IOCardCapture.Record();
+			int direction = mStream.ReadByte();
+			long delta, length;
+			if (direction < 0 || !_getVarint(out delta) || !_getVarint(out length) || length > int.MaxValue)
+				return false;
+
+			var data = new byte[length];
+			if (!_readFully(data, data.Length))
+				return false;
+
+			mTime += delta;
+			record.Direction = (IOCardCapture.Direction)direction;
+			record.Time = mTime;
+			record.Data = data;
+			return true;
+		}
+
+		/// <summary>
+		/// every record left in the capture.
+		/// </summary>
+		public IEnumerable<IOCardCapture.Record> Records()
+		{
+			IOCardCapture.Record record;
+			while (Read(out record))
+				yield return record;
+		}
+
+		bool _getVarint(out long value)
+		{
+			value = 0;
+			for (int shift = 0; shift < 64; shift += 7)
+			{
+				int b = mStream.ReadByte();
+				if (b < 0)
+					return false;
+				value |= (long)(b & 0x7F) << shift;
+				if ((b & 0x80) == 0)
+					return true;
+			}
+			return false;
+		}
+
+		bool _readFully(byte[] buffer, int count)
+		{
+			int offset = 0;
+			while (offset < count)
+			{
+				int read = mStream.Read(buffer, offset, count - offset);
+				if (read <= 0)
+					return false;
+				offset += read;
+			}
+			return true;
+		}
+
+		readonly Stream mStream;
+		long mTime;
+	}
+}
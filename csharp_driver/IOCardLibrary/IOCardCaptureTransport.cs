@@ -0,0 +1,268 @@
+using System;
+using System.Diagnostics;
+using System.Threading;
+using CommandMessenger.Transport;
+
+namespace Spark.Slot.IO
+{
+	/// <summary>
+	/// Passes everything through to another transport, and writes what goes either way into a capture.
+	/// </summary>
+	public class IOCardRecordingTransport : ITransport
+	{
+		/// <param name="transport">the transport doing the real work, disposed with this one.</param>
+		/// <param name="writer">where the traffic goes, disposed with this one.</param>
+		public IOCardRecordingTransport(ITransport transport, IOCardCaptureWriter writer)
+		{
+			mTransport = transport;
+			mWriter = writer;
+			mTransport.DataReceived += Transport_DataReceived;
+		}
+
+		public void Dispose()
+		{
+			mTransport.DataReceived -= Transport_DataReceived;
+			mTransport.Dispose();
+			mWriter.Dispose();
+		}
+
+		public IOCardCaptureWriter Writer { get { return mWriter; } }
+
+		public bool Connect() { return mTransport.Connect(); }
+		public bool Disconnect() { return mTransport.Disconnect(); }
+		public bool IsConnected() { return mTransport.IsConnected(); }
+		public bool IsSaturated() { return mTransport.IsSaturated(); }
+
+		public byte[] Read()
+		{
+			var data = mTransport.Read();
+			if (data != null && data.Length != 0)
+				mWriter.Write(IOCardCapture.Direction.FromCard, data, 0, data.Length);
+			return data;
+		}
+
+		public void Write(byte[] buffer)
+		{
+			mWriter.Write(IOCardCapture.Direction.ToCard, buffer, 0, buffer.Length);
+			mTransport.Write(buffer);
+		}
+
+		public event EventHandler DataReceived;
+
+		void Transport_DataReceived(object sender, EventArgs e)
+		{
+			var handler = DataReceived;
+			if (handler != null)
+				handler(this, e);
+		}
+
+		readonly ITransport mTransport;
+		readonly IOCardCaptureWriter mWriter;
+	}
+
+	/// <summary>
+	/// Plays what the card sent in a capture, for <see cref="IOCard.Connect(ITransport)"/>, so the driver parses the
+	/// exact same stream again.
+	/// </summary>
+	/// <remarks>
+	/// What the host sends is thrown away, the card's side of the capture doesn't depend on it. Played as fast as
+	/// possible the reads are held back while the driver hasn't taken the previous ones, so it measures the driver and
+	/// not the memory.
+	/// </remarks>
+	public class IOCardReplayTransport : ITransport
+	{
+		/// <summary>
+		/// most bytes waiting for the driver when playing as fast as possible.
+		/// </summary>
+		public const int MAX_PENDING = 4096;
+
+		/// <param name="reader">the capture, disposed with this transport.</param>
+		/// <param name="speed">
+		/// 1.0 plays at the pace it was captured, 2.0 twice as fast, and so on. 0 plays as fast as the driver takes
+		/// it.
+		/// </param>
+		public IOCardReplayTransport(IOCardCaptureReader reader, double speed = 0)
+		{
+			mReader = reader;
+			mSpeed = speed;
+		}
+
+		public void Dispose()
+		{
+			Disconnect();
+			mReader.Dispose();
+		}
+
+		/// <summary>
+		/// fired on the replay thread once the whole capture is played, and the driver took all of it.
+		/// </summary>
+		public event EventHandler OnCompleted;
+
+		/// <summary>
+		/// <c>true</c> once the whole capture is played.
+		/// </summary>
+		public bool IsCompleted { get { lock (mLock) return mCompleted; } }
+
+		/// <summary>
+		/// bytes the driver took so far.
+		/// </summary>
+		public long BytesPlayed { get { lock (mLock) return mBytesPlayed; } }
+
+		/// <summary>
+		/// frames played so far, counted by their terminators, see <see cref="IOCard.WaitForFrames"/>.
+		/// </summary>
+		public long FramesPlayed { get { lock (mLock) return mFramesPlayed; } }
+
+		/// <summary>
+		/// bytes the driver sent, thrown away.
+		/// </summary>
+		public long BytesWritten { get { return Interlocked.Read(ref mBytesWritten); } }
+
+		/// <summary>
+		/// time since the replay started, in microseconds, up to <see cref="Disconnect"/>. Read it once the driver's
+		/// handled the last frame, <see cref="IOCard.WaitForFrames"/>, the capture's completed before that.
+		/// </summary>
+		public long Elapsed { get { return mStopwatch.ElapsedTicks * 1000000L / Stopwatch.Frequency; } }
+
+		/// <summary>
+		/// blocks until the whole capture is played.
+		/// </summary>
+		/// <returns><c>false</c> if it timed out.</returns>
+		public bool WaitForCompletion(int millisecondsTimeout = Timeout.Infinite)
+		{
+			return mCompletedEvent.WaitOne(millisecondsTimeout);
+		}
+
+		public bool Connect()
+		{
+			lock (mLock)
+			{
+				if (mThread != null)
+					return true;
+				mRunning = true;
+				mStopwatch.Start();
+				mThread = new Thread(_play) { IsBackground = true, Name = "IOCardReplay" };
+				mThread.Start();
+				return true;
+			}
+		}
+
+		public bool Disconnect()
+		{
+			Thread thread;
+			lock (mLock)
+			{
+				thread = mThread;
+				mThread = null;
+				mRunning = false;
+				mStopwatch.Stop();
+				Monitor.PulseAll(mLock);
+			}
+			if (thread != null && thread != Thread.CurrentThread)
+				thread.Join();
+			return true;
+		}
+
+		public bool IsConnected() { lock (mLock) return mThread != null; }
+		public bool IsSaturated() { return false; }
+
+		public byte[] Read()
+		{
+			lock (mLock)
+			{
+				if (mPendingLength == 0)
+					return new byte[0];
+				var data = new byte[mPendingLength];
+				Array.Copy(mPending, data, mPendingLength);
+				mBytesPlayed += mPendingLength;
+				mPendingLength = 0;
+				Monitor.PulseAll(mLock);
+				return data;
+			}
+		}
+
+		public void Write(byte[] buffer)
+		{
+			Interlocked.Add(ref mBytesWritten, buffer.Length);
+		}
+
+		public event EventHandler DataReceived;
+
+		void _play()
+		{
+			foreach (var record in mReader.Records())
+			{
+				if (record.Direction != IOCardCapture.Direction.FromCard)
+					continue;
+
+				lock (mLock)
+				{
+					if (mSpeed > 0)
+					{
+						// reads wake us up too, wait until it's really due.
+						var due = (long)(record.Time / mSpeed);
+						long wait;
+						while (mRunning && (wait = (due - Elapsed) / 1000) > 0)
+							Monitor.Wait(mLock, (int)Math.Min(wait, int.MaxValue));
+					}
+					while (mRunning && mSpeed <= 0 && mPendingLength >= MAX_PENDING)
+						Monitor.Wait(mLock);
+					if (!mRunning)
+						return;
+					if (mPending.Length < mPendingLength + record.Data.Length)
+						Array.Resize(ref mPending, Math.Max(mPending.Length * 2, mPendingLength + record.Data.Length));
+					Array.Copy(record.Data, 0, mPending, mPendingLength, record.Data.Length);
+					mPendingLength += record.Data.Length;
+					_count(record.Data);
+				}
+
+				var handler = DataReceived;
+				if (handler != null)
+					handler(this, EventArgs.Empty);
+			}
+
+			// let the driver take the rest before telling it's over.
+			lock (mLock)
+			{
+				while (mRunning && mPendingLength != 0)
+					Monitor.Wait(mLock);
+				if (!mRunning)
+					return;
+				mCompleted = true;
+			}
+			mCompletedEvent.Set();
+			var completed = OnCompleted;
+			if (completed != null)
+				completed(this, EventArgs.Empty);
+		}
+
+		// follows the escapes like CmdMessenger does, under mLock.
+		void _count(byte[] data)
+		{
+			foreach (var b in data)
+			{
+				if (mEscaped)
+					mEscaped = false;
+				else if (b == IOCardDirectLink.ESCAPE)
+					mEscaped = true;
+				else if (b == IOCardDirectLink.COMMAND_SEPARATOR)
+					++mFramesPlayed;
+			}
+		}
+
+		readonly IOCardCaptureReader mReader;
+		readonly double mSpeed;
+		readonly object mLock = new object();
+		readonly Stopwatch mStopwatch = new Stopwatch();
+		readonly ManualResetEvent mCompletedEvent = new ManualResetEvent(false);
+		Thread mThread;
+		bool mRunning;
+		bool mCompleted;
+		byte[] mPending = new byte[MAX_PENDING];
+		int mPendingLength;
+		long mBytesPlayed;
+		long mFramesPlayed;
+		bool mEscaped;
+		long mBytesWritten;
+	}
+}
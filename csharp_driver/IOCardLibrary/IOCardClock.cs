@@ -0,0 +1,237 @@
+﻿using System.Diagnostics;
+
+namespace Spark.Slot.IO
+{
+	/// <summary>
+	/// Maps the card's <c>micros()</c> to host time, and keeps the end-to-end latency statistics.
+	/// </summary>
+	/// <remarks>
+	/// Host time is a monotonic microsecond clock (<see cref="Now"/>), not wall clock time.
+	/// The mapping is estimated from SYNC_CLOCK ping/pong pairs: the device time is assumed to be taken right in the
+	/// middle of the round trip, and only the samples with the smallest round trip in the current window are trusted.
+	/// The skew between the two crystals is estimated from the trusted samples of consecutive windows.
+	/// </remarks>
+	public class IOCardClock
+	{
+		/// <summary>
+		/// Latency statistics, in microseconds.
+		/// </summary>
+		public struct LatencyStats
+		{
+			public long Count;
+			public long Min;
+			public long Max;
+			public long Last;
+			public long Total;
+			public double Average { get { return Count == 0 ? 0.0 : (double)Total / Count; } }
+		}
+
+		/// <summary>
+		/// number of ping/pong samples in a window, the one with smallest round trip wins.
+		/// </summary>
+		public const int SAMPLES_PER_WINDOW = 8;
+
+		/// <summary>
+		/// the current host time, in microseconds.
+		/// </summary>
+		/// <remarks>
+		/// the seconds and the fraction are scaled apart, <c>ticks * 1000000</c> overflows after ~2.5 hours of uptime
+		/// with a 1GHz <see cref="Stopwatch.Frequency"/>.
+		/// </remarks>
+		public static long Now
+		{
+			get
+			{
+				var ticks = Stopwatch.GetTimestamp();
+				var frequency = Stopwatch.Frequency;
+				return ticks / frequency * 1000000L + ticks % frequency * 1000000L / frequency;
+			}
+		}
+
+		/// <summary>
+		/// <c>true</c> if at least one window of samples is collected, and device time can be mapped.
+		/// </summary>
+		public bool IsSynchronized { get { lock (this) return mSynchronized; } }
+
+		/// <summary>
+		/// the smallest round trip of the last window, in microseconds.
+		/// </summary>
+		public long RoundTrip { get { lock (this) return mRoundTrip; } }
+
+		/// <summary>
+		/// estimated device clock rate relative to the host clock, 1.0 means they run at the same speed.
+		/// </summary>
+		public double Skew { get { lock (this) return mSkew; } }
+
+		/// <summary>
+		/// latency from the event happened on the card to it's been processed by the driver.
+		/// </summary>
+		public LatencyStats Latency { get { lock (this) return mLatency; } }
+
+		/// <summary>
+		/// reset the latency statistics.
+		/// </summary>
+		public void ResetLatency()
+		{
+			lock (this)
+				mLatency = new LatencyStats();
+		}
+
+		/// <summary>
+		/// reset everything, call this when the card reboots or reconnects.
+		/// </summary>
+		public void Reset()
+		{
+			lock (this)
+			{
+				mSynchronized = false;
+				mHasDevice = false;
+				mWindowCount = 0;
+				mBestRoundTrip = long.MaxValue;
+				mHasAnchor = false;
+				mSkew = 1.0;
+				mRoundTrip = 0;
+				mPings = 0;
+				mLatency = new LatencyStats();
+			}
+		}
+
+		/// <summary>
+		/// mark the start of a ping, returns the sequence number to be sent with the SYNC_CLOCK command.
+		/// </summary>
+		internal uint Ping()
+		{
+			lock (this)
+			{
+				++mPings;
+				mPingSequence = mPings;
+				mPingHost = Now;
+				return mPingSequence;
+			}
+		}
+
+		/// <summary>
+		/// feed a pong, returns <c>false</c> if it doesn't match the outstanding ping.
+		/// </summary>
+		internal bool Pong(uint sequence, uint device, long host)
+		{
+			lock (this)
+			{
+				if (sequence != mPingSequence)
+					return false;
+
+				var unwrapped = _unwrap(device);
+				var roundTrip = host - mPingHost;
+				if (roundTrip < mBestRoundTrip)
+				{
+					mBestRoundTrip = roundTrip;
+					mBestHost = mPingHost + roundTrip / 2;
+					mBestDevice = unwrapped;
+				}
+
+				if (++mWindowCount >= SAMPLES_PER_WINDOW)
+				{
+					if (mHasAnchor && mBestDevice != mAnchorDevice)
+					{
+						var skew = (double)(mBestHost - mAnchorHost) / (mBestDevice - mAnchorDevice);
+						// ceramic resonators are good to 0.5%, ignore anything crazier than that.
+						if (skew > 0.99 && skew < 1.01)
+							mSkew = skew;
+					}
+					mAnchorHost = mBestHost;
+					mAnchorDevice = mBestDevice;
+					mHasAnchor = true;
+					mRoundTrip = mBestRoundTrip;
+					mSynchronized = true;
+
+					mWindowCount = 0;
+					mBestRoundTrip = long.MaxValue;
+				}
+				return true;
+			}
+		}
+
+		/// <summary>
+		/// map the device time into host time, returns <c>false</c> if not synchronized yet.
+		/// </summary>
+		public bool TryToHost(uint device, out long host)
+		{
+			lock (this)
+			{
+				var unwrapped = _unwrap(device);
+				if (!mSynchronized)
+				{
+					host = 0;
+					return false;
+				}
+				host = mAnchorHost + (long)((unwrapped - mAnchorDevice) * mSkew);
+				return true;
+			}
+		}
+
+		/// <summary>
+		/// record an event, returns <c>false</c> if not synchronized yet, <paramref name="latency"/> is in microseconds.
+		/// </summary>
+		internal bool Record(uint device, long host, out long latency)
+		{
+			long happened;
+			if (!TryToHost(device, out happened))
+			{
+				latency = 0;
+				return false;
+			}
+
+			latency = host - happened;
+			lock (this)
+			{
+				if (mLatency.Count == 0 || latency < mLatency.Min)
+					mLatency.Min = latency;
+				if (mLatency.Count == 0 || latency > mLatency.Max)
+					mLatency.Max = latency;
+				mLatency.Last = latency;
+				mLatency.Total += latency;
+				++mLatency.Count;
+			}
+			return true;
+		}
+
+		// device micros() wraps every ~71 minutes, extend it to 64bits assuming the samples we got are never more
+		// than ~35 minutes apart.
+		long _unwrap(uint device)
+		{
+			if (!mHasDevice)
+			{
+				mHasDevice = true;
+				mLastDeviceRaw = device;
+				mLastDevice = device;
+				return mLastDevice;
+			}
+			var delta = (int)(device - mLastDeviceRaw);
+			mLastDeviceRaw = device;
+			mLastDevice += delta;
+			return mLastDevice;
+		}
+
+		bool mSynchronized;
+		bool mHasDevice;
+		uint mLastDeviceRaw;
+		long mLastDevice;
+
+		uint mPings;
+		uint mPingSequence;
+		long mPingHost;
+
+		int mWindowCount;
+		long mBestRoundTrip = long.MaxValue;
+		long mBestHost;
+		long mBestDevice;
+
+		bool mHasAnchor;
+		long mAnchorHost;
+		long mAnchorDevice;
+		double mSkew = 1.0;
+		long mRoundTrip;
+
+		LatencyStats mLatency;
+	}
+}
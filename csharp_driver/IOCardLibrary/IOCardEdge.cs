@@ -0,0 +1,113 @@
+using System.Threading;
+
+namespace Spark.Slot.IO
+{
+	/// <summary>
+	/// A key that changed or coins counted, see <see cref="IOCardStateCache.DrainEdges(IOCardEdge[], int, int)"/>.
+	/// </summary>
+	public struct IOCardEdge
+	{
+		public enum Kinds : byte
+		{
+			/// <summary>
+			/// key <see cref="Index"/> went to <see cref="Level"/>.
+			/// </summary>
+			Key = 0x00,
+			/// <summary>
+			/// <see cref="Coins"/> more coins on track <see cref="Index"/>, the counter is at <see cref="Counter"/> now.
+			/// </summary>
+			Coin = 0x01
+		}
+
+		public Kinds Kind;
+		/// <summary>
+		/// the key, numbered like <see cref="IOCardStateCache.GetKey(byte)"/>, or the track.
+		/// </summary>
+		public byte Index;
+		/// <summary>
+		/// <c>true</c> if the key is HIGH now, that's released, the keys are active LOW.
+		/// </summary>
+		public bool Level;
+		public uint Coins;
+		public uint Counter;
+		/// <summary>
+		/// the card's <c>micros()</c> when it happened. the keys changed in the same KEYS event have the same time.
+		/// </summary>
+		public uint DeviceMicros;
+		/// <summary>
+		/// when it happened on <see cref="IOCardClock.Now"/>, that's when it's been received less the latency if
+		/// the clock is synchronized.
+		/// </summary>
+		public long HostMicros;
+
+		public bool Pressed { get { return Kind == Kinds.Key && !Level; } }
+		public bool Released { get { return Kind == Kinds.Key && Level; } }
+	}
+
+	/// <summary>
+	/// Bounded ring of <see cref="IOCardEdge"/>, one thread adds and one thread takes, neither waits for the other.
+	/// When it's full the new edges are dropped and counted.
+	/// </summary>
+	public class IOCardEdgeRing
+	{
+		/// <param name="capacity">rounded up to a power of 2.</param>
+		public IOCardEdgeRing(int capacity)
+		{
+			if (capacity <= 0)
+				throw new System.ArgumentOutOfRangeException("capacity");
+			int size = 1;
+			while (size < capacity)
+				size <<= 1;
+			mEdges = new IOCardEdge[size];
+			mMask = size - 1;
+		}
+
+		public int Capacity { get { return mEdges.Length; } }
+		public int Count { get { return Volatile.Read(ref mTail) - Volatile.Read(ref mHead); } }
+
+		/// <summary>
+		/// edges dropped because the ring was full.
+		/// </summary>
+		public long Dropped { get { return Interlocked.Read(ref mDropped); } }
+
+		/// <summary>
+		/// adds an edge, from the producing thread only.
+		/// </summary>
+		/// <returns><c>false</c> if the ring is full, the edge is dropped.</returns>
+		public bool Add(ref IOCardEdge edge)
+		{
+			// the counters wrap around, the difference is still right.
+			var tail = mTail;
+			if (tail - Volatile.Read(ref mHead) == mEdges.Length)
+			{
+				Interlocked.Increment(ref mDropped);
+				return false;
+			}
+			mEdges[tail & mMask] = edge;
+			Volatile.Write(ref mTail, tail + 1);
+			return true;
+		}
+
+		/// <summary>
+		/// moves up to <paramref name="count"/> edges into <paramref name="buffer"/>, oldest first, from the consuming
+		/// thread only.
+		/// </summary>
+		/// <returns>the number of edges moved.</returns>
+		public int Drain(IOCardEdge[] buffer, int offset, int count)
+		{
+			var head = mHead;
+			var available = Volatile.Read(ref mTail) - head;
+			var drained = System.Math.Min(count, available);
+			for (int i = 0; i < drained; ++i)
+				buffer[offset + i] = mEdges[(head + i) & mMask];
+			Volatile.Write(ref mHead, head + drained);
+			return drained;
+		}
+
+		readonly IOCardEdge[] mEdges;
+		readonly int mMask;
+		int mHead;
+		int mTail;
+		long mDropped;
+	}
+}
@@ -0,0 +1,169 @@
+namespace Spark.Slot.IO
+{
+	/// <summary>
+	/// An event from the card as a value, for <see cref="IOCard.PollEvents(IOCardEvent[], int, int)"/>. Nothing in
+	/// it lives on the heap, so queuing and draining them allocates nothing.
+	/// </summary>
+	/// <remarks>
+	/// Only the events a game handles all the time are queued, the others still go through the <c>IOCard.On*</c>
+	/// events.
+	/// </remarks>
+	public struct IOCardEvent
+	{
+		public enum Kinds : byte
+		{
+			None = 0x00,
+			/// <summary>
+			/// KEYS, <see cref="KeyBytes"/> and <see cref="GetKeyByte(int)"/>.
+			/// </summary>
+			Keys = 0x01,
+			/// <summary>
+			/// COIN_COUNTER_RESULT, <see cref="Track"/> and <see cref="Coins"/>.
+			/// </summary>
+			CoinCounter = 0x02,
+			/// <summary>
+			/// EJECT_RESULT, <see cref="Track"/>, <see cref="RequestId"/>, <see cref="Requested"/> and
+			/// <see cref="Remaining"/>.
+			/// </summary>
+			Eject = 0x03,
+			/// <summary>
+			/// ERROR, <see cref="Error"/>, and <see cref="Track"/> for the errors about a track.
+			/// </summary>
+			Error = 0x04,
+			/// <summary>
+			/// BOOT, the card rebooted.
+			/// </summary>
+			Boot = 0x05
+		}
+
+		/// <summary>
+		/// the chain is never longer than this, see IO_CHAIN_LENGTH in the firmware.
+		/// </summary>
+		public const int MAX_KEY_BYTES = 8;
+
+		public Kinds Kind;
+		/// <summary>
+		/// the card it came from, its index in the <see cref="IOCardHub"/>, 0 for a card on its own.
+		/// </summary>
+		public byte Card;
+		/// <summary>
+		/// same as <see cref="IOCard.EventArgs.TimeStamp"/>.
+		/// </summary>
+		public long TimeStamp;
+		/// <summary>
+		/// the card's <c>micros()</c> when the event happened, 0 for <see cref="Kinds.Boot"/>.
+		/// </summary>
+		public uint DeviceMicros;
+		/// <summary>
+		/// same as <see cref="IOCard.EventArgs.HasLatency"/>.
+		/// </summary>
+		public bool HasLatency;
+		/// <summary>
+		/// microseconds from the event happened on the card to it's been processed by the driver, valid only if
+		/// <see cref="HasLatency"/>.
+		/// </summary>
+		public long Latency;
+
+		public byte Track;
+		public uint Coins;
+		public byte RequestId;
+		public byte Requested;
+		public byte Remaining;
+		public IOCard.Errors Error;
+
+		/// <summary>
+		/// number of 74HC165 bytes in <see cref="Keys"/>.
+		/// </summary>
+		public byte KeyBytes;
+		/// <summary>
+		/// the chain, byte N in bits <c>8 * N</c> to <c>8 * N + 7</c>.
+		/// </summary>
+		public ulong Keys;
+
+		public bool Completed { get { return Remaining == 0; } }
+
+		public byte GetKeyByte(int index)
+		{
+			return (byte)(Keys >> (index * 8));
+		}
+
+		/// <summary>
+		/// the level of a key, numbered like <see cref="IOCardStateCache.GetKey(byte)"/>.
+		/// </summary>
+		public bool GetKey(int key)
+		{
+			return (Keys & (1UL << key)) != 0;
+		}
+	}
+
+	/// <summary>
+	/// Fixed size ring of <see cref="IOCardEvent"/>, filled by the messenger's thread and drained by the game's.
+	/// When it's full the oldest event is dropped, a KEYS or a COIN_COUNTER_RESULT carries the whole state so the
+	/// newer one is worth more.
+	/// </summary>
+	public class IOCardEventQueue
+	{
+		public IOCardEventQueue(int capacity)
+		{
+			if (capacity <= 0)
+				throw new System.ArgumentOutOfRangeException("capacity");
+			mEvents = new IOCardEvent[capacity];
+		}
+
+		public int Capacity { get { return mEvents.Length; } }
+		public int Count { get { lock (mEvents) return mCount; } }
+
+		/// <summary>
+		/// events dropped because the queue was full.
+		/// </summary>
+		public long Dropped { get { lock (mEvents) return mDropped; } }
+
+		public void Enqueue(ref IOCardEvent e)
+		{
+			lock (mEvents)
+			{
+				if (mCount == mEvents.Length)
+				{
+					mHead = (mHead + 1) % mEvents.Length;
+					--mCount;
+					++mDropped;
+				}
+				mEvents[(mHead + mCount) % mEvents.Length] = e;
+				++mCount;
+			}
+		}
+
+		/// <summary>
+		/// moves up to <paramref name="count"/> events into <paramref name="buffer"/>, oldest first.
+		/// </summary>
+		/// <returns>the number of events moved.</returns>
+		public int Drain(IOCardEvent[] buffer, int offset, int count)
+		{
+			lock (mEvents)
+			{
+				int drained = System.Math.Min(count, mCount);
+				for (int i = 0; i < drained; ++i)
+				{
+					buffer[offset + i] = mEvents[mHead];
+					mHead = (mHead + 1) % mEvents.Length;
+				}
+				mCount -= drained;
+				return drained;
+			}
+		}
+
+		public void Clear()
+		{
+			lock (mEvents)
+			{
+				mHead = 0;
+				mCount = 0;
+			}
+		}
+
+		readonly IOCardEvent[] mEvents;
+		int mHead;
+		int mCount;
+		long mDropped;
+	}
+}
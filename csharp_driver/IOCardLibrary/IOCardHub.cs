@@ -0,0 +1,660 @@
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.IO.Ports;
+using System.Runtime.InteropServices;
+using System.Threading;
+using System.Threading.Tasks;
+using CommandMessenger.Transport;
+
+namespace Spark.Slot.IO
+{
+	/// <summary>
+	/// Many cards in one process, a thread reads all their ports and their events are merged into one queue.
+	/// </summary>
+	/// <remarks>
+	/// <para>
+	/// A card connected on its own has a transport thread polling its port, and timers for
+	/// <see cref="IOCard.SyncInterval"/> and <see cref="IOCard.OutputFlushInterval"/>, and its messenger has a send and
+	/// a receive thread. The hub's one thread does all of that for all the cards added to it: it parses their frames and
+	/// runs their callbacks and events, and the commands are written by the thread sending them. Adding a card doesn't
+	/// add a thread.
+	/// </para>
+	/// <para>
+	/// On Linux the hub's thread sleeps in poll(2) on all the ports at once, until one of them has data or the next
+	/// SYNC_CLOCK or flush is due. Elsewhere each port has a read pending, the thread pool's I/O completion hands the
+	/// data to the hub's thread.
+	/// </para>
+	/// <para>
+	/// The cards' KEYS, COIN_COUNTER_RESULT, EJECT_RESULT, ERROR and BOOT go into <see cref="PollEvents(IOCardEvent[])"/>
+	/// in the order they came in, <see cref="IOCardEvent.Card"/> tells the card. Don't set
+	/// <see cref="IOCard.PollCapacity"/> of a card in the hub, it'd have its own queue again.
+	/// </para>
+	/// </remarks>
+	public class IOCardHub : IDisposable
+	{
+		/// <summary>
+		/// the cards are numbered with a byte.
+		/// </summary>
+		public const int MAX_CARDS = 256;
+		public const int DEFAULT_POLL_CAPACITY = 4096;
+
+		/// <param name="pollCapacity">size of the merged queue, see <see cref="IOCard.PollCapacity"/>.</param>
+		public IOCardHub(int pollCapacity = DEFAULT_POLL_CAPACITY)
+		{
+			mEvents = new IOCardEventQueue(pollCapacity);
+			if (IS_LINUX)
+			{
+				var pipe = new int[2];
+				if (pipe2(pipe, O_NONBLOCK | O_CLOEXEC) != 0)
+					throw new IOException("Can't create the hub's wake pipe, errno " + Marshal.GetLastWin32Error() + ".");
+				mWakeRead = pipe[0];
+				mWakeWrite = pipe[1];
+			}
+			mReactor = new Thread(_run) { Name = "IOCardHub", IsBackground = true };
+			mReactor.Start();
+		}
+
+		public void Dispose()
+		{
+			DisconnectAll();
+			mStopping = true;
+			_wake();
+			mReactor.Join();
+			mWake.Dispose();
+			if (mWakeRead >= 0)
+			{
+				close(mWakeRead);
+				close(mWakeWrite);
+			}
+		}
+
+		public int Count { get { lock (mCards) return mCards.Count; } }
+
+		public IOCard this[int card] { get { lock (mCards) return mCards[card].Card; } }
+
+		/// <summary>
+		/// Events dropped because nobody drained the merged queue in time.
+		/// </summary>
+		public long DroppedEvents { get { return mEvents.Dropped; } }
+
+		/// <summary>
+		/// Ports lost since the hub's been created, their cards are disconnected then, see <see cref="ResyncAsync"/>.
+		/// </summary>
+		public long LostPorts { get { return Interlocked.Read(ref mLostPorts); } }
+
+		/// <summary>
+		/// Adds a card, not connected yet.
+		/// </summary>
+		/// <param name="port">Port, ex. "COM10" on Windows, or "/dev/ttyUSB0" on Linux, or the emulator's pty.</param>
+		/// <returns>the card's index, its <see cref="IOCardEvent.Card"/>.</returns>
+		public int Add(string port, int baudrate)
+		{
+			lock (mCards)
+			{
+				if (mCards.Count == MAX_CARDS)
+					throw new InvalidOperationException("Too many cards.");
+				var card = new IOCard();
+				card.JoinHub((byte)mCards.Count, mEvents);
+				mCards.Add(new Entry { Card = card, PortName = port, Baudrate = baudrate });
+				return mCards.Count - 1;
+			}
+		}
+
+		/// <summary>
+		/// Connects a card and waits for it to answer GET_INFO, then asks for its keys so the merged queue starts with
+		/// them.
+		/// </summary>
+		/// <exception cref="System.InvalidOperationException">the port can't be opened or the card's already connected.</exception>
+		/// <exception cref="System.TimeoutException">the card didn't answer.</exception>
+		public async Task<IOCard.GetInfoResultEventArgs> ConnectAsync(int card, CancellationToken cancellationToken = default(CancellationToken))
+		{
+			Entry entry;
+			lock (mCards)
+				entry = mCards[card];
+
+			// opening a port can take a while, the cards are opened side by side.
+			await Task.Run(() => entry.Card.ConnectPort(new Port(this, entry)), cancellationToken).ConfigureAwait(false);
+
+			// a card just powered takes a moment to boot, GET_INFO is asked again until it's there.
+			for (int attempt = 1; ; ++attempt)
+			{
+				try
+				{
+					var info = await entry.Card.GetInfoAsync(cancellationToken).ConfigureAwait(false);
+					entry.Card.QueryGetKeys();
+					return info;
+				}
+				catch (TimeoutException)
+				{
+					if (attempt == BOOT_ATTEMPTS)
+						throw;
+				}
+			}
+		}
+		const int BOOT_ATTEMPTS = 3;
+
+		/// <summary>
+		/// Connects all the cards not connected yet, side by side.
+		/// </summary>
+		/// <returns>completes when all of them answered, faulted with the failures of the others.</returns>
+		public Task ConnectAllAsync(CancellationToken cancellationToken = default(CancellationToken))
+		{
+			var connecting = new List<Task>();
+			for (int card = 0; card < Count; ++card)
+			{
+				if (!this[card].IsConnected)
+					connecting.Add(ConnectAsync(card, cancellationToken));
+			}
+			return Task.WhenAll(connecting);
+		}
+
+		/// <summary>
+		/// Connects a card again, after its port's been lost or the card rebooted.
+		/// </summary>
+		public Task<IOCard.GetInfoResultEventArgs> ResyncAsync(int card, CancellationToken cancellationToken = default(CancellationToken))
+		{
+			var iocard = this[card];
+			if (iocard.IsConnected)
+				iocard.Disconnect();
+			return ConnectAsync(card, cancellationToken);
+		}
+
+		/// <summary>
+		/// <see cref="ResyncAsync"/> all the cards side by side.
+		/// </summary>
+		public Task ResyncAllAsync(CancellationToken cancellationToken = default(CancellationToken))
+		{
+			var resyncing = new Task[Count];
+			for (int card = 0; card < resyncing.Length; ++card)
+				resyncing[card] = ResyncAsync(card, cancellationToken);
+			return Task.WhenAll(resyncing);
+		}
+
+		public void DisconnectAll()
+		{
+			for (int card = 0; card < Count; ++card)
+			{
+				var iocard = this[card];
+				if (iocard.IsConnected)
+					iocard.Disconnect();
+			}
+		}
+
+		/// <summary>
+		/// same as <see cref="IOCard.PollEvents(IOCardEvent[], int, int)"/> for all the cards.
+		/// </summary>
+		public int PollEvents(IOCardEvent[] buffer, int offset, int count)
+		{
+			return mEvents.Drain(buffer, offset, count);
+		}
+
+		public int PollEvents(IOCardEvent[] buffer)
+		{
+			return PollEvents(buffer, 0, buffer.Length);
+		}
+
+		class Entry
+		{
+			public IOCard Card;
+			public string PortName;
+			public int Baudrate;
+		}
+
+		// the transport of a card in the hub, opens the port and writes to it, the reactor reads it and raises
+		// DataReceived on its thread.
+		class Port : ITransport
+		{
+			public Port(IOCardHub hub, Entry entry)
+			{
+				mHub = hub;
+				mEntry = entry;
+			}
+
+			public void Dispose()
+			{
+				Disconnect();
+			}
+
+			public bool Connect()
+			{
+				var serial = new SerialPort(mEntry.PortName, mEntry.Baudrate) { DtrEnable = false };
+				var fd = -1;
+				try
+				{
+					serial.Open();
+					// like CmdMessenger's SerialTransport, what the card sent before is stale.
+					serial.DiscardInBuffer();
+					// SerialPort can't be waited on, the reactor polls a descriptor of its own on the same tty, the
+					// settings are the tty's.
+					if (IS_LINUX && (fd = open(mEntry.PortName, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC)) < 0)
+						throw new IOException("Can't open " + mEntry.PortName + ", errno " + Marshal.GetLastWin32Error() + ".");
+				}
+				catch (Exception)
+				{
+					serial.Dispose();
+					return false;
+				}
+				lock (mLock)
+				{
+					mSerial = serial;
+					mFd = fd;
+					mPendingLength = 0;
+				}
+				// like the card's own timers, the intervals are taken when it connects, the first SYNC_CLOCK right away.
+				var now = _now();
+				mSyncInterval = mEntry.Card.SyncInterval;
+				mNextSync = now;
+				mFlushInterval = mEntry.Card.OutputFlushInterval;
+				mNextFlush = now + mFlushInterval;
+				mHub._register(this);
+				if (!IS_LINUX)
+					_beginRead(serial);
+				return true;
+			}
+
+			public bool Disconnect()
+			{
+				mHub._unregister(this);
+				_close();
+				return true;
+			}
+
+			public bool IsConnected()
+			{
+				lock (mLock)
+					return mSerial != null;
+			}
+
+			public bool IsSaturated() { return false; }
+
+			// the reactor's descriptor, -1 once it's closed.
+			public int Fd { get { lock (mLock) return mFd; } }
+
+			public byte[] Read()
+			{
+				lock (mLock)
+				{
+					var data = new byte[mPendingLength];
+					Array.Copy(mPending, data, mPendingLength);
+					mPendingLength = 0;
+					return data;
+				}
+			}
+
+			public void Write(byte[] buffer)
+			{
+				lock (mWriteLock)
+				{
+					var serial = mSerial;
+					if (serial == null)
+						return;
+					try
+					{
+						serial.Write(buffer, 0, buffer.Length);
+					}
+					catch (Exception e)
+					{
+						if (!(e is IOException || e is InvalidOperationException || e is UnauthorizedAccessException || e is TimeoutException))
+							throw;
+						_lost();
+					}
+				}
+			}
+
+			public event EventHandler DataReceived;
+
+			// called by the reactor once poll(2) says the port's readable, or hung up.
+			public void ReadReady(byte[] buffer)
+			{
+				long count;
+				lock (mLock)
+				{
+					if (mFd < 0)
+						return;
+					count = (long)read(mFd, buffer, (UIntPtr)buffer.Length);
+					if (count > 0)
+						_append(buffer, (int)count);
+					else if (count < 0)
+					{
+						var errno = Marshal.GetLastWin32Error();
+						if (errno == EAGAIN || errno == EINTR)
+							return;
+					}
+				}
+				// nothing at all, or an error, the port's gone.
+				if (count <= 0)
+				{
+					_lost();
+					return;
+				}
+				Dispatch();
+			}
+
+			// called by the reactor, hands what came in to the card.
+			public void Dispatch()
+			{
+				lock (mLock)
+				{
+					if (mPendingLength == 0)
+						return;
+				}
+				var handler = DataReceived;
+				if (handler != null)
+					handler(this, EventArgs.Empty);
+			}
+
+			// called by the reactor, the card's SYNC_CLOCK and output flush when they're due. returns when the next one
+			// is, long.MaxValue if there's none.
+			public long Tick(long now)
+			{
+				var card = mEntry.Card;
+				var next = long.MaxValue;
+				if (mSyncInterval > 0)
+				{
+					// not connected yet, tried again in a millisecond.
+					if (now >= mNextSync)
+						mNextSync = card.QuerySyncClock() ? now + mSyncInterval : now + 1;
+					next = mNextSync;
+				}
+				if (mFlushInterval > 0)
+				{
+					if (now >= mNextFlush)
+					{
+						card.FlushOutputs();
+						mNextFlush = now + mFlushInterval;
+					}
+					next = Math.Min(next, mNextFlush);
+				}
+				return next;
+			}
+
+			// not on Linux, a read's always pending, it completes on the thread pool and hands the data to the reactor.
+			void _beginRead(SerialPort serial)
+			{
+				try
+				{
+					serial.BaseStream.BeginRead(mReadBuffer, 0, mReadBuffer.Length, _readDone, serial);
+				}
+				catch (Exception e)
+				{
+					if (!(e is IOException || e is InvalidOperationException || e is UnauthorizedAccessException))
+						throw;
+					if (serial == mSerial)
+						_lost();
+				}
+			}
+
+			void _readDone(IAsyncResult result)
+			{
+				var serial = (SerialPort)result.AsyncState;
+				int count;
+				try
+				{
+					count = serial.BaseStream.EndRead(result);
+				}
+				catch (Exception e)
+				{
+					if (!(e is IOException || e is InvalidOperationException || e is UnauthorizedAccessException))
+						throw;
+					// closed by Disconnect(), or lost.
+					if (serial == mSerial)
+						_lost();
+					return;
+				}
+				lock (mLock)
+				{
+					if (serial != mSerial)
+						return;
+					_append(mReadBuffer, count);
+				}
+				mHub._ready(this);
+				_beginRead(serial);
+			}
+
+			// under mLock.
+			void _append(byte[] buffer, int count)
+			{
+				if (mPending.Length < mPendingLength + count)
+					Array.Resize(ref mPending, Math.Max(mPending.Length * 2, mPendingLength + count));
+				Array.Copy(buffer, 0, mPending, mPendingLength, count);
+				mPendingLength += count;
+			}
+
+			// the port's gone (unplugged, the emulator's quit, ...), the card's disconnected.
+			void _lost()
+			{
+				if (!IsConnected())
+					return;
+				Interlocked.Increment(ref mHub.mLostPorts);
+				mHub._unregister(this);
+				_close();
+				ThreadPool.QueueUserWorkItem((state) => mEntry.Card.Disconnect());
+			}
+
+			void _close()
+			{
+				SerialPort serial;
+				int fd;
+				lock (mLock)
+				{
+					serial = mSerial;
+					mSerial = null;
+					fd = mFd;
+					mFd = -1;
+				}
+				if (fd >= 0)
+					close(fd);
+				if (serial != null)
+				{
+					try
+					{
+						serial.Close();
+					}
+					catch (IOException)
+					{
+					}
+				}
+			}
+
+			readonly IOCardHub mHub;
+			readonly Entry mEntry;
+			readonly object mLock = new object();
+			readonly object mWriteLock = new object();
+			volatile SerialPort mSerial;
+			int mFd = -1;
+			byte[] mPending = new byte[512];
+			int mPendingLength;
+			// only touched by the pending read.
+			readonly byte[] mReadBuffer = new byte[READ_BUFFER_SIZE];
+			// only touched by the reactor once it's registered.
+			int mSyncInterval;
+			long mNextSync;
+			int mFlushInterval;
+			long mNextFlush;
+			// in the reactor's ready queue, under its lock.
+			internal bool mQueued;
+		}
+
+		static long _now()
+		{
+			return IOCardClock.Now / 1000;
+		}
+
+		void _register(Port port)
+		{
+			lock (mPorts)
+			{
+				mPorts.Add(port);
+				mPortsSnapshot = mPorts.ToArray();
+			}
+			_wake();
+		}
+
+		// the reactor stops polling it on its next round.
+		void _unregister(Port port)
+		{
+			bool removed;
+			lock (mPorts)
+			{
+				removed = mPorts.Remove(port);
+				if (removed)
+					mPortsSnapshot = mPorts.ToArray();
+			}
+			if (removed)
+				_wake();
+		}
+
+		// a read's completed, not on Linux.
+		void _ready(Port port)
+		{
+			lock (mReady)
+			{
+				if (port.mQueued)
+					return;
+				port.mQueued = true;
+				mReady.Enqueue(port);
+			}
+			mWake.Set();
+		}
+
+		Port _nextReady()
+		{
+			lock (mReady)
+			{
+				if (mReady.Count == 0)
+					return null;
+				var port = mReady.Dequeue();
+				port.mQueued = false;
+				return port;
+			}
+		}
+
+		// the ports changed, or the hub's disposed.
+		void _wake()
+		{
+			if (mWakeWrite >= 0)
+				write(mWakeWrite, WAKE, (UIntPtr)1);
+			else
+				mWake.Set();
+		}
+
+		void _run()
+		{
+			var buffer = new byte[READ_BUFFER_SIZE];
+			var fds = new PollFd[1];
+			while (!mStopping)
+			{
+				var ports = mPortsSnapshot;
+				var now = _now();
+				var next = long.MaxValue;
+				foreach (var port in ports)
+					next = Math.Min(next, port.Tick(now));
+				// no timer, nothing to do until a port has data or the ports change.
+				var wait = next == long.MaxValue ? Timeout.Infinite : (int)Math.Min(Math.Max(0, next - now), int.MaxValue);
+
+				if (mWakeRead < 0)
+				{
+					mWake.WaitOne(wait);
+					Port ready;
+					while ((ready = _nextReady()) != null)
+						ready.Dispatch();
+					continue;
+				}
+
+				if (fds.Length < ports.Length + 1)
+					fds = new PollFd[ports.Length + 1];
+				fds[0] = new PollFd { fd = mWakeRead, events = POLLIN };
+				for (int i = 0; i < ports.Length; ++i)
+					fds[i + 1] = new PollFd { fd = ports[i].Fd, events = POLLIN };
+				// timed out, or interrupted.
+				if (poll(fds, (UIntPtr)(ports.Length + 1), wait) <= 0)
+					continue;
+				if (fds[0].revents != 0)
+				{
+					while ((long)read(mWakeRead, buffer, (UIntPtr)buffer.Length) > 0)
+					{
+					}
+				}
+				for (int i = 0; i < ports.Length; ++i)
+				{
+					if (fds[i + 1].revents != 0)
+						ports[i].ReadReady(buffer);
+				}
+			}
+		}
+		const int READ_BUFFER_SIZE = 4096;
+
+		#region Linux
+
+		static readonly bool IS_LINUX = _isLinux();
+
+		static bool _isLinux()
+		{
+			if (Environment.OSVersion.Platform != PlatformID.Unix)
+				return false;
+			// struct utsname, sysname comes first. Mono says Unix on a Mac too.
+			var name = new byte[8192];
+			try
+			{
+				if (uname(name) != 0)
+					return false;
+			}
+			catch (Exception e)
+			{
+				if (!(e is DllNotFoundException || e is EntryPointNotFoundException))
+					throw;
+				return false;
+			}
+			return name[0] == 'L' && name[1] == 'i' && name[2] == 'n' && name[3] == 'u' && name[4] == 'x' && name[5] == 0;
+		}
+
+		[StructLayout(LayoutKind.Sequential)]
+		struct PollFd
+		{
+			public int fd;
+			public short events;
+			public short revents;
+		}
+
+		const short POLLIN = 0x001;
+		const int O_RDWR = 0x0002;
+		const int O_NOCTTY = 0x0100;
+		const int O_NONBLOCK = 0x0800;
+		const int O_CLOEXEC = 0x80000;
+		const int EINTR = 4;
+		const int EAGAIN = 11;
+
+		[DllImport("libc")]
+		static extern int uname(byte[] name);
+		[DllImport("libc", SetLastError = true)]
+		static extern int open(string path, int flags);
+		[DllImport("libc", SetLastError = true)]
+		static extern int close(int fd);
+		[DllImport("libc", SetLastError = true)]
+		static extern int pipe2(int[] fds, int flags);
+		[DllImport("libc", SetLastError = true)]
+		static extern IntPtr read(int fd, byte[] buffer, UIntPtr count);
+		[DllImport("libc", SetLastError = true)]
+		static extern IntPtr write(int fd, byte[] buffer, UIntPtr count);
+		[DllImport("libc", SetLastError = true)]
+		static extern int poll([In, Out] PollFd[] fds, UIntPtr count, int timeout);
+
+		static readonly byte[] WAKE = { 1 };
+
+		#endregion
+
+		readonly List<Entry> mCards = new List<Entry>();
+		readonly List<Port> mPorts = new List<Port>();
+		volatile Port[] mPortsSnapshot = new Port[0];
+		readonly Queue<Port> mReady = new Queue<Port>();
+		readonly IOCardEventQueue mEvents;
+		readonly Thread mReactor;
+		readonly AutoResetEvent mWake = new AutoResetEvent(false);
+		// the reactor's wake pipe, on Linux.
+		readonly int mWakeRead = -1;
+		readonly int mWakeWrite = -1;
+		volatile bool mStopping;
+		long mLostPorts;
+	}
+}
@@ -0,0 +1,469 @@
+using System;
+using System.Text;
+using System.Threading;
+using CommandMessenger;
+using CommandMessenger.Transport;
+
+namespace Spark.Slot.IO
+{
+	// a frame from the card, as the callbacks read it: parsed by CmdMessenger for a card on its own, or by
+	// IOCardDirectLink for a card in an IOCardHub.
+	internal abstract class IOCardFrame
+	{
+		public abstract int CmdId { get; }
+		// milliseconds since 1970 UTC, like CmdMessenger's.
+		public abstract long TimeStamp { get; }
+		public abstract string RawString { get; }
+		// CmdMessenger's command, null for a frame the hub decoded.
+		public abstract ReceivedCommand Command { get; }
+
+		public abstract byte ReadBinByteArg();
+		public abstract bool ReadBinBoolArg();
+		public abstract ushort ReadBinUInt16Arg();
+		public abstract uint ReadBinUInt32Arg();
+		public abstract string ReadBinStringArg();
+	}
+
+	// a command for the card, handed to CmdMessenger, or written straight into the port for a card in an IOCardHub.
+	// the arguments are binary, like SendCommand.AddBinArgument().
+	internal sealed class IOCardCommand
+	{
+		public IOCardCommand(int id)
+		{
+			mId = id;
+		}
+
+		public int CmdId { get { return mId; } }
+
+		public void AddBinArgument(byte value) { _add(1, value); }
+		public void AddBinArgument(bool value) { _add(0, value ? 1u : 0u); }
+		public void AddBinArgument(ushort value) { _add(2, value); }
+		public void AddBinArgument(uint value) { _add(4, value); }
+
+		// the same command for CmdMessenger's queue.
+		public SendCommand ToSendCommand()
+		{
+			var cmd = new SendCommand(mId);
+			for (int i = 0; i < mCount; ++i)
+			{
+				switch (mSizes[i])
+				{
+					case 0:
+						cmd.AddBinArgument(mValues[i] != 0);
+						break;
+					case 1:
+						cmd.AddBinArgument((byte)mValues[i]);
+						break;
+					case 2:
+						cmd.AddBinArgument((ushort)mValues[i]);
+						break;
+					default:
+						cmd.AddBinArgument(mValues[i]);
+						break;
+				}
+			}
+			return cmd;
+		}
+
+		// the frame as CmdMessenger writes it: the id in decimal, the arguments little-endian and escaped.
+		public byte[] Encode()
+		{
+			var frame = new byte[12 + mCount * 9];
+			var length = 0;
+			foreach (var c in mId.ToString(System.Globalization.CultureInfo.InvariantCulture))
+				frame[length++] = (byte)c;
+			for (int i = 0; i < mCount; ++i)
+			{
+				frame[length++] = IOCardDirectLink.FIELD_SEPARATOR;
+				var value = mValues[i];
+				for (int b = Math.Max((int)mSizes[i], 1); b > 0; --b, value >>= 8)
+				{
+					var v = (byte)value;
+					if (v == IOCardDirectLink.FIELD_SEPARATOR || v == IOCardDirectLink.COMMAND_SEPARATOR ||
+						v == IOCardDirectLink.ESCAPE || v == 0)
+						frame[length++] = IOCardDirectLink.ESCAPE;
+					frame[length++] = v;
+				}
+			}
+			frame[length++] = IOCardDirectLink.COMMAND_SEPARATOR;
+			Array.Resize(ref frame, length);
+			return frame;
+		}
+
+		// 0 is a bool, otherwise the size in bytes.
+		void _add(byte size, uint value)
+		{
+			if (mCount == mValues.Length)
+			{
+				Array.Resize(ref mValues, mCount * 2);
+				Array.Resize(ref mSizes, mCount * 2);
+			}
+			mSizes[mCount] = size;
+			mValues[mCount] = value;
+			++mCount;
+		}
+
+		readonly int mId;
+		byte[] mSizes = new byte[8];
+		uint[] mValues = new uint[8];
+		int mCount;
+	}
+
+	// how IOCard talks to the card.
+	internal abstract class IOCardLink
+	{
+		public abstract bool Connect();
+		public abstract bool Disconnect();
+		public abstract void Attach(int id, Action<IOCardFrame> callback);
+		// frames without a callback of their own.
+		public abstract void Attach(Action<IOCardFrame> callback);
+		public abstract void Send(IOCardCommand command, SendQueue queuePosition);
+
+		// frames whose callback has run, or that had none.
+		public long Handled { get { return Interlocked.Read(ref mHandled); } }
+
+		// blocks until that many frames are handled, false if it timed out.
+		public bool WaitHandled(long count, int millisecondsTimeout)
+		{
+			var deadline = Environment.TickCount + millisecondsTimeout;
+			lock (mHandledLock)
+			{
+				Interlocked.Exchange(ref mWaitingFor, count);
+				try
+				{
+					while (Handled < count)
+					{
+						var wait = millisecondsTimeout == Timeout.Infinite ? Timeout.Infinite : deadline - Environment.TickCount;
+						if (millisecondsTimeout != Timeout.Infinite && wait <= 0)
+							return false;
+						Monitor.Wait(mHandledLock, wait);
+					}
+					return true;
+				}
+				finally
+				{
+					Interlocked.Exchange(ref mWaitingFor, long.MaxValue);
+				}
+			}
+		}
+
+		// after the frame's callback, on the thread running it.
+		protected void _handled()
+		{
+			if (Interlocked.Increment(ref mHandled) < Interlocked.Read(ref mWaitingFor))
+				return;
+			lock (mHandledLock)
+				Monitor.PulseAll(mHandledLock);
+		}
+
+		long mHandled;
+		long mWaitingFor = long.MaxValue;
+		readonly object mHandledLock = new object();
+	}
+
+	// a card on its own: CmdMessenger's queues and threads.
+	internal sealed class IOCardMessengerLink : IOCardLink
+	{
+		public IOCardMessengerLink(ITransport transport)
+		{
+			mMessenger = new CmdMessenger(transport, 512);
+		}
+
+		public override bool Connect() { return mMessenger.Connect(); }
+		public override bool Disconnect() { return mMessenger.Disconnect(); }
+
+		public override void Attach(int id, Action<IOCardFrame> callback)
+		{
+			mMessenger.Attach(id, (receivedCommand) =>
+			{
+				callback(mFrame.Wrap(receivedCommand));
+				_handled();
+			});
+		}
+
+		public override void Attach(Action<IOCardFrame> callback)
+		{
+			mMessenger.Attach((receivedCommand) =>
+			{
+				callback(mFrame.Wrap(receivedCommand));
+				_handled();
+			});
+		}
+
+		public override void Send(IOCardCommand command, SendQueue queuePosition)
+		{
+			mMessenger.SendCommand(command.ToSendCommand(), queuePosition);
+		}
+
+		// the messenger runs the callbacks one at a time, on its thread.
+		sealed class Frame : IOCardFrame
+		{
+			public Frame Wrap(ReceivedCommand command)
+			{
+				mCommand = command;
+				return this;
+			}
+
+			public override int CmdId { get { return mCommand.CmdId; } }
+			public override long TimeStamp { get { return mCommand.TimeStamp; } }
+			public override string RawString { get { return mCommand.RawString; } }
+			public override ReceivedCommand Command { get { return mCommand; } }
+
+			public override byte ReadBinByteArg() { return mCommand.ReadBinByteArg(); }
+			public override bool ReadBinBoolArg() { return mCommand.ReadBinBoolArg(); }
+			public override ushort ReadBinUInt16Arg() { return mCommand.ReadBinUInt16Arg(); }
+			public override uint ReadBinUInt32Arg() { return mCommand.ReadBinUInt32Arg(); }
+			public override string ReadBinStringArg() { return mCommand.ReadBinStringArg(); }
+
+			ReceivedCommand mCommand;
+		}
+
+		readonly CmdMessenger mMessenger;
+		readonly Frame mFrame = new Frame();
+	}
+
+	// a card in an IOCardHub: the frames are decoded, and their callbacks run, on the thread raising the transport's
+	// DataReceived, the hub's. the commands are written straight into the transport by the thread sending them. no
+	// thread or queue of its own.
+	internal sealed class IOCardDirectLink : IOCardLink
+	{
+		// CmdMessenger's defaults, what the firmware uses.
+		internal const byte FIELD_SEPARATOR = (byte)',';
+		internal const byte COMMAND_SEPARATOR = (byte)';';
+		internal const byte ESCAPE = (byte)'/';
+
+		// longer frames are dropped, like CmdMessenger's buffer.
+		public const int MAX_FRAME_LENGTH = 512;
+		const int MAX_FIELDS = MAX_FRAME_LENGTH / 2 + 1;
+
+		public IOCardDirectLink(ITransport transport)
+		{
+			mTransport = transport;
+		}
+
+		public override bool Connect()
+		{
+			mFrame.Reset();
+			mTransport.DataReceived += Transport_DataReceived;
+			if (mTransport.Connect())
+				return true;
+			mTransport.DataReceived -= Transport_DataReceived;
+			return false;
+		}
+
+		public override bool Disconnect()
+		{
+			mTransport.DataReceived -= Transport_DataReceived;
+			return mTransport.Disconnect();
+		}
+
+		// the ids are bytes, a callback is attached while frames may already come in, no lock needed.
+		public override void Attach(int id, Action<IOCardFrame> callback)
+		{
+			mCallbacks[id & 0xFF] = callback;
+		}
+
+		public override void Attach(Action<IOCardFrame> callback)
+		{
+			mDefaultCallback = callback;
+		}
+
+		// there's no queue, so the position doesn't matter, the command's written right away.
+		public override void Send(IOCardCommand command, SendQueue queuePosition)
+		{
+			var frame = command.Encode();
+			lock (mWriteLock)
+				mTransport.Write(frame);
+		}
+
+		void Transport_DataReceived(object sender, EventArgs e)
+		{
+			var data = mTransport.Read();
+			if (data == null)
+				return;
+			foreach (var b in data)
+			{
+				if (mFrame.Push(b))
+				{
+					var id = mFrame.Complete();
+					var callback = id >= 0 && id <= 0xFF ? mCallbacks[id] : null;
+					if (callback == null)
+						callback = mDefaultCallback;
+					if (callback != null)
+						callback(mFrame);
+					mFrame.Reset();
+					_handled();
+				}
+			}
+		}
+
+		// the frame being received, and read by the callback once it's complete.
+		sealed class Frame : IOCardFrame
+		{
+			public void Reset()
+			{
+				mLength = 0;
+				mRawLength = 0;
+				mFields = 0;
+				mFieldStart = 0;
+				mEscaped = false;
+				mOverflow = false;
+			}
+
+			// true once the byte ends the frame.
+			public bool Push(byte b)
+			{
+				if (mRawLength < MAX_FRAME_LENGTH)
+					mRaw[mRawLength++] = b;
+				else
+					mOverflow = true;
+
+				if (mEscaped)
+				{
+					mEscaped = false;
+					_append(b);
+					return false;
+				}
+				if (b == ESCAPE)
+				{
+					mEscaped = true;
+					return false;
+				}
+				if (b == FIELD_SEPARATOR)
+				{
+					_endField();
+					return false;
+				}
+				if (b == COMMAND_SEPARATOR)
+				{
+					_endField();
+					if (!mOverflow)
+						return true;
+					// too long, start over with the next one.
+					Reset();
+					return false;
+				}
+				_append(b);
+				return false;
+			}
+
+			// parses the id, -1 if it isn't one. the arguments are read from the start.
+			public int Complete()
+			{
+				mTimeStamp = (DateTime.UtcNow.Ticks - EPOCH_TICKS) / TimeSpan.TicksPerMillisecond;
+				mNext = 1;
+				mId = -1;
+				if (mFields == 0)
+					return mId;
+				var id = 0;
+				var digits = 0;
+				for (int i = mStarts[0]; i < mEnds[0]; ++i)
+				{
+					var c = mData[i];
+					// CmdMessenger trims the line breaks.
+					if (c == '\r' || c == '\n')
+						continue;
+					if (c < '0' || c > '9' || ++digits > 5)
+						return mId;
+					id = id * 10 + (c - '0');
+				}
+				if (digits != 0)
+					mId = id;
+				return mId;
+			}
+
+			public override int CmdId { get { return mId; } }
+			public override long TimeStamp { get { return mTimeStamp; } }
+			public override string RawString { get { return LATIN1.GetString(mRaw, 0, mRawLength); } }
+			public override ReceivedCommand Command { get { return null; } }
+
+			public override byte ReadBinByteArg()
+			{
+				int start;
+				return _next(1, out start) ? mData[start] : (byte)0;
+			}
+
+			public override bool ReadBinBoolArg()
+			{
+				return ReadBinByteArg() != 0;
+			}
+
+			public override ushort ReadBinUInt16Arg()
+			{
+				int start;
+				return _next(2, out start) ? (ushort)(mData[start] | mData[start + 1] << 8) : (ushort)0;
+			}
+
+			public override uint ReadBinUInt32Arg()
+			{
+				int start;
+				return _next(4, out start) ?
+					(uint)(mData[start] | mData[start + 1] << 8 | mData[start + 2] << 16 | mData[start + 3] << 24) : 0;
+			}
+
+			public override string ReadBinStringArg()
+			{
+				if (mNext >= mFields)
+					return null;
+				var field = mNext++;
+				return LATIN1.GetString(mData, mStarts[field], mEnds[field] - mStarts[field]);
+			}
+
+			// the next argument, if it's long enough. it's skipped anyway, like CmdMessenger does.
+			bool _next(int size, out int start)
+			{
+				start = 0;
+				if (mNext >= mFields)
+					return false;
+				var field = mNext++;
+				start = mStarts[field];
+				return mEnds[field] - start >= size;
+			}
+
+			void _append(byte b)
+			{
+				if (mLength < MAX_FRAME_LENGTH)
+					mData[mLength++] = b;
+				else
+					mOverflow = true;
+			}
+
+			void _endField()
+			{
+				if (mFields < MAX_FIELDS)
+				{
+					mStarts[mFields] = mFieldStart;
+					mEnds[mFields] = mLength;
+					++mFields;
+				}
+				else
+					mOverflow = true;
+				mFieldStart = mLength;
+			}
+
+			static readonly long EPOCH_TICKS = new DateTime(1970, 1, 1, 0, 0, 0, DateTimeKind.Utc).Ticks;
+			static readonly Encoding LATIN1 = Encoding.GetEncoding(28591);
+
+			// unescaped, the fields one after another.
+			readonly byte[] mData = new byte[MAX_FRAME_LENGTH];
+			readonly byte[] mRaw = new byte[MAX_FRAME_LENGTH];
+			readonly int[] mStarts = new int[MAX_FIELDS];
+			readonly int[] mEnds = new int[MAX_FIELDS];
+			int mLength;
+			int mRawLength;
+			int mFields;
+			int mFieldStart;
+			bool mEscaped;
+			bool mOverflow;
+			int mId;
+			int mNext;
+			long mTimeStamp;
+		}
+
+		readonly ITransport mTransport;
+		readonly object mWriteLock = new object();
+		readonly Action<IOCardFrame>[] mCallbacks = new Action<IOCardFrame>[256];
+		volatile Action<IOCardFrame> mDefaultCallback;
+		readonly Frame mFrame = new Frame();
+	}
+}
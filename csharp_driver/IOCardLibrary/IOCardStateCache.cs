@@ -1,10 +1,19 @@
 ﻿using System;
 using System.Collections.Concurrent;
-using System.Collections.Generic;
 using System.Diagnostics;
+using System.Threading;
 
 namespace Spark.Slot.IO
 {
+	/// <summary>
+	/// Keeps the latest states of the card, for a game loop to look at once per frame.
+	/// </summary>
+	/// <remarks>
+	/// The card's events write the states into a back buffer and publish it with a single exchange, the reading side
+	/// picks the latest published one up, also with a single exchange, so neither side waits for the other and
+	/// nothing is allocated. There are three buffers so the writer always has one to itself.
+	/// All the getters and <see cref="Processed"/> must be called from one thread, the game's.
+	/// </remarks>
 	public class IOCardStateCache
 	{
 		public enum KeyState
@@ -15,6 +24,16 @@ namespace Spark.Slot.IO
 			StateNotAKey
 		};
 
+		/// <summary>
+		/// keys are numbered from 0 to <c>MAX_KEYS - 1</c>, 8 per byte of the chain.
+		/// </summary>
+		public const int MAX_KEYS = 64;
+
+		/// <summary>
+		/// coin counters are kept for the tracks from 0 to <c>MAX_TRACKS - 1</c>.
+		/// </summary>
+		public const int MAX_TRACKS = 8;
+
 		/// <summary>
 		/// The IO card object
 		/// </summary>
@@ -80,18 +99,43 @@ namespace Spark.Slot.IO
 		/// <value><c>true</c> if is error queue empty; otherwise, <c>false</c>.</value>
 		public bool IsErrorQueueEmpty { get { return mErrors.IsEmpty; } }
 
+		/// <summary>
+		/// The capacity of the edge queue, see <see cref="DrainEdges(IOCardEdge[], int, int)"/>. Defaults to 1024,
+		/// changing it drops what's queued.
+		/// </summary>
+		public int EdgeQueueCapacity
+		{
+			get { return mEdges.Capacity; }
+			set
+			{
+				lock (mState)
+					mEdges = new IOCardEdgeRing(value);
+			}
+		}
+		const int DEFAULT_EDGE_QUEUE_CAPACITY = 1024;
+
+		/// <summary>
+		/// The number of edges waiting in the edge queue.
+		/// </summary>
+		public int EdgeQueueCount { get { return mEdges.Count; } }
+
+		/// <summary>
+		/// Edges dropped because the edge queue was full, the game didn't drain it in time.
+		/// </summary>
+		public long DroppedEdges { get { return mEdges.Dropped; } }
+
 		/// <summary>
 		/// Gets the value indicating whether this <see cref="T:Spark.Slot.IO.IOCardStateCache"/> is changed.
 		/// </summary>
 		/// <value><c>true</c> if is changed; otherwise, <c>false</c>.</value>
-		public bool IsChanged { get; internal set; }
+		public bool IsChanged { get { return _front().Version != mProcessedVersion; } }
 
 		public string Manufacturer
 		{
 			get
 			{
-				lock (this)
-					return mGetInfoResultEventArgs == null ? null : mGetInfoResultEventArgs.Manufacturer;
+				var info = _front().Info;
+				return info == null ? null : info.Manufacturer;
 			}
 		}
 
@@ -99,8 +143,8 @@ namespace Spark.Slot.IO
 		{
 			get
 			{
-				lock (this)
-					return mGetInfoResultEventArgs == null ? null : mGetInfoResultEventArgs.Product;
+				var info = _front().Info;
+				return info == null ? null : info.Product;
 			}
 		}
 
@@ -108,8 +152,8 @@ namespace Spark.Slot.IO
 		{
 			get
 			{
-				lock (this)
-					return mGetInfoResultEventArgs == null ? null : mGetInfoResultEventArgs.Version;
+				var info = _front().Info;
+				return info == null ? null : info.Version;
 			}
 		}
 
@@ -117,13 +161,60 @@ namespace Spark.Slot.IO
 		{
 			get
 			{
-				lock (this)
-					return mGetInfoResultEventArgs == null ? -1L : mGetInfoResultEventArgs.ProtocolVersion;
+				var info = _front().Info;
+				return info == null ? -1L : info.ProtocolVersion;
 			}
 		}
 
+		/// <summary>
+		/// Number of 74HC165 bytes in the chain, 0 if unknown yet.
+		/// </summary>
+		public int KeyBytes { get { return _front().KeyBytes; } }
+
+		/// <summary>
+		/// The output masks, one byte per 74HC595 in the chain. <c>null</c> if unknown yet.
+		/// </summary>
+		public byte[] OutputMasks { get { return _front().OutputMasks; } }
+
+		/// <summary>
+		/// The level of every key, a bit per key numbered like <see cref="GetKey(byte)"/>, set when HIGH.
+		/// </summary>
+		public ulong KeyLevels { get { return _front().Levels; } }
+
+		/// <summary>
+		/// A bit set for every key the card has sent a level of, and that is a key according to its key masks.
+		/// </summary>
+		public ulong KnownKeys
+		{
+			get
+			{
+				var front = _front();
+				return front.Known & front.Keys;
+			}
+		}
+
+		/// <summary>
+		/// Keys pressed since the last <see cref="Processed"/>, the keys are active LOW so that's a key gone LOW.
+		/// </summary>
+		/// <remarks>
+		/// A key pressed and released again in between is in both <see cref="PressedKeys"/> and
+		/// <see cref="ReleasedKeys"/>.
+		/// </remarks>
+		public ulong PressedKeys { get { return _edges(false); } }
+
+		/// <summary>
+		/// Keys released since the last <see cref="Processed"/>, that's a key gone HIGH.
+		/// </summary>
+		public ulong ReleasedKeys { get { return _edges(true); } }
+
 		public IOCardStateCache(IOCard card = null, int error_capacity = DEFAULT_ERROR_QUEUE_CAPACITY)
 		{
+			for (int i = 0; i < mBuffers.Length; ++i)
+				mBuffers[i] = new Snapshot();
+			mState = new Snapshot();
+			mEdges = new IOCardEdgeRing(DEFAULT_EDGE_QUEUE_CAPACITY);
+			mMiddle = 1;
+			mFront = 2;
 			ErrorQueueCapacity = error_capacity;
 			Card = card;
 		}
@@ -143,17 +234,11 @@ namespace Spark.Slot.IO
 		/// <summary>
 		/// Gets the coin counter.
 		/// </summary>
-		/// <returns>The coin counter.</returns>
+		/// <returns>The coin counter, 0 if unknown or the track is out of range.</returns>
 		/// <param name="track">Track.</param>
 		public uint GetCoinCounter(byte track)
 		{
-			lock (mCoinCounters)
-			{
-				uint coins;
-				if (mCoinCounters.TryGetValue(track, out coins))
-					return coins;
-				return 0;
-			}
+			return track < MAX_TRACKS ? _front().CoinCounters[track] : 0;
 		}
 
 		/// <summary>
@@ -163,13 +248,34 @@ namespace Spark.Slot.IO
 		/// <param name="key">Key.</param>
 		public KeyState GetKey(byte key)
 		{
-			lock (mKeyStates)
-			{
-				KeyState state;
-				if (mKeyStates.TryGetValue(key, out state))
-					return state;
+			if (key >= MAX_KEYS)
 				return KeyState.StateUnknown;
-			}
+			var front = _front();
+			var bit = 1UL << key;
+			if ((front.Keys & bit) == 0)
+				return KeyState.StateNotAKey;
+			if ((front.Known & bit) == 0)
+				return KeyState.StateUnknown;
+			return (front.Levels & bit) != 0 ? KeyState.StateHigh : KeyState.StateLow;
+		}
+
+		/// <summary>
+		/// Moves the key edges and the coins counted since the last call into <paramref name="buffer"/>, oldest
+		/// first, so a key pressed and released between two frames is seen, and every coin is counted once.
+		/// </summary>
+		/// <returns>the number of edges moved.</returns>
+		/// <remarks>
+		/// Allocates nothing, call it once per frame with the same buffer, until it returns less than
+		/// <paramref name="count"/>. Unlike the states, the edges are not affected by <see cref="Processed"/>.
+		/// </remarks>
+		public int DrainEdges(IOCardEdge[] buffer, int offset, int count)
+		{
+			return mEdges.Drain(buffer, offset, count);
+		}
+
+		public int DrainEdges(IOCardEdge[] buffer)
+		{
+			return DrainEdges(buffer, 0, buffer.Length);
 		}
 
 		/// <summary>
@@ -177,17 +283,106 @@ namespace Spark.Slot.IO
 		/// </summary>
 		public void Processed()
 		{
-			IsChanged = false;
+			var front = _front();
+			mProcessedVersion = front.Version;
+			mProcessedLevels = front.Levels;
+			Buffer.BlockCopy(front.Toggles, 0, mProcessedToggles, 0, MAX_KEYS);
 		}
 
+		// everything the cache knows, a copy per buffer.
+		class Snapshot
+		{
+			public long Version;
+			public IOCard.GetInfoResultEventArgs Info;
+			public int KeyBytes;
+			public byte[] OutputMasks;
+			// bit N is key N, like GetKey()
+			public ulong Keys = ulong.MaxValue;
+			public ulong Known;
+			public ulong Levels;
+			// times every key changed, wraps around, only the difference is used.
+			public readonly byte[] Toggles = new byte[MAX_KEYS];
+			public readonly uint[] CoinCounters = new uint[MAX_TRACKS];
+
+			public void CopyTo(Snapshot other)
+			{
+				other.Version = Version;
+				other.Info = Info;
+				other.KeyBytes = KeyBytes;
+				other.OutputMasks = OutputMasks;
+				other.Keys = Keys;
+				other.Known = Known;
+				other.Levels = Levels;
+				Buffer.BlockCopy(Toggles, 0, other.Toggles, 0, MAX_KEYS);
+				Array.Copy(CoinCounters, other.CoinCounters, MAX_TRACKS);
+			}
+		}
+
+		// TRACK_EJECT ~ TRACK_BANKNOTE on the card
+		const byte CARD_TRACKS = 5;
+
+		// mMiddle holds the index of the buffer last published, FRESH is set until the reader picks it up.
+		const int INDEX = 0x03;
+		const int FRESH = 0x04;
+
 		IOCard mCard;
 		int mErrorQueueCapacity;
 
-		IOCard.GetInfoResultEventArgs mGetInfoResultEventArgs;
-		readonly Dictionary<byte, uint> mCoinCounters = new Dictionary<byte, uint>();
-		readonly Dictionary<byte, KeyState> mKeyStates = new Dictionary<byte, KeyState>();
+		readonly Snapshot[] mBuffers = new Snapshot[3];
+		// the writers' state, under mState's lock, copied into the back buffer on publish.
+		readonly Snapshot mState;
+		int mBack;
+		int mMiddle;
+		// the reader's.
+		int mFront;
+		long mProcessedVersion;
+		ulong mProcessedLevels;
+		readonly byte[] mProcessedToggles = new byte[MAX_KEYS];
+		// filled under mState's lock, so by one thread at a time.
+		volatile IOCardEdgeRing mEdges;
+		// coins counted per track, to tell how many a COIN_COUNTER_RESULT adds, -1 when unknown.
+		readonly long[] mLastCoins = { -1, -1, -1, -1, -1, -1, -1, -1 };
+
 		readonly ConcurrentQueue<IOCard.ErrorEventArgs> mErrors = new ConcurrentQueue<IOCard.ErrorEventArgs>();
 
+		Snapshot _front()
+		{
+			if ((Volatile.Read(ref mMiddle) & FRESH) != 0)
+				mFront = Interlocked.Exchange(ref mMiddle, mFront) & INDEX;
+			return mBuffers[mFront];
+		}
+
+		// called with mState locked.
+		void _publish()
+		{
+			++mState.Version;
+			mState.CopyTo(mBuffers[mBack]);
+			mBack = Interlocked.Exchange(ref mMiddle, mBack | FRESH) & INDEX;
+		}
+
+		static long _hostTime(IOCard.EventArgs e)
+		{
+			var now = IOCardClock.Now;
+			return e.HasLatency ? now - e.Latency : now;
+		}
+
+		ulong _edges(bool high)
+		{
+			var front = _front();
+			ulong edges = 0;
+			for (int i = 0; i < MAX_KEYS; ++i)
+			{
+				var toggles = (byte)(front.Toggles[i] - mProcessedToggles[i]);
+				if (toggles == 0)
+					continue;
+				// twice or more is both ways, once is where it is now.
+				var bit = 1UL << i;
+				if (toggles > 1 || ((front.Levels & bit) != 0) == high)
+					edges |= bit;
+			}
+			return edges & front.Keys;
+		}
+
 		void _detach()
 		{
 			mCard.OnConnected -= Card_OnConnected;
@@ -223,16 +418,25 @@ namespace Spark.Slot.IO
 			// query the card for initial states
 			mCard.QueryGetInfo();
 			mCard.QueryGetKeyMasks();
+			// the coins counted so far, so the next ones are edges.
+			for (byte track = 0; track < CARD_TRACKS; ++track)
+				mCard.QueryGetCoinCounter(track, CommandMessenger.SendQueue.AtEndQueue);
 		}
 
 		void Card_OnDisconnected(object sender, EventArgs e)
 		{
-			lock (this)
+			lock (mState)
 			{
-				// clears out everything
-				mGetInfoResultEventArgs = null;
-				mCoinCounters.Clear();
-				mKeyStates.Clear();
+				// clears out everything, but the toggles so no key looks pressed.
+				mState.Info = null;
+				mState.KeyBytes = 0;
+				mState.OutputMasks = null;
+				mState.Keys = ulong.MaxValue;
+				mState.Known = 0;
+				mState.Levels = 0;
+				Array.Clear(mState.CoinCounters, 0, MAX_TRACKS);
+				for (int i = 0; i < MAX_TRACKS; ++i)
+					mLastCoins[i] = -1;
 				if (!mErrors.IsEmpty)
 				{
 					Debug.WriteLine("{0} error(s) unprocessed before disconnect", mErrors.Count);
@@ -240,43 +444,57 @@ namespace Spark.Slot.IO
 					while (mErrors.TryDequeue(out error))
 						Debug.WriteLine("    {0}: error {1}", error.TimeStamp, error.ErrorCode);
 				}
-				IsChanged = true;
+				_publish();
 			}
 		}
 
 		void Card_OnKey(object sender, IOCard.KeysEventArgs e)
 		{
-			lock (mKeyStates)
+			ulong levels = 0;
+			var count = Math.Min(e.Keys.Length, MAX_KEYS / 8);
+			for (int i = 0; i < count; ++i)
+				levels |= (ulong)e.Keys[i] << (i * 8);
+			var known = count == MAX_KEYS / 8 ? ulong.MaxValue : (1UL << (count * 8)) - 1;
+
+			lock (mState)
 			{
-				for (int i = 0; i < e.Keys.Length; ++i)
+				// only the keys known before count as a change.
+				var changed = (mState.Levels ^ levels) & mState.Known & known;
+				var edge = new IOCardEdge
+				{
+					Kind = IOCardEdge.Kinds.Key,
+					DeviceMicros = e.DeviceMicros,
+					HostMicros = _hostTime(e)
+				};
+				for (int i = 0; changed != 0; ++i, changed >>= 1)
 				{
-					for (int b = 0; b < 8; ++b)
+					if ((changed & 1) != 0)
 					{
-						var index = (byte)(i * 8 + b);
-						if (!mKeyStates.ContainsKey(index) || mKeyStates[index] != KeyState.StateNotAKey)
-							mKeyStates[index] = (e.Keys[i] & (1 << b)) != 0 ? KeyState.StateHigh : KeyState.StateLow;
+						++mState.Toggles[i];
+						edge.Index = (byte)i;
+						edge.Level = (levels & (1UL << i)) != 0;
+						mEdges.Add(ref edge);
 					}
 				}
+				mState.Levels = (mState.Levels & ~known) | levels;
+				mState.Known |= known;
+				_publish();
 			}
-			lock (this)
-				IsChanged = true;
 		}
 
 		void Card_OnKeyMasks(object sender, IOCard.KeyMasksEventArgs e)
 		{
-			lock (mKeyStates)
+			ulong keys = 0;
+			for (int i = 0; i < e.KeyMasks.Length && i < MAX_KEYS / 8; ++i)
+				keys |= (ulong)e.KeyMasks[i] << (i * 8);
+
+			lock (mState)
 			{
-				for (int i = 0; i < e.KeyMasks.Length; ++i)
-				{
-					for (int b = 0; b < 8; ++b)
-					{
-						if ((e.KeyMasks[i] & (1 << b)) == 0)
-							mKeyStates[(byte)(i * 8 + b)] = KeyState.StateNotAKey;
-					}
-				}
+				mState.KeyBytes = e.KeyMasks.Length;
+				mState.OutputMasks = e.OutputMasks;
+				mState.Keys = keys;
+				_publish();
 			}
-			lock (this)
-				IsChanged = true;
 		}
 
 		void Card_OnDebug(object sender, IOCard.DebugEventArgs e)
@@ -293,29 +511,51 @@ namespace Spark.Slot.IO
 					Debug.WriteLine("{0}: error queue full, error {1} received on {2} dropped.", DateTime.Now, error.ErrorCode, error.DateTime);
 			}
 			mErrors.Enqueue(e);
-			lock (this)
-				IsChanged = true;
+			lock (mState)
+				_publish();
 		}
 
 		void Card_OnUnknown(object sender, IOCard.UnknownEventArgs e)
 		{
-			Debug.WriteLine("unknow event received: {0}, raw = {1}", e.Command.CmdId, e.Command.RawString);
+			Debug.WriteLine("unknow event received: {0}, raw = {1}", e.CommandId, e.RawString);
 		}
 
 		void Card_OnGetInfoResult(object sender, IOCard.GetInfoResultEventArgs e)
 		{
-			lock (this)
-				mGetInfoResultEventArgs = e;
-			lock (this)
-				IsChanged = true;
+			lock (mState)
+			{
+				mState.Info = e;
+				_publish();
+			}
 		}
 
 		void Card_OnCoinCounterResult(object sender, IOCard.CoinCounterResultEventArgs e)
 		{
-			lock (mCoinCounters)
-				mCoinCounters[e.Track] = e.Coins;
-			lock (this)
-				IsChanged = true;
+			if (e.Track >= MAX_TRACKS)
+				return;
+			lock (mState)
+			{
+				// GET_COIN_COUNTER replies too, only more coins are edges. less is a counter reset, what's there was
+				// counted since.
+				var last = mLastCoins[e.Track];
+				var coins = e.Coins >= last ? e.Coins - last : e.Coins;
+				if (last >= 0 && coins != 0)
+				{
+					var edge = new IOCardEdge
+					{
+						Kind = IOCardEdge.Kinds.Coin,
+						Index = e.Track,
+						Coins = (uint)coins,
+						Counter = e.Coins,
+						DeviceMicros = e.DeviceMicros,
+						HostMicros = _hostTime(e)
+					};
+					mEdges.Add(ref edge);
+				}
+				mLastCoins[e.Track] = e.Coins;
+				mState.CoinCounters[e.Track] = e.Coins;
+				_publish();
+			}
 		}
 	}
 }
@@ -0,0 +1,325 @@
+using System;
+
+namespace Spark.Slot.IO
+{
+	/// <summary>
+	/// Reads or writes a range of the card's storage with the STREAM_* commands, for backing up and restoring the whole
+	/// FRAM without a round trip per 64 bytes.
+	/// </summary>
+	/// <remarks>
+	/// Reads keep <see cref="Credits"/> chunks in flight, returning a credit for every chunk received. Writes keep as
+	/// many chunks in flight as the card allows, and go back to the last ack when the card refuses a chunk. Only one
+	/// transfer can be active at a time on a card.
+	/// </remarks>
+	public class IOCardStorageTransfer : IDisposable
+	{
+		public class CompletedEventArgs : System.EventArgs
+		{
+			public ushort Address { get; internal set; }
+			/// <summary>
+			/// the data read, or written.
+			/// </summary>
+			public byte[] Data { get; internal set; }
+			/// <summary>
+			/// <c>true</c> if the transfer finished and the range CRC matches.
+			/// </summary>
+			public bool IsGood { get; internal set; }
+			/// <summary>
+			/// the error stopped the transfer, <c>null</c> if there isn't one.
+			/// </summary>
+			public IOCard.ErrorEventArgs Error { get; internal set; }
+
+			public CompletedEventArgs(ushort address, byte[] data, bool good, IOCard.ErrorEventArgs error)
+			{
+				Address = address;
+				Data = data;
+				IsGood = good;
+				Error = error;
+			}
+		}
+
+		/// <summary>
+		/// maximum number of bytes in a chunk.
+		/// </summary>
+		public const int CHUNK_LENGTH = 32;
+		const byte DEFAULT_CREDITS = 8;
+
+		public IOCardStorageTransfer(IOCard card)
+		{
+			mCard = card;
+			mCard.OnStreamReadChunk += Card_OnStreamReadChunk;
+			mCard.OnStreamReadEnd += Card_OnStreamReadEnd;
+			mCard.OnStreamWriteBeginResult += Card_OnStreamWriteBeginResult;
+			mCard.OnStreamWriteAck += Card_OnStreamWriteAck;
+			mCard.OnStreamWriteResult += Card_OnStreamWriteResult;
+			mCard.OnError += Card_OnError;
+			mCard.OnDisconnected += Card_OnDisconnected;
+		}
+
+		public void Dispose()
+		{
+			mCard.OnStreamReadChunk -= Card_OnStreamReadChunk;
+			mCard.OnStreamReadEnd -= Card_OnStreamReadEnd;
+			mCard.OnStreamWriteBeginResult -= Card_OnStreamWriteBeginResult;
+			mCard.OnStreamWriteAck -= Card_OnStreamWriteAck;
+			mCard.OnStreamWriteResult -= Card_OnStreamWriteResult;
+			mCard.OnError -= Card_OnError;
+			mCard.OnDisconnected -= Card_OnDisconnected;
+		}
+
+		/// <summary>
+		/// fired when the transfer is finished, or failed.
+		/// </summary>
+		public event EventHandler<CompletedEventArgs> OnCompleted;
+
+		/// <summary>
+		/// number of chunks the card can send ahead when reading, defaults to 8.
+		/// </summary>
+		public byte Credits
+		{
+			get { return mCredits; }
+			set { mCredits = value; }
+		}
+
+		public bool IsBusy { get { lock (this) return mState != State.Idle; } }
+
+		/// <summary>
+		/// starts reading <paramref name="length"/> bytes from <paramref name="address"/>.
+		/// </summary>
+		/// <returns><c>false</c> if a transfer is already active, or the card isn't connected.</returns>
+		public bool BeginRead(ushort address, ushort length)
+		{
+			lock (this)
+			{
+				if (mState != State.Idle || !mCard.IsConnected)
+					return false;
+				_begin(State.Reading, address, new byte[length]);
+				return mCard.QueryStreamReadStorage(address, length, mCredits);
+			}
+		}
+
+		/// <summary>
+		/// starts writing <paramref name="data"/> to <paramref name="address"/>.
+		/// </summary>
+		/// <returns><c>false</c> if a transfer is already active, or the card isn't connected.</returns>
+		public bool BeginWrite(ushort address, byte[] data)
+		{
+			lock (this)
+			{
+				if (mState != State.Idle || !mCard.IsConnected)
+					return false;
+				_begin(State.Writing, address, data);
+				return mCard.QueryStreamWriteBegin(address, (ushort)data.Length);
+			}
+		}
+
+		/// <summary>
+		/// stops the active transfer, <see cref="OnCompleted"/> is not fired.
+		/// </summary>
+		public void Abort()
+		{
+			lock (this)
+			{
+				if (mState == State.Idle)
+					return;
+				mState = State.Idle;
+				mCard.QueryStreamAbort();
+			}
+		}
+
+		/// <summary>
+		/// CRC of a chunk, same as avr-libc's <c>_crc8_ccitt_update</c> seeded with 0.
+		/// </summary>
+		public static byte Crc8(byte[] data, int offset, int count)
+		{
+			byte crc = 0;
+			for (int i = 0; i < count; ++i)
+			{
+				crc ^= data[offset + i];
+				for (int b = 0; b < 8; ++b)
+					crc = (crc & 0x80) != 0 ? (byte)((crc << 1) ^ 0x07) : (byte)(crc << 1);
+			}
+			return crc;
+		}
+
+		/// <summary>
+		/// CRC of a range, same as avr-libc's <c>_crc_ccitt_update</c> seeded with 0xFFFF.
+		/// </summary>
+		public static ushort Crc16(byte[] data, int offset, int count, ushort crc = 0xFFFF)
+		{
+			for (int i = 0; i < count; ++i)
+			{
+				var d = (byte)(data[offset + i] ^ (crc & 0xFF));
+				d ^= (byte)(d << 4);
+				crc = (ushort)((((ushort)d << 8) | (crc >> 8)) ^ (byte)(d >> 4) ^ ((ushort)d << 3));
+			}
+			return crc;
+		}
+
+		enum State
+		{
+			Idle,
+			Reading,
+			Writing
+		}
+
+		void _begin(State state, ushort address, byte[] data)
+		{
+			mState = state;
+			mAddress = address;
+			mData = data;
+			mReceived = 0;
+			mNext = 0;
+			mAcked = 0;
+			mWindow = 0;
+			mRewoundAt = -1;
+		}
+
+		// sends the chunks the window allows, must be called with the lock held.
+		void _pump()
+		{
+			while (mNext < mData.Length && mNext - mAcked < mWindow * CHUNK_LENGTH)
+			{
+				var count = Math.Min(CHUNK_LENGTH, mData.Length - mNext);
+				mCard.QueryStreamWriteChunk((ushort)(mAddress + mNext), mData, mNext, count);
+				mNext += count;
+			}
+		}
+
+		// must be called with the lock held.
+		void _complete(bool good, IOCard.ErrorEventArgs error)
+		{
+			mState = State.Idle;
+			var e = new CompletedEventArgs(mAddress, mData, good, error);
+			if (OnCompleted != null)
+				OnCompleted(this, e);
+		}
+
+		void Card_OnStreamReadChunk(object sender, IOCard.StreamReadChunkEventArgs e)
+		{
+			lock (this)
+			{
+				if (mState != State.Reading)
+					return;
+
+				var offset = e.Address - mAddress;
+				if (!e.IsGood || offset != mReceived || offset + e.Data.Length > mData.Length)
+				{
+					mCard.QueryStreamAbort();
+					_complete(false, null);
+					return;
+				}
+				Buffer.BlockCopy(e.Data, 0, mData, offset, e.Data.Length);
+				mReceived += e.Data.Length;
+				mCard.QueryStreamCredit(1);
+			}
+		}
+
+		void Card_OnStreamReadEnd(object sender, IOCard.StreamRangeEventArgs e)
+		{
+			lock (this)
+			{
+				if (mState != State.Reading)
+					return;
+				_complete(mReceived == mData.Length && Crc16(mData, 0, mData.Length) == e.Crc, null);
+			}
+		}
+
+		void Card_OnStreamWriteBeginResult(object sender, IOCard.StreamWriteBeginResultEventArgs e)
+		{
+			lock (this)
+			{
+				if (mState != State.Writing)
+					return;
+				mWindow = e.Window;
+				_pump();
+			}
+		}
+
+		void Card_OnStreamWriteAck(object sender, IOCard.StreamWriteAckEventArgs e)
+		{
+			lock (this)
+			{
+				if (mState != State.Writing)
+					return;
+				var acked = e.Next - mAddress;
+				if (acked <= mAcked)
+					return;
+				mAcked = acked;
+				mRewoundAt = -1;
+				if (mAcked == mData.Length)
+					mCard.QueryStreamWriteEnd(Crc16(mData, 0, mData.Length));
+				else
+					_pump();
+			}
+		}
+
+		void Card_OnStreamWriteResult(object sender, IOCard.StreamWriteResultEventArgs e)
+		{
+			lock (this)
+			{
+				if (mState != State.Writing)
+					return;
+				_complete(e.IsGood, null);
+			}
+		}
+
+		void Card_OnError(object sender, IOCard.ErrorEventArgs e)
+		{
+			lock (this)
+			{
+				if (mState == State.Idle)
+					return;
+
+				switch (e.ErrorCode)
+				{
+					case IOCard.Errors.ERR_STREAM_SEQUENCE:
+					case IOCard.Errors.ERR_STREAM_CHECKSUM:
+						if (mState == State.Writing)
+						{
+							// go back to where the card is, once for every refused chunk, the chunks already in
+							// flight after it are refused as well.
+							var expected = e.ErrorCode == IOCard.Errors.ERR_STREAM_SEQUENCE ?
+								((IOCard.ErrorStreamSequenceEventArgs)e).Expected :
+								((IOCard.ErrorStreamChecksumEventArgs)e).Address;
+							var offset = expected - mAddress;
+							if (offset != mRewoundAt && offset >= mAcked && offset <= mData.Length)
+							{
+								mRewoundAt = offset;
+								mAcked = offset;
+								mNext = offset;
+								_pump();
+							}
+						}
+						break;
+					case IOCard.Errors.ERR_STREAM_BUSY:
+					case IOCard.Errors.ERR_NO_STREAM:
+					case IOCard.Errors.ERR_STREAM_OUT_OF_RANGE:
+					case IOCard.Errors.ERR_PROTECTED_STORAGE:
+						_complete(false, e);
+						break;
+				}
+			}
+		}
+
+		void Card_OnDisconnected(object sender, System.EventArgs e)
+		{
+			lock (this)
+			{
+				if (mState != State.Idle)
+					_complete(false, null);
+			}
+		}
+
+		readonly IOCard mCard;
+		byte mCredits = DEFAULT_CREDITS;
+		State mState;
+		ushort mAddress;
+		byte[] mData;
+		int mReceived;
+		int mNext;
+		int mAcked;
+		int mWindow;
+		int mRewoundAt;
+	}
+}
@@ -0,0 +1,107 @@
+﻿using System;
+using System.Globalization;
+using System.Text;
+using System.Threading;
+using Spark.Slot.IO;
+
+namespace Spark.Slot.IO.Replay
+{
+	/// <summary>
+	/// Plays a capture written with <see cref="IOCard.CapturePath"/> into an <see cref="IOCard"/>, to reproduce what a
+	/// cabinet sent, or to time the parser on it.
+	/// </summary>
+	class Program
+	{
+		const string USAGE =
+			"usage: IOCardReplay <capture> [--speed=<x>] [--dump]\n" +
+			"  --speed=<x>  1 plays at the pace it was captured, 0 (default) as fast as possible\n" +
+			"  --dump       lists the records instead of playing them";
+
+		static int Main(string[] args)
+		{
+			string path = null;
+			double speed = 0;
+			bool dump = false;
+			foreach (var arg in args)
+			{
+				if (arg.StartsWith("--speed="))
+					speed = double.Parse(arg.Substring(8), CultureInfo.InvariantCulture);
+				else if (arg == "--dump")
+					dump = true;
+				else if (path == null && !arg.StartsWith("--"))
+					path = arg;
+				else
+				{
+					Console.Error.WriteLine(USAGE);
+					return 2;
+				}
+			}
+			if (path == null)
+			{
+				Console.Error.WriteLine(USAGE);
+				return 2;
+			}
+
+			var reader = new IOCardCaptureReader(path);
+			if (dump)
+			{
+				_dump(reader);
+				return 0;
+			}
+			return _replay(reader, speed);
+		}
+
+		static void _dump(IOCardCaptureReader reader)
+		{
+			Console.WriteLine("# started {0:o}", reader.Started);
+			foreach (var record in reader.Records())
+			{
+				var text = new StringBuilder(record.Data.Length);
+				foreach (var b in record.Data)
+					text.Append(b >= 0x20 && b < 0x7F ? (char)b : '.');
+				Console.WriteLine("{0,12} {1} {2,5} {3}", record.Time,
+					record.Direction == IOCardCapture.Direction.FromCard ? "<" : ">", record.Data.Length, text);
+			}
+			reader.Dispose();
+		}
+
+		static int _replay(IOCardCaptureReader reader, double speed)
+		{
+			var card = new IOCard();
+			// a capture has its own EVT_SYNC_CLOCK_RESULT, don't ask for more.
+			card.SyncInterval = 0;
+
+			long events = 0;
+			long errors = 0;
+			long unknown = 0;
+			card.OnBoot += (sender, e) => Interlocked.Increment(ref events);
+			card.OnKeys += (sender, e) => Interlocked.Increment(ref events);
+			card.OnCoinCounterResult += (sender, e) => Interlocked.Increment(ref events);
+			card.OnEjectResult += (sender, e) => Interlocked.Increment(ref events);
+			card.OnSyncClockResult += (sender, e) => Interlocked.Increment(ref events);
+			card.OnError += (sender, e) => Interlocked.Increment(ref errors);
+			card.OnUnknown += (sender, e) => Interlocked.Increment(ref unknown);
+
+			var transport = new IOCardReplayTransport(reader, speed);
+			card.Connect(transport);
+			transport.WaitForCompletion();
+			// the last frames may still be in the parser, the time's up to the last one's events. a frame the parser
+			// dropped (too long) never comes.
+			var frames = transport.FramesPlayed;
+			if (!card.WaitForFrames(frames, FRAMES_TIMEOUT))
+				Console.Error.WriteLine("only {0} of the {1} frames handled", card.FramesHandled, frames);
+			var elapsed = transport.Elapsed;
+			card.Disconnect();
+			transport.Dispose();
+
+			var seconds = Math.Max(elapsed, 1) / 1000000.0;
+			Console.WriteLine("{0} bytes in {1:F3}s, {2:F0} bytes/s", transport.BytesPlayed, seconds,
+				transport.BytesPlayed / seconds);
+			Console.WriteLine("{0} events ({1:F0}/s), {2} errors, {3} unknown", events, events / seconds, errors,
+				unknown);
+			return 0;
+		}
+		// ms without the last frames before giving up on them.
+		const int FRAMES_TIMEOUT = 1000;
+	}
+}
@@ -0,0 +1,82 @@
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Benchmark.h"
+
+namespace bench {
+
+#define MAX_BENCHMARKS		(64)
+#define MAX_ITERATIONS		(1000000000ull)
+
+struct BenchmarkT {
+	char const * name;
+	BenchmarkFunctionT function;
+};
+
+static BenchmarkT benchmarks[MAX_BENCHMARKS];
+static uint8_t count = 0;
+
+Registration::Registration(char const * const name, BenchmarkFunctionT const function) {
+	if (count < MAX_BENCHMARKS) {
+		benchmarks[count].name = name;
+		benchmarks[count].function = function;
+		++count;
+	}
+}
+
+static double run(BenchmarkT const & benchmark, uint64_t const iterations, uint64_t & items, char const * & error) {
+	State state(iterations);
+	auto const begin = std::chrono::steady_clock::now();
+	benchmark.function(state);
+	auto const end = std::chrono::steady_clock::now();
+	items = state.getItemsProcessed();
+	error = state.getError();
+	return std::chrono::duration<double>(end - begin).count();
+}
+
+int RunSpecifiedBenchmarks(int argc, char * argv[]) {
+	char const * filter = NULL;
+	double min_time = 0.5;
+	for (int i = 1;i < argc;++i) {
+		if (strncmp(argv[i], "--filter=", 9) == 0)
+			filter = argv[i] + 9;
+		else if (strncmp(argv[i], "--min_time=", 11) == 0)
+			min_time = atof(argv[i] + 11);
+	}
+
+	printf("%-32s %12s %14s %14s\n", "Benchmark", "Time", "Iterations", "Rate");
+	for (uint8_t i = 0;i < count;++i) {
+		BenchmarkT const & benchmark = benchmarks[i];
+		if (filter && !strstr(benchmark.name, filter))
+			continue;
+
+		uint64_t iterations = 1;
+		uint64_t items = 0;
+		char const * error = NULL;
+		double seconds = run(benchmark, iterations, items, error);
+		if (error) {
+			printf("%-32s skipped: %s\n", benchmark.name, error);
+			continue;
+		}
+		while (seconds < min_time && iterations < MAX_ITERATIONS) {
+			// aim a bit past `min_time`, but never more than 10 times at once
+			double multiplier = seconds > 0 ? min_time * 1.4 / seconds : 10.0;
+			if (multiplier > 10.0)
+				multiplier = 10.0;
+			if (multiplier < 2.0)
+				multiplier = 2.0;
+			iterations = (uint64_t)(iterations * multiplier);
+			if (iterations > MAX_ITERATIONS)
+				iterations = MAX_ITERATIONS;
+			seconds = run(benchmark, iterations, items, error);
+		}
+
+		printf("%-32s %9.1f ns %14llu %12.3fM/s\n", benchmark.name,
+			seconds * 1e9 / iterations, (unsigned long long)iterations, items / seconds / 1e6);
+	}
+	return 0;
+}
+
+}
@@ -0,0 +1,65 @@
+#ifndef __BENCH_BENCHMARK_H__
+#define __BENCH_BENCHMARK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// a small take on Google Benchmark: `BENCHMARK(function)` registers
+// `void function(bench::State & state)`, which runs its body
+// `while (state.KeepRunning())`. the runner grows the iterations until a run
+// takes `--min_time` seconds.
+namespace bench {
+
+class State {
+public:
+	State(uint64_t const iterations):
+		_iterations(iterations),
+		_done(0),
+		_items(0),
+		_error(NULL)
+	{
+	}
+
+	__attribute__((always_inline)) inline
+	bool KeepRunning() { return !_error && _done++ < _iterations; }
+
+	__attribute__((always_inline)) inline
+	uint64_t iterations() const { return _iterations; }
+
+	// things done per run, reported as a rate, loops by default.
+	__attribute__((always_inline)) inline
+	void SetItemsProcessed(uint64_t const items) { _items = items; }
+
+	__attribute__((always_inline)) inline
+	uint64_t getItemsProcessed() const { return _items ? _items : _iterations; }
+
+	// the benchmark can't run, it's reported as skipped.
+	__attribute__((always_inline)) inline
+	void SkipWithError(char const * const error) { _error = error; }
+
+	__attribute__((always_inline)) inline
+	char const * getError() const { return _error; }
+
+private:
+	uint64_t const _iterations;
+	uint64_t _done;
+	uint64_t _items;
+	char const * _error;
+};
+
+typedef void (* BenchmarkFunctionT)(State & state);
+
+class Registration {
+public:
+	Registration(char const * const name, BenchmarkFunctionT const function);
+};
+
+// `--filter=<substring>`, `--min_time=<seconds>`, returns the exit code.
+int RunSpecifiedBenchmarks(int argc, char * argv[]);
+
+}
+
+#define BENCHMARK(function) \
+	static bench::Registration const _registration_##function(#function, function)
+
+#endif
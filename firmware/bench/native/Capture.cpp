@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "Capture.h"
+
+#define CAPTURE_HEADER_SIZE		(16)
+#define CAPTURE_VERSION			(1)
+#define CAPTURE_TO_CARD			(0x01)
+
+static bool getVarint(FILE * const f, uint64_t & value) {
+	value = 0;
+	for (uint8_t shift = 0;shift < 64;shift += 7) {
+		int const b = fgetc(f);
+		if (b == EOF)
+			return false;
+		value |= (uint64_t)(b & 0x7F) << shift;
+		if (!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+bool Capture::load(char const * const path) {
+	FILE * const f = fopen(path, "rb");
+	if (!f)
+		return false;
+	_count = 0;
+	_bytes = 0;
+	rewind(0);
+
+	uint8_t header[CAPTURE_HEADER_SIZE];
+	if (fread(header, 1, sizeof(header), f) != sizeof(header) ||
+		memcmp(header, "IOCP", 4) != 0 || header[4] != CAPTURE_VERSION) {
+		fclose(f);
+		return false;
+	}
+
+	// the delays between the records of the host, the card's are skipped.
+	uint64_t time = 0;
+	uint64_t last = 0;
+	int direction;
+	while ((direction = fgetc(f)) != EOF) {
+		uint64_t delta, length;
+		if (!getVarint(f, delta) || !getVarint(f, length))
+			break;
+		time += delta;
+		if (direction != CAPTURE_TO_CARD || length == 0) {
+			if (fseek(f, length, SEEK_CUR) != 0)
+				break;
+			continue;
+		}
+		if (_count == CAPTURE_MAX_RECORDS || length > CAPTURE_MAX_BYTES - _bytes)
+			break;
+		// a record cut short by a crash is the end.
+		if (fread(_data + _bytes, 1, length, f) != length)
+			break;
+		RecordT & record = _records[_count++];
+		uint64_t const delay_us = time - last;
+		record.delay_us = delay_us > 0xFFFFFFFF ? 0xFFFFFFFF : delay_us;
+		record.offset = _bytes;
+		record.length = length;
+		_bytes += length;
+		last = time;
+	}
+	fclose(f);
+	return _count != 0;
+}
+
+void Capture::rewind(uint32_t const now) {
+	_next = 0;
+	_sent = 0;
+	_at_us = now;
+}
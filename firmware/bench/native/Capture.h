@@ -0,0 +1,74 @@
+#ifndef __BENCH_CAPTURE_H__
+#define __BENCH_CAPTURE_H__
+
+#include <stdint.h>
+
+#include <Board.h>
+
+// what a host sent to a card, from a capture of the C# driver
+// (`IOCard.CapturePath`, see `IOCardCapture.cs` for the format), replayed
+// into the serial RX of `native::board`. what the card sent is skipped, the
+// firmware sends it again.
+//
+// the bytes go in the chunks the driver wrote them in, at the time they were
+// written. whatever doesn't fit the RX buffer waits for the next loop.
+#define CAPTURE_MAX_RECORDS	(65536)
+#define CAPTURE_MAX_BYTES	(1048576)
+
+class Capture {
+public:
+	struct RecordT {
+		uint32_t delay_us;
+		uint32_t offset;
+		uint32_t length;
+	};
+
+	Capture():
+		_count(0),
+		_bytes(0),
+		_next(0),
+		_sent(0),
+		_at_us(0)
+	{
+	}
+
+	bool load(char const * const path);
+
+	__attribute__((always_inline)) inline
+	uint32_t size() const { return _count; }
+
+	__attribute__((always_inline)) inline
+	uint32_t bytes() const { return _bytes; }
+
+	void rewind(uint32_t const now);
+
+	// feeds the records due by `now`, starts over after the last one.
+	__attribute__((always_inline)) inline
+	void play(uint32_t const now) {
+		while (_count) {
+			RecordT const & record = _records[_next];
+			if (_sent == 0) {
+				if (now - _at_us < record.delay_us)
+					return;
+				_at_us += record.delay_us;
+			}
+			_sent += native::board.serial.feed(_data + record.offset + _sent, record.length - _sent);
+			if (_sent != record.length)
+				return;
+			_sent = 0;
+			if (++_next == _count)
+				_next = 0;
+		}
+	}
+
+private:
+	RecordT _records[CAPTURE_MAX_RECORDS];
+	uint8_t _data[CAPTURE_MAX_BYTES];
+	uint32_t _count;
+	uint32_t _bytes;
+	uint32_t _next;
+	uint32_t _sent;
+	uint32_t _at_us;
+};
+
+#endif
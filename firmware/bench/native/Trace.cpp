@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Trace.h"
+
+bool Trace::load(char const * const path, uint8_t const length) {
+	FILE * const f = fopen(path, "r");
+	if (!f)
+		return false;
+	clear();
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		char * cursor = line;
+		uint32_t const delay_us = strtoul(cursor, &cursor, 10);
+		uint8_t bytes[CHAINS_MAX_LENGTH];
+		memset(bytes, 0xFF, sizeof(bytes));
+		for (uint8_t i = 0;i < length;++i)
+			bytes[i] = strtoul(cursor, &cursor, 16);
+		add(delay_us, bytes, length);
+	}
+	fclose(f);
+	return _count != 0;
+}
+
+void Trace::add(uint32_t const delay_us, uint8_t const * const bytes, uint8_t const length) {
+	if (_count == TRACE_MAX_EVENTS)
+		return;
+	EventT & event = _events[_count++];
+	event.delay_us = delay_us;
+	memset(event.bytes, 0xFF, sizeof(event.bytes));
+	memcpy(event.bytes, bytes, length);
+}
+
+void Trace::rewind(uint32_t const now) {
+	_next = 0;
+	_at_us = now;
+}
@@ -0,0 +1,59 @@
+#ifndef __BENCH_TRACE_H__
+#define __BENCH_TRACE_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#include <Board.h>
+
+// inputs of the 74HC165 chain over time, replayed into `native::board`.
+//
+// a recorded trace is a text file, a line per change:
+//   <us since the previous line> <byte 0> <byte 1> ... (hex)
+// lines starting with '#' are comments.
+#define TRACE_MAX_EVENTS	(65536)
+
+class Trace {
+public:
+	struct EventT {
+		uint32_t delay_us;
+		uint8_t bytes[CHAINS_MAX_LENGTH];
+	};
+
+	Trace():
+		_count(0),
+		_next(0),
+		_at_us(0)
+	{
+	}
+
+	bool load(char const * const path, uint8_t const length);
+
+	// builds a trace on the fly, `add()` after `clear()`.
+	void clear() { _count = 0; rewind(0); }
+	void add(uint32_t const delay_us, uint8_t const * const bytes, uint8_t const length);
+
+	__attribute__((always_inline)) inline
+	uint32_t size() const { return _count; }
+
+	void rewind(uint32_t const now);
+
+	// applies the changes due by `now`, starts over after the last one.
+	__attribute__((always_inline)) inline
+	void play(uint32_t const now) {
+		while (_count && now - _at_us >= _events[_next].delay_us) {
+			_at_us += _events[_next].delay_us;
+			memcpy(native::board.chains.inputs(), _events[_next].bytes, CHAINS_MAX_LENGTH);
+			if (++_next == _count)
+				_next = 0;
+		}
+	}
+
+private:
+	EventT _events[TRACE_MAX_EVENTS];
+	uint32_t _count;
+	uint32_t _next;
+	uint32_t _at_us;
+};
+
+#endif
@@ -0,0 +1,247 @@
+// microbenchmarks of the firmware core on the host, `pio run -e native` and
+// run `.pioenvs/native/program`.
+//
+// `setup()` runs once, then every benchmark drives the real `loop()` (or a
+// single class) with the virtual clock moving `LOOP_PERIOD` per iteration.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <Arduino.h>
+#include <Board.h>
+
+#include "../../src/Communication.h"
+#include "../../src/Configuration.h"
+#include "../../src/Debounce.h"
+#include "../../src/Pulse.h"
+#include "../../src/TimeoutTracker.h"
+#include "../../src/CommandStats.h"
+
+#include "Benchmark.h"
+#include "Trace.h"
+#include "Capture.h"
+
+void setup();
+void loop();
+extern Configuration conf;
+
+// about what `loop()` takes on the AVR
+#define LOOP_PERIOD			(100)
+
+// sensors at rest, the eject sensors are active LOW and the insert / banknote
+// sensors are active HIGH, see TRACK_LEVELS_DEFAULT.
+static uint8_t const IDLE_INPUTS[CHAINS_MAX_LENGTH] = {
+	0xFF, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+static Trace trace;
+static char const * trace_path = NULL;
+static Capture capture;
+static char const * capture_path = NULL;
+
+static void idle() {
+	memcpy(native::board.chains.inputs(), IDLE_INPUTS, sizeof(IDLE_INPUTS));
+	native::board.serial.discard();
+}
+
+static void runTrace(bench::State & state) {
+	trace.rewind(micros());
+	while (state.KeepRunning()) {
+		native::board.clock.advance(LOOP_PERIOD);
+		trace.play(micros());
+		loop();
+		native::board.serial.discard();
+	}
+	idle();
+}
+
+// --- loop() -----------------------------------------------------------------
+
+static void BM_LoopIdle(bench::State & state) {
+	idle();
+	while (state.KeepRunning()) {
+		native::board.clock.advance(LOOP_PERIOD);
+		loop();
+	}
+}
+BENCHMARK(BM_LoopIdle);
+
+// a key toggling every 3ms, every change is an EVT_KEYS_RESULT.
+static void BM_LoopKeyMash(bench::State & state) {
+	uint8_t bytes[CHAINS_MAX_LENGTH];
+	memcpy(bytes, IDLE_INPUTS, sizeof(bytes));
+	trace.clear();
+	for (uint8_t i = 0;i < 16;++i) {
+		bytes[0] ^= 1 << (i & 0x07);
+		trace.add(3000, bytes, IO_CHAIN_LENGTH);
+	}
+	runTrace(state);
+}
+BENCHMARK(BM_LoopKeyMash);
+
+// coins on insert track 1 at 33 per second, every coin is counted in the FRAM
+// and sent.
+static void BM_LoopCoinStorm(bench::State & state) {
+	uint8_t bytes[CHAINS_MAX_LENGTH];
+	memcpy(bytes, IDLE_INPUTS, sizeof(bytes));
+	trace.clear();
+	bytes[1] |= 1 << 4;
+	trace.add(15000, bytes, IO_CHAIN_LENGTH);
+	bytes[1] &= ~(1 << 4);
+	trace.add(15000, bytes, IO_CHAIN_LENGTH);
+	runTrace(state);
+}
+BENCHMARK(BM_LoopCoinStorm);
+
+// `--trace=<file>`, see `Trace.h` for the format.
+static void BM_LoopRecordedTrace(bench::State & state) {
+	if (!trace_path) {
+		state.SkipWithError("no --trace given");
+		return;
+	}
+	if (!trace.load(trace_path, IO_CHAIN_LENGTH)) {
+		state.SkipWithError("can't load the trace");
+		return;
+	}
+	runTrace(state);
+}
+BENCHMARK(BM_LoopRecordedTrace);
+
+// `--capture=<file>`, what a host sent, see `Capture.h`. the inputs stay idle.
+static void BM_LoopRecordedCapture(bench::State & state) {
+	if (!capture_path) {
+		state.SkipWithError("no --capture given");
+		return;
+	}
+	if (!capture.load(capture_path)) {
+		state.SkipWithError("can't load the capture");
+		return;
+	}
+	idle();
+	capture.rewind(micros());
+	while (state.KeepRunning()) {
+		native::board.clock.advance(LOOP_PERIOD);
+		capture.play(micros());
+		loop();
+		native::board.serial.discard();
+	}
+	idle();
+}
+BENCHMARK(BM_LoopRecordedCapture);
+
+// --- command dispatch -------------------------------------------------------
+
+static void command(bench::State & state, char const * const frame, size_t const length) {
+	idle();
+	while (state.KeepRunning()) {
+		native::board.clock.advance(LOOP_PERIOD);
+		native::board.serial.feed(reinterpret_cast<uint8_t const *>(frame), length);
+		loop();
+		native::board.serial.discard();
+	}
+}
+
+static void BM_CommandGetKeys(bench::State & state) {
+	static char const frame[] = "16;"; // CMD_GET_KEYS
+	static_assert(CMD_GET_KEYS == 16, "CMD_GET_KEYS changed");
+	command(state, frame, sizeof(frame) - 1);
+}
+BENCHMARK(BM_CommandGetKeys);
+
+static void BM_CommandSyncClock(bench::State & state) {
+	static char const frame[] = "3,\x01\x02\x03\x04;"; // CMD_SYNC_CLOCK
+	static_assert(CMD_SYNC_CLOCK == 3, "CMD_SYNC_CLOCK changed");
+	command(state, frame, sizeof(frame) - 1);
+}
+BENCHMARK(BM_CommandSyncClock);
+
+static void BM_CommandStatsSlotOf(bench::State & state) {
+	uint8_t id = 0;
+	uint32_t sum = 0;
+	while (state.KeepRunning())
+		sum += CommandStats::slotOf(id++);
+	if (sum == 0xFFFFFFFF)
+		puts("");
+}
+BENCHMARK(BM_CommandStatsSlotOf);
+
+// --- the parts --------------------------------------------------------------
+
+class CountFunctorT {
+public:
+	void operator () (uint32_t const & now) { ++edges; }
+	static uint32_t edges;
+};
+uint32_t CountFunctorT::edges = 0;
+
+// a bouncing input, 2ms stable every 10ms.
+static void BM_Debounce(bench::State & state) {
+	Debounce<LOW, DEBOUNCE_TIMEOUT, CountFunctorT, CountFunctorT> debounce;
+	uint32_t now = 0;
+	debounce.begin(HIGH, now);
+	while (state.KeepRunning()) {
+		now += LOOP_PERIOD;
+		debounce.feed((now / 2000) & 1 || (now % 10000) < 2000, now);
+	}
+}
+BENCHMARK(BM_Debounce);
+
+static void BM_PulseUpdate(bench::State & state) {
+	// zeroed like the firmware's `pulse_counters`, `Pulse` relies on it
+	static Pulse<COUNTER_PULSE_DUTY_HIGH, COUNTER_PULSE_DUTY_LOW> pulse;
+	uint32_t now = 0;
+	uint32_t toggles = 0;
+	while (state.KeepRunning()) {
+		now += LOOP_PERIOD;
+		if ((now % 100000) == 0)
+			pulse.pulse(5);
+		toggles += pulse.update(now);
+	}
+	if (toggles == 0xFFFFFFFF)
+		puts("");
+}
+BENCHMARK(BM_PulseUpdate);
+
+static void BM_TimeoutTrackerTrigger(bench::State & state) {
+	TimeoutTracker tracker;
+	uint32_t now = 0;
+	uint32_t triggers = 0;
+	tracker.begin(TIMEOUT_NACK);
+	tracker.start(now);
+	while (state.KeepRunning()) {
+		now += LOOP_PERIOD;
+		if (tracker.trigger(now)) {
+			++triggers;
+			tracker.start(now);
+		}
+	}
+	if (triggers == 0xFFFFFFFF)
+		puts("");
+}
+BENCHMARK(BM_TimeoutTrackerTrigger);
+
+// the FRAM writes of a counted coin, both banks and their CRCs.
+static void BM_ConfigurationSetCoinCount(bench::State & state) {
+	uint32_t coins = conf.getCoinCount(TRACK_INSERT_1);
+	while (state.KeepRunning())
+		conf.setCoinCount(TRACK_INSERT_1, ++coins);
+}
+BENCHMARK(BM_ConfigurationSetCoinCount);
+
+int main(int argc, char * argv[]) {
+	for (int i = 1;i < argc;++i)
+		if (strncmp(argv[i], "--trace=", 8) == 0)
+			trace_path = argv[i] + 8;
+		else if (strncmp(argv[i], "--capture=", 10) == 0)
+			capture_path = argv[i] + 10;
+
+	idle();
+	setup();
+	idle();
+	int const result = bench::RunSpecifiedBenchmarks(argc, argv);
+
+	native::Fram::StatsT const & stats = native::board.fram.getStats();
+	printf("fram: %u reads, %u writes, %u bytes read, %u bytes written\n",
+		stats.reads, stats.writes, stats.bytes_read, stats.bytes_written);
+	return result;
+}
@@ -0,0 +1,353 @@
+// a virtual IO card on a pseudo-terminal, for load testing the host side
+// (`IOCard`, `IOCardStateCache`, the GTK tester) without the hardware.
+//
+// it's the real firmware, built by `[env:emulator]` on top of the shims in
+// `native/NativeArduino`: `setup()` and `loop()` run against the host clock,
+// the UART is the master side of a pty and the FRAM is a mapped file, so
+// it's kept between runs. on top of that it generates traffic:
+//   - through the inputs, like a machine would (coins, keys), limited by the
+//     debouncing like on the real card.
+//   - straight into the UART with the firmware's own `Communicator` (coin,
+//     key and error events), at any rate, to load the host past what the card
+//     can do.
+// the output is paced to the given baudrate, 0 for as fast as the host reads.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+#include <Board.h>
+
+#include "../src/Communication.h"
+#include "../src/Configuration.h"
+#include "../src/Communicator.h"
+
+void setup();
+void loop();
+extern Communicator communicator;
+
+// from Ports.h, coin track 1 on the insert sensors, active HIGH
+#define IN_BYTE_SENSORS		(1)
+#define IN_BIT_INSERT_1		(4)
+// a coin takes 15ms on the sensor, or half the period if they come faster
+#define COIN_PULSE_US		(15000)
+
+// the watchdog bites after that long without `wdt_reset()`
+#define WATCHDOG_US			(500000)
+
+struct OptionsT {
+	char const * link;
+	char const * fram;
+	uint32_t baudrate;
+	uint32_t loop_period;
+	double coins;
+	double keys;
+	double flood_coins;
+	double flood_keys;
+	double flood_errors;
+	int pty_fd;
+	char ** argv;
+};
+
+static OptionsT options = {
+	NULL, NULL, UART_BAUDRATE, 100, 0, 0, 0, 0, 0, -1, NULL,
+};
+
+static uint64_t monotonic_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000u + ts.tv_nsec / 1000u;
+}
+
+// fires `rate` times per second, catching up if it's late.
+class Generator {
+public:
+	Generator():
+		_period_us(0),
+		_next_us(0)
+	{
+	}
+
+	void begin(double const rate, uint64_t const now) {
+		_period_us = rate > 0 ? 1000000.0 / rate : 0;
+		_next_us = now + _period_us;
+	}
+
+	__attribute__((always_inline)) inline
+	bool due(uint64_t const now) {
+		if (_period_us == 0 || now < _next_us)
+			return false;
+		_next_us += _period_us;
+		return true;
+	}
+
+	__attribute__((always_inline)) inline
+	double period() const { return _period_us; }
+
+private:
+	double _period_us;
+	double _next_us;
+};
+
+// --- setup ------------------------------------------------------------------
+
+static int open_pty() {
+	if (options.pty_fd >= 0)
+		return options.pty_fd;
+
+	int const fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+		perror("posix_openpt");
+		return -1;
+	}
+	char const * const name = ptsname(fd);
+	// raw bytes both ways, and keep the slave open so the master doesn't get
+	// EIO while no host is connected.
+	int const slave = open(name, O_RDWR | O_NOCTTY);
+	struct termios tio;
+	tcgetattr(slave, &tio);
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, B230400);
+	cfsetospeed(&tio, B230400);
+	tcsetattr(slave, TCSANOW, &tio);
+
+	if (options.link) {
+		unlink(options.link);
+		if (symlink(name, options.link) != 0)
+			perror(options.link);
+	}
+	fprintf(stderr, "emulator: IO card on %s%s%s\n", name,
+		options.link ? ", linked from " : "", options.link ? options.link : "");
+	return fd;
+}
+
+static bool map_fram() {
+	if (!options.fram)
+		return true;
+	int const fd = open(options.fram, O_RDWR | O_CREAT, 0644);
+	if (fd < 0 || ftruncate(fd, FRAM_DEFAULT_SIZE) != 0) {
+		perror(options.fram);
+		return false;
+	}
+	void * const memory = mmap(NULL, FRAM_DEFAULT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (memory == MAP_FAILED) {
+		perror("mmap");
+		return false;
+	}
+	native::board.fram.attach(static_cast<uint8_t *>(memory), FRAM_DEFAULT_SIZE);
+	return true;
+}
+
+// the AVR resets, the emulator starts over with fresh RAM: exec ourselves,
+// keeping the pty and the mapped FRAM file.
+static void * watchdog(void *) {
+	uint32_t last = 0;
+	uint64_t fed_us = monotonic_us();
+	for (;;) {
+		usleep(WATCHDOG_US / 4);
+		uint32_t const resets = __atomic_load_n(&native::board.wdt_resets, __ATOMIC_RELAXED);
+		uint64_t const now = monotonic_us();
+		if (resets != last) {
+			last = resets;
+			fed_us = now;
+		} else if (now - fed_us > WATCHDOG_US) {
+			fprintf(stderr, "emulator: watchdog reset\n");
+			native::Fram & fram = native::board.fram;
+			msync(fram.memory(), fram.size(), MS_SYNC);
+
+			char fd_option[32];
+			snprintf(fd_option, sizeof(fd_option), "--pty-fd=%d", native::board.serial.fd());
+			char * argv[64];
+			int argc = 0;
+			for (char ** arg = options.argv;*arg && argc < 62;++arg)
+				if (strncmp(*arg, "--pty-fd=", 9) != 0)
+					argv[argc++] = *arg;
+			argv[argc++] = fd_option;
+			argv[argc] = NULL;
+			execv("/proc/self/exe", argv);
+			perror("execv");
+			_exit(1);
+		}
+	}
+	return NULL;
+}
+
+// the supply the power-fail warning watches: SIGUSR1 takes it under the
+// threshold, SIGUSR2 brings it back. kill the emulator in between for the
+// power cut itself.
+static void on_supply(int const signal) {
+	native::board.comparator.setOutput(signal == SIGUSR1);
+}
+
+static void usage(char const * const name) {
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -l, --link=PATH          symlink to the pty, /tmp/iocard for example\n"
+		"  -f, --fram=FILE          FRAM image, created if it's not there, kept in RAM otherwise\n"
+		"  -b, --baudrate=BAUD      output pacing, %lu by default, 0 to go as fast as the host reads\n"
+		"  -p, --loop-period=US     time `loop()` takes on the card, 100 by default, 0 to spin\n"
+		"  -c, --coins=RATE         coins per second on insert track 1, through the sensor\n"
+		"  -k, --keys=RATE          key changes per second\n"
+		"      --flood-coins=RATE   EVT_COIN_COUNTER_RESULT per second, straight to the host\n"
+		"      --flood-keys=RATE    EVT_KEYS_RESULT per second, straight to the host\n"
+		"      --flood-errors=RATE  EVT_ERROR per second, straight to the host\n",
+		name, (unsigned long)UART_BAUDRATE);
+}
+
+static bool parse(int argc, char * argv[]) {
+	enum { FLOOD_COINS = 0x100, FLOOD_KEYS, FLOOD_ERRORS, PTY_FD };
+	static struct option const long_options[] = {
+		{ "link", required_argument, NULL, 'l' },
+		{ "fram", required_argument, NULL, 'f' },
+		{ "baudrate", required_argument, NULL, 'b' },
+		{ "loop-period", required_argument, NULL, 'p' },
+		{ "coins", required_argument, NULL, 'c' },
+		{ "keys", required_argument, NULL, 'k' },
+		{ "flood-coins", required_argument, NULL, FLOOD_COINS },
+		{ "flood-keys", required_argument, NULL, FLOOD_KEYS },
+		{ "flood-errors", required_argument, NULL, FLOOD_ERRORS },
+		{ "pty-fd", required_argument, NULL, PTY_FD },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	options.argv = argv;
+	int option;
+	while ((option = getopt_long(argc, argv, "l:f:b:p:c:k:h", long_options, NULL)) != -1) {
+		switch (option) {
+			case 'l': options.link = optarg; break;
+			case 'f': options.fram = optarg; break;
+			case 'b': options.baudrate = strtoul(optarg, NULL, 0); break;
+			case 'p': options.loop_period = strtoul(optarg, NULL, 0); break;
+			case 'c': options.coins = atof(optarg); break;
+			case 'k': options.keys = atof(optarg); break;
+			case FLOOD_COINS: options.flood_coins = atof(optarg); break;
+			case FLOOD_KEYS: options.flood_keys = atof(optarg); break;
+			case FLOOD_ERRORS: options.flood_errors = atof(optarg); break;
+			case PTY_FD: options.pty_fd = atoi(optarg); break;
+			default: return false;
+		}
+	}
+	return optind == argc;
+}
+
+// --- main loop --------------------------------------------------------------
+
+int main(int argc, char * argv[]) {
+	if (!parse(argc, argv)) {
+		usage(argv[0]);
+		return 2;
+	}
+	int const fd = open_pty();
+	if (fd < 0 || !map_fram())
+		return 1;
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGUSR1, on_supply);
+	signal(SIGUSR2, on_supply);
+
+	// sensors at rest, see TRACK_LEVELS_DEFAULT
+	native::board.chains.inputs()[IN_BYTE_SENSORS] = 0x0F;
+	native::board.clock.realtime(true);
+	native::board.serial.attach(fd);
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, watchdog, NULL);
+
+	setup();
+
+	uint64_t const begin_us = monotonic_us();
+	Generator coins, keys, flood_coins, flood_keys, flood_errors, report;
+	coins.begin(options.coins, begin_us);
+	keys.begin(options.keys, begin_us);
+	flood_coins.begin(options.flood_coins, begin_us);
+	flood_keys.begin(options.flood_keys, begin_us);
+	flood_errors.begin(options.flood_errors, begin_us);
+	report.begin(1, begin_us);
+	double const coin_pulse_us = coins.period() > 0 && coins.period() < 2 * COIN_PULSE_US ?
+		coins.period() / 2 : COIN_PULSE_US;
+
+	uint64_t coin_release_us = 0;
+	uint32_t synthetic_coins = 0;
+	uint32_t seed = 0x13579BDF;
+	uint32_t loops = 0;
+	uint32_t last_out = 0;
+	uint32_t last_in = 0;
+	uint32_t paced_out = 0;
+	uint64_t total_out = 0;
+	for (;;) {
+		uint64_t const now = monotonic_us();
+
+		// traffic through the inputs
+		if (coins.due(now)) {
+			native::board.chains.setInput(IN_BYTE_SENSORS, IN_BIT_INSERT_1, HIGH);
+			coin_release_us = now + coin_pulse_us;
+		}
+		if (coin_release_us && now >= coin_release_us) {
+			native::board.chains.setInput(IN_BYTE_SENSORS, IN_BIT_INSERT_1, LOW);
+			coin_release_us = 0;
+		}
+		if (keys.due(now)) {
+			seed = seed * 1664525u + 1013904223u;
+			native::board.chains.inputs()[0] ^= 1 << ((seed >> 24) & 0x07);
+		}
+
+		loop();
+		++loops;
+
+		// traffic straight to the host, between two `loop()`s so it never
+		// lands in the middle of a frame.
+		if (flood_coins.due(now))
+			communicator.dispatchCoinCounterResult(TRACK_INSERT_1, ++synthetic_coins);
+		if (flood_keys.due(now)) {
+			seed = seed * 1664525u + 1013904223u;
+			uint8_t keys[IO_CHAIN_LENGTH];
+			memcpy(keys, native::board.chains.inputs(), IO_CHAIN_LENGTH);
+			keys[0] ^= 1 << ((seed >> 24) & 0x07);
+			communicator.dispatchKeysResult(IO_CHAIN_LENGTH, keys);
+		}
+		if (flood_errors.due(now)) {
+			seed = seed * 1664525u + 1013904223u;
+			switch ((seed >> 24) % 3) {
+				case 0: communicator.dispatchErrorEjectTimeout(TRACK_EJECT, seed & 0x0F); break;
+				case 1: communicator.dispatchErrorStorageCorrupted(CONF_ADDR_USER_BEGIN + (seed & 0x0FC0)); break;
+				case 2: communicator.dispatchErrorUnknownCommand(0xF0 | (seed & 0x0F)); break;
+			}
+		}
+
+		if (report.due(now)) {
+			uint32_t const out = native::board.serial.getBytesOut();
+			uint32_t const in = native::board.serial.getBytesIn();
+			fprintf(stderr, "emulator: %u loops/s, %u bytes/s out, %u bytes/s in, %u dropped\n",
+				loops, out - last_out, in - last_in, native::board.serial.getDropped());
+			loops = 0;
+			last_out = out;
+			last_in = in;
+		}
+
+		// 10 bits per byte on the wire, wait for the UART to catch up
+		uint64_t wait_us = options.loop_period;
+		if (options.baudrate) {
+			uint32_t const out = native::board.serial.getBytesOut();
+			total_out += out - paced_out;
+			paced_out = out;
+			uint64_t const sent_us = total_out * 10000000u / options.baudrate;
+			uint64_t const elapsed_us = monotonic_us() - begin_us;
+			if (sent_us > elapsed_us + wait_us)
+				wait_us = sent_us - elapsed_us;
+		}
+		if (wait_us)
+			usleep(wait_us);
+	}
+	return 0;
+}
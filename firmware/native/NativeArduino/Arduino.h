@@ -0,0 +1,64 @@
+#ifndef __NATIVE_ARDUINO_H__
+#define __NATIVE_ARDUINO_H__
+
+// just enough of the arduino core for the sources in `src/` to build on the
+// host, see `Board.h` for what drives it.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <avr/pgmspace.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH			(0x1)
+#define LOW				(0x0)
+
+#define INPUT			(0x0)
+#define OUTPUT			(0x1)
+#define INPUT_PULLUP	(0x2)
+
+#define DEC				(10)
+#define HEX				(16)
+#define OCT				(8)
+#define BIN				(2)
+
+// analog pins of the ATmega328P
+#define A0				(14)
+#define A1				(15)
+#define A2				(16)
+#define A3				(17)
+#define A4				(18)
+#define A5				(19)
+#define A6				(20)
+#define A7				(21)
+
+#define _BV(bit)				(1 << (bit))
+#define bitRead(value, bit)		(((value) >> (bit)) & 0x01)
+#define bitSet(value, bit)		((value) |= (1UL << (bit)))
+#define bitClear(value, bit)	((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue)	((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+#define lowByte(w)				((uint8_t)((w) & 0xFF))
+#define highByte(w)				((uint8_t)((w) >> 8))
+
+class __FlashStringHelper;
+#define F(string_literal)		(reinterpret_cast<__FlashStringHelper const *>(PSTR(string_literal)))
+
+uint32_t micros();
+uint32_t millis();
+void delay(uint32_t ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+char * dtostrf(double value, signed char width, unsigned char precision, char * buffer);
+
+#include "HardwareSerial.h"
+
+#endif
@@ -0,0 +1,284 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <avr/wdt.h>
+
+#include "Board.h"
+
+namespace native {
+
+Board board;
+
+// --- clock ------------------------------------------------------------------
+
+static uint64_t monotonic_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000u + ts.tv_nsec / 1000u;
+}
+
+uint32_t Clock::now() {
+	if (_realtime)
+		return (uint32_t)(monotonic_us() - _origin_us);
+	return _now_us;
+}
+
+void Clock::realtime(bool const realtime) {
+	if (realtime && !_realtime)
+		_origin_us = monotonic_us() - _now_us;
+	else if (!realtime && _realtime)
+		_now_us = now();
+	_realtime = realtime;
+}
+
+// --- chains -----------------------------------------------------------------
+
+#define PIN_QH			(7)
+#define PIN_CLK_IN		(8)
+#define PIN_LOAD		(9)
+#define PIN_SDI			(2)
+#define PIN_CLK_OUT		(3)
+#define PIN_LATCH		(4)
+
+#if defined(IO_CHAIN_LENGTH)
+#define CHAINS_LENGTH	(IO_CHAIN_LENGTH)
+#else
+#define CHAINS_LENGTH	(3)
+#endif
+
+Chains::Chains():
+	_bit(0),
+	_load(false),
+	_clock_in(false),
+	_sdi(false),
+	_clock_out(false),
+	_latch(false),
+	_loads(0),
+	_latches(0)
+{
+	memset(_inputs, 0xFF, sizeof(_inputs));
+	memset(_loaded, 0xFF, sizeof(_loaded));
+	memset(_shift, 0, sizeof(_shift));
+	memset(_outputs, 0, sizeof(_outputs));
+}
+
+void Chains::write(uint8_t const pin, bool const level) {
+	switch (pin) {
+		case PIN_LOAD:
+			// SH/nLD low loads the inputs, the chain shifts once it goes high
+			if (level && !_load) {
+				memcpy(_loaded, _inputs, CHAINS_LENGTH);
+				_bit = 0;
+				++_loads;
+			}
+			_load = level;
+			break;
+		case PIN_CLK_IN:
+			if (level && !_clock_in && _load)
+				++_bit;
+			_clock_in = level;
+			break;
+		case PIN_SDI:
+			_sdi = level;
+			break;
+		case PIN_CLK_OUT:
+			if (level && !_clock_out) {
+				for (uint8_t i = 0;i < CHAINS_LENGTH - 1;++i)
+					_shift[i] = (_shift[i] << 1) | (_shift[i + 1] >> 7);
+				_shift[CHAINS_LENGTH - 1] = (_shift[CHAINS_LENGTH - 1] << 1) | _sdi;
+			}
+			_clock_out = level;
+			break;
+		case PIN_LATCH:
+			if (level && !_latch) {
+				memcpy(_outputs, _shift, CHAINS_LENGTH);
+				++_latches;
+			}
+			_latch = level;
+			break;
+	}
+}
+
+bool Chains::read(uint8_t const pin) const {
+	if (pin != PIN_QH)
+		return false;
+	uint8_t const byte = _bit >> 3;
+	if (byte >= CHAINS_LENGTH)
+		return true;
+	uint8_t const * const bytes = _load ? _loaded : _inputs;
+	return (bytes[byte] >> (7 - (_bit & 0x07))) & 1;
+}
+
+void Chains::setInput(uint8_t const byte, uint8_t const bit, bool const level) {
+	if (level)
+		_inputs[byte] |= 1 << bit;
+	else
+		_inputs[byte] &= ~(1 << bit);
+}
+
+// --- fram -------------------------------------------------------------------
+
+Fram::Fram():
+	_memory(_own),
+	_size(sizeof(_own))
+{
+	memset(_own, 0, sizeof(_own));
+	resetStats();
+}
+
+void Fram::attach(uint8_t * const memory, uint32_t const size) {
+	_memory = memory ? memory : _own;
+	_size = memory ? size : sizeof(_own);
+}
+
+void Fram::read(uint16_t const address, uint8_t const length, uint8_t * const buffer) {
+	for (uint8_t i = 0;i < length;++i)
+		buffer[i] = _memory[(address + i) % _size];
+	++_stats.reads;
+	_stats.bytes_read += length;
+}
+
+void Fram::write(uint16_t const address, uint8_t const length, uint8_t const * const buffer) {
+	for (uint8_t i = 0;i < length;++i)
+		_memory[(address + i) % _size] = buffer[i];
+	++_stats.writes;
+	_stats.bytes_written += length;
+}
+
+void Fram::resetStats() {
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+// --- serial -----------------------------------------------------------------
+
+SerialPipe::SerialPipe():
+	_fd(-1),
+	_rx_head(0),
+	_rx_count(0),
+	_tx_head(0),
+	_tx_count(0),
+	_bytes_in(0),
+	_bytes_out(0),
+	_dropped(0)
+{
+}
+
+void SerialPipe::attach(int const fd) {
+	_fd = fd;
+	if (_fd >= 0)
+		fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+}
+
+size_t SerialPipe::feed(uint8_t const * const data, size_t const length) {
+	size_t fed = 0;
+	while (fed < length && _rx_count < SERIAL_RX_SIZE) {
+		_rx[(_rx_head + _rx_count) % SERIAL_RX_SIZE] = data[fed++];
+		++_rx_count;
+	}
+	return fed;
+}
+
+size_t SerialPipe::take(uint8_t * const buffer, size_t const length) {
+	size_t taken = 0;
+	uint16_t const tail = (_tx_head + SERIAL_TX_SIZE - _tx_count) % SERIAL_TX_SIZE;
+	while (taken < length && taken < _tx_count) {
+		buffer[taken] = _tx[(tail + taken) % SERIAL_TX_SIZE];
+		++taken;
+	}
+	_tx_count -= taken;
+	return taken;
+}
+
+void SerialPipe::discard() {
+	_tx_count = 0;
+}
+
+void SerialPipe::_poll() {
+	if (_fd < 0 || _rx_count == SERIAL_RX_SIZE)
+		return;
+	uint8_t buffer[SERIAL_RX_SIZE];
+	ssize_t const got = ::read(_fd, buffer, SERIAL_RX_SIZE - _rx_count);
+	if (got > 0)
+		feed(buffer, got);
+}
+
+int SerialPipe::available() {
+	_poll();
+	return _rx_count;
+}
+
+int SerialPipe::read() {
+	_poll();
+	if (_rx_count == 0)
+		return -1;
+	uint8_t const value = _rx[_rx_head];
+	_rx_head = (_rx_head + 1) % SERIAL_RX_SIZE;
+	--_rx_count;
+	++_bytes_in;
+	return value;
+}
+
+int SerialPipe::peek() {
+	_poll();
+	return _rx_count ? _rx[_rx_head] : -1;
+}
+
+void SerialPipe::write(uint8_t const value) {
+	++_bytes_out;
+	if (_fd >= 0) {
+		ssize_t written;
+		do {
+			written = ::write(_fd, &value, 1);
+		} while (written < 0 && errno == EINTR);
+		if (written != 1)
+			++_dropped;
+		return;
+	}
+	_tx[_tx_head] = value;
+	_tx_head = (_tx_head + 1) % SERIAL_TX_SIZE;
+	if (_tx_count < SERIAL_TX_SIZE)
+		++_tx_count;
+}
+
+}
+
+// --- the arduino side -------------------------------------------------------
+
+HardwareSerial Serial;
+TwoWire Wire;
+
+uint32_t micros() { return native::board.clock.now(); }
+uint32_t millis() { return native::board.clock.now() / 1000; }
+void delay(uint32_t ms) { native::board.clock.advance(ms * 1000); }
+void delayMicroseconds(unsigned int us) { native::board.clock.advance(us); }
+
+void pinMode(uint8_t pin, uint8_t mode) { }
+void digitalWrite(uint8_t pin, uint8_t value) { native::board.chains.write(pin, value); }
+int digitalRead(uint8_t pin) { return native::board.chains.read(pin); }
+
+void wdt_enable(uint8_t timeout) { }
+void wdt_disable() { }
+void wdt_reset() { ++native::board.wdt_resets; }
+
+char * dtostrf(double value, signed char width, unsigned char precision, char * buffer) {
+	sprintf(buffer, "%*.*f", width, precision, value);
+	return buffer;
+}
+
+void HardwareSerial::begin(unsigned long baudrate) { }
+int HardwareSerial::available() { return native::board.serial.available(); }
+int HardwareSerial::read() { return native::board.serial.read(); }
+int HardwareSerial::peek() { return native::board.serial.peek(); }
+// the host always keeps up, as much room as an empty AVR TX buffer.
+int HardwareSerial::availableForWrite() { return 63; }
+
+size_t HardwareSerial::write(uint8_t value) {
+	native::board.serial.write(value);
+	return 1;
+}
@@ -0,0 +1,219 @@
+#ifndef __NATIVE_BOARD_H__
+#define __NATIVE_BOARD_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// the other side of the shims, what a bench or an emulator drives: the clock,
+// the 74HC165 / 74HC595 chains, the FRAM and the UART.
+namespace native {
+
+// `micros()` and `millis()`. virtual by default, the bench moves it forward
+// itself, so the firmware sees the same times on every run.
+class Clock {
+public:
+	Clock():
+		_now_us(0),
+		_realtime(false)
+	{
+	}
+
+	uint32_t now();
+
+	__attribute__((always_inline)) inline
+	void advance(uint32_t const us) { _now_us += us; }
+
+	// follows the host's monotonic clock instead.
+	void realtime(bool const realtime);
+
+private:
+	uint32_t _now_us;
+	bool _realtime;
+	uint64_t _origin_us;
+};
+
+// the shift register chains at the pin level, driven by `WreckedSPI`.
+// 74HC165: QH on D7, CLK on D8, SH/nLD on D9.
+// 74HC595: SDI on D2, SRCLK on D3, RCLK on D4.
+#define CHAINS_MAX_LENGTH	(8)
+
+class Chains {
+public:
+	Chains();
+
+	void write(uint8_t const pin, bool const level);
+	bool read(uint8_t const pin) const;
+
+	// the pins of the 74HC165s, as the firmware sees them, `inputs()[0]` is
+	// the first byte shifted in.
+	__attribute__((always_inline)) inline
+	uint8_t * inputs() { return _inputs; }
+
+	void setInput(uint8_t const byte, uint8_t const bit, bool const level);
+
+	// the 74HC595 outputs, updated on RCLK, in the order the firmware sends
+	// them.
+	__attribute__((always_inline)) inline
+	uint8_t const * outputs() const { return _outputs; }
+
+	// SH/nLD rising edges, one per `loop()`
+	__attribute__((always_inline)) inline
+	uint32_t getLoads() const { return _loads; }
+
+	// RCLK rising edges, one per output update
+	__attribute__((always_inline)) inline
+	uint32_t getLatches() const { return _latches; }
+
+private:
+	uint8_t _inputs[CHAINS_MAX_LENGTH];
+	uint8_t _loaded[CHAINS_MAX_LENGTH];
+	uint8_t _shift[CHAINS_MAX_LENGTH];
+	uint8_t _outputs[CHAINS_MAX_LENGTH];
+	uint8_t _bit;
+	bool _load;
+	bool _clock_in;
+	bool _sdi;
+	bool _clock_out;
+	bool _latch;
+	uint32_t _loads;
+	uint32_t _latches;
+};
+
+// the FRAM, in RAM, or in whatever `attach()` is given (a mapped file for
+// example). addresses wrap around at the end.
+#define FRAM_DEFAULT_SIZE	(16384u)
+
+class Fram {
+public:
+	struct StatsT {
+		uint32_t reads;
+		uint32_t writes;
+		uint32_t bytes_read;
+		uint32_t bytes_written;
+	};
+
+	Fram();
+
+	void attach(uint8_t * const memory, uint32_t const size);
+
+	void read(uint16_t const address, uint8_t const length, uint8_t * const buffer);
+	void write(uint16_t const address, uint8_t const length, uint8_t const * const buffer);
+
+	__attribute__((always_inline)) inline
+	uint8_t * memory() { return _memory; }
+
+	__attribute__((always_inline)) inline
+	uint32_t size() const { return _size; }
+
+	__attribute__((always_inline)) inline
+	StatsT const & getStats() const { return _stats; }
+
+	void resetStats();
+
+private:
+	uint8_t _own[FRAM_DEFAULT_SIZE];
+	uint8_t * _memory;
+	uint32_t _size;
+	StatsT _stats;
+};
+
+// the UART. the RX buffer is as big as the AVR one, the TX side never blocks,
+// it's either kept for `take()` or written to the file descriptor given to
+// `attach()` (a pty or a pipe). like on the wire, what the other side isn't
+// there to read is lost.
+#define SERIAL_RX_SIZE		(64)
+#define SERIAL_TX_SIZE		(4096)
+
+class SerialPipe {
+public:
+	SerialPipe();
+
+	// reads from / writes to `fd`, -1 to go back to the buffers.
+	void attach(int const fd);
+
+	__attribute__((always_inline)) inline
+	int fd() const { return _fd; }
+
+	// bytes to the firmware, returns how many fit in the RX buffer.
+	size_t feed(uint8_t const * const data, size_t const length);
+	// bytes from the firmware.
+	size_t take(uint8_t * const buffer, size_t const length);
+	void discard();
+
+	__attribute__((always_inline)) inline
+	uint32_t getBytesIn() const { return _bytes_in; }
+
+	__attribute__((always_inline)) inline
+	uint32_t getBytesOut() const { return _bytes_out; }
+
+	// bytes the file descriptor didn't take
+	__attribute__((always_inline)) inline
+	uint32_t getDropped() const { return _dropped; }
+
+	// the firmware side, for `HardwareSerial`
+	int available();
+	int read();
+	int peek();
+	void write(uint8_t const value);
+
+private:
+	void _poll();
+
+	int _fd;
+	uint8_t _rx[SERIAL_RX_SIZE];
+	uint8_t _rx_head;
+	uint8_t _rx_count;
+	uint8_t _tx[SERIAL_TX_SIZE];
+	uint16_t _tx_head;
+	uint16_t _tx_count;
+	uint32_t _bytes_in;
+	uint32_t _bytes_out;
+	uint32_t _dropped;
+};
+
+// the analog comparator's registers, see avr/io.h. the output (ACO) is driven
+// from this side, with the power-fail warning it's the supply going low.
+class Comparator {
+public:
+	Comparator():
+		admux(0),
+		adcsra(0),
+		adcsrb(0),
+		acsr(0)
+	{
+	}
+
+	__attribute__((always_inline)) inline
+	void setOutput(bool const high) {
+		if (high)
+			acsr |= 1 << 5;
+		else
+			acsr &= ~(1 << 5);
+	}
+
+	volatile uint8_t admux;
+	volatile uint8_t adcsra;
+	volatile uint8_t adcsrb;
+	volatile uint8_t acsr;
+};
+
+class Board {
+public:
+	Board():
+		wdt_resets(0)
+	{
+	}
+
+	Clock clock;
+	Chains chains;
+	Fram fram;
+	SerialPipe serial;
+	Comparator comparator;
+	uint32_t wdt_resets;
+};
+
+extern Board board;
+
+}
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef __NATIVE_DIGITAL_IO_H__
+#define __NATIVE_DIGITAL_IO_H__
+
+#include <DigitalPin.h>
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef __NATIVE_DIGITAL_PIN_H__
+#define __NATIVE_DIGITAL_PIN_H__
+
+#include <Arduino.h>
+
+#include "Board.h"
+
+// the pins the shift register chains hang on go to `native::board.chains`.
+
+static inline __attribute__((always_inline))
+void fastPinMode(uint8_t const pin, uint8_t const mode) {
+}
+
+static inline __attribute__((always_inline))
+void fastDigitalWrite(uint8_t const pin, bool const level) {
+	native::board.chains.write(pin, level);
+}
+
+static inline __attribute__((always_inline))
+bool fastDigitalRead(uint8_t const pin) {
+	return native::board.chains.read(pin);
+}
+
+static inline __attribute__((always_inline))
+void fastPinConfig(uint8_t const pin, uint8_t const mode, bool const level) {
+	fastPinMode(pin, mode);
+	fastDigitalWrite(pin, level);
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef __NATIVE_FRAM_MB85RC_I2C_H__
+#define __NATIVE_FRAM_MB85RC_I2C_H__
+
+#include <Arduino.h>
+
+#include "Board.h"
+
+#define MB85RC_DEFAULT_ADDRESS	(0x50)
+
+#define ERROR_0					(0) // success
+
+class WriteProtect_Unmanaged { };
+
+// the FRAM library, on top of `native::board.fram`.
+template < typename WriteProtectT >
+class FRAM_MB85RC_I2C_T {
+public:
+	FRAM_MB85RC_I2C_T(uint8_t const address, bool const wp, int const pin, uint16_t const density) { }
+
+	byte begin() { return ERROR_0; }
+
+	byte readArray(uint16_t const address, uint8_t const items, uint8_t * const values) {
+		native::board.fram.read(address, items, values);
+		return ERROR_0;
+	}
+
+	byte writeArray(uint16_t const address, uint8_t const items, uint8_t const * const values) {
+		native::board.fram.write(address, items, values);
+		return ERROR_0;
+	}
+
+	template < typename T >
+	byte readFrom(uint16_t const address, T & value) {
+		native::board.fram.read(address, sizeof(T), reinterpret_cast<uint8_t *>(&value));
+		return ERROR_0;
+	}
+
+	template < typename T >
+	byte writeTo(uint16_t const address, T const & value) {
+		native::board.fram.write(address, sizeof(T), reinterpret_cast<uint8_t const *>(&value));
+		return ERROR_0;
+	}
+};
+
+#endif
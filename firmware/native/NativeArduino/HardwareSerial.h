@@ -0,0 +1,26 @@
+#ifndef __NATIVE_HARDWARE_SERIAL_H__
+#define __NATIVE_HARDWARE_SERIAL_H__
+
+#include "Stream.h"
+
+// the UART, bytes go through `native::board.serial`.
+class HardwareSerial: public Stream {
+public:
+	void begin(unsigned long baudrate);
+	void end() { }
+
+	virtual int available();
+	virtual int read();
+	virtual int peek();
+	virtual void flush() { }
+	int availableForWrite();
+
+	virtual size_t write(uint8_t value);
+	using Print::write;
+
+	operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
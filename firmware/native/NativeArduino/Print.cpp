@@ -0,0 +1,89 @@
+#include <math.h>
+#include <string.h>
+
+#include "Print.h"
+
+size_t Print::write(uint8_t const * buffer, size_t size) {
+	size_t written = 0;
+	while (size--)
+		written += write(*buffer++);
+	return written;
+}
+
+size_t Print::write(char const * string) {
+	return string ? write(string, strlen(string)) : 0;
+}
+
+size_t Print::print(__FlashStringHelper const * string) {
+	return write(reinterpret_cast<char const *>(string));
+}
+
+size_t Print::print(char const string[]) { return write(string); }
+size_t Print::print(char value) { return write((uint8_t)value); }
+size_t Print::print(unsigned char value, int base) { return print((unsigned long)value, base); }
+size_t Print::print(int value, int base) { return print((long)value, base); }
+size_t Print::print(unsigned int value, int base) { return print((unsigned long)value, base); }
+
+size_t Print::print(long value, int base) {
+	if (base == 0)
+		return write((uint8_t)value);
+	if (base == 10 && value < 0)
+		return print('-') + _printNumber(-value, 10);
+	return _printNumber(value, base);
+}
+
+size_t Print::print(unsigned long value, int base) {
+	if (base == 0)
+		return write((uint8_t)value);
+	return _printNumber(value, base);
+}
+
+size_t Print::print(double value, int digits) { return _printFloat(value, digits); }
+
+size_t Print::println() { return write("\r\n"); }
+
+size_t Print::_printNumber(unsigned long value, uint8_t base) {
+	char buffer[8 * sizeof(long) + 1];
+	char * text = &buffer[sizeof(buffer) - 1];
+	*text = '\0';
+	if (base < 2)
+		base = 10;
+	do {
+		char const digit = value % base;
+		value /= base;
+		*--text = digit < 10 ? digit + '0' : digit + 'A' - 10;
+	} while (value);
+	return write(text);
+}
+
+size_t Print::_printFloat(double value, uint8_t digits) {
+	if (isnan(value))
+		return print("nan");
+	if (isinf(value))
+		return print("inf");
+	if (value > 4294967040.0 || value < -4294967040.0)
+		return print("ovf");
+
+	size_t written = 0;
+	if (value < 0.0) {
+		written += print('-');
+		value = -value;
+	}
+	double rounding = 0.5;
+	for (uint8_t i = 0;i < digits;++i)
+		rounding /= 10.0;
+	value += rounding;
+
+	unsigned long const integer = (unsigned long)value;
+	double remainder = value - (double)integer;
+	written += print(integer);
+	if (digits > 0)
+		written += print('.');
+	while (digits-- > 0) {
+		remainder *= 10.0;
+		unsigned int const digit = (unsigned int)remainder;
+		written += print(digit);
+		remainder -= digit;
+	}
+	return written;
+}
@@ -0,0 +1,40 @@
+#ifndef __NATIVE_PRINT_H__
+#define __NATIVE_PRINT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+class __FlashStringHelper;
+
+// the arduino `Print`, numbers are formatted the same way.
+class Print {
+public:
+	virtual ~Print() { }
+
+	virtual size_t write(uint8_t value) = 0;
+	virtual size_t write(uint8_t const * buffer, size_t size);
+	size_t write(char const * string);
+	size_t write(char const * buffer, size_t size) { return write(reinterpret_cast<uint8_t const *>(buffer), size); }
+
+	size_t print(__FlashStringHelper const * string);
+	size_t print(char const string[]);
+	size_t print(char value);
+	size_t print(unsigned char value, int base = 10);
+	size_t print(int value, int base = 10);
+	size_t print(unsigned int value, int base = 10);
+	size_t print(long value, int base = 10);
+	size_t print(unsigned long value, int base = 10);
+	size_t print(double value, int digits = 2);
+
+	size_t println();
+	template <typename T>
+	size_t println(T const & value) { return print(value) + println(); }
+	template <typename T>
+	size_t println(T const & value, int format) { return print(value, format) + println(); }
+
+private:
+	size_t _printNumber(unsigned long value, uint8_t base);
+	size_t _printFloat(double value, uint8_t digits);
+};
+
+#endif
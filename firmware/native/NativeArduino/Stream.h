@@ -0,0 +1,14 @@
+#ifndef __NATIVE_STREAM_H__
+#define __NATIVE_STREAM_H__
+
+#include "Print.h"
+
+class Stream: public Print {
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+	virtual void flush() { }
+};
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef __NATIVE_WIRE_H__
+#define __NATIVE_WIRE_H__
+
+#include <Arduino.h>
+
+// the FRAM is the only thing on the bus, and `FRAM_MB85RC_I2C.h` doesn't go
+// through here.
+class TwoWire {
+public:
+	void begin() { }
+	void setClock(uint32_t const clock) { }
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef __NATIVE_AVR_INTERRUPT_H__
+#define __NATIVE_AVR_INTERRUPT_H__
+
+// nothing interrupts the loop on the host
+#define cli()
+#define sei()
+
+#endif
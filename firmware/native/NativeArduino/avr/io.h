@@ -0,0 +1,25 @@
+#ifndef __NATIVE_AVR_IO_H__
+#define __NATIVE_AVR_IO_H__
+
+#include <Board.h>
+
+// the analog comparator, the only registers the firmware touches itself, the
+// rest is behind the other shims. see `native::Comparator`.
+#define ADMUX			(native::board.comparator.admux)
+#define ADCSRA			(native::board.comparator.adcsra)
+#define ADCSRB			(native::board.comparator.adcsrb)
+#define ACSR			(native::board.comparator.acsr)
+
+#define ADEN			(7)
+#define ACME			(6)
+
+#define ACD				(7)
+#define ACBG			(6)
+#define ACO				(5)
+#define ACI				(4)
+#define ACIE			(3)
+#define ACIC			(2)
+#define ACIS1			(1)
+#define ACIS0			(0)
+
+#endif
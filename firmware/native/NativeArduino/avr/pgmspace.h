@@ -0,0 +1,22 @@
+#ifndef __NATIVE_AVR_PGMSPACE_H__
+#define __NATIVE_AVR_PGMSPACE_H__
+
+#include <stdint.h>
+#include <string.h>
+
+// one address space on the host
+#define PROGMEM
+#define PGM_P					char const *
+#define PSTR(s)					(s)
+
+#define pgm_read_byte(address)	(*reinterpret_cast<uint8_t const *>(address))
+#define pgm_read_word(address)	(*reinterpret_cast<uint16_t const *>(address))
+#define pgm_read_dword(address)	(*reinterpret_cast<uint32_t const *>(address))
+#define pgm_read_ptr(address)	(*reinterpret_cast<void * const *>(address))
+
+#define memcpy_P				memcpy
+#define strlen_P				strlen
+#define strcpy_P				strcpy
+#define strcmp_P				strcmp
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef __NATIVE_AVR_POWER_H__
+#define __NATIVE_AVR_POWER_H__
+
+#define power_adc_disable()
+#define power_spi_disable()
+#define power_timer0_disable()
+#define power_timer1_disable()
+#define power_timer2_disable()
+#define power_twi_disable()
+#define power_usart0_disable()
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef __NATIVE_UTILITY_TWI_H__
+#define __NATIVE_UTILITY_TWI_H__
+
+#endif
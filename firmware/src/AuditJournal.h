@@ -0,0 +1,119 @@
+#ifndef __AUDIT_JOURNAL_H__
+#define __AUDIT_JOURNAL_H__
+
+#include <Arduino.h>
+#include <util/crc16.h>
+
+#include "Configuration.h"
+
+// each counter has its own ring of records, a checkpoint writes one record
+// over the counter's oldest one, so a write cut short by a reset leaves the
+// ones before it good.
+#define AUDIT_JOURNAL_SLOTS		(4)
+// record: [ sequence ] [ pending (4) ] [ crc8 ], the crc is seeded with the
+// counter so a blank FRAM doesn't read as a good record.
+#define AUDIT_RECORD_SIZE		(6)
+#define AUDIT_SEED				(0xA0)
+
+// the meter ticks not pulsed yet, checkpointed to the FRAM as they change so
+// a reset in the middle of a long CMD_TICK_AUDIT_COUNTER burst resumes where
+// it was, instead of the meters drifting from the coin counters.
+//
+// a record holds the counter's whole backlog and not a delta, so losing one
+// can't skew the ones after it. the newest good record wins on boot.
+class AuditJournal {
+public:
+	AuditJournal(Configuration & conf):
+		_conf(conf),
+		_next(0),
+		_writes(0)
+	{
+	}
+
+	// the backlog left from before the reset goes to `pending`.
+	__attribute__((always_inline)) inline
+	void begin(uint32_t * const pending) {
+		for (uint8_t counter = 0;counter < NUM_COUNTERS;++counter) {
+			_slots[counter] = AUDIT_JOURNAL_SLOTS - 1;
+			_sequences[counter] = 0;
+			_checkpoints[counter] = 0;
+			bool found = false;
+			for (uint8_t slot = 0;slot < AUDIT_JOURNAL_SLOTS;++slot) {
+				uint8_t record[AUDIT_RECORD_SIZE];
+				_conf.readBytes(_addressOf(counter, slot), AUDIT_RECORD_SIZE, record);
+				if (_checksum(counter, record) != record[AUDIT_RECORD_SIZE - 1])
+					continue;
+				if (!found || (int8_t)(record[0] - _sequences[counter]) > 0) {
+					found = true;
+					_slots[counter] = slot;
+					_sequences[counter] = record[0];
+					memcpy(&_checkpoints[counter], record + 1, sizeof(uint32_t));
+				}
+			}
+			pending[counter] = _checkpoints[counter];
+		}
+	}
+
+	// checkpoints one counter per call, the next one whose backlog moved.
+	template < typename PulseT >
+	__attribute__((always_inline)) inline
+	void service(PulseT const (& counters)[NUM_COUNTERS]) {
+		for (uint8_t i = 0;i < NUM_COUNTERS;++i) {
+			uint8_t const counter = _next;
+			_next = (_next + 1) % NUM_COUNTERS;
+			uint32_t const pending = counters[counter].pending();
+			if (pending != _checkpoints[counter]) {
+				_checkpoint(counter, pending);
+				return;
+			}
+		}
+	}
+
+	// the backlog as the FRAM has it.
+	__attribute__((always_inline)) inline
+	uint32_t getCheckpoint(uint8_t const counter) const {
+		return _checkpoints[counter];
+	}
+
+	__attribute__((always_inline)) inline
+	uint32_t getWrites() const {
+		return _writes;
+	}
+
+private:
+	__attribute__((always_inline)) inline
+	void _checkpoint(uint8_t const counter, uint32_t const & pending) {
+		_slots[counter] = (_slots[counter] + 1) % AUDIT_JOURNAL_SLOTS;
+		++_sequences[counter];
+		_checkpoints[counter] = pending;
+
+		uint8_t record[AUDIT_RECORD_SIZE];
+		record[0] = _sequences[counter];
+		memcpy(record + 1, &pending, sizeof(uint32_t));
+		record[AUDIT_RECORD_SIZE - 1] = _checksum(counter, record);
+		_conf.writeBytes(_addressOf(counter, _slots[counter]), AUDIT_RECORD_SIZE, record);
+		++_writes;
+	}
+
+	static inline
+	uint16_t _addressOf(uint8_t const counter, uint8_t const slot) {
+		return CONF_ADDR_AUDIT_JOURNAL + (counter * AUDIT_JOURNAL_SLOTS + slot) * AUDIT_RECORD_SIZE;
+	}
+
+	static inline
+	uint8_t _checksum(uint8_t const counter, uint8_t const * const record) {
+		uint8_t crc = AUDIT_SEED | counter;
+		for (uint8_t i = 0;i < AUDIT_RECORD_SIZE - 1;++i)
+			crc = _crc8_ccitt_update(crc, record[i]);
+		return crc;
+	}
+
+	Configuration & _conf;
+	uint8_t _slots[NUM_COUNTERS]; // the newest record of each counter
+	uint8_t _sequences[NUM_COUNTERS];
+	uint32_t _checkpoints[NUM_COUNTERS];
+	uint8_t _next;
+	uint32_t _writes;
+};
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef __COIN_RATE_H__
+#define __COIN_RATE_H__
+
+#include <Arduino.h>
+
+#include "util.h"
+#include "Configuration.h"
+
+// the estimate is an exponential moving average with alpha = 1 / 2^COIN_RATE_SHIFT
+#define COIN_RATE_SHIFT			(3)
+// need this many intervals before we trust the estimate
+#define COIN_RATE_MIN_SAMPLES	(4)
+
+// rolling estimate of the interval between coins on an eject track, measured
+// only while the motor is running.
+class CoinRate {
+public:
+	CoinRate():
+		_running(false),
+		_overdue(false),
+		_avg_us(0),
+		_dev_us(0),
+		_samples(0)
+	{
+		resetStats();
+	}
+
+	// the motor is started from a stop, the next coin doesn't make an interval.
+	__attribute__((always_inline)) inline
+	void start() {
+		_running = false;
+	}
+
+	// forget the estimate, the statistics are kept.
+	__attribute__((always_inline)) inline
+	void relearn() {
+		_samples = 0;
+	}
+
+	__attribute__((always_inline)) inline
+	void resetStats() {
+		_min_us = 0xFFFFFFFF;
+		_max_us = 0;
+		_slow = 0;
+		_cuts = 0;
+		_misses = 0;
+	}
+
+	__attribute__((always_inline)) inline
+	void feed(uint32_t const & now) {
+		if (_running) {
+			uint32_t const interval = now - _last_us;
+			if (_samples == 0) {
+				_avg_us = interval;
+				_dev_us = interval >> 2;
+			} else {
+				int32_t const error = interval - _avg_us;
+				_avg_us += error >> COIN_RATE_SHIFT;
+				int32_t const deviation = (error < 0 ? -error : error) - _dev_us;
+				_dev_us += deviation >> COIN_RATE_SHIFT;
+			}
+			if (_samples != 0xFFFF)
+				++_samples;
+			if (interval < _min_us)
+				_min_us = interval;
+			if (interval > _max_us)
+				_max_us = interval;
+		}
+		_running = true;
+		_overdue = false;
+		_last_us = now;
+	}
+
+	// the estimate is good enough to predict the next coin.
+	__attribute__((always_inline)) inline
+	bool stable() const {
+		return _samples >= COIN_RATE_MIN_SAMPLES && (_dev_us << 2) < _avg_us;
+	}
+
+	// true once per coin if it's taking EJECT_SLOW_FACTOR times longer than
+	// what we're expecting.
+	__attribute__((always_inline)) inline
+	bool overdue(uint32_t const & now) {
+		if (_running && !_overdue && _samples >= COIN_RATE_MIN_SAMPLES &&
+			now - _last_us > _avg_us * EJECT_SLOW_FACTOR) {
+			_overdue = true;
+			if (_slow != 0xFFFF)
+				++_slow;
+			return true;
+		}
+		return false;
+	}
+
+	__attribute__((always_inline)) inline
+	void countCut() {
+		if (_cuts != 0xFFFF)
+			++_cuts;
+	}
+
+	__attribute__((always_inline)) inline
+	void countMiss() {
+		if (_misses != 0xFFFF)
+			++_misses;
+	}
+
+	__attribute__((always_inline)) inline uint32_t getLast() const { return _last_us; }
+	__attribute__((always_inline)) inline uint32_t getAverage() const { return _avg_us; }
+	__attribute__((always_inline)) inline uint32_t getDeviation() const { return _dev_us; }
+	__attribute__((always_inline)) inline uint32_t getMin() const { return _min_us; }
+	__attribute__((always_inline)) inline uint32_t getMax() const { return _max_us; }
+	__attribute__((always_inline)) inline uint16_t getSamples() const { return _samples; }
+	__attribute__((always_inline)) inline uint16_t getSlow() const { return _slow; }
+	__attribute__((always_inline)) inline uint16_t getCuts() const { return _cuts; }
+	__attribute__((always_inline)) inline uint16_t getMisses() const { return _misses; }
+
+private:
+	bool _running;
+	bool _overdue;
+	uint32_t _last_us;
+	uint32_t _avg_us;
+	uint32_t _dev_us;
+	uint32_t _min_us;
+	uint32_t _max_us;
+	uint16_t _samples;
+	uint16_t _slow;
+	uint16_t _cuts;
+	uint16_t _misses;
+};
+
+#endif
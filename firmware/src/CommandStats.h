@@ -0,0 +1,171 @@
+#ifndef __COMMAND_STATS_H__
+#define __COMMAND_STATS_H__
+
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+
+#include "util.h"
+#include "Communication.h"
+
+// histogram buckets are powers of 4, starting from 128us:
+//   [0] < 128us, [1] < 512us, [2] < 2048us, [3] >= 2048us
+// a realtime task is due every 500us, see TASKS in main.cpp.
+#define CMD_STATS_BUCKETS				(4)
+#define CMD_STATS_FIRST_BUCKET_SHIFT	(7)
+
+// the totals are kept in steps of 32us, 16 bits hold ~2s per command.
+#define CMD_STATS_STEP_SHIFT			(5)
+
+// slots sent per EVT_CMD_STATS_RESULT, the host asks for the next page. 4 slots
+// are ~75 bytes on the wire, ~3ms of `Serial.write()`.
+#define CMD_STATS_PAGE					(4)
+
+// commands we handle. keep it sorted by opcode, and in sync with
+// COMMAND_HANDLERS in main.cpp.
+static const uint8_t COMMAND_OPCODES[] PROGMEM = {
+	CMD_ACK,
+	CMD_GET_INFO,
+	CMD_GET_KEY_MASKS,
+	CMD_SYNC_CLOCK,
+	CMD_GET_KEYS,
+	CMD_SET_OUTPUT,
+	CMD_GET_COIN_COUNTER,
+	CMD_RESET_COIN_COINTER,
+	CMD_TICK_AUDIT_COUNTER,
+	CMD_GET_AUDIT_BACKLOG,
+	CMD_EJECT_COIN,
+	CMD_SET_TRACK_LEVEL,
+	CMD_SET_EJECT_TIMEOUT,
+	CMD_QUEUE_EJECT_COIN,
+	CMD_GET_EJECT_STATS,
+	CMD_READ_STORAGE,
+	CMD_STREAM_READ_STORAGE,
+	CMD_STREAM_CREDIT,
+	CMD_GET_INTEGRITY_MAP,
+	CMD_KV_GET,
+	CMD_STREAM_ABORT,
+	CMD_WRITE_STORAGE,
+	CMD_STREAM_WRITE_BEGIN,
+	CMD_STREAM_WRITE_CHUNK,
+	CMD_STREAM_WRITE_END,
+	CMD_KV_PUT,
+	CMD_KV_DELETE,
+	CMD_KV_FORMAT,
+	CMD_GET_CMD_STATS,
+	CMD_GET_PERSIST_STATS,
+	CMD_GET_TASK_STATS,
+	CMD_LOAD_TEST,
+	CMD_GET_LOAD_TEST_STATS,
+};
+#define COMMAND_COUNT					(sizeof(COMMAND_OPCODES))
+
+// commands timed on their own: the ones going to the FRAM in the handler, and
+// the heavy ones the host sends in the field. everything else goes into the
+// last slot. keep it sorted by opcode.
+static const uint8_t CMD_STATS_OPCODES[] PROGMEM = {
+	CMD_RESET_COIN_COINTER,
+	CMD_TICK_AUDIT_COUNTER,
+	CMD_EJECT_COIN,
+	CMD_QUEUE_EJECT_COIN,
+	CMD_READ_STORAGE,
+	CMD_GET_INTEGRITY_MAP,
+	CMD_KV_GET,
+	CMD_WRITE_STORAGE,
+	CMD_STREAM_WRITE_CHUNK,
+	CMD_KV_PUT,
+	CMD_KV_DELETE,
+};
+#define CMD_STATS_SLOTS					(sizeof(CMD_STATS_OPCODES) + 1)
+#define CMD_STATS_SLOT_OTHERS			(CMD_STATS_SLOTS - 1)
+
+// binary search in sorted `opcodes`, `count` when `command` isn't there.
+static inline
+uint8_t findOpcode(uint8_t const * const opcodes, uint8_t const count, uint8_t const command) {
+	uint8_t low = 0, high = count;
+	while (low < high) {
+		uint8_t const middle = (low + high) >> 1;
+		uint8_t const opcode = pgm_read_byte(&opcodes[middle]);
+		if (opcode == command)
+			return middle;
+		if (opcode < command)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return count;
+}
+
+class CommandStats {
+public:
+	// the slot stops counting when `count` or `total` saturates, so the average
+	// stays right. reset it then.
+	struct SlotT {
+		uint16_t count;
+		uint16_t total; // in steps of 1 << CMD_STATS_STEP_SHIFT us
+		uint16_t max_us;
+		uint16_t histogram[CMD_STATS_BUCKETS];
+	};
+
+	CommandStats()
+	{
+		reset();
+	}
+
+	__attribute__((always_inline)) inline
+	void reset() {
+		memset(_slots, 0, sizeof(_slots));
+	}
+
+	__attribute__((always_inline)) inline
+	void reset(uint8_t const first, uint8_t const count) {
+		memset(&_slots[first], 0, sizeof(_slots[0]) * count);
+	}
+
+	// the slots of the page starting at `first`.
+	static inline
+	uint8_t pageOf(uint8_t const first) {
+		if (first >= CMD_STATS_SLOTS)
+			return 0;
+		return CMD_STATS_SLOTS - first < CMD_STATS_PAGE ? CMD_STATS_SLOTS - first : CMD_STATS_PAGE;
+	}
+
+	__attribute__((always_inline)) inline
+	void record(uint8_t const index, uint32_t const elapsed_us) {
+		SlotT & slot = _slots[index];
+		if (unlikely(slot.count == 0xFFFF || slot.total == 0xFFFF))
+			return;
+
+		++slot.count;
+		// rounded, so short handlers still add up.
+		uint32_t const total = slot.total + ((elapsed_us + (1 << (CMD_STATS_STEP_SHIFT - 1))) >> CMD_STATS_STEP_SHIFT);
+		slot.total = total > 0xFFFF ? 0xFFFF : total;
+		uint16_t const clamped = elapsed_us > 0xFFFF ? 0xFFFF : elapsed_us;
+		if (clamped > slot.max_us)
+			slot.max_us = clamped;
+
+		uint8_t bucket = 0;
+		for (uint16_t t = clamped >> CMD_STATS_FIRST_BUCKET_SHIFT; t != 0 && bucket < CMD_STATS_BUCKETS - 1; t >>= 2)
+			++bucket;
+		++slot.histogram[bucket]; // can't wrap, `count` stops first
+	}
+
+	__attribute__((always_inline)) inline
+	SlotT const & get(uint8_t const slot) const {
+		return _slots[slot];
+	}
+
+	static inline
+	uint8_t opcodeOf(uint8_t const slot) {
+		return slot < CMD_STATS_SLOT_OTHERS ? pgm_read_byte(&CMD_STATS_OPCODES[slot]) : 0xFF;
+	}
+
+	static inline
+	uint8_t slotOf(uint8_t const command) {
+		return findOpcode(CMD_STATS_OPCODES, CMD_STATS_SLOT_OTHERS, command);
+	}
+
+private:
+	SlotT _slots[CMD_STATS_SLOTS];
+};
+
+#endif
@@ -1,27 +1,68 @@
 #ifndef __COMMUNICATION_H__
 #define __COMMUNICATION_H__
 
+// change this when the wire format changes.
+#define PROTOCOL_VERSION			(20261019L)
+
 #define CMD_ACK						(0x00)
 #define CMD_GET_INFO				(0x01)
 #define CMD_GET_KEY_MASKS			(0x02)
+#define CMD_SYNC_CLOCK				(0x03)
 #define CMD_GET_KEYS				(0x10)
 #define CMD_SET_OUTPUT				(0x11)
 #define CMD_GET_COIN_COUNTER		(0x20)
 #define CMD_RESET_COIN_COINTER		(0x21)
 #define CMD_TICK_AUDIT_COUNTER		(0x30)
+#define CMD_GET_AUDIT_BACKLOG		(0x31)
 #define CMD_EJECT_COIN				(0x40)
 #define CMD_SET_TRACK_LEVEL			(0x41)
 #define CMD_SET_EJECT_TIMEOUT		(0x42)
+#define CMD_QUEUE_EJECT_COIN		(0x43)
+#define CMD_GET_EJECT_STATS			(0x44)
 #define CMD_READ_STORAGE			(0x50)
+#define CMD_STREAM_READ_STORAGE		(0x51)
+#define CMD_STREAM_CREDIT			(0x52)
+#define CMD_GET_INTEGRITY_MAP		(0x53)
+#define CMD_KV_GET					(0x54)
+#define CMD_STREAM_ABORT			(0x57)
 #define CMD_WRITE_STORAGE			(0x58)
+#define CMD_STREAM_WRITE_BEGIN		(0x59)
+#define CMD_STREAM_WRITE_CHUNK		(0x5A)
+#define CMD_STREAM_WRITE_END		(0x5B)
+#define CMD_KV_PUT					(0x5C)
+#define CMD_KV_DELETE				(0x5D)
+#define CMD_KV_FORMAT				(0x5E)
+#define CMD_GET_CMD_STATS			(0x60)
+#define CMD_GET_PERSIST_STATS		(0x61)
+#define CMD_GET_TASK_STATS			(0x62)
+#define CMD_LOAD_TEST				(0x70)
+#define CMD_GET_LOAD_TEST_STATS		(0x71)
 #define CMD_REBOOT					(0xFF)
 
 #define EVT_GET_INFO_RESULT			(0x01)
 #define EVT_KEY_MASKS_RESULT		(0x02)
+#define EVT_SYNC_CLOCK_RESULT		(0x03)
 #define EVT_KEYS_RESULT				(0x10)
 #define EVT_COIN_COUNTER_RESULT		(0x20)
+#define EVT_AUDIT_BACKLOG_RESULT	(0x31)
+#define EVT_EJECT_RESULT			(0x40)
+#define EVT_EJECT_STATS_RESULT		(0x44)
 #define EVT_READ_STORAGE_RESULT		(0x50)
+#define EVT_STREAM_READ_CHUNK		(0x51)
+#define EVT_STREAM_READ_END			(0x52)
+#define EVT_INTEGRITY_MAP_RESULT	(0x53)
+#define EVT_KV_GET_RESULT			(0x54)
 #define EVT_WRITE_STORAGE_RESULT	(0x58)
+#define EVT_STREAM_WRITE_BEGIN_RESULT	(0x59)
+#define EVT_STREAM_WRITE_ACK		(0x5A)
+#define EVT_STREAM_WRITE_RESULT		(0x5B)
+#define EVT_KV_PUT_RESULT			(0x5C)
+#define EVT_KV_DELETE_RESULT		(0x5D)
+#define EVT_KV_FORMAT_RESULT		(0x5E)
+#define EVT_CMD_STATS_RESULT		(0x60)
+#define EVT_PERSIST_STATS_RESULT	(0x61)
+#define EVT_TASK_STATS_RESULT		(0x62)
+#define EVT_LOAD_TEST_RESULT		(0x70)
 #define EVT_BOOT					(0x80)
 #define EVT_DEBUG					(0xFE)
 #define EVT_ERROR					(0xFF)
@@ -33,6 +74,19 @@
 #define ERR_TOO_LONG				(0x05)
 #define ERR_NOT_A_COUNTER			(0x06)
 #define ERR_OUT_OF_RANGE			(0x07)
+#define ERR_EJECT_QUEUE_FULL		(0x08)
+#define ERR_EJECT_SLOW				(0x09)
+#define ERR_STREAM_BUSY				(0x0A)
+#define ERR_NO_STREAM				(0x0B)
+#define ERR_STREAM_SEQUENCE			(0x0C)
+#define ERR_STREAM_CHECKSUM			(0x0D)
+#define ERR_STREAM_OUT_OF_RANGE		(0x0E)
+#define ERR_KV_FULL					(0x0F)
+#define ERR_KV_INVALID				(0x10)
+#define ERR_KV_CORRUPTED			(0x11)
+#define ERR_STORAGE_CORRUPTED		(0x12)
+#define ERR_LOAD_TEST_DENIED		(0x13)
+#define ERR_KV_UNFORMATTED			(0x14)
 #define ERR_UNKNOWN_COMMAND			(0xFF)
 
 #endif
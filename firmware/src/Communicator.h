@@ -1,11 +1,19 @@
 #ifndef __COMMUNICATOR_H__
 #define __COMMUNICATOR_H__
 
+#include <stdarg.h>
+#include <avr/pgmspace.h>
 #include <CmdMessenger.h>
 
+#include "util.h"
 #include "Ports.h"
 #include "Communication.h"
 #include "Configuration.h"
+#include "CommandStats.h"
+#include "CoinRate.h"
+#include "LoadTest.h"
+#include "AuditJournal.h"
+#include "Scheduler.h"
 
 class Communicator {
 public:
@@ -20,131 +28,337 @@ public:
 		_messenger.sendCmdArg(F("Spark"));
 		_messenger.sendCmdArg(F("SLOT-IO-Card"));
 		_messenger.sendCmdArg(F("v0.0.1"));
-		_messenger.sendCmdBinArg<uint32_t>(20170123L);
+		_messenger.sendCmdBinArg<uint32_t>(PROTOCOL_VERSION);
 		_messenger.sendCmdEnd();
 	}
 
-	__attribute__((always_inline)) inline
+	inline
 	void dispatchBoot() {
-		_messenger.sendCmdStart(EVT_BOOT);
-		_messenger.sendCmdBinArg<uint32_t>(20170123L);
-		_messenger.sendCmdEnd();
+		_dispatch(EVT_BOOT, PSTR("l"), (uint32_t)PROTOCOL_VERSION);
 	}
 
-	__attribute__((always_inline)) inline
-	void dispatchCoinCounterResult(uint8_t const track, uint32_t const & coins) {
-		_messenger.sendCmdStart(EVT_COIN_COUNTER_RESULT);
-		_messenger.sendCmdBinArg<uint8_t>(track);
-		_messenger.sendCmdBinArg<uint32_t>(coins);
-		_messenger.sendCmdEnd();
+	inline
+	void dispatchSyncClockResult(uint32_t const & sequence, uint32_t const & now = micros()) {
+		_dispatch(EVT_SYNC_CLOCK_RESULT, PSTR("ll"), sequence, now);
+	}
+
+	inline
+	void dispatchCoinCounterResult(uint8_t const track, uint32_t const & coins, uint32_t const & now = micros()) {
+		_dispatch(EVT_COIN_COUNTER_RESULT, PSTR("bll"), track, coins, now);
+	}
+
+	inline
+	void dispatchEjectResult(uint8_t const track, uint8_t const id, uint8_t const requested, uint8_t const remaining, uint32_t const & now = micros()) {
+		_dispatch(EVT_EJECT_RESULT, PSTR("bbbbl"), track, id, requested, remaining, now);
+	}
+
+	inline
+	void dispatchEjectStatsResult(uint8_t const track, CoinRate const & rate) {
+		_dispatch(EVT_EJECT_STATS_RESULT, PSTR("bwllllwww"), track,
+			rate.getSamples(), rate.getAverage(), rate.getDeviation(), rate.getMin(), rate.getMax(),
+			rate.getSlow(), rate.getCuts(), rate.getMisses());
 	}
 
 	__attribute__((always_inline)) inline
 	void dispatchKeyMasksResult() {
 		_messenger.sendCmdStart(EVT_KEY_MASKS_RESULT);
-		_messenger.sendCmdBinArg<uint8_t>(3); // length
-		_messenger.sendCmdBinArg<uint8_t>(IN_MASK_0);
-		_messenger.sendCmdBinArg<uint8_t>(IN_MASK_1);
-		_messenger.sendCmdBinArg<uint8_t>(IN_MASK_2);
+		_messenger.sendCmdBinArg<uint8_t>(IO_CHAIN_LENGTH); // length
+		unroll<IO_CHAIN_LENGTH>([this](uint8_t const i) {
+			_messenger.sendCmdBinArg<uint8_t>(inMask(i));
+		});
+		_messenger.sendCmdBinArg<uint8_t>(IO_CHAIN_LENGTH); // length
+		unroll<IO_CHAIN_LENGTH>([this](uint8_t const i) {
+			_messenger.sendCmdBinArg<uint8_t>(outMask(i));
+		});
 		_messenger.sendCmdEnd();
 	}
 
-	__attribute__((always_inline)) inline
-	void dispatchKeysResult(uint8_t const length, uint8_t const * const keys) {
-		_messenger.sendCmdStart(EVT_KEYS_RESULT);
-		_messenger.sendCmdBinArg<uint8_t>(length);
-		for (uint8_t i = 0;i < length;++i)
-			_messenger.sendCmdBinArg<uint8_t>(keys[i]);
-		_messenger.sendCmdEnd();
+	inline
+	void dispatchKeysResult(uint8_t const length, uint8_t const * const keys, uint32_t const & now = micros()) {
+		_dispatch(EVT_KEYS_RESULT, PSTR("nl"), length, keys, now);
 	}
 
-	__attribute__((always_inline)) inline
+	inline
 	void dispatchWriteStorageResult(uint16_t const & address, uint8_t const length) {
-		_messenger.sendCmdStart(EVT_WRITE_STORAGE_RESULT);
-		_messenger.sendCmdBinArg<uint16_t>(address);
-		_messenger.sendCmdBinArg<uint8_t>(length);
-		_messenger.sendCmdEnd();
+		_dispatch(EVT_WRITE_STORAGE_RESULT, PSTR("wb"), address, length);
 	}
 
-	__attribute__((always_inline)) inline
+	inline
 	void dispatchReadStorageResult(uint16_t const & address, uint8_t const length, uint8_t const * const buffer) {
-		_messenger.sendCmdStart(EVT_READ_STORAGE_RESULT);
-		_messenger.sendCmdBinArg<uint16_t>(address);
-		_messenger.sendCmdBinArg<uint8_t>(length);
-		for (uint8_t i = 0;i < length;++i)
-			_messenger.sendCmdBinArg<uint8_t>(buffer[i]);
-		_messenger.sendCmdEnd();
+		_dispatch(EVT_READ_STORAGE_RESULT, PSTR("wn"), address, length, buffer);
+	}
+
+	inline
+	void dispatchStreamReadChunk(uint16_t const & address, uint8_t const length, uint8_t const * const buffer, uint8_t const crc) {
+		_dispatch(EVT_STREAM_READ_CHUNK, PSTR("wnb"), address, length, buffer, crc);
+	}
+
+	inline
+	void dispatchStreamReadEnd(uint16_t const & address, uint16_t const & length, uint16_t const & crc) {
+		_dispatch(EVT_STREAM_READ_END, PSTR("www"), address, length, crc);
+	}
+
+	inline
+	void dispatchStreamWriteBeginResult(uint16_t const & address, uint16_t const & length, uint8_t const window) {
+		_dispatch(EVT_STREAM_WRITE_BEGIN_RESULT, PSTR("wwb"), address, length, window);
+	}
+
+	inline
+	void dispatchStreamWriteAck(uint16_t const & next) {
+		_dispatch(EVT_STREAM_WRITE_ACK, PSTR("w"), next);
+	}
+
+	inline
+	void dispatchStreamWriteResult(uint16_t const & address, uint16_t const & length, uint16_t const & crc, bool const good) {
+		_dispatch(EVT_STREAM_WRITE_RESULT, PSTR("wwwb"), address, length, crc, good);
+	}
+
+	inline
+	void dispatchIntegrityMapResult(uint16_t const & address, uint8_t const block_size, uint8_t const blocks, bool const sealed, uint16_t const & passes, uint8_t const * const map) {
+		_dispatch(EVT_INTEGRITY_MAP_RESULT, PSTR("wbbbwp"), address, block_size, blocks, sealed, passes, (blocks + 7) / 8, map);
+	}
+
+	inline
+	void dispatchKvGetResult(uint16_t const & key, bool const found, uint8_t const length, uint8_t const * const value) {
+		_dispatch(EVT_KV_GET_RESULT, PSTR("wbn"), key, found, length, value);
+	}
+
+	inline
+	void dispatchKvPutResult(uint16_t const & key, uint8_t const length, uint16_t const & free) {
+		_dispatch(EVT_KV_PUT_RESULT, PSTR("wbw"), key, length, free);
 	}
 
+	inline
+	void dispatchKvDeleteResult(uint16_t const & key, bool const found) {
+		_dispatch(EVT_KV_DELETE_RESULT, PSTR("wb"), key, found);
+	}
+
+	inline
+	void dispatchKvFormatResult(bool const formatted, uint16_t const & user_end, uint16_t const & free) {
+		_dispatch(EVT_KV_FORMAT_RESULT, PSTR("bww"), formatted, user_end, free);
+	}
+
+	// one page of the slots, the whole table would block the loop past the
+	// watchdog.
 	__attribute__((always_inline)) inline
-	void dispatchErrorEjectInterrupted(uint8_t const track, uint8_t const count) {
-		_messenger.sendCmdStart(EVT_ERROR);
-		_messenger.sendCmdBinArg<uint8_t>(ERR_EJECT_INTERRUPTED);
-		_messenger.sendCmdBinArg<uint8_t>(track);
+	void dispatchCmdStatsResult(CommandStats const & stats, uint8_t const first, uint8_t const count) {
+		_messenger.sendCmdStart(EVT_CMD_STATS_RESULT);
+		_messenger.sendCmdBinArg<uint8_t>(CMD_STATS_SLOTS);
+		_messenger.sendCmdBinArg<uint8_t>(CMD_STATS_BUCKETS);
+		_messenger.sendCmdBinArg<uint8_t>(first);
 		_messenger.sendCmdBinArg<uint8_t>(count);
+		for (uint8_t i = first;i < first + count;++i) {
+			CommandStats::SlotT const & slot = stats.get(i);
+			_messenger.sendCmdBinArg<uint8_t>(CommandStats::opcodeOf(i));
+			_messenger.sendCmdBinArg<uint16_t>(slot.count);
+			_messenger.sendCmdBinArg<uint32_t>((uint32_t)slot.total << CMD_STATS_STEP_SHIFT); // us
+			_messenger.sendCmdBinArg<uint16_t>(slot.max_us);
+			for (uint8_t b = 0;b < CMD_STATS_BUCKETS;++b)
+				_messenger.sendCmdBinArg<uint16_t>(slot.histogram[b]);
+		}
 		_messenger.sendCmdEnd();
 	}
 
+	// the meter ticks not pulsed yet, and the checkpoints of them in the FRAM.
 	__attribute__((always_inline)) inline
-	void dispatchErrorEjectTimeout(uint8_t const track, uint8_t const coins) {
-		_messenger.sendCmdStart(EVT_ERROR);
-		_messenger.sendCmdBinArg<uint8_t>(ERR_EJECT_TIMEOUT);
-		_messenger.sendCmdBinArg<uint8_t>(track);
-		_messenger.sendCmdBinArg<uint8_t>(coins);
+	void dispatchAuditBacklogResult(uint32_t const * const pending, AuditJournal const & journal) {
+		_messenger.sendCmdStart(EVT_AUDIT_BACKLOG_RESULT);
+		_messenger.sendCmdBinArg<uint8_t>(NUM_COUNTERS);
+		for (uint8_t i = 0;i < NUM_COUNTERS;++i) {
+			_messenger.sendCmdBinArg<uint32_t>(pending[i]);
+			_messenger.sendCmdBinArg<uint32_t>(journal.getCheckpoint(i));
+		}
+		_messenger.sendCmdBinArg<uint32_t>(journal.getWrites());
 		_messenger.sendCmdEnd();
 	}
 
+	inline
+	void dispatchPersistStatsResult(bool const enabled, bool const failed, Configuration::PersistStatsT const & stats) {
+		_dispatch(EVT_PERSIST_STATS_RESULT, PSTR("bbwwwllb"), enabled, stats.restored,
+			stats.flushes, stats.last_us, stats.max_us, stats.changes, stats.writebacks, failed);
+	}
+
 	__attribute__((always_inline)) inline
-	void dispatchErrorNotATrack(uint8_t const track) {
-		_messenger.sendCmdStart(EVT_ERROR);
-		_messenger.sendCmdBinArg<uint8_t>(ERR_NOT_A_TRACK);
-		_messenger.sendCmdBinArg<uint8_t>(track);
+	void dispatchTaskStatsResult(Scheduler const & scheduler, uint8_t const i) {
+		_messenger.sendCmdStart(EVT_TASK_STATS_RESULT);
+		_messenger.sendCmdBinArg<uint32_t>(scheduler.getPasses());
+		_messenger.sendCmdBinArg<uint32_t>(scheduler.getIdle());
+		_messenger.sendCmdBinArg<uint8_t>(scheduler.getCount());
+		_messenger.sendCmdBinArg<uint8_t>(i);
+		// one task per frame, the whole table takes longer to send than the
+		// watchdog waits.
+		if (i < scheduler.getCount()) {
+			TaskT task;
+			scheduler.getTask(i, task);
+			Scheduler::StatsT const & stats = scheduler.get(i);
+			_messenger.sendCmdBinArg<uint8_t>(task.flags);
+			_messenger.sendCmdBinArg<uint16_t>(task.period_us);
+			_messenger.sendCmdBinArg<uint16_t>(task.budget_us);
+			_messenger.sendCmdBinArg<uint32_t>(stats.runs);
+			_messenger.sendCmdBinArg<uint32_t>(stats.total_us);
+			_messenger.sendCmdBinArg<uint16_t>(stats.max_us);
+			_messenger.sendCmdBinArg<uint16_t>(stats.overruns);
+			_messenger.sendCmdBinArg<uint16_t>(stats.misses);
+		}
 		_messenger.sendCmdEnd();
 	}
 
-	__attribute__((always_inline)) inline
+	inline
+	void dispatchLoadTestResult(LoadTest const & test) {
+		LoadTest::StatsT const & stats = test.getStats();
+		_dispatch(EVT_LOAD_TEST_RESULT, PSTR("blllllll"), test.getMode(), stats.elapsed_us, stats.loops,
+			stats.key_edges, stats.key_events, stats.coins, stats.coin_events, stats.tx_stalls);
+	}
+
+	inline
+	void dispatchErrorEjectInterrupted(uint8_t const track, uint8_t const count) {
+		_dispatch(EVT_ERROR, PSTR("bbbt"), ERR_EJECT_INTERRUPTED, track, count);
+	}
+
+	inline
+	void dispatchErrorEjectTimeout(uint8_t const track, uint8_t const coins) {
+		_dispatch(EVT_ERROR, PSTR("bbbt"), ERR_EJECT_TIMEOUT, track, coins);
+	}
+
+	inline
+	void dispatchErrorEjectQueueFull(uint8_t const track, uint8_t const id) {
+		_dispatch(EVT_ERROR, PSTR("bbbt"), ERR_EJECT_QUEUE_FULL, track, id);
+	}
+
+	inline
+	void dispatchErrorEjectSlow(uint8_t const track, uint32_t const & elapsed, uint32_t const & average, uint32_t const & now = micros()) {
+		_dispatch(EVT_ERROR, PSTR("bblll"), ERR_EJECT_SLOW, track, elapsed, average, now);
+	}
+
+	inline
+	void dispatchErrorNotATrack(uint8_t const track) {
+		_dispatch(EVT_ERROR, PSTR("bbt"), ERR_NOT_A_TRACK, track);
+	}
+
+	inline
 	void dispatchErrorNotACounter(uint8_t const counter) {
-		_messenger.sendCmdStart(EVT_ERROR);
-		_messenger.sendCmdBinArg<uint8_t>(ERR_NOT_A_COUNTER);
-		_messenger.sendCmdBinArg<uint8_t>(counter);
-		_messenger.sendCmdEnd();
+		_dispatch(EVT_ERROR, PSTR("bbt"), ERR_NOT_A_COUNTER, counter);
 	}
 
-	__attribute__((always_inline)) inline
+	inline
 	void dispatchErrorProtectedStorage(uint16_t const & address) {
-		_messenger.sendCmdStart(EVT_ERROR);
-		_messenger.sendCmdBinArg<uint8_t>(ERR_PROTECTED_STORAGE);
-		_messenger.sendCmdBinArg<uint16_t>(address);
-		_messenger.sendCmdEnd();
+		_dispatch(EVT_ERROR, PSTR("bwt"), ERR_PROTECTED_STORAGE, address);
 	}
 
-	__attribute__((always_inline)) inline
+	inline
 	void dispatchErrorTooLong(uint8_t const length) {
-		_messenger.sendCmdStart(EVT_ERROR);
-		_messenger.sendCmdBinArg<uint8_t>(ERR_TOO_LONG);
-		_messenger.sendCmdBinArg<uint8_t>(MAX_BYTES_LENGTH);
-		_messenger.sendCmdBinArg<uint8_t>(length);
-		_messenger.sendCmdEnd();
+		_dispatch(EVT_ERROR, PSTR("bbbt"), ERR_TOO_LONG, MAX_BYTES_LENGTH, length);
 	}
 
-	__attribute__((always_inline)) inline
+	inline
 	void dispatchErrorOutOfRange(uint16_t const & address, uint8_t const length) {
-		_messenger.sendCmdStart(EVT_ERROR);
-		_messenger.sendCmdBinArg<uint8_t>(ERR_OUT_OF_RANGE);
-		_messenger.sendCmdBinArg<uint16_t>(address);
-		_messenger.sendCmdBinArg<uint8_t>(length);
-		_messenger.sendCmdEnd();
+		_dispatch(EVT_ERROR, PSTR("bwbt"), ERR_OUT_OF_RANGE, address, length);
 	}
 
-	__attribute__((always_inline)) inline
+	inline
+	void dispatchErrorStreamBusy() {
+		_dispatch(EVT_ERROR, PSTR("bt"), ERR_STREAM_BUSY);
+	}
+
+	inline
+	void dispatchErrorNoStream() {
+		_dispatch(EVT_ERROR, PSTR("bt"), ERR_NO_STREAM);
+	}
+
+	inline
+	void dispatchErrorStreamSequence(uint16_t const & expected, uint16_t const & address) {
+		_dispatch(EVT_ERROR, PSTR("bwwt"), ERR_STREAM_SEQUENCE, expected, address);
+	}
+
+	inline
+	void dispatchErrorStreamChecksum(uint16_t const & address) {
+		_dispatch(EVT_ERROR, PSTR("bwt"), ERR_STREAM_CHECKSUM, address);
+	}
+
+	inline
+	void dispatchErrorStreamOutOfRange(uint16_t const & address, uint16_t const & length) {
+		_dispatch(EVT_ERROR, PSTR("bwwt"), ERR_STREAM_OUT_OF_RANGE, address, length);
+	}
+
+	inline
+	void dispatchErrorKvFull(uint16_t const & key, uint16_t const & free) {
+		_dispatch(EVT_ERROR, PSTR("bwwt"), ERR_KV_FULL, key, free);
+	}
+
+	inline
+	void dispatchErrorKvInvalid(uint16_t const & key, uint8_t const length) {
+		_dispatch(EVT_ERROR, PSTR("bwbt"), ERR_KV_INVALID, key, length);
+	}
+
+	inline
+	void dispatchErrorKvCorrupted(uint16_t const & key) {
+		_dispatch(EVT_ERROR, PSTR("bwt"), ERR_KV_CORRUPTED, key);
+	}
+
+	inline
+	void dispatchErrorKvUnformatted(uint16_t const & key) {
+		_dispatch(EVT_ERROR, PSTR("bwt"), ERR_KV_UNFORMATTED, key);
+	}
+
+	inline
+	void dispatchErrorStorageCorrupted(uint16_t const & address) {
+		_dispatch(EVT_ERROR, PSTR("bwt"), ERR_STORAGE_CORRUPTED, address);
+	}
+
+	inline
+	void dispatchErrorLoadTestDenied(uint8_t const command) {
+		_dispatch(EVT_ERROR, PSTR("bbt"), ERR_LOAD_TEST_DENIED, command);
+	}
+
+	inline
 	void dispatchErrorUnknownCommand(uint8_t const command) {
-		_messenger.sendCmdStart(EVT_ERROR);
-		_messenger.sendCmdBinArg<uint8_t>(ERR_UNKNOWN_COMMAND);
-		_messenger.sendCmdBinArg<uint8_t>(command);
-		_messenger.sendCmdEnd();
+		_dispatch(EVT_ERROR, PSTR("bbt"), ERR_UNKNOWN_COMMAND, command);
 	}
 
 private:
+	// sends an event, the arguments are described by `schema`, a string in
+	// flash with a character per argument:
+	//   'b' uint8_t or bool, 'w' uint16_t, 'l' uint32_t,
+	//   'n' a buffer, passed as its length then a pointer, sent with the length,
+	//   'p' same as 'n', but only the bytes are sent,
+	//   't' micros(), takes no argument.
+	// the send sequence is only compiled here, instead of at every call site.
+	__attribute__((noinline))
+	void _dispatch(uint8_t const event, char const * schema, ...) {
+		va_list args;
+		va_start(args, schema);
+		_messenger.sendCmdStart(event);
+		for (char type = pgm_read_byte(schema);type != '\0';type = pgm_read_byte(++schema)) {
+			switch (type) {
+				case 'b':
+					_messenger.sendCmdBinArg<uint8_t>(va_arg(args, int));
+					break;
+				case 'w':
+					_messenger.sendCmdBinArg<uint16_t>(va_arg(args, unsigned int));
+					break;
+				case 'l':
+					_messenger.sendCmdBinArg<uint32_t>(va_arg(args, uint32_t));
+					break;
+				case 'n':
+				case 'p':
+					{
+						uint8_t const length = va_arg(args, int);
+						uint8_t const * const buffer = va_arg(args, uint8_t const *);
+						if (type == 'n')
+							_messenger.sendCmdBinArg<uint8_t>(length);
+						for (uint8_t i = 0;i < length;++i)
+							_messenger.sendCmdBinArg<uint8_t>(buffer[i]);
+					}
+					break;
+				case 't':
+					_messenger.sendCmdBinArg<uint32_t>(micros());
+					break;
+			}
+		}
+		_messenger.sendCmdEnd();
+		va_end(args);
+	}
+
 	CmdMessenger & _messenger;
 };
 
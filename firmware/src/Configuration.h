@@ -21,6 +21,13 @@
 #define CONF_ADDR_BANK_0				(CONF_ADDR_BEGIN)
 #define CONF_ADDR_BANK_1				(CONF_ADDR_BANK_0 + 0x0100)
 #define CONF_ADDR_USER_BEGIN			(CONF_ADDR_BANK_1 + 0x0100)
+#define CONF_ADDR_USER_END				(0x3700)
+// the top of the FRAM is user area too until the host formats it (CMD_KV_FORMAT)
+#define CONF_ADDR_CRC_TABLE				(CONF_ADDR_USER_END) // CRCs of the user area blocks
+#define CONF_ADDR_KV_STORE				(0x3800) // the rest is the key/value store
+#define CONF_ADDR_PERSIST				(CONF_ADDR_BANK_0 + 0x0080) // the power-fail record, in bank 0's reserved bytes
+#define CONF_ADDR_PERSIST_STATS			(CONF_ADDR_BANK_0 + 0x00C0) // how long the power-fail flushes took
+#define CONF_ADDR_AUDIT_JOURNAL			(CONF_ADDR_BANK_1 + 0x0080) // meter ticks not pulsed yet, in bank 1's reserved bytes
 
 #define TRACK_EJECT				(0)
 #define TRACK_TICKET			(1)
@@ -34,6 +41,7 @@
 #define COUNTER_INSERT			(2)
 #define COUNTER_EJECT			(3)
 #define COUNTER_NOT_A_COUNTER	(0xFF)
+#define NUM_COUNTERS			(4)
 
 //                             Eject -----+
 //                            Ticket ----+|
@@ -44,6 +52,12 @@
 #define TRACK_LEVELS_DEFAULT	(0b11111110)
 
 #define EJECT_TIMEOUT_DEFAULT	(10000000L) // us
+#define EJECT_QUEUE_DEPTH		(4) // requests per track, including the one being paid out
+#define EJECT_SLOW_FACTOR		(2) // a coin taking this many times the average interval is late
+#define EJECT_CUTOFF_LEAD		(0L) // us, cut the SSR this much earlier to make up for the motor coasting
+
+#define PERSIST_MARKER				(0xA5) // the power-fail record holds counters newer than the banks
+#define PERSIST_WRITEBACK_INTERVAL	(250000L) // us, the counters kept in RAM are written back this often
 
 #define MAX_BYTES_LENGTH		(64)
 #define MAX_STORAGE_ADDRESS		(16384u)
@@ -64,7 +78,19 @@ public:
 		uint8_t bytes;
 	};
 
+	struct PersistStatsT {
+		uint32_t changes; // counter updates kept in RAM
+		uint32_t writebacks; // of the counters kept in RAM to the banks
+		uint16_t flushes; // power-fail flushes, these 3 are kept in the FRAM
+		uint16_t last_us;
+		uint16_t max_us;
+		bool restored; // this boot picked up a power-fail record
+	};
+
 	Configuration():
+		_dirty(false),
+		_stale(false),
+		_persist_stats(),
 		_fram(MB85RC_DEFAULT_ADDRESS, true, /* WP */ A7, 16 /* kb */)
 	{
 	}
@@ -158,6 +184,96 @@ public:
 		}
 
 		dumpBuffer("_data", _data.bytes, sizeof(ConfigDataT));
+
+		FlushStatsT flush_stats;
+		_fram.readFrom(CONF_ADDR_PERSIST_STATS, flush_stats);
+		if (flush_stats.crc == _crc(reinterpret_cast<uint8_t const *>(&flush_stats), sizeof(flush_stats) - 1)) {
+			_persist_stats.flushes = flush_stats.flushes;
+			_persist_stats.last_us = flush_stats.last_us;
+			_persist_stats.max_us = flush_stats.max_us;
+		}
+	}
+
+	// picks up the record the last power failure left, if any: the counters go
+	// to both banks, and the meter ticks that weren't pulsed yet to `pulses`.
+	__attribute__((always_inline)) inline
+	bool restore(uint32_t * const pulses) {
+		PersistT record;
+		_fram.readFrom(CONF_ADDR_PERSIST, record);
+		_persist_stats.restored = record.marker == PERSIST_MARKER &&
+			record.crc == _crc(reinterpret_cast<uint8_t const *>(&record), sizeof(record) - 1);
+		if (_persist_stats.restored) {
+			memcpy(_data.configs.coins_to_eject, record.coins_to_eject, sizeof(record.coins_to_eject));
+			memcpy(_data.configs.coin_count, record.coin_count, sizeof(record.coin_count));
+			memcpy(pulses, record.pulses, sizeof(record.pulses));
+			writeBack();
+			discardPersisted();
+			dumpBuffer("restored", _data.bytes, sizeof(ConfigDataT));
+		}
+		return _persist_stats.restored;
+	}
+
+	// the power's going: the counters kept in RAM and the meter ticks still to
+	// pulse, in one sequential write. `since` is when the warning came, the
+	// time it took goes in the stats.
+	__attribute__((always_inline)) inline
+	void persist(uint32_t const * const pulses, uint32_t const & since) {
+		_persist(pulses);
+
+		uint32_t const elapsed = micros() - since;
+		_persist_stats.last_us = elapsed > 0xFFFF ? 0xFFFF : elapsed;
+		if (_persist_stats.last_us > _persist_stats.max_us)
+			_persist_stats.max_us = _persist_stats.last_us;
+		++_persist_stats.flushes;
+		_saveFlushStats();
+	}
+
+	// the counters changed while the supply's still low: the record follows
+	// them, the banks wait for the supply to come back.
+	__attribute__((always_inline)) inline
+	void persistChanges(uint32_t const * const pulses) {
+		if (_stale)
+			_persist(pulses);
+	}
+
+	// the supply came back, or the record's been restored: the banks are good
+	// again.
+	__attribute__((always_inline)) inline
+	void discardPersisted() {
+		uint8_t const marker = 0;
+		_fram.writeTo(CONF_ADDR_PERSIST, marker);
+	}
+
+	// with POWER_FAIL_CHANNEL the coin counters stay in RAM, they're written
+	// back every PERSIST_WRITEBACK_INTERVAL while they change, so a reset that
+	// isn't a power failure (the watchdog) loses that much at most. the hopper
+	// path writes them back after each coin paid out.
+	__attribute__((always_inline)) inline
+	void service() {
+		if (_dirty && micros() - _dirty_us >= PERSIST_WRITEBACK_INTERVAL)
+			writeBack();
+	}
+
+	__attribute__((always_inline)) inline
+	void writeBack() {
+		_data.configs.crc = _getChecksum();
+		_fram.writeTo(CONF_ADDR_BANK_0, _data.configs);
+		_fram.writeTo(CONF_ADDR_BANK_1, _data.configs);
+		_dirty = false;
+		++_persist_stats.writebacks;
+	}
+
+	__attribute__((always_inline)) inline
+	PersistStatsT const & getPersistStats() const {
+		return _persist_stats;
+	}
+
+	__attribute__((always_inline)) inline
+	void resetPersistStats() {
+		bool const restored = _persist_stats.restored;
+		memset(&_persist_stats, 0, sizeof(_persist_stats));
+		_persist_stats.restored = restored;
+		_saveFlushStats();
 	}
 
 	__attribute__((always_inline)) inline
@@ -167,6 +283,11 @@ public:
 
 	__attribute__((always_inline)) inline
 	void setTrackLevel(uint8_t const track, bool const level) {
+		#if defined(POWER_FAIL_CHANNEL)
+		// the crc covers the counters kept in RAM too
+		if (_dirty)
+			writeBack();
+		#endif
 		bitSet(_data.configs.track_levels.bytes, track);
 		_data.configs.crc = _getChecksum();
 		_fram.writeTo(CONF_ADDR_BANK_0 + (reinterpret_cast<uint8_t const * const>(&_data.configs.track_levels) - reinterpret_cast<uint8_t const * const>(&_data.configs)), _data.configs.track_levels);
@@ -189,11 +310,15 @@ public:
 	__attribute__((always_inline)) inline
 	void setCoinsToEject(uint8_t const track, uint8_t const coins) {
 		_data.configs.coins_to_eject[track] = coins;
+		#if defined(POWER_FAIL_CHANNEL)
+		_defer();
+		#else
 		_data.configs.crc = _getChecksum();
 		_fram.writeTo(CONF_ADDR_BANK_0 + (reinterpret_cast<uint8_t const * const>(&(_data.configs.coins_to_eject[track])) - reinterpret_cast<uint8_t const * const>(&_data.configs)), coins);
 		_fram.writeTo(CONF_ADDR_BANK_0 + (reinterpret_cast<uint8_t const * const>(&_data.configs.crc) - reinterpret_cast<uint8_t const * const>(&_data.configs)), _data.configs.crc);
 		_fram.writeTo(CONF_ADDR_BANK_1 + (reinterpret_cast<uint8_t const * const>(&(_data.configs.coins_to_eject[track])) - reinterpret_cast<uint8_t const * const>(&_data.configs)), coins);
 		_fram.writeTo(CONF_ADDR_BANK_1 + (reinterpret_cast<uint8_t const * const>(&_data.configs.crc) - reinterpret_cast<uint8_t const * const>(&_data.configs)), _data.configs.crc);
+		#endif
 		dumpBuffer("_data", _data.bytes, sizeof(ConfigDataT));
 	}
 
@@ -205,11 +330,15 @@ public:
 	__attribute__((always_inline)) inline
 	void setCoinCount(uint8_t const track, uint32_t const & count) {
 		_data.configs.coin_count[track] = count;
+		#if defined(POWER_FAIL_CHANNEL)
+		_defer();
+		#else
 		_data.configs.crc = _getChecksum();
 		_fram.writeTo(CONF_ADDR_BANK_0 + (reinterpret_cast<uint8_t const * const>(&(_data.configs.coin_count[track])) - reinterpret_cast<uint8_t const * const>(&_data.configs)), count);
 		_fram.writeTo(CONF_ADDR_BANK_0 + (reinterpret_cast<uint8_t const * const>(&_data.configs.crc) - reinterpret_cast<uint8_t const * const>(&_data.configs)), _data.configs.crc);
 		_fram.writeTo(CONF_ADDR_BANK_1 + (reinterpret_cast<uint8_t const * const>(&(_data.configs.coin_count[track])) - reinterpret_cast<uint8_t const * const>(&_data.configs)), count);
 		_fram.writeTo(CONF_ADDR_BANK_1 + (reinterpret_cast<uint8_t const * const>(&_data.configs.crc) - reinterpret_cast<uint8_t const * const>(&_data.configs)), _data.configs.crc);
+		#endif
 		dumpBuffer("_data", _data.bytes, sizeof(ConfigDataT));
 	}
 
@@ -220,6 +349,11 @@ public:
 
 	__attribute__((always_inline)) inline
 	void setEjectTimeout(uint8_t const track, uint32_t const & timeout) {
+		#if defined(POWER_FAIL_CHANNEL)
+		// the crc covers the counters kept in RAM too
+		if (_dirty)
+			writeBack();
+		#endif
 		_data.configs.eject_timeout[track] = timeout;
 		_data.configs.crc = _getChecksum();
 		_fram.writeTo(CONF_ADDR_BANK_0 + (reinterpret_cast<uint8_t const * const>(&(_data.configs.eject_timeout[track])) - reinterpret_cast<uint8_t const * const>(&_data.configs)), timeout);
@@ -260,6 +394,46 @@ public:
 	}
 
 private:
+	// the change stays in RAM until `service()` or `persist()`.
+	__attribute__((always_inline)) inline
+	void _defer() {
+		if (!_dirty) {
+			_dirty = true;
+			_dirty_us = micros();
+		}
+		_stale = true;
+		++_persist_stats.changes;
+	}
+
+	__attribute__((always_inline)) inline
+	void _persist(uint32_t const * const pulses) {
+		PersistT record;
+		record.marker = PERSIST_MARKER;
+		memcpy(record.coins_to_eject, _data.configs.coins_to_eject, sizeof(record.coins_to_eject));
+		memcpy(record.coin_count, _data.configs.coin_count, sizeof(record.coin_count));
+		memcpy(record.pulses, pulses, sizeof(record.pulses));
+		record.crc = _crc(reinterpret_cast<uint8_t const *>(&record), sizeof(record) - 1);
+		_fram.writeTo(CONF_ADDR_PERSIST, record);
+		_stale = false;
+	}
+
+	__attribute__((always_inline)) inline
+	void _saveFlushStats() {
+		FlushStatsT flush_stats;
+		flush_stats.flushes = _persist_stats.flushes;
+		flush_stats.last_us = _persist_stats.last_us;
+		flush_stats.max_us = _persist_stats.max_us;
+		flush_stats.crc = _crc(reinterpret_cast<uint8_t const *>(&flush_stats), sizeof(flush_stats) - 1);
+		_fram.writeTo(CONF_ADDR_PERSIST_STATS, flush_stats);
+	}
+
+	static uint8_t _crc(uint8_t const * const bytes, uint8_t const length) {
+		uint8_t crc = CONF_VERSION;
+		for (uint8_t i = 0;i < length;++i)
+			crc = _crc8_ccitt_update(crc, bytes[i]);
+		return crc;
+	}
+
 	__attribute__((always_inline, optimize("unroll-loops"))) inline
 	uint8_t _getChecksum() {
 		#if defined(DEBUG_SERIAL)
@@ -281,7 +455,9 @@ private:
 		return crc;
 	}
 
-	struct ConfigDataT {
+	// packed so the layout in the FRAM is the same on any target, AVR doesn't
+	// pad but the host build of the firmware does.
+	struct __attribute__((packed)) ConfigDataT {
 		union TrackLevelsT track_levels;
 
 		uint8_t coins_to_eject[NUM_EJECT_TRACKS];
@@ -296,6 +472,27 @@ private:
 		struct ConfigDataT configs;
 	} _data;
 
+	// the power-fail record, see `persist()`.
+	struct __attribute__((packed)) PersistT {
+		uint8_t marker;
+		uint8_t coins_to_eject[NUM_EJECT_TRACKS];
+		uint32_t coin_count[NUM_TRACKS];
+		uint32_t pulses[NUM_COUNTERS];
+		uint8_t crc;
+	};
+
+	struct __attribute__((packed)) FlushStatsT {
+		uint16_t flushes;
+		uint16_t last_us;
+		uint16_t max_us;
+		uint8_t crc;
+	};
+
+	bool _dirty;
+	bool _stale; // the power-fail record is behind the counters
+	uint32_t _dirty_us;
+	PersistStatsT _persist_stats;
+
 	// FIXME: hardware layout connects WP to A7, but A7 can only be used as ADC
 	//        input and not digital output, so we have to leave WP unmanaged.
 	FRAM_MB85RC_I2C_T<WriteProtect_Unmanaged> _fram;
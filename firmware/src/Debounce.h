@@ -40,13 +40,13 @@ public:
 			_energy = DEBOUNCE_TIMEOUT_US;
 			if (_old_output != true) {
 				_old_output = true;
-				OnRaiseHandlerT()();
+				OnRaiseHandlerT()(now);
 			}
 		} else if (_energy < -DEBOUNCE_TIMEOUT_US) {
 			_energy = -DEBOUNCE_TIMEOUT_US;
 			if (_old_output != false) {
 				_old_output = false;
-				OnFallHandlerT()();
+				OnFallHandlerT()(now);
 			}
 		}
 	}
@@ -0,0 +1,76 @@
+#ifndef __EJECT_QUEUE_H__
+#define __EJECT_QUEUE_H__
+
+#include <Arduino.h>
+
+#include "util.h"
+
+// request id used by the legacy `CMD_EJECT_COIN`, no `EVT_EJECT_RESULT` is
+// sent for them.
+#define EJECT_REQUEST_LEGACY	(0xFF)
+
+// per-track payout queue, the front one is the request being paid out, the
+// rest are paid out right after it without stopping the motor.
+template <uint8_t DEPTH>
+class EjectQueue {
+public:
+	struct RequestT {
+		uint8_t id;
+		uint8_t count;
+	};
+
+	EjectQueue():
+		_head(0),
+		_size(0)
+	{
+	}
+
+	__attribute__((always_inline)) inline
+	bool empty() const {
+		return _size == 0;
+	}
+
+	__attribute__((always_inline)) inline
+	bool full() const {
+		return _size == DEPTH;
+	}
+
+	__attribute__((always_inline)) inline
+	uint8_t size() const {
+		return _size;
+	}
+
+	__attribute__((always_inline)) inline
+	RequestT const & front() const {
+		return _requests[_head];
+	}
+
+	__attribute__((always_inline)) inline
+	bool push(uint8_t const id, uint8_t const count) {
+		if (unlikely(full()))
+			return false;
+		uint8_t tail = _head + _size;
+		if (tail >= DEPTH)
+			tail -= DEPTH;
+		_requests[tail].id = id;
+		_requests[tail].count = count;
+		++_size;
+		return true;
+	}
+
+	__attribute__((always_inline)) inline
+	void pop() {
+		if (likely(_size != 0)) {
+			if (++_head >= DEPTH)
+				_head = 0;
+			--_size;
+		}
+	}
+
+private:
+	RequestT _requests[DEPTH];
+	uint8_t _head;
+	uint8_t _size;
+};
+
+#endif
@@ -0,0 +1,417 @@
+#ifndef __KEY_VALUE_STORE_H__
+#define __KEY_VALUE_STORE_H__
+
+#include <Arduino.h>
+#include <util/crc16.h>
+#include <avr/wdt.h>
+
+#include "util.h"
+#include "Configuration.h"
+
+// the store lives at the top of the FRAM, in 2 semispaces, only one of
+// them is active at a time, the other one is the target of the compaction.
+// the top of the FRAM is user area until the host formats the store, titles
+// might keep their data there.
+#define KV_ADDR_BEGIN			(CONF_ADDR_KV_STORE)
+#define KV_SPACE_SIZE			(0x0400)
+#define KV_SPACE_0				(KV_ADDR_BEGIN)
+#define KV_SPACE_1				(KV_ADDR_BEGIN + KV_SPACE_SIZE)
+
+// in-RAM index, open addressing, has to be a power of 2. one slot is always
+// left empty, so the store holds up to KV_INDEX_SIZE - 1 keys.
+#define KV_INDEX_SIZE			(32)
+#define KV_MAX_VALUE_LENGTH		(32)
+
+// compact when the free space drops below this, and there's garbage to collect.
+#define KV_COMPACT_THRESHOLD	(KV_SPACE_SIZE / 4)
+
+// semispace header: [ KV_MAGIC ] [ generation ] [ crc8 ]
+#define KV_MAGIC				(0x4B)
+#define KV_HEADER_SIZE			(3)
+// record: [ key (2) ] [ flags | length ] [ value ] [ crc8 ], the log ends with
+// a KV_KEY_END.
+#define KV_RECORD_OVERHEAD		(4)
+#define KV_TOMBSTONE			(0x80)
+#define KV_KEY_END				(0xFFFF)
+
+#define KV_OK					(0)
+#define KV_NOT_FOUND			(1)
+#define KV_FULL					(2)
+#define KV_INVALID				(3)
+#define KV_CORRUPTED			(4)
+#define KV_UNFORMATTED			(5)
+
+// CMD_KV_FORMAT only formats with this, so a corrupted frame can't do it.
+#define KV_FORMAT_GUARD			(0x4B46) // "KF"
+
+// log-structured key/value store, writes are appended to the active
+// semispace, so a change only touches the record and the end marker after it.
+//
+// compaction copies the live records into the other semispace, one record per
+// `service()`. writes keep going to the active semispace while compacting, so
+// the store is always consistent on the FRAM, the other semispace only becomes
+// active when its header is written with the next generation.
+class KeyValueStore {
+public:
+	KeyValueStore(Configuration & conf):
+		_conf(conf),
+		_formatted(false),
+		_compacting(false)
+	{
+	}
+
+	// the store is only there if the host formatted it, see `format()`.
+	__attribute__((always_inline)) inline
+	void begin() {
+		uint8_t generation0, generation1;
+		bool const good0 = _readHeader(KV_SPACE_0, generation0);
+		bool const good1 = _readHeader(KV_SPACE_1, generation1);
+
+		_formatted = good0 || good1;
+		if (!_formatted)
+			return;
+		if (good0 && (!good1 || (int8_t)(generation0 - generation1) > 0)) {
+			_active = KV_SPACE_0;
+			_generation = generation0;
+		} else {
+			_active = KV_SPACE_1;
+			_generation = generation1;
+		}
+		_scan();
+	}
+
+	// an empty store, whatever was at the top of the FRAM is lost.
+	__attribute__((always_inline)) inline
+	void format() {
+		uint8_t const header[KV_HEADER_SIZE] = { 0, 0, 0 };
+		_conf.writeBytes(KV_SPACE_1, KV_HEADER_SIZE, header);
+		_writeEnd(KV_SPACE_0 + KV_HEADER_SIZE);
+		_writeHeader(KV_SPACE_0, 0);
+		_active = KV_SPACE_0;
+		_generation = 0;
+		_formatted = true;
+		_scan();
+	}
+
+	__attribute__((always_inline)) inline
+	uint8_t get(uint16_t const & key, uint8_t & length, uint8_t * const value) {
+		if (unlikely(!_formatted))
+			return KV_UNFORMATTED;
+		uint8_t const slot = _find(key);
+		if (slot == KV_INDEX_SIZE)
+			return KV_NOT_FOUND;
+
+		EntryT const & entry = _index[slot];
+		uint8_t record[KV_MAX_VALUE_LENGTH + KV_RECORD_OVERHEAD];
+		uint8_t const size = entry.length + KV_RECORD_OVERHEAD;
+		_conf.readBytes(entry.address, size, record);
+		if (unlikely(_checksum(record, size - 1) != record[size - 1] || _keyOf(record) != key))
+			return KV_CORRUPTED;
+
+		length = entry.length;
+		memcpy(value, record + 3, length);
+		return KV_OK;
+	}
+
+	__attribute__((always_inline)) inline
+	uint8_t put(uint16_t const & key, uint8_t const length, uint8_t const * const value) {
+		if (unlikely(!_formatted))
+			return KV_UNFORMATTED;
+		if (unlikely(key == KV_KEY_END || length > KV_MAX_VALUE_LENGTH))
+			return KV_INVALID;
+		if (unlikely(_find(key) == KV_INDEX_SIZE && _count >= KV_INDEX_SIZE - 1))
+			return KV_FULL;
+		if (unlikely(!_fits(_active, _tail, length + KV_RECORD_OVERHEAD))) {
+			_compact();
+			return KV_FULL;
+		}
+
+		_set(key, _tail, length);
+		_tail += _append(_tail, key, length, value);
+		_compact();
+		return KV_OK;
+	}
+
+	__attribute__((always_inline)) inline
+	uint8_t remove(uint16_t const & key) {
+		if (unlikely(!_formatted))
+			return KV_UNFORMATTED;
+		if (_find(key) == KV_INDEX_SIZE)
+			return KV_NOT_FOUND;
+		if (unlikely(!_fits(_active, _tail, KV_RECORD_OVERHEAD))) {
+			_compact();
+			return KV_FULL;
+		}
+
+		_tail += _append(_tail, key, KV_TOMBSTONE, nullptr);
+		if (_compacting) {
+			// a copy might be there already
+			if (_fits(_other(), _copy_tail, KV_RECORD_OVERHEAD))
+				_copy_tail += _append(_copy_tail, key, KV_TOMBSTONE, nullptr);
+			else
+				_abortCompaction();
+		}
+		_erase(key);
+		_compact();
+		return KV_OK;
+	}
+
+	// copies one record when compacting, call this from `loop()`.
+	__attribute__((always_inline)) inline
+	void service() {
+		if (likely(!_compacting))
+			return;
+
+		for (uint8_t n = 0;n < KV_INDEX_SIZE;++n) {
+			EntryT & entry = _index[_copy_slot];
+			_copy_slot = (_copy_slot + 1) & (KV_INDEX_SIZE - 1);
+			if (entry.key == KV_KEY_END || !_inSpace(_active, entry.address))
+				continue;
+
+			uint8_t record[KV_MAX_VALUE_LENGTH + KV_RECORD_OVERHEAD];
+			uint8_t const size = entry.length + KV_RECORD_OVERHEAD;
+			if (unlikely(!_fits(_other(), _copy_tail, size))) {
+				_abortCompaction();
+				return;
+			}
+			_conf.readBytes(entry.address, size, record);
+			_writeEnd(_copy_tail + size);
+			_conf.writeBytes(_copy_tail, size, record);
+			entry.address = _copy_tail;
+			_copy_tail += size;
+			return;
+		}
+
+		// everything is in the other semispace, make it the active one
+		_writeHeader(_other(), _generation + 1);
+		_active = _other();
+		++_generation;
+		_tail = _copy_tail;
+		_compacting = false;
+	}
+
+	__attribute__((always_inline)) inline
+	uint8_t getCount() const {
+		return _count;
+	}
+
+	__attribute__((always_inline)) inline
+	uint16_t getFree() const {
+		return _formatted ? _active + KV_SPACE_SIZE - _tail - 2 : 0;
+	}
+
+	__attribute__((always_inline)) inline
+	bool isFormatted() const {
+		return _formatted;
+	}
+
+	__attribute__((always_inline)) inline
+	bool isCompacting() const {
+		return _compacting;
+	}
+
+private:
+	struct EntryT {
+		uint16_t key;
+		uint16_t address;
+		uint8_t length;
+	};
+
+	__attribute__((always_inline)) inline
+	uint16_t _other() const {
+		return _active == KV_SPACE_0 ? KV_SPACE_1 : KV_SPACE_0;
+	}
+
+	static inline
+	bool _inSpace(uint16_t const & space, uint16_t const & address) {
+		return address >= space && address < space + KV_SPACE_SIZE;
+	}
+
+	// room for the record and the end marker after it
+	static inline
+	bool _fits(uint16_t const & space, uint16_t const & at, uint8_t const size) {
+		return at + size + 2 <= space + KV_SPACE_SIZE;
+	}
+
+	static inline
+	uint16_t _keyOf(uint8_t const * const record) {
+		return record[0] | (record[1] << 8);
+	}
+
+	static inline
+	uint8_t _checksum(uint8_t const * const buffer, uint8_t const length) {
+		uint8_t crc = 0;
+		for (uint8_t i = 0;i < length;++i)
+			crc = _crc8_ccitt_update(crc, buffer[i]);
+		return crc;
+	}
+
+	static inline
+	uint8_t _slotOf(uint16_t const & key) {
+		return (uint8_t)(key ^ (key >> 5)) & (KV_INDEX_SIZE - 1);
+	}
+
+	__attribute__((always_inline)) inline
+	bool _readHeader(uint16_t const & space, uint8_t & generation) {
+		uint8_t header[KV_HEADER_SIZE];
+		_conf.readBytes(space, KV_HEADER_SIZE, header);
+		generation = header[1];
+		return header[0] == KV_MAGIC && _checksum(header, KV_HEADER_SIZE - 1) == header[2];
+	}
+
+	__attribute__((always_inline)) inline
+	void _writeHeader(uint16_t const & space, uint8_t const generation) {
+		uint8_t header[KV_HEADER_SIZE] = { KV_MAGIC, generation, 0 };
+		header[2] = _checksum(header, KV_HEADER_SIZE - 1);
+		_conf.writeBytes(space, KV_HEADER_SIZE, header);
+	}
+
+	__attribute__((always_inline)) inline
+	void _writeEnd(uint16_t const & at) {
+		uint8_t const end[2] = { 0xFF, 0xFF };
+		_conf.writeBytes(at, 2, end);
+	}
+
+	// writes the end marker first, so a record cut by a power loss always
+	// fails its crc and ends the log. returns the size of the record.
+	__attribute__((always_inline)) inline
+	uint8_t _append(uint16_t const & at, uint16_t const & key, uint8_t const flags_length, uint8_t const * const value) {
+		uint8_t record[KV_MAX_VALUE_LENGTH + KV_RECORD_OVERHEAD];
+		uint8_t const length = flags_length & KV_TOMBSTONE ? 0 : flags_length;
+		uint8_t const size = length + KV_RECORD_OVERHEAD;
+		record[0] = key & 0xFF;
+		record[1] = key >> 8;
+		record[2] = flags_length;
+		if (length != 0)
+			memcpy(record + 3, value, length);
+		record[size - 1] = _checksum(record, size - 1);
+		_writeEnd(at + size);
+		_conf.writeBytes(at, size, record);
+		return size;
+	}
+
+	// rebuilds the index from the active semispace.
+	__attribute__((always_inline)) inline
+	void _scan() {
+		for (uint8_t i = 0;i < KV_INDEX_SIZE;++i)
+			_index[i].key = KV_KEY_END;
+		_count = 0;
+
+		uint16_t at = _active + KV_HEADER_SIZE;
+		for (;;) {
+			wdt_reset(); // might take a while on a full semispace
+
+			uint8_t record[KV_MAX_VALUE_LENGTH + KV_RECORD_OVERHEAD];
+			if (!_fits(_active, at, KV_RECORD_OVERHEAD))
+				break;
+			_conf.readBytes(at, 3, record);
+			uint16_t const key = _keyOf(record);
+			uint8_t const length = record[2] & KV_TOMBSTONE ? 0 : record[2];
+			uint8_t const size = length + KV_RECORD_OVERHEAD;
+			if (key == KV_KEY_END || length > KV_MAX_VALUE_LENGTH || !_fits(_active, at, size))
+				break;
+			_conf.readBytes(at + 3, size - 3, record + 3);
+			if (_checksum(record, size - 1) != record[size - 1])
+				break;
+
+			if (record[2] & KV_TOMBSTONE)
+				_erase(key);
+			else if (_find(key) != KV_INDEX_SIZE || _count < KV_INDEX_SIZE - 1)
+				_set(key, at, length);
+			at += size;
+		}
+		_tail = at;
+		_compacting = false;
+	}
+
+	__attribute__((always_inline)) inline
+	void _compact() {
+		uint16_t const used = _tail - _active - KV_HEADER_SIZE;
+		uint16_t live = 0;
+		for (uint8_t i = 0;i < KV_INDEX_SIZE;++i)
+			if (_index[i].key != KV_KEY_END)
+				live += _index[i].length + KV_RECORD_OVERHEAD;
+
+		if (_compacting || getFree() >= KV_COMPACT_THRESHOLD || used == live)
+			return;
+
+		// invalidate the other semispace first, it only becomes valid again
+		// when everything is copied.
+		uint8_t const header[KV_HEADER_SIZE] = { 0, 0, 0 };
+		_conf.writeBytes(_other(), KV_HEADER_SIZE, header);
+		_copy_tail = _other() + KV_HEADER_SIZE;
+		_writeEnd(_copy_tail);
+		_copy_slot = 0;
+		_compacting = true;
+	}
+
+	// the other semispace ran out of room, what's copied is not reachable
+	// anymore, rebuild the index from the active semispace.
+	__attribute__((always_inline)) inline
+	void _abortCompaction() {
+		_scan();
+	}
+
+	__attribute__((always_inline)) inline
+	uint8_t _find(uint16_t const & key) const {
+		uint8_t slot = _slotOf(key);
+		for (uint8_t n = 0;n < KV_INDEX_SIZE;++n) {
+			if (_index[slot].key == key)
+				return slot;
+			if (_index[slot].key == KV_KEY_END)
+				break;
+			slot = (slot + 1) & (KV_INDEX_SIZE - 1);
+		}
+		return KV_INDEX_SIZE;
+	}
+
+	__attribute__((always_inline)) inline
+	void _set(uint16_t const & key, uint16_t const & address, uint8_t const length) {
+		uint8_t slot = _slotOf(key);
+		while (_index[slot].key != key && _index[slot].key != KV_KEY_END)
+			slot = (slot + 1) & (KV_INDEX_SIZE - 1);
+		if (_index[slot].key == KV_KEY_END)
+			++_count;
+		_index[slot].key = key;
+		_index[slot].address = address;
+		_index[slot].length = length;
+	}
+
+	// backward shift deletion, keeps the probe sequences intact without
+	// tombstones in the index.
+	__attribute__((always_inline)) inline
+	void _erase(uint16_t const & key) {
+		uint8_t hole = _find(key);
+		if (hole == KV_INDEX_SIZE)
+			return;
+		--_count;
+
+		uint8_t slot = hole;
+		for (;;) {
+			slot = (slot + 1) & (KV_INDEX_SIZE - 1);
+			if (_index[slot].key == KV_KEY_END)
+				break;
+			uint8_t const home = _slotOf(_index[slot].key);
+			// stays if its home is cyclically within (hole, slot]
+			if (hole <= slot ? (hole < home && home <= slot) : (hole < home || home <= slot))
+				continue;
+			_index[hole] = _index[slot];
+			hole = slot;
+		}
+		_index[hole].key = KV_KEY_END;
+	}
+
+	Configuration & _conf;
+	EntryT _index[KV_INDEX_SIZE];
+	uint8_t _count;
+	uint16_t _active;
+	uint8_t _generation;
+	uint16_t _tail;
+
+	bool _formatted;
+	bool _compacting;
+	uint8_t _copy_slot;
+	uint16_t _copy_tail;
+};
+
+#endif
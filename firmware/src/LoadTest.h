@@ -0,0 +1,218 @@
+#ifndef __LOAD_TEST_H__
+#define __LOAD_TEST_H__
+
+#include <Arduino.h>
+
+#include "util.h"
+#include "Ports.h"
+#include "Configuration.h"
+
+// CMD_LOAD_TEST has to carry this, so a stray frame can't start it.
+#define LOAD_TEST_GUARD			(0x4C54) // "LT"
+
+#define LOAD_TEST_OFF			(0)
+#define LOAD_TEST_RANDOM		(1) // random keys at random intervals around the rate
+#define LOAD_TEST_PATTERN		(2) // presses and releases the keys in order, at the rate
+
+// a coin has to stay on the sensor, and off it, long enough for the debouncer
+// to see it, with some margin since it works like an RC.
+#define LOAD_TEST_MIN_PULSE		(DEBOUNCE_TIMEOUT * 3L)
+
+// the test stops by itself after that long, 0 as the duration means that too.
+// it also keeps the elapsed time within 32 bits of us.
+#define LOAD_TEST_MAX_DURATION	(3600) // s
+
+// the sensors on the second byte of the chain, see InPort.
+#define LOAD_TEST_SENSOR_BYTE	(1)
+#define LOAD_TEST_COIN_BIT		(4) // sw12, coin track 1
+
+// less room than that in the UART buffer and the next event blocks `loop()`,
+// about the size of an EVT_KEYS_RESULT.
+#define LOAD_TEST_TX_ROOM		(16)
+
+// replaces what's read from the 74HC165 chain with generated key edges and
+// coin pulses on insert track 1, so they go through the debouncers and the
+// `Communicator` like the real ones. the other sensors are held inactive.
+//
+// everything is counted so the host can tell what it should have received,
+// the coins are not written to the FRAM and don't tick the meters.
+class LoadTest {
+public:
+	struct StatsT {
+		uint32_t elapsed_us;
+		uint32_t loops;
+		uint32_t key_edges; // generated
+		uint32_t key_events; // EVT_KEYS_RESULT sent
+		uint32_t coins; // generated
+		uint32_t coin_events; // EVT_COIN_COUNTER_RESULT sent
+		uint32_t tx_stalls; // loops starting with less than LOAD_TEST_TX_ROOM in the UART buffer
+	};
+
+	LoadTest():
+		_mode(LOAD_TEST_OFF)
+	{
+		memset(&_stats, 0, sizeof(_stats));
+	}
+
+	// `keys` are the keys as they are now, the test starts from there.
+	inline
+	void begin(uint8_t const mode, uint16_t const key_rate, uint16_t const coin_rate, uint16_t const duration_s,
+		uint16_t const seed, uint8_t const * const keys, uint32_t const & now)
+	{
+		memset(&_stats, 0, sizeof(_stats));
+		_mode = mode;
+		_begin_us = now;
+		_duration_us = (duration_s == 0 || duration_s > LOAD_TEST_MAX_DURATION ? LOAD_TEST_MAX_DURATION : duration_s) * 1000000UL;
+		_random = seed ? seed : 1;
+		_cursor = 0;
+
+		_key_interval = key_rate ? 1000000UL / key_rate : 0;
+		_next_key_us = now + _key_interval;
+
+		_coin_interval = coin_rate ? 1000000UL / coin_rate : 0;
+		if (_coin_interval != 0 && _coin_interval < LOAD_TEST_MIN_PULSE * 2)
+			_coin_interval = LOAD_TEST_MIN_PULSE * 2;
+		_coin_on = false;
+		_next_coin_us = now + _coin_interval;
+
+		for (uint8_t i = 0;i < IO_CHAIN_LENGTH;++i)
+			_keys[i] = keys[i] & _keyMask(i);
+	}
+
+	__attribute__((always_inline)) inline
+	void stop(uint32_t const & now) {
+		if (_mode != LOAD_TEST_OFF)
+			_stats.elapsed_us = now - _begin_us;
+		_mode = LOAD_TEST_OFF;
+	}
+
+	__attribute__((always_inline)) inline
+	bool active() const {
+		return _mode != LOAD_TEST_OFF;
+	}
+
+	__attribute__((always_inline)) inline
+	uint8_t getMode() const {
+		return _mode;
+	}
+
+	// overwrites `bytes` read from the chain, `levels` are the active levels
+	// of the tracks. returns false once the duration is over, `bytes` are left
+	// alone then.
+	inline
+	bool generate(uint8_t * const bytes, uint8_t const levels, uint32_t const & now) {
+		_stats.elapsed_us = now - _begin_us;
+		if (unlikely(_stats.elapsed_us >= _duration_us)) {
+			_mode = LOAD_TEST_OFF;
+			return false;
+		}
+		++_stats.loops;
+
+		if (_key_interval != 0 && (int32_t)(now - _next_key_us) >= 0) {
+			_toggleKey();
+			_next_key_us += _jitter(_key_interval);
+			// don't try to catch up after a slow loop, that's bursts of edges
+			if ((int32_t)(now - _next_key_us) >= 0)
+				_next_key_us = now + _key_interval;
+		}
+
+		if (_coin_interval != 0 && (int32_t)(now - _next_coin_us) >= 0) {
+			_coin_on = !_coin_on;
+			if (_coin_on)
+				++_stats.coins;
+			// half the period on the sensor, half off it.
+			uint32_t const half = _jitter(_coin_interval) / 2;
+			_next_coin_us = now + (half < LOAD_TEST_MIN_PULSE ? LOAD_TEST_MIN_PULSE : half);
+		}
+
+		for (uint8_t i = 0;i < IO_CHAIN_LENGTH;++i)
+			bytes[i] = _keys[i];
+
+		// sensors at rest are the opposite of their active level.
+		//   eject sw11: bit 3, ticket sw14: bit 6, insert sw12: bit 4,
+		//   insert sw13: bit 5, banknote sw20: bit 7
+		uint8_t sensors =
+			(!bitRead(levels, TRACK_EJECT) << 3) |
+			(!bitRead(levels, TRACK_TICKET) << 6) |
+			(!bitRead(levels, TRACK_INSERT_1) << 4) |
+			(!bitRead(levels, TRACK_INSERT_2) << 5) |
+			(!bitRead(levels, TRACK_BANKNOTE) << 7);
+		if (_coin_on)
+			sensors ^= 1 << LOAD_TEST_COIN_BIT;
+		bytes[LOAD_TEST_SENSOR_BYTE] |= sensors;
+		return true;
+	}
+
+	__attribute__((always_inline)) inline void countKeyEvent() { ++_stats.key_events; }
+	__attribute__((always_inline)) inline void countCoinEvent() { ++_stats.coin_events; }
+	__attribute__((always_inline)) inline void countTxStall() { ++_stats.tx_stalls; }
+
+	// the counters of the test running, or of the last one.
+	__attribute__((always_inline)) inline
+	StatsT const & getStats() const {
+		return _stats;
+	}
+
+private:
+	// every key on the chain, but not the coin sensors.
+	static inline constexpr
+	uint8_t _keyMask(uint8_t const i) {
+		return i == LOAD_TEST_SENSOR_BYTE ? IN_MASK_1 : inMask(i);
+	}
+
+	// xorshift16
+	__attribute__((always_inline)) inline
+	uint16_t _next() {
+		_random ^= _random << 7;
+		_random ^= _random >> 9;
+		_random ^= _random << 8;
+		return _random;
+	}
+
+	// anywhere between half and one and a half `interval`, the same on average.
+	__attribute__((always_inline)) inline
+	uint32_t _jitter(uint32_t const interval) {
+		if (_mode != LOAD_TEST_RANDOM)
+			return interval;
+		return interval / 2 + (uint32_t)(((uint64_t)interval * _next()) >> 16);
+	}
+
+	inline
+	void _toggleKey() {
+		uint8_t byte, bit;
+		if (_mode == LOAD_TEST_RANDOM) {
+			// the first byte is all keys, so this ends.
+			do {
+				uint16_t const r = _next();
+				byte = (r >> 3) % IO_CHAIN_LENGTH;
+				bit = r & 0x07;
+			} while (!bitRead(_keyMask(byte), bit));
+		} else {
+			// every key goes one way then back, then the next key
+			do {
+				uint8_t const key = _cursor >> 1;
+				byte = key >> 3;
+				bit = key & 0x07;
+				if (++_cursor == IO_CHAIN_LENGTH * 16)
+					_cursor = 0;
+			} while (!bitRead(_keyMask(byte), bit));
+		}
+		_keys[byte] ^= 1 << bit;
+		++_stats.key_edges;
+	}
+
+	uint8_t _mode;
+	uint8_t _cursor;
+	uint16_t _random;
+	uint8_t _keys[IO_CHAIN_LENGTH];
+	bool _coin_on;
+	uint32_t _begin_us;
+	uint32_t _duration_us;
+	uint32_t _key_interval;
+	uint32_t _next_key_us;
+	uint32_t _coin_interval;
+	uint32_t _next_coin_us;
+	StatsT _stats;
+};
+
+#endif
@@ -3,6 +3,15 @@
 
 #include <Arduino.h>
 
+// number of cascaded 74HC165 / 74HC595 bytes, the on-board chain has 3 of them.
+// extension boards are cascaded after the on-board chips, byte 3 and above are
+// the extension bytes, in the order they're shifted in / out.
+// the host learns the width from EVT_KEY_MASKS_RESULT, up to 8 bytes.
+#if !defined(IO_CHAIN_LENGTH)
+#define IO_CHAIN_LENGTH (3)
+#endif
+static_assert(IO_CHAIN_LENGTH >= 3 && IO_CHAIN_LENGTH <= 8, "IO_CHAIN_LENGTH must be within 3 ~ 8");
+
 #define OUT_MASK_0 (0b00000000)
 #define OUT_MASK_1 (0b01111111)
 #define OUT_MASK_2 (0b01111111)
@@ -36,6 +45,11 @@ struct OutPort {
     uint8_t ssr5:1;     // 0b10000000: reserved SSR5
 };
 
+// every bit on the extension boards are outputs
+#if !defined(OUT_MASK_EXT)
+#define OUT_MASK_EXT (0b11111111)
+#endif
+
 #define IN_MASK_0 (0b11111111)
 #define IN_MASK_1 (0b00000111)
 #define IN_MASK_2 (0b11111111)
@@ -69,4 +83,19 @@ struct InPort {
     uint8_t sw24:1;     // 0b10000000: S4 (settings)
 };
 
+// every bit on the extension boards are keys
+#if !defined(IN_MASK_EXT)
+#define IN_MASK_EXT (0b11111111)
+#endif
+
+static inline constexpr
+uint8_t inMask(uint8_t const i) {
+	return i == 0 ? IN_MASK_0 : i == 1 ? IN_MASK_1 : i == 2 ? IN_MASK_2 : IN_MASK_EXT;
+}
+
+static inline constexpr
+uint8_t outMask(uint8_t const i) {
+	return i == 0 ? OUT_MASK_0 : i == 1 ? OUT_MASK_1 : i == 2 ? OUT_MASK_2 : OUT_MASK_EXT;
+}
+
 #endif
@@ -0,0 +1,44 @@
+#ifndef __POWER_FAIL_H__
+#define __POWER_FAIL_H__
+
+#include <Arduino.h>
+#include <avr/io.h>
+
+#if defined(POWER_FAIL_CHANNEL)
+#define POWER_FAIL_ENABLED		(true)
+#define POWER_FAIL_RECOVERY		(100000L) // us the supply stays good before the outputs come back
+
+// the power-fail warning, with POWER_FAIL_CHANNEL: the analog comparator
+// checks the 1.1V bandgap against the supply divided down on ADC channel
+// POWER_FAIL_CHANNEL. D6 / D7 (AIN0 / AIN1) drive the chains, but the
+// comparator can take its negative input from the ADC multiplexer instead, A6
+// is free.
+//
+// the output goes HIGH when the supply falls under the threshold, what's left
+// in the capacitors has to cover the flush, see `CMD_GET_PERSIST_STATS`.
+class PowerFail {
+public:
+	__attribute__((always_inline)) inline
+	void begin() {
+		// the multiplexer only goes to the comparator with the ADC off, but it
+		// has to stay powered, see `setup()`.
+		ADCSRA &= ~_BV(ADEN);
+		ADMUX = (ADMUX & ~0x07) | (POWER_FAIL_CHANNEL & 0x07);
+		ADCSRB |= _BV(ACME);
+		// bandgap on the positive input. no interrupt, `loop()` checks the
+		// output, the flush can't run in the middle of a FRAM transfer anyway.
+		ACSR = _BV(ACBG) | _BV(ACI);
+	}
+
+	// the supply is under the threshold.
+	__attribute__((always_inline)) inline
+	bool low() const {
+		return ACSR & _BV(ACO);
+	}
+};
+
+#else
+#define POWER_FAIL_ENABLED		(false)
+#endif
+
+#endif
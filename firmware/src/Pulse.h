@@ -58,6 +58,13 @@ public:
 		return _state == STATE_HIGH;
 	}
 
+	// the pulses the meter hasn't seen yet, one in LOW is already counted by
+	// the meter.
+	__attribute__((always_inline)) inline
+	uint32_t pending() const {
+		return _state == STATE_LOW ? _pulses - 1 : _pulses;
+	}
+
 private:
 	uint32_t _start_us;
 	uint32_t _pulses;
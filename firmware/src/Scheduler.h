@@ -0,0 +1,212 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+
+#include "util.h"
+
+// the size of TASKS in main.cpp, every slot is 18 bytes of SRAM.
+#define SCHED_MAX_TASKS			(7)
+
+// the task runs at its period, the others only fill the gaps between the
+// realtime ones.
+#define TASK_REALTIME			(0x01)
+
+// a task of the table, in PROGMEM. `period_us` 0 is every pass, for tasks
+// that aren't realtime. `budget_us` is what the task is allowed to take, the
+// gaps are filled with the tasks that fit in them.
+struct TaskT {
+	void (* run)(uint32_t const & now);
+	uint16_t period_us;
+	uint16_t budget_us;
+	uint8_t flags;
+};
+
+// cooperative scheduler for `loop()`, a static table of tasks in priority
+// order. every pass runs the realtime tasks that are due, then the other
+// tasks, as long as their budget fits before the next realtime task is due.
+// one that doesn't fit still runs once per gap, taking turns, so a task with
+// a budget bigger than the gaps gets its turn, late, and shows up in the stats.
+class Scheduler {
+public:
+	struct StatsT {
+		uint32_t runs;
+		uint32_t total_us;
+		uint16_t max_us;
+		uint16_t overruns; // took longer than the budget
+		// realtime: started a whole period late. others: due, and didn't get
+		// to run before the next realtime pass.
+		uint16_t misses;
+	};
+
+	Scheduler(TaskT const * const tasks, uint8_t const count):
+		_tasks(tasks),
+		_count(count),
+		_waiting(0),
+		_ran(0),
+		_stretch(false),
+		_turn(0)
+	{
+		reset();
+	}
+
+	__attribute__((always_inline)) inline
+	void begin(uint32_t const & now) {
+		for (uint8_t i = 0;i < _count;++i)
+			_due[i] = now;
+	}
+
+	__attribute__((always_inline)) inline
+	void reset() {
+		memset(_stats, 0, sizeof(_stats));
+		_passes = 0;
+		_idle = 0;
+	}
+
+	// one task, the loop counters go with the first one.
+	__attribute__((always_inline)) inline
+	void reset(uint8_t const task) {
+		memset(&_stats[task], 0, sizeof(_stats[task]));
+		if (task == 0) {
+			_passes = 0;
+			_idle = 0;
+		}
+	}
+
+	// one pass of `loop()`.
+	__attribute__((always_inline)) inline
+	void run() {
+		++_passes;
+		uint32_t now = micros();
+		bool realtime = false;
+
+		for (uint8_t i = 0;i < _count;++i) {
+			TaskT task;
+			memcpy_P(&task, &_tasks[i], sizeof(task));
+			if (!(task.flags & TASK_REALTIME) || (int32_t)(now - _due[i]) < 0)
+				continue;
+			if (now - _due[i] >= task.period_us) {
+				// fell a whole period behind, skip the periods missed, keeping
+				// the phase so the realtime tasks stay together
+				_saturate(_stats[i].misses);
+				_due[i] += (now - _due[i]) / task.period_us * task.period_us;
+			}
+			_due[i] += task.period_us;
+			now = _run(i, task, now);
+			realtime = true;
+		}
+
+		if (realtime) {
+			// what waited through the whole gap before this pass
+			for (uint8_t i = 0;i < _count;++i)
+				if (bitRead(_waiting, i) && !bitRead(_ran, i))
+					_saturate(_stats[i].misses);
+			_waiting = 0;
+			_ran = 0;
+			// nobody after `_turn` took the last gap, start over
+			if (_stretch)
+				_turn = 0;
+			_stretch = true;
+		}
+
+		bool ran = realtime;
+		for (uint8_t i = 0;i < _count;++i) {
+			TaskT task;
+			memcpy_P(&task, &_tasks[i], sizeof(task));
+			if (task.flags & TASK_REALTIME)
+				continue;
+			if (task.period_us != 0 && (int32_t)(now - _due[i]) < 0)
+				continue;
+			bool const fits = (int32_t)(_nextRealtime(now) - now) >= (int32_t)task.budget_us;
+			if (!fits) {
+				if (!_stretch || i < _turn) {
+					bitSet(_waiting, i);
+					continue;
+				}
+				_stretch = false;
+				_turn = i + 1;
+			}
+			if (task.period_us != 0)
+				_due[i] = now + task.period_us;
+			now = _run(i, task, now);
+			bitSet(_ran, i);
+			ran = true;
+		}
+
+		if (!ran)
+			++_idle;
+	}
+
+	__attribute__((always_inline)) inline
+	uint8_t getCount() const {
+		return _count;
+	}
+
+	__attribute__((always_inline)) inline
+	StatsT const & get(uint8_t const task) const {
+		return _stats[task];
+	}
+
+	__attribute__((always_inline)) inline
+	void getTask(uint8_t const task, TaskT & out) const {
+		memcpy_P(&out, &_tasks[task], sizeof(out));
+	}
+
+	__attribute__((always_inline)) inline
+	uint32_t getPasses() const {
+		return _passes;
+	}
+
+	// passes where nothing was due, the CPU left over.
+	__attribute__((always_inline)) inline
+	uint32_t getIdle() const {
+		return _idle;
+	}
+
+private:
+	__attribute__((always_inline)) inline
+	uint32_t _run(uint8_t const i, TaskT const & task, uint32_t const & now) {
+		task.run(now);
+		uint32_t const end = micros();
+		uint32_t const elapsed = end - now;
+
+		StatsT & stats = _stats[i];
+		++stats.runs;
+		stats.total_us += elapsed;
+		uint16_t const clamped = elapsed > 0xFFFF ? 0xFFFF : elapsed;
+		if (clamped > stats.max_us)
+			stats.max_us = clamped;
+		if (clamped > task.budget_us)
+			_saturate(stats.overruns);
+		return end;
+	}
+
+	__attribute__((always_inline)) inline
+	uint32_t _nextRealtime(uint32_t const & now) const {
+		uint32_t next = now + 0x7FFFFFFFL;
+		for (uint8_t i = 0;i < _count;++i)
+			if ((pgm_read_byte(&_tasks[i].flags) & TASK_REALTIME) && (int32_t)(_due[i] - next) < 0)
+				next = _due[i];
+		return next;
+	}
+
+	static inline
+	void _saturate(uint16_t & counter) {
+		if (counter != 0xFFFF)
+			++counter;
+	}
+
+	TaskT const * const _tasks;
+	uint8_t const _count;
+	uint32_t _due[SCHED_MAX_TASKS];
+	StatsT _stats[SCHED_MAX_TASKS];
+	uint16_t _waiting; // tasks that didn't fit since the last realtime pass
+	uint16_t _ran; // and those that ran
+	bool _stretch; // the gap's one task that doesn't fit hasn't run yet
+	uint8_t _turn; // the first task that may take it
+	uint32_t _passes;
+	uint32_t _idle;
+};
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef __STORAGE_SCRUBBER_H__
+#define __STORAGE_SCRUBBER_H__
+
+#include <Arduino.h>
+#include <util/crc16.h>
+
+#include "util.h"
+#include "Configuration.h"
+#include "Communicator.h"
+
+// the user area is checked in blocks, one crc8 per block in the table.
+#define SCRUB_BLOCK_SIZE		(64)
+#define SCRUB_BLOCKS			((CONF_ADDR_USER_END - CONF_ADDR_USER_BEGIN) / SCRUB_BLOCK_SIZE)
+#define SCRUB_MAP_SIZE			((SCRUB_BLOCKS + 7) / 8)
+// bytes read per slice, and the time between slices, a pass over the whole
+// user area takes about SCRUB_BLOCKS * SCRUB_BLOCK_SIZE / SCRUB_SLICE_LENGTH
+// slices.
+#define SCRUB_SLICE_LENGTH		(16)
+#define SCRUB_INTERVAL			(2000L)
+
+// table: [ SCRUB_MAGIC ] [ crc8 of block 0 ] ... [ crc8 of block N - 1 ]
+#define SCRUB_MAGIC				(0x53)
+#define SCRUB_ADDR_MAGIC		(CONF_ADDR_CRC_TABLE)
+#define SCRUB_ADDR_TABLE		(CONF_ADDR_CRC_TABLE + 1)
+
+// checks the user area against the CRC table, a slice per `service()`, and
+// reports the blocks that don't match with ERR_STORAGE_CORRUPTED, once until
+// they're written again.
+//
+// everything writing to the user area has to `seal()` what it wrote. the table
+// is at the top of the FRAM, so like the key/value store the scrubber only runs
+// once the host formatted it, titles might have their data there. the first
+// pass after that builds the table instead of checking.
+class StorageScrubber {
+public:
+	StorageScrubber(Configuration & conf, Communicator & communicator):
+		_conf(conf),
+		_communicator(communicator),
+		_enabled(false),
+		_sealed(false),
+		_block(0),
+		_offset(0),
+		_passes(0)
+	{
+		memset(_map, 0, sizeof(_map));
+	}
+
+	__attribute__((always_inline)) inline
+	void begin(uint32_t const & now, bool const formatted) {
+		uint8_t magic = 0;
+		if (formatted)
+			_conf.readBytes(SCRUB_ADDR_MAGIC, 1, &magic);
+		_enabled = formatted;
+		_sealed = magic == SCRUB_MAGIC;
+		_crc = 0;
+		_last_us = now;
+	}
+
+	// claims the table, whatever was there is lost. the next pass builds it.
+	__attribute__((always_inline)) inline
+	void format() {
+		uint8_t const magic = 0;
+		_conf.writeBytes(SCRUB_ADDR_MAGIC, 1, &magic);
+		_enabled = true;
+		_sealed = false;
+		_block = 0;
+		_offset = 0;
+		_crc = 0;
+		memset(_map, 0, sizeof(_map));
+	}
+
+	// recomputes the CRCs of the blocks touched by a write.
+	__attribute__((always_inline)) inline
+	void seal(uint16_t const & address, uint16_t const & length) {
+		if (!_enabled || address + length <= CONF_ADDR_USER_BEGIN || address >= CONF_ADDR_USER_END)
+			return;
+
+		uint16_t const first = address < CONF_ADDR_USER_BEGIN ? 0 : (address - CONF_ADDR_USER_BEGIN) / SCRUB_BLOCK_SIZE;
+		uint16_t const end = address + length >= CONF_ADDR_USER_END ? SCRUB_BLOCKS :
+			(address + length - CONF_ADDR_USER_BEGIN + SCRUB_BLOCK_SIZE - 1) / SCRUB_BLOCK_SIZE;
+		for (uint16_t block = first;block < end;++block) {
+			uint8_t crc = 0;
+			for (uint8_t offset = 0;offset < SCRUB_BLOCK_SIZE;offset += SCRUB_SLICE_LENGTH)
+				crc = _checksum(crc, _blockAddress(block) + offset);
+			_conf.writeBytes(SCRUB_ADDR_TABLE + block, 1, &crc);
+			_map[block >> 3] &= ~(1 << (block & 0x07));
+			// the block being scrubbed changed under us, start it over.
+			if (block == _block) {
+				_offset = 0;
+				_crc = 0;
+			}
+		}
+	}
+
+	__attribute__((always_inline)) inline
+	void service(uint32_t const & now) {
+		if (likely(!_enabled || now - _last_us < SCRUB_INTERVAL))
+			return;
+		_last_us = now;
+
+		_crc = _checksum(_crc, _blockAddress(_block) + _offset);
+		_offset += SCRUB_SLICE_LENGTH;
+		if (_offset < SCRUB_BLOCK_SIZE)
+			return;
+
+		if (_sealed) {
+			uint8_t expected;
+			_conf.readBytes(SCRUB_ADDR_TABLE + _block, 1, &expected);
+			uint8_t const mask = 1 << (_block & 0x07);
+			if (_crc == expected) {
+				_map[_block >> 3] &= ~mask;
+			} else if (!(_map[_block >> 3] & mask)) {
+				_map[_block >> 3] |= mask;
+				_communicator.dispatchErrorStorageCorrupted(_blockAddress(_block));
+			}
+		} else {
+			_conf.writeBytes(SCRUB_ADDR_TABLE + _block, 1, &_crc);
+		}
+
+		_offset = 0;
+		_crc = 0;
+		if (++_block == SCRUB_BLOCKS) {
+			_block = 0;
+			if (_sealed) {
+				if (_passes != 0xFFFF)
+					++_passes;
+			} else {
+				uint8_t const magic = SCRUB_MAGIC;
+				_conf.writeBytes(SCRUB_ADDR_MAGIC, 1, &magic);
+				_sealed = true;
+			}
+		}
+	}
+
+	// false until the table is built.
+	__attribute__((always_inline)) inline bool isSealed() const { return _sealed; }
+	// complete passes checked against the table since boot.
+	__attribute__((always_inline)) inline uint16_t getPasses() const { return _passes; }
+	// a bit per block, set when the block doesn't match the table.
+	__attribute__((always_inline)) inline uint8_t const * getMap() const { return _map; }
+
+private:
+	static __attribute__((always_inline)) inline
+	uint16_t _blockAddress(uint16_t const block) {
+		return CONF_ADDR_USER_BEGIN + block * SCRUB_BLOCK_SIZE;
+	}
+
+	__attribute__((always_inline)) inline
+	uint8_t _checksum(uint8_t crc, uint16_t const & address) {
+		uint8_t buffer[SCRUB_SLICE_LENGTH];
+		_conf.readBytes(address, SCRUB_SLICE_LENGTH, buffer);
+		for (uint8_t i = 0;i < SCRUB_SLICE_LENGTH;++i)
+			crc = _crc8_ccitt_update(crc, buffer[i]);
+		return crc;
+	}
+
+	Configuration & _conf;
+	Communicator & _communicator;
+	bool _enabled;
+	bool _sealed;
+	uint8_t _crc;
+	uint8_t _block;
+	uint8_t _offset;
+	uint16_t _passes;
+	uint32_t _last_us;
+	uint8_t _map[SCRUB_MAP_SIZE];
+};
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef __STORAGE_STREAM_H__
+#define __STORAGE_STREAM_H__
+
+#include <Arduino.h>
+#include <util/crc16.h>
+
+#include "util.h"
+#include "Communication.h"
+#include "Configuration.h"
+#include "Communicator.h"
+#include "StorageScrubber.h"
+
+// bytes per chunk, an escaped chunk has to fit in CmdMessenger's 64 bytes
+// buffer, so the host might send shorter ones.
+#define STREAM_CHUNK_LENGTH		(32)
+// chunks the host can write before it has to wait for an ack.
+#define STREAM_WRITE_WINDOW		(4)
+// room needed in the UART TX buffer before a chunk is sent, so the loop never
+// blocks on the UART.
+#define STREAM_TX_ROOM			(STREAM_CHUNK_LENGTH + 16)
+
+#define STREAM_IDLE				(0)
+#define STREAM_READING			(1)
+#define STREAM_WRITING			(2)
+#define STREAM_VERIFYING		(3)
+
+// streams a range of the storage, one chunk per `service()`.
+//
+// reads are flow controlled with credits, one credit per chunk, the host
+// returns them with `CMD_STREAM_CREDIT` as it consumes the chunks. the range
+// CRC comes with `EVT_STREAM_READ_END`.
+//
+// writes are acked per chunk, the host keeps up to `STREAM_WRITE_WINDOW`
+// chunks in flight. chunks have to come in order, a bad one is refused and the
+// host resends from the last ack. after the last chunk, the range is read back
+// and compared to the CRC given by the host.
+//
+// CRCs are `_crc8_ccitt_update` per chunk, `_crc_ccitt_update` over the range
+// seeded with 0xFFFF.
+class StorageStream {
+public:
+	StorageStream(Configuration & conf, Communicator & communicator, StorageScrubber & scrubber):
+		_conf(conf),
+		_communicator(communicator),
+		_scrubber(scrubber),
+		_state(STREAM_IDLE)
+	{
+	}
+
+	__attribute__((always_inline)) inline
+	bool busy() const {
+		return _state != STREAM_IDLE;
+	}
+
+	// the address of the next chunk to be written.
+	__attribute__((always_inline)) inline
+	uint16_t expected() const {
+		return _address + _offset;
+	}
+
+	__attribute__((always_inline)) inline
+	void beginRead(uint16_t const & address, uint16_t const & length, uint8_t const credits) {
+		_begin(STREAM_READING, address, length);
+		_credits = credits;
+	}
+
+	__attribute__((always_inline)) inline
+	void credit(uint8_t const credits) {
+		if (_state == STREAM_READING) {
+			uint16_t const total = _credits + credits;
+			_credits = total > 0xFF ? 0xFF : total;
+		}
+	}
+
+	__attribute__((always_inline)) inline
+	void beginWrite(uint16_t const & address, uint16_t const & length) {
+		_begin(STREAM_WRITING, address, length);
+		_communicator.dispatchStreamWriteBeginResult(address, length, STREAM_WRITE_WINDOW);
+	}
+
+	__attribute__((always_inline)) inline
+	void writeChunk(uint16_t const & address, uint8_t const length, uint8_t const * const buffer, uint8_t const crc) {
+		if (unlikely(_state != STREAM_WRITING)) {
+			_communicator.dispatchErrorNoStream();
+		} else if (unlikely(address != expected() || length == 0 || length > _length - _offset)) {
+			_communicator.dispatchErrorStreamSequence(expected(), address);
+		} else if (unlikely(_checksum(buffer, length) != crc)) {
+			_communicator.dispatchErrorStreamChecksum(address);
+		} else {
+			_conf.writeBytes(address, length, buffer);
+			_scrubber.seal(address, length);
+			_offset += length;
+			_communicator.dispatchStreamWriteAck(_address + _offset);
+		}
+	}
+
+	__attribute__((always_inline)) inline
+	void endWrite(uint16_t const & crc) {
+		if (unlikely(_state != STREAM_WRITING)) {
+			_communicator.dispatchErrorNoStream();
+		} else if (unlikely(_offset != _length)) {
+			_communicator.dispatchErrorStreamSequence(_address + _offset, _address + _length);
+		} else {
+			_expected = crc;
+			_begin(STREAM_VERIFYING, _address, _length);
+		}
+	}
+
+	__attribute__((always_inline)) inline
+	void abort() {
+		_state = STREAM_IDLE;
+	}
+
+	__attribute__((always_inline)) inline
+	void service() {
+		if (likely(_state != STREAM_READING && _state != STREAM_VERIFYING))
+			return;
+		if (_state == STREAM_READING && (_credits == 0 || Serial.availableForWrite() < STREAM_TX_ROOM))
+			return;
+
+		uint8_t buffer[STREAM_CHUNK_LENGTH];
+		uint16_t const address = _address + _offset;
+		uint8_t const length = _length - _offset > STREAM_CHUNK_LENGTH ? STREAM_CHUNK_LENGTH : _length - _offset;
+		_conf.readBytes(address, length, buffer);
+		for (uint8_t i = 0;i < length;++i)
+			_crc = _crc_ccitt_update(_crc, buffer[i]);
+		_offset += length;
+
+		if (_state == STREAM_READING) {
+			--_credits;
+			_communicator.dispatchStreamReadChunk(address, length, buffer, _checksum(buffer, length));
+			if (_offset == _length) {
+				_communicator.dispatchStreamReadEnd(_address, _length, _crc);
+				_state = STREAM_IDLE;
+			}
+		} else if (_offset == _length) {
+			_communicator.dispatchStreamWriteResult(_address, _length, _crc, _crc == _expected);
+			_state = STREAM_IDLE;
+		}
+	}
+
+private:
+	__attribute__((always_inline)) inline
+	void _begin(uint8_t const state, uint16_t const & address, uint16_t const & length) {
+		_state = state;
+		_address = address;
+		_length = length;
+		_offset = 0;
+		_crc = 0xFFFF;
+	}
+
+	static inline
+	uint8_t _checksum(uint8_t const * const buffer, uint8_t const length) {
+		uint8_t crc = 0;
+		for (uint8_t i = 0;i < length;++i)
+			crc = _crc8_ccitt_update(crc, buffer[i]);
+		return crc;
+	}
+
+	Configuration & _conf;
+	Communicator & _communicator;
+	StorageScrubber & _scrubber;
+	uint8_t _state;
+	uint8_t _credits;
+	uint16_t _address;
+	uint16_t _length;
+	uint16_t _offset;
+	uint16_t _crc;
+	uint16_t _expected;
+};
+
+#endif
@@ -32,27 +32,48 @@
 #include "Pulse.h"
 #include "Configuration.h"
 #include "TimeoutTracker.h"
+#include "EjectQueue.h"
+#include "CoinRate.h"
+#include "CommandStats.h"
 #include "Communicator.h"
+#include "StorageScrubber.h"
+#include "StorageStream.h"
+#include "KeyValueStore.h"
+#include "LoadTest.h"
+#include "PowerFail.h"
+#include "AuditJournal.h"
+#include "Scheduler.h"
 
 typedef WreckedSPI< /* MISO */ 7, /* MOSI */ 2, /* SCLK_MISO */ 8, /* SCLK_MOSI */ 3, /* MODE_MISO */ 2, /* MODE_MOSI */ 0 > spi;
 Configuration conf;
 
 CmdMessenger messenger(Serial);
 Communicator communicator(messenger);
+CommandStats cmd_stats;
+StorageScrubber scrubber(conf, communicator);
+StorageStream storage_stream(conf, communicator, scrubber);
+KeyValueStore kv_store(conf);
+AuditJournal audit_journal(conf);
+LoadTest load_test;
+extern Scheduler scheduler; // with its tasks, before `loop()`
+#if defined(POWER_FAIL_CHANNEL)
+PowerFail power_fail;
+uint32_t power_low_us; // the supply was last seen under the threshold
+#endif
+// the supply's under the power-fail threshold, or not back for long: the
+// outputs are held off and the meters wait.
+bool power_failed = false;
 
 union {
-    uint8_t bytes[sizeof(struct OutPort)];
+    uint8_t bytes[IO_CHAIN_LENGTH];
     struct OutPort port;
 } out;
 
 union {
-    uint8_t bytes[sizeof(struct InPort)];
+    uint8_t bytes[IO_CHAIN_LENGTH];
     struct InPort port;
 } in, previous_in;
 
-// put these here so we can iterate through it...
-static const uint8_t OUTPUT_MASK[3] = { OUT_MASK_0, OUT_MASK_1, OUT_MASK_2 };
-
 bool do_send = false;
 
 TimeoutTracker trackers[] = {
@@ -70,38 +91,145 @@ TimeoutTracker trackers[] = {
 #define TRACKER_TICKET (trackers[1])
 #define TRACKER_NACK (trackers[2])
 
-Pulse<COUNTER_PULSE_DUTY_HIGH, COUNTER_PULSE_DUTY_LOW> pulse_counters[4];
+Pulse<COUNTER_PULSE_DUTY_HIGH, COUNTER_PULSE_DUTY_LOW> pulse_counters[NUM_COUNTERS];
+
+typedef EjectQueue<EJECT_QUEUE_DEPTH> EjectQueueT;
+EjectQueueT eject_queues[NUM_EJECT_TRACKS];
+
+CoinRate coin_rates[NUM_EJECT_TRACKS];
+
+// predictive cut-off for the final coin of a payout: armed to cut the SSR
+// right when the final coin is expected to hit the sensor, then waits for the
+// coin to actually show up.
+#define CUTOFF_IDLE		(0)
+#define CUTOFF_ARMED	(1)
+#define CUTOFF_CUT		(2)
+TimeoutTracker cutoff_trackers[] = {
+#if defined(DEBUG_SERIAL)
+	TimeoutTracker("eject cut-off"),
+	TimeoutTracker("ticket cut-off"),
+#else
+	TimeoutTracker(),
+	TimeoutTracker(),
+#endif
+};
+uint8_t cutoff_states[NUM_EJECT_TRACKS];
+
+// stops the predictive cut-off, powering the motor again if the SSR is already
+// cut, since there are more coins to come.
+static void cancelCutoff(uint8_t const track) {
+	cutoff_trackers[track].stop();
+	if (cutoff_states[track] == CUTOFF_CUT) {
+		#if (NUM_EJECT_TRACKS < 4)
+		bitSet(out.bytes[0], 7 - track); // pull HIGH to enable the SSR
+		#else
+		#error find another way to set the bits!
+		#endif
+		do_send = true;
+	}
+	cutoff_states[track] = CUTOFF_IDLE;
+}
+
+// drops every request on the track, reporting how many coins are left unpaid
+// for each of them.
+static void flushEjectQueue(uint8_t const track) {
+	cutoff_trackers[track].stop();
+	cutoff_states[track] = CUTOFF_IDLE;
+
+	EjectQueueT & queue = eject_queues[track];
+	uint8_t remaining = conf.getCoinsToEject(track);
+	bool queued = false;
+	while (!queue.empty()) {
+		EjectQueueT::RequestT const request = queue.front();
+		queue.pop();
+		if (request.id != EJECT_REQUEST_LEGACY) {
+			communicator.dispatchEjectResult(track, request.id, request.count, remaining);
+			queued = true;
+		}
+		remaining = queue.empty() ? 0 : queue.front().count;
+	}
+	// the results tell the host exactly what's left, no need to block the
+	// next request like the legacy `CMD_EJECT_COIN` does.
+	if (queued)
+		conf.setCoinsToEject(track, 0);
+}
+
+// the NACK didn't come in time, or the supply's going.
+static void stopHoppers() {
+	TRACKER_EJECT.stop();
+	TRACKER_TICKET.stop();
+	out.port.ssr1 = false;
+	out.port.ssr2 = false;
+	do_send = true;
+	flushEjectQueue(TRACK_EJECT);
+	flushEjectQueue(TRACK_TICKET);
+}
 
 class EmptyFunctorT {
 public:
 	__attribute__((always_inline)) inline
-	void operator () () { }
+	void operator () (uint32_t const & now) { }
 };
 
 template < uint8_t TRACK, uint8_t COUNTER >
 class DebounceEjectFallFunctorT {
 public:
 	__attribute__((always_inline)) inline
-	void operator () () {
+	void operator () (uint32_t const & now) {
 		if (TRACK != TRACK_NOT_A_TRACK) {
 			uint32_t coins = conf.getCoinCount(TRACK) + 1;
 			conf.setCoinCount(TRACK, coins);
 			uint8_t to_eject = conf.getCoinsToEject(TRACK);
-			if (to_eject < 2) {
-				trackers[TRACK].stop();
-				TRACKER_NACK.stop();
-				#if (NUM_EJECT_TRACKS < 4)
-				bitClear(out.bytes[0], 7 - TRACK); // pull LOW to stop the SSR
-				#else
-				#error find another way to clear the bits!
-				#endif
-				do_send = true;
-			}
+			EjectQueueT & queue = eject_queues[TRACK];
 			if (to_eject > 0) {
-				trackers[TRACK].stop();
-				conf.setCoinsToEject(TRACK, to_eject - 1);
+				coin_rates[TRACK].feed(now);
+				cutoff_trackers[TRACK].stop();
+				cutoff_states[TRACK] = CUTOFF_IDLE;
 			}
-			communicator.dispatchCoinCounterResult(TRACK, coins);
+			EjectQueueT::RequestT done = { EJECT_REQUEST_LEGACY, 0 };
+			if (to_eject == 1 && !queue.empty()) {
+				// this is the last coin of the request being paid out
+				done = queue.front();
+				queue.pop();
+			}
+			if (to_eject == 1 && !queue.empty()) {
+				// keep the SSR on, and go on with the next request
+				conf.setCoinsToEject(TRACK, queue.front().count);
+				trackers[TRACK].start(now);
+			} else {
+				if (to_eject < 2) {
+					trackers[TRACK].stop();
+					TRACKER_NACK.stop();
+					#if (NUM_EJECT_TRACKS < 4)
+					bitClear(out.bytes[0], 7 - TRACK); // pull LOW to stop the SSR
+					#else
+					#error find another way to clear the bits!
+					#endif
+					do_send = true;
+				}
+				if (to_eject > 0) {
+					trackers[TRACK].stop();
+					conf.setCoinsToEject(TRACK, to_eject - 1);
+				}
+			}
+			// one coin left with nothing queued after it, cut the SSR when it's
+			// expected to hit the sensor instead of after it's debounced.
+			CoinRate const & rate = coin_rates[TRACK];
+			if (conf.getCoinsToEject(TRACK) == 1 && queue.size() <= 1 && rate.stable() &&
+				rate.getAverage() > DEBOUNCE_TIMEOUT + EJECT_CUTOFF_LEAD) {
+				cutoff_trackers[TRACK].begin(rate.getAverage() - DEBOUNCE_TIMEOUT - EJECT_CUTOFF_LEAD);
+				cutoff_trackers[TRACK].start(now);
+				cutoff_states[TRACK] = CUTOFF_ARMED;
+			}
+			#if defined(POWER_FAIL_CHANNEL)
+			// a reset in the middle of a payout mustn't lose the coins paid
+			// since the last write-back, they'd be paid again.
+			if (to_eject > 0 && !power_failed)
+				conf.writeBack();
+			#endif
+			communicator.dispatchCoinCounterResult(TRACK, coins, now);
+			if (done.id != EJECT_REQUEST_LEGACY)
+				communicator.dispatchEjectResult(TRACK, done.id, done.count, 0, now);
 			TRACKER_NACK.start();
 		}
 		badCounterCheck(COUNTER);
@@ -127,11 +255,17 @@ template < uint8_t TRACK, uint8_t COUNTER >
 class DebounceInsertFallFunctorT {
 public:
 	__attribute__((always_inline)) inline
-	void operator () () {
+	void operator () (uint32_t const & now) {
+		if (unlikely(load_test.active())) {
+			// generated, keep them out of the counters and the meters
+			load_test.countCoinEvent();
+			communicator.dispatchCoinCounterResult(TRACK, load_test.getStats().coin_events, now);
+			return;
+		}
 		if (TRACK != TRACK_NOT_A_TRACK) {
 			uint32_t coins = conf.getCoinCount(TRACK) + 1;
 			conf.setCoinCount(TRACK, coins);
-			communicator.dispatchCoinCounterResult(TRACK, coins);
+			communicator.dispatchCoinCounterResult(TRACK, coins, now);
 		}
 		badCounterCheck(COUNTER);
 		if (COUNTER != COUNTER_NOT_A_COUNTER) {
@@ -161,6 +295,505 @@ Debounce<
 static uint8_t const PIN_LATCH_OUT = 4; // for 74HC595
 static uint8_t const PIN_LATCH_IN = 9;  // for 74HC165
 
+// command handlers, they read their own arguments from the messenger.
+static void onAck() {
+	TRACKER_NACK.stop();
+}
+
+static void onGetInfo() {
+	communicator.dispatchGetInfoResult();
+}
+
+static void onSyncClock() {
+	communicator.dispatchSyncClockResult(messenger.readBinArg<uint32_t>());
+}
+
+static void onEjectCoin() {
+	uint8_t const track = messenger.readBinArg<uint8_t>();
+	if (unlikely(track >= NUM_EJECT_TRACKS)) {
+		communicator.dispatchErrorNotATrack(track);
+	} else {
+		uint8_t const count = messenger.readBinArg<uint8_t>();
+		uint8_t const remained = conf.getCoinsToEject(track);
+
+		// block newer command if there are still something left to be ejected
+		if (count != 0 && remained != 0) {
+			communicator.dispatchErrorEjectInterrupted(track, remained);
+		} else if (unlikely(count != 0 && load_test.active())) {
+			// the hoppers stay off during the load test
+			communicator.dispatchErrorLoadTestDenied(CMD_EJECT_COIN);
+		} else {
+			if (count == 0)
+				flushEjectQueue(track);
+			conf.setCoinsToEject(track, count);
+			if (likely(count != 0)) {
+				eject_queues[track].push(EJECT_REQUEST_LEGACY, count);
+				coin_rates[track].start();
+				trackers[track].start();
+				#if (NUM_EJECT_TRACKS < 4)
+				bitSet(out.bytes[0], 7 - track); // pull HIGH to enable the SSR
+				#else
+				#error find another way to set the bits!
+				#endif
+				do_send = true;
+			} else {
+				trackers[track].stop();
+				TRACKER_NACK.stop();
+				#if (NUM_EJECT_TRACKS < 4)
+				bitClear(out.bytes[0], 7 - track); // pull LOW to stop the SSR
+				#else
+				#error find another way to clear the bits!
+				#endif
+				do_send = true;
+			}
+		}
+	}
+}
+
+static void onQueueEjectCoin() {
+	uint8_t const track = messenger.readBinArg<uint8_t>();
+	if (unlikely(track >= NUM_EJECT_TRACKS)) {
+		communicator.dispatchErrorNotATrack(track);
+	} else {
+		uint8_t const id = messenger.readBinArg<uint8_t>();
+		uint8_t const count = messenger.readBinArg<uint8_t>();
+		uint8_t const remained = conf.getCoinsToEject(track);
+		EjectQueueT & queue = eject_queues[track];
+
+		if (unlikely(queue.empty() && remained != 0)) {
+			// left over from before a reset, has to be cancelled
+			// with `CMD_EJECT_COIN` first.
+			communicator.dispatchErrorEjectInterrupted(track, remained);
+		} else if (unlikely(count == 0)) {
+			communicator.dispatchEjectResult(track, id, 0, 0);
+		} else if (unlikely(load_test.active())) {
+			communicator.dispatchErrorLoadTestDenied(CMD_QUEUE_EJECT_COIN);
+		} else if (unlikely(!queue.push(id, count))) {
+			communicator.dispatchErrorEjectQueueFull(track, id);
+		} else if (queue.size() == 1) {
+			// nothing being paid out, start the motor
+			conf.setCoinsToEject(track, count);
+			coin_rates[track].start();
+			trackers[track].start();
+			#if (NUM_EJECT_TRACKS < 4)
+			bitSet(out.bytes[0], 7 - track); // pull HIGH to enable the SSR
+			#else
+			#error find another way to set the bits!
+			#endif
+			do_send = true;
+		} else {
+			// the final coin isn't final anymore
+			cancelCutoff(track);
+		}
+	}
+}
+
+static void onGetEjectStats() {
+	uint8_t const track = messenger.readBinArg<uint8_t>();
+	if (unlikely(track >= NUM_EJECT_TRACKS)) {
+		communicator.dispatchErrorNotATrack(track);
+	} else {
+		bool const reset = messenger.readBinArg<bool>();
+		communicator.dispatchEjectStatsResult(track, coin_rates[track]);
+		if (reset)
+			coin_rates[track].resetStats();
+	}
+}
+
+static void onGetCoinCounter() {
+	uint8_t const track = messenger.readBinArg<uint8_t>();
+	if (unlikely(track >= NUM_TRACKS)) {
+		communicator.dispatchErrorNotATrack(track);
+	} else {
+		communicator.dispatchCoinCounterResult(track, conf.getCoinCount(track));
+	}
+}
+
+static void onResetCoinCointer() {
+	uint8_t const track = messenger.readBinArg<uint8_t>();
+	if (unlikely(track >= NUM_TRACKS)) {
+		communicator.dispatchErrorNotATrack(track);
+	} else {
+		conf.setCoinCount(track, 0);
+	}
+}
+
+static void onGetKeyMasks() {
+	communicator.dispatchKeyMasksResult();
+}
+
+static void onGetKeys() {
+	communicator.dispatchKeysResult(IO_CHAIN_LENGTH, previous_in.bytes);
+}
+
+static void onSetOutput() {
+	uint8_t const length = messenger.readBinArg<uint8_t>();
+	if (unlikely(length != 0)) {
+		for (uint8_t i = 0;i < length && i < IO_CHAIN_LENGTH;++i)
+			out.bytes[i] =
+				(out.bytes[i] & ~outMask(i)) |
+				(messenger.readBinArg<uint8_t>() & outMask(i));
+		do_send = true;
+	}
+}
+
+static void onTickAuditCounter() {
+	uint8_t const counter = messenger.readBinArg<uint8_t>();
+	uint32_t const ticks = messenger.readBinArg<uint32_t>();
+#if defined(DEBUG_SERIAL)
+	if (likely(counter < 4)) {
+#else
+	if (likely(counter < 2)) {
+#endif
+		pulse_counters[counter].pulse(ticks);
+	} else {
+		communicator.dispatchErrorNotACounter(counter);
+	}
+}
+
+static void onGetAuditBacklog() {
+	uint32_t pending[NUM_COUNTERS];
+	for (uint8_t i = 0;i < NUM_COUNTERS;++i)
+		pending[i] = pulse_counters[i].pending();
+	communicator.dispatchAuditBacklogResult(pending, audit_journal);
+}
+
+static void onSetTrackLevel() {
+	uint8_t const track = messenger.readBinArg<uint8_t>();
+	if (unlikely(track >= NUM_TRACKS)) {
+		communicator.dispatchErrorNotATrack(track);
+	} else {
+		uint8_t const level = messenger.readBinArg<bool>();
+		conf.setTrackLevel(track, level);
+	}
+}
+
+static void onSetEjectTimeout() {
+	uint8_t const track = messenger.readBinArg<uint8_t>();
+	if (unlikely(track >= NUM_EJECT_TRACKS)) {
+		communicator.dispatchErrorNotATrack(track);
+	} else {
+		uint32_t const timeout = messenger.readBinArg<uint32_t>();
+		conf.setEjectTimeout(track, timeout);
+	}
+}
+
+// the top of the FRAM (the scrubber's table and the key/value store) stays user
+// area until the host formats it, titles might have their data in it.
+static inline uint16_t userEnd() {
+	return kv_store.isFormatted() ? CONF_ADDR_USER_END : MAX_STORAGE_ADDRESS;
+}
+
+static void onWriteStorage() {
+	uint32_t const address = messenger.readBinArg<uint16_t>();
+	uint8_t const length = messenger.readBinArg<uint8_t>();
+	if (unlikely(address < CONF_ADDR_USER_BEGIN)) {
+		communicator.dispatchErrorProtectedStorage(address);
+	} else if (unlikely(length > MAX_BYTES_LENGTH)) {
+		communicator.dispatchErrorTooLong(length);
+	} else if (unlikely(address + length > MAX_STORAGE_ADDRESS)) {
+		communicator.dispatchErrorOutOfRange(address, length);
+	} else if (unlikely(address + length > userEnd())) {
+		communicator.dispatchErrorProtectedStorage(userEnd());
+	} else {
+		uint8_t buffer[length];
+		for (uint8_t i = 0; i < length; ++i)
+			buffer[i] = messenger.readBinArg<uint8_t>();
+		conf.writeBytes(address, length, buffer);
+		scrubber.seal(address, length);
+		communicator.dispatchWriteStorageResult(address, length);
+	}
+}
+
+static void onReadStorage() {
+	uint32_t const address = messenger.readBinArg<uint16_t>();
+	uint8_t const length = messenger.readBinArg<uint8_t>();
+#if !defined(DEBUG_SERIAL)
+	if (unlikely(address < CONF_ADDR_USER_BEGIN)) {
+		communicator.dispatchErrorProtectedStorage(address);
+	} else
+#endif
+	if (unlikely(length > MAX_BYTES_LENGTH)) {
+		communicator.dispatchErrorTooLong(length);
+	} else if (unlikely(address + length > MAX_STORAGE_ADDRESS)) {
+		communicator.dispatchErrorOutOfRange(address, length);
+#if !defined(DEBUG_SERIAL)
+	} else if (unlikely(address + length > userEnd())) {
+		communicator.dispatchErrorProtectedStorage(userEnd());
+#endif
+	} else {
+		uint8_t buffer[length];
+		conf.readBytes(address, length, buffer);
+		communicator.dispatchReadStorageResult(address, length, buffer);
+	}
+}
+
+static void onStreamReadStorage() {
+	uint32_t const address = messenger.readBinArg<uint16_t>();
+	uint32_t const length = messenger.readBinArg<uint16_t>();
+	uint8_t const credits = messenger.readBinArg<uint8_t>();
+	if (unlikely(storage_stream.busy())) {
+		communicator.dispatchErrorStreamBusy();
+	} else
+#if !defined(DEBUG_SERIAL)
+	if (unlikely(address < CONF_ADDR_USER_BEGIN)) {
+		communicator.dispatchErrorProtectedStorage(address);
+	} else
+#endif
+	if (unlikely(length == 0 || address + length > MAX_STORAGE_ADDRESS)) {
+		communicator.dispatchErrorStreamOutOfRange(address, length);
+#if !defined(DEBUG_SERIAL)
+	} else if (unlikely(address + length > userEnd())) {
+		communicator.dispatchErrorProtectedStorage(userEnd());
+#endif
+	} else {
+		storage_stream.beginRead(address, length, credits);
+	}
+}
+
+static void onStreamCredit() {
+	storage_stream.credit(messenger.readBinArg<uint8_t>());
+}
+
+static void onGetIntegrityMap() {
+	communicator.dispatchIntegrityMapResult(CONF_ADDR_USER_BEGIN, SCRUB_BLOCK_SIZE, SCRUB_BLOCKS,
+		scrubber.isSealed(), scrubber.getPasses(), scrubber.getMap());
+}
+
+static void onStreamAbort() {
+	storage_stream.abort();
+}
+
+static void onStreamWriteBegin() {
+	uint32_t const address = messenger.readBinArg<uint16_t>();
+	uint32_t const length = messenger.readBinArg<uint16_t>();
+	if (unlikely(storage_stream.busy())) {
+		communicator.dispatchErrorStreamBusy();
+	} else if (unlikely(address < CONF_ADDR_USER_BEGIN)) {
+		communicator.dispatchErrorProtectedStorage(address);
+	} else if (unlikely(length == 0 || address + length > MAX_STORAGE_ADDRESS)) {
+		communicator.dispatchErrorStreamOutOfRange(address, length);
+	} else if (unlikely(address + length > userEnd())) {
+		communicator.dispatchErrorProtectedStorage(userEnd());
+	} else {
+		storage_stream.beginWrite(address, length);
+	}
+}
+
+static void onStreamWriteChunk() {
+	uint16_t const address = messenger.readBinArg<uint16_t>();
+	uint8_t const length = messenger.readBinArg<uint8_t>();
+	if (unlikely(length > STREAM_CHUNK_LENGTH)) {
+		communicator.dispatchErrorStreamSequence(storage_stream.expected(), address);
+	} else {
+		uint8_t buffer[STREAM_CHUNK_LENGTH];
+		for (uint8_t i = 0; i < length; ++i)
+			buffer[i] = messenger.readBinArg<uint8_t>();
+		uint8_t const crc = messenger.readBinArg<uint8_t>();
+		storage_stream.writeChunk(address, length, buffer, crc);
+	}
+}
+
+static void onStreamWriteEnd() {
+	storage_stream.endWrite(messenger.readBinArg<uint16_t>());
+}
+
+static void onKvGet() {
+	uint16_t const key = messenger.readBinArg<uint16_t>();
+	uint8_t value[KV_MAX_VALUE_LENGTH];
+	uint8_t length = 0;
+	uint8_t const result = kv_store.get(key, length, value);
+	if (unlikely(result == KV_CORRUPTED))
+		communicator.dispatchErrorKvCorrupted(key);
+	else if (unlikely(result == KV_UNFORMATTED))
+		communicator.dispatchErrorKvUnformatted(key);
+	else
+		communicator.dispatchKvGetResult(key, result == KV_OK, length, value);
+}
+
+static void onKvPut() {
+	uint16_t const key = messenger.readBinArg<uint16_t>();
+	uint8_t const length = messenger.readBinArg<uint8_t>();
+	if (unlikely(length > KV_MAX_VALUE_LENGTH)) {
+		communicator.dispatchErrorKvInvalid(key, length);
+	} else {
+		uint8_t value[KV_MAX_VALUE_LENGTH];
+		for (uint8_t i = 0; i < length; ++i)
+			value[i] = messenger.readBinArg<uint8_t>();
+		uint8_t const result = kv_store.put(key, length, value);
+		if (likely(result == KV_OK))
+			communicator.dispatchKvPutResult(key, length, kv_store.getFree());
+		else if (result == KV_FULL)
+			communicator.dispatchErrorKvFull(key, kv_store.getFree());
+		else if (result == KV_UNFORMATTED)
+			communicator.dispatchErrorKvUnformatted(key);
+		else
+			communicator.dispatchErrorKvInvalid(key, length);
+	}
+}
+
+static void onKvDelete() {
+	uint16_t const key = messenger.readBinArg<uint16_t>();
+	uint8_t const result = kv_store.remove(key);
+	if (unlikely(result == KV_FULL))
+		communicator.dispatchErrorKvFull(key, kv_store.getFree());
+	else if (unlikely(result == KV_UNFORMATTED))
+		communicator.dispatchErrorKvUnformatted(key);
+	else
+		communicator.dispatchKvDeleteResult(key, result == KV_OK);
+}
+
+// reports the store, and formats the top of the FRAM with the guard: the
+// scrubber's table and the store. not while a stream might be writing there.
+static void onKvFormat() {
+	uint16_t const guard = messenger.readBinArg<uint16_t>();
+	if (guard == KV_FORMAT_GUARD && unlikely(storage_stream.busy())) {
+		communicator.dispatchErrorStreamBusy();
+	} else {
+		if (guard == KV_FORMAT_GUARD) {
+			scrubber.format();
+			kv_store.format();
+		}
+		communicator.dispatchKvFormatResult(kv_store.isFormatted(), userEnd(), kv_store.getFree());
+	}
+}
+
+static void onGetCmdStats() {
+	bool const reset = messenger.readBinArg<bool>();
+	uint8_t const first = messenger.readBinArg<uint8_t>();
+	uint8_t const count = CommandStats::pageOf(first);
+	communicator.dispatchCmdStatsResult(cmd_stats, first, count);
+	if (reset)
+		cmd_stats.reset(first, count);
+}
+
+static void onGetPersistStats() {
+	bool const reset = messenger.readBinArg<bool>();
+	communicator.dispatchPersistStatsResult(POWER_FAIL_ENABLED, power_failed, conf.getPersistStats());
+	if (reset)
+		conf.resetPersistStats();
+}
+
+static void onLoadTest() {
+	uint16_t const guard = messenger.readBinArg<uint16_t>();
+	uint8_t const mode = messenger.readBinArg<uint8_t>();
+	uint16_t const key_rate = messenger.readBinArg<uint16_t>();
+	uint16_t const coin_rate = messenger.readBinArg<uint16_t>();
+	uint16_t const duration = messenger.readBinArg<uint16_t>();
+	uint16_t const seed = messenger.readBinArg<uint16_t>();
+	uint32_t const now = micros();
+	if (mode == LOAD_TEST_OFF) {
+		load_test.stop(now);
+		communicator.dispatchLoadTestResult(load_test);
+	} else if (unlikely(guard != LOAD_TEST_GUARD || mode > LOAD_TEST_PATTERN ||
+		conf.getCoinsToEject(TRACK_EJECT) != 0 || conf.getCoinsToEject(TRACK_TICKET) != 0)) {
+		// never while a hopper is paying out
+		communicator.dispatchErrorLoadTestDenied(CMD_LOAD_TEST);
+	} else {
+		load_test.begin(mode, key_rate, coin_rate, duration, seed, previous_in.bytes, now);
+		out.port.ssr1 = false;
+		out.port.ssr2 = false;
+		do_send = true;
+		communicator.dispatchLoadTestResult(load_test);
+	}
+}
+
+static void onGetLoadTestStats() {
+	communicator.dispatchLoadTestResult(load_test);
+}
+
+static void onGetTaskStats() {
+	bool const reset = messenger.readBinArg<bool>();
+	uint8_t const task = messenger.readBinArg<uint8_t>();
+	communicator.dispatchTaskStatsResult(scheduler, task);
+	if (reset && task < scheduler.getCount())
+		scheduler.reset(task);
+}
+
+// command handlers, in the same order as COMMAND_OPCODES.
+typedef void (* CommandHandlerT)();
+static CommandHandlerT const COMMAND_HANDLERS[] PROGMEM = {
+	onAck, // CMD_ACK
+	onGetInfo, // CMD_GET_INFO
+	onGetKeyMasks, // CMD_GET_KEY_MASKS
+	onSyncClock, // CMD_SYNC_CLOCK
+	onGetKeys, // CMD_GET_KEYS
+	onSetOutput, // CMD_SET_OUTPUT
+	onGetCoinCounter, // CMD_GET_COIN_COUNTER
+	onResetCoinCointer, // CMD_RESET_COIN_COINTER
+	onTickAuditCounter, // CMD_TICK_AUDIT_COUNTER
+	onGetAuditBacklog, // CMD_GET_AUDIT_BACKLOG
+	onEjectCoin, // CMD_EJECT_COIN
+	onSetTrackLevel, // CMD_SET_TRACK_LEVEL
+	onSetEjectTimeout, // CMD_SET_EJECT_TIMEOUT
+	onQueueEjectCoin, // CMD_QUEUE_EJECT_COIN
+	onGetEjectStats, // CMD_GET_EJECT_STATS
+	onReadStorage, // CMD_READ_STORAGE
+	onStreamReadStorage, // CMD_STREAM_READ_STORAGE
+	onStreamCredit, // CMD_STREAM_CREDIT
+	onGetIntegrityMap, // CMD_GET_INTEGRITY_MAP
+	onKvGet, // CMD_KV_GET
+	onStreamAbort, // CMD_STREAM_ABORT
+	onWriteStorage, // CMD_WRITE_STORAGE
+	onStreamWriteBegin, // CMD_STREAM_WRITE_BEGIN
+	onStreamWriteChunk, // CMD_STREAM_WRITE_CHUNK
+	onStreamWriteEnd, // CMD_STREAM_WRITE_END
+	onKvPut, // CMD_KV_PUT
+	onKvDelete, // CMD_KV_DELETE
+	onKvFormat, // CMD_KV_FORMAT
+	onGetCmdStats, // CMD_GET_CMD_STATS
+	onGetPersistStats, // CMD_GET_PERSIST_STATS
+	onGetTaskStats, // CMD_GET_TASK_STATS
+	onLoadTest, // CMD_LOAD_TEST
+	onGetLoadTestStats, // CMD_GET_LOAD_TEST_STATS
+};
+static_assert(sizeof(COMMAND_HANDLERS) / sizeof(COMMAND_HANDLERS[0]) == COMMAND_COUNT,
+	"COMMAND_HANDLERS and COMMAND_OPCODES are out of sync");
+
+#if defined(POWER_FAIL_CHANNEL)
+// the supply's going: the outputs go off so the capacitors last longer, and
+// the counters kept in RAM go to the FRAM with the meter ticks not pulsed yet.
+// then the card goes on with the outputs held off, and the hoppers stopped like
+// on a missing NACK, until the supply is good again for POWER_FAIL_RECOVERY
+// (a brown-out the card lived through), or the end.
+static void onPowerFail(uint32_t const & since) {
+	power_failed = true;
+	fastDigitalWrite(PIN_LATCH_OUT, LOW);
+	unroll<IO_CHAIN_LENGTH>([](uint8_t const i) {
+		spi::send(0);
+	});
+	fastDigitalWrite(PIN_LATCH_OUT, HIGH);
+
+	uint32_t pulses[NUM_COUNTERS];
+	for (uint8_t i = 0;i < NUM_COUNTERS;++i)
+		pulses[i] = pulse_counters[i].pending();
+	conf.persist(pulses, since);
+
+	stopHoppers();
+	communicator.dispatchPersistStatsResult(POWER_FAIL_ENABLED, power_failed, conf.getPersistStats());
+}
+
+// the banks are good again, and the outputs back.
+static void onPowerBack() {
+	power_failed = false;
+	conf.writeBack();
+	conf.discardPersisted();
+	do_send = true;
+	communicator.dispatchPersistStatsResult(POWER_FAIL_ENABLED, power_failed, conf.getPersistStats());
+}
+
+static void checkPowerFail() {
+	uint32_t const now = micros();
+	if (power_fail.low()) {
+		power_low_us = now;
+		if (!power_failed)
+			onPowerFail(now);
+	} else if (now - power_low_us >= POWER_FAIL_RECOVERY) {
+		onPowerBack();
+	}
+}
+#endif
+
 void setup() {
 	#if defined(DEBUG_SERIAL)
 	uint32_t t1 = micros(), t2;
@@ -177,9 +810,9 @@ void setup() {
 	// send and receive the initial states
     fastDigitalWrite(PIN_LATCH_OUT, LOW);
     fastDigitalWrite(PIN_LATCH_IN, HIGH);
-    previous_in.bytes[0] = spi::transfer(out.bytes[0]) & IN_MASK_0;
-    previous_in.bytes[1] = spi::transfer(out.bytes[1]) & IN_MASK_1;
-    previous_in.bytes[2] = spi::transfer(out.bytes[2]) & IN_MASK_2;
+    unroll<IO_CHAIN_LENGTH>([](uint8_t const i) {
+        previous_in.bytes[i] = spi::transfer(out.bytes[i]) & inMask(i);
+    });
     fastDigitalWrite(PIN_LATCH_OUT, HIGH);
     fastDigitalWrite(PIN_LATCH_IN, LOW);
 
@@ -187,7 +820,10 @@ void setup() {
 
 	// power-off unused peripherals, so they don't generate interrupts
 	// also saves some power...
+	// the power-fail warning needs the ADC powered for its multiplexer
+	#if !defined(POWER_FAIL_CHANNEL)
 	power_adc_disable(); // we're not using the ADC
+	#endif
 	power_spi_disable(); // we're not using the hardware SPI
 	power_timer1_disable(); // we're not using Timer1
 	power_timer2_disable(); // we're not using Timer2
@@ -200,6 +836,18 @@ void setup() {
 	// do the rest of the thing after we switch off the motor
     Serial.begin(UART_BAUDRATE);
 	conf.begin();
+	// the meter ticks a reset cut short, the power-fail record is newer than
+	// the journal when there's one.
+	uint32_t pulses[NUM_COUNTERS];
+	audit_journal.begin(pulses);
+	conf.restore(pulses);
+	for (uint8_t i = 0;i < NUM_COUNTERS;++i)
+		pulse_counters[i].pulse(pulses[i]);
+	#if defined(POWER_FAIL_CHANNEL)
+	power_fail.begin();
+	#endif
+	kv_store.begin();
+	scrubber.begin(now, kv_store.isFormatted());
 
 	// debuggin with FRAM takes a lot of time, enable wdt after that.
 	#if defined(DEBUG_SERIAL)
@@ -220,174 +868,22 @@ void setup() {
 
 	// attach command handler
 	messenger.attach([]() {
-		#if defined(DEBUG_SERIAL)
 		uint32_t t1, t2;
 		t1 = micros();
-		#endif
-		switch (messenger.commandID()) {
-			case CMD_ACK:
-				TRACKER_NACK.stop();
-				break;
-			case CMD_GET_INFO:
-				communicator.dispatchGetInfoResult();
-				break;
-			case CMD_EJECT_COIN:
-				{
-					uint8_t const track = messenger.readBinArg<uint8_t>();
-					if (unlikely(track >= NUM_EJECT_TRACKS)) {
-						communicator.dispatchErrorNotATrack(track);
-					} else {
-						uint8_t const count = messenger.readBinArg<uint8_t>();
-						uint8_t const remained = conf.getCoinsToEject(track);
-
-						// block newer command if there are still something left to be ejected
-						if (count != 0 && remained != 0) {
-							communicator.dispatchErrorEjectInterrupted(track, remained);
-						} else {
-							conf.setCoinsToEject(track, count);
-							if (likely(count != 0)) {
-								trackers[track].start();
-								#if (NUM_EJECT_TRACKS < 4)
-								bitSet(out.bytes[0], 7 - track); // pull HIGH to enable the SSR
-								#else
-								#error find another way to set the bits!
-								#endif
-								do_send = true;
-							} else {
-								trackers[track].stop();
-								TRACKER_NACK.stop();
-								#if (NUM_EJECT_TRACKS < 4)
-								bitClear(out.bytes[0], 7 - track); // pull LOW to stop the SSR
-								#else
-								#error find another way to clear the bits!
-								#endif
-								do_send = true;
-							}
-						}
-					}
-				}
-				break;
-			case CMD_GET_COIN_COUNTER:
-				{
-					uint8_t const track = messenger.readBinArg<uint8_t>();
-					if (unlikely(track >= NUM_TRACKS)) {
-						communicator.dispatchErrorNotATrack(track);
-					} else {
-						communicator.dispatchCoinCounterResult(track, conf.getCoinCount(track));
-					}
-				}
-				break;
-			case CMD_RESET_COIN_COINTER:
-				{
-					uint8_t const track = messenger.readBinArg<uint8_t>();
-					if (unlikely(track >= NUM_TRACKS)) {
-						communicator.dispatchErrorNotATrack(track);
-					} else {
-						conf.setCoinCount(track, 0);
-					}
-				}
-				break;
-			case CMD_GET_KEY_MASKS:
-				communicator.dispatchKeyMasksResult();
-				break;
-			case CMD_GET_KEYS:
-				communicator.dispatchKeysResult(3, previous_in.bytes);
-				break;
-			case CMD_SET_OUTPUT:
-				{
-					uint8_t const length = messenger.readBinArg<uint8_t>();
-					if (unlikely(length != 0)) {
-						for (int i = 0;i < length && i < 3;++i)
-							out.bytes[i] =
-								(out.bytes[i] & ~OUTPUT_MASK[i]) |
-								(messenger.readBinArg<uint8_t>() & OUTPUT_MASK[i]);
-						do_send = true;
-					}
-				}
-				break;
-			case CMD_TICK_AUDIT_COUNTER:
-				{
-					uint8_t const counter = messenger.readBinArg<uint8_t>();
-					uint32_t const ticks = messenger.readBinArg<uint32_t>();
-				#if defined(DEBUG_SERIAL)
-					if (likely(counter < 4)) {
-				#else
-					if (likely(counter < 2)) {
-				#endif
-						pulse_counters[counter].pulse(ticks);
-					} else {
-						communicator.dispatchErrorNotACounter(counter);
-					}
-				}
-				break;
-			case CMD_SET_TRACK_LEVEL:
-				{
-					uint8_t const track = messenger.readBinArg<uint8_t>();
-					if (unlikely(track >= NUM_TRACKS)) {
-						communicator.dispatchErrorNotATrack(track);
-					} else {
-						uint8_t const level = messenger.readBinArg<bool>();
-						conf.setTrackLevel(track, level);
-					}
-				}
-				break;
-			case CMD_SET_EJECT_TIMEOUT:
-				{
-					uint8_t const track = messenger.readBinArg<uint8_t>();
-					if (unlikely(track >= NUM_EJECT_TRACKS)) {
-						communicator.dispatchErrorNotATrack(track);
-					} else {
-						uint32_t const timeout = messenger.readBinArg<uint32_t>();
-						conf.setEjectTimeout(track, timeout);
-					}
-				}
-				break;
-			case CMD_WRITE_STORAGE:
-				{
-					uint32_t const address = messenger.readBinArg<uint16_t>();
-					uint8_t const length = messenger.readBinArg<uint8_t>();
-					if (unlikely(address < CONF_ADDR_USER_BEGIN)) {
-						communicator.dispatchErrorProtectedStorage(address);
-					} else if (unlikely(length > MAX_BYTES_LENGTH)) {
-						communicator.dispatchErrorTooLong(length);
-					} else if (unlikely(address + length > MAX_STORAGE_ADDRESS)) {
-						communicator.dispatchErrorOutOfRange(address, length);
-					} else {
-						uint8_t buffer[length];
-						for (uint8_t i = 0; i < length; ++i)
-							buffer[i] = messenger.readBinArg<uint8_t>();
-						conf.writeBytes(address, length, buffer);
-						communicator.dispatchWriteStorageResult(address, length);
-					}
-				}
-				break;
-			case CMD_READ_STORAGE:
-				{
-					uint32_t const address = messenger.readBinArg<uint16_t>();
-					uint8_t const length = messenger.readBinArg<uint8_t>();
-				#if !defined(DEBUG_SERIAL)
-					if (unlikely(address < CONF_ADDR_USER_BEGIN)) {
-						communicator.dispatchErrorProtectedStorage(address);
-					} else
-				#endif
-					if (unlikely(length > MAX_BYTES_LENGTH)) {
-						communicator.dispatchErrorTooLong(length);
-					} else if (unlikely(address + length > MAX_STORAGE_ADDRESS)) {
-						communicator.dispatchErrorOutOfRange(address, length);
-					} else {
-						uint8_t buffer[length];
-						conf.readBytes(address, length, buffer);
-						communicator.dispatchReadStorageResult(address, length, buffer);
-					}
-				}
-				break;
-			case CMD_REBOOT:
-				for (;;); // block the thread and let WDT triggers an reset
-			default:
-				communicator.dispatchErrorUnknownCommand(messenger.commandID());
+		uint8_t const handler = findOpcode(COMMAND_OPCODES, COMMAND_COUNT, messenger.commandID());
+		if (likely(handler != COMMAND_COUNT)) {
+			reinterpret_cast<CommandHandlerT>(pgm_read_ptr(&COMMAND_HANDLERS[handler]))();
+		} else if (messenger.commandID() == CMD_REBOOT) {
+			#if defined(POWER_FAIL_CHANNEL)
+			conf.writeBack(); // RAM doesn't survive the reset
+			#endif
+			for (;;); // block the thread and let WDT triggers an reset
+		} else {
+			communicator.dispatchErrorUnknownCommand(messenger.commandID());
 		}
-		#if defined(DEBUG_SERIAL)
 		t2 = micros();
+		cmd_stats.record(CommandStats::slotOf(messenger.commandID()), t2 - t1);
+		#if defined(DEBUG_SERIAL)
 		DEBUG_SERIAL.print((int)EVT_DEBUG);
 		DEBUG_SERIAL.print(F(",cmd handler took "));
 		DEBUG_SERIAL.print(t2 - t1);
@@ -395,6 +891,7 @@ void setup() {
 		#endif
 	});
 
+	scheduler.begin(micros());
 	communicator.dispatchBoot();
 
 	#if defined(DEBUG_SERIAL)
@@ -421,34 +918,28 @@ void check_counter(uint32_t const now = micros()) {
 	}
 }
 
-void loop() {
-	#if defined(DEBUG_SERIAL)
-	static uint32_t last_millis = millis();
-	uint32_t t1, t2;
-	t1 = micros();
-	#endif
-
-	wdt_reset(); // feed the dog
-
+// scans the inputs, then everything the inputs and the time drive: the load
+// test, the timeouts, the predictive cut-off, the debouncers and the keys.
+static void taskInputs(uint32_t const & now) {
 	// read key states
     fastDigitalWrite(PIN_LATCH_IN, HIGH);
-    in.bytes[0] = spi::receive();
-    in.bytes[1] = spi::receive();
-    in.bytes[2] = spi::receive();
+    unroll<IO_CHAIN_LENGTH>([](uint8_t const i) {
+        in.bytes[i] = spi::receive();
+    });
     fastDigitalWrite(PIN_LATCH_IN, LOW);
 
-	uint32_t now = micros();
+	// the load test replaces the inputs, until it's over.
+	if (unlikely(load_test.active())) {
+		if (Serial.availableForWrite() < LOAD_TEST_TX_ROOM)
+			load_test.countTxStall();
+		if (!load_test.generate(in.bytes, conf.getTrackLevels().bytes, now))
+			communicator.dispatchLoadTestResult(load_test);
+	}
 
 	// check the timeout tracker before we feed the debouncers, since debouncers
 	// might trigger tracker.start() when a coin is confirmed.
 	if (TRACKER_NACK.trigger(now))
-	{
-		TRACKER_EJECT.stop();
-		TRACKER_TICKET.stop();
-		out.port.ssr1 = false;
-		out.port.ssr2 = false;
-		do_send = true;
-	}
+		stopHoppers();
 	if (TRACKER_EJECT.trigger(now))
 	{
 		uint8_t const coins = conf.getCoinsToEject(TRACK_EJECT);
@@ -456,6 +947,7 @@ void loop() {
 			communicator.dispatchErrorEjectTimeout(TRACK_EJECT, coins);
 			out.port.ssr1 = false;
 			do_send = true;
+			flushEjectQueue(TRACK_EJECT);
 		}
 	}
 	if (TRACKER_TICKET.trigger(now))
@@ -465,9 +957,43 @@ void loop() {
 			communicator.dispatchErrorEjectTimeout(TRACK_TICKET, coins);
 			out.port.ssr2 = false;
 			do_send = true;
+			flushEjectQueue(TRACK_TICKET);
 		}
 	}
 
+	// predictive cut-off and slow hopper detection
+	unroll<NUM_EJECT_TRACKS>([&](uint8_t const track) {
+		CoinRate & rate = coin_rates[track];
+		if (cutoff_trackers[track].trigger(now)) {
+			if (cutoff_states[track] == CUTOFF_ARMED) {
+				// the final coin should be hitting the sensor, let the motor
+				// coast it out.
+				#if (NUM_EJECT_TRACKS < 4)
+				bitClear(out.bytes[0], 7 - track); // pull LOW to stop the SSR
+				#else
+				#error find another way to clear the bits!
+				#endif
+				cutoff_states[track] = CUTOFF_CUT;
+				cutoff_trackers[track].begin(rate.getAverage() * EJECT_SLOW_FACTOR);
+				cutoff_trackers[track].start(now);
+				rate.countCut();
+			} else {
+				// cut too early, power the motor again and learn from scratch
+				#if (NUM_EJECT_TRACKS < 4)
+				bitSet(out.bytes[0], 7 - track); // pull HIGH to enable the SSR
+				#else
+				#error find another way to set the bits!
+				#endif
+				cutoff_states[track] = CUTOFF_IDLE;
+				rate.countMiss();
+				rate.relearn();
+			}
+			do_send = true;
+		}
+		if (conf.getCoinsToEject(track) != 0 && cutoff_states[track] != CUTOFF_CUT && rate.overdue(now))
+			communicator.dispatchErrorEjectSlow(track, now - rate.getLast(), rate.getAverage(), now);
+	});
+
 	// debounce the inputs
 	const Configuration::TrackLevelsT &track_levels = conf.getTrackLevels();
 	debounce_insert_1.feed(in.port.sw12, track_levels.bits.track_level_2, now);
@@ -476,33 +1002,102 @@ void loop() {
 	debounce_eject.feed(in.port.sw11, track_levels.bits.track_level_0, now);
 	debounce_ticket.feed(in.port.sw14, track_levels.bits.track_level_1, now);
 
-	// pulse the counters
-	check_counter<COUNTER_SCORE>(now);
-	check_counter<COUNTER_WASH>(now);
-	check_counter<COUNTER_INSERT>(now);
-	check_counter<COUNTER_EJECT>(now);
-
 	// rest of the keys are not debounced, we just send them to the PC if
 	// anything changed.
-	uint8_t masked[] = {
-		static_cast<uint8_t>(in.bytes[0] & IN_MASK_0),
-		static_cast<uint8_t>(in.bytes[1] & IN_MASK_1),
-		static_cast<uint8_t>(in.bytes[2] & IN_MASK_2),
-	};
-	if (masked[0] != previous_in.bytes[0] ||
-		masked[1] != previous_in.bytes[1] ||
-		masked[2] != previous_in.bytes[2])
+	uint8_t masked[IO_CHAIN_LENGTH];
+	uint8_t changed = 0;
+	unroll<IO_CHAIN_LENGTH>([&](uint8_t const i) {
+		masked[i] = in.bytes[i] & inMask(i);
+		changed |= masked[i] ^ previous_in.bytes[i];
+	});
+	if (changed)
 	{
-		communicator.dispatchKeysResult(3, masked);
+		communicator.dispatchKeysResult(IO_CHAIN_LENGTH, masked, now);
+		if (unlikely(load_test.active()))
+			load_test.countKeyEvent();
 
-		previous_in.bytes[0] = masked[0];
-		previous_in.bytes[1] = masked[1];
-		previous_in.bytes[2] = masked[2];
+		unroll<IO_CHAIN_LENGTH>([&](uint8_t const i) {
+			previous_in.bytes[i] = masked[i];
+		});
 	}
+}
 
-	// feed the serial data before we send, because messenger might want to
-	// modify stuff.
+// pulses the meters
+static void taskCounters(uint32_t const & now) {
+	// the ticks not pulsed are in the power-fail record
+	if (unlikely(power_failed))
+		return;
+	check_counter<COUNTER_SCORE>(now);
+	check_counter<COUNTER_WASH>(now);
+	check_counter<COUNTER_INSERT>(now);
+	check_counter<COUNTER_EJECT>(now);
+}
+
+// the commands, before the storage work so credits and aborts take effect
+// right away.
+static void taskSerial(uint32_t const & now) {
 	messenger.feedinSerialData();
+}
+
+// the counters kept in RAM, and the meter ticks not pulsed yet.
+static void taskJournal(uint32_t const & now) {
+	#if defined(POWER_FAIL_CHANNEL)
+	if (unlikely(power_failed)) {
+		uint32_t pulses[NUM_COUNTERS];
+		for (uint8_t i = 0;i < NUM_COUNTERS;++i)
+			pulses[i] = pulse_counters[i].pending();
+		conf.persistChanges(pulses);
+	} else
+	#endif
+	conf.service();
+	audit_journal.service(pulse_counters);
+}
+
+// background storage work, one chunk / record per run.
+static void taskStream(uint32_t const & now) {
+	storage_stream.service();
+}
+
+static void taskKvStore(uint32_t const & now) {
+	kv_store.service();
+}
+
+// scrub only when nothing else is using the FRAM.
+static void taskScrubber(uint32_t const & now) {
+	if (!storage_stream.busy() && !kv_store.isCompacting())
+		scrubber.service(now);
+}
+
+// by priority: the inputs and the meters run at their period, the rest fills
+// the gaps, see `Scheduler`. the budgets are in us.
+static TaskT const TASKS[] PROGMEM = {
+	{ taskInputs, 500, 250, TASK_REALTIME },
+	{ taskCounters, 1000, 50, TASK_REALTIME },
+	{ taskSerial, 0, 300, 0 },
+	{ taskJournal, 0, 300, 0 },
+	{ taskStream, 0, 1000, 0 },
+	{ taskKvStore, 0, 1000, 0 },
+	{ taskScrubber, 0, 500, 0 },
+};
+static_assert(sizeof(TASKS) / sizeof(TASKS[0]) <= SCHED_MAX_TASKS, "too many tasks");
+Scheduler scheduler(TASKS, sizeof(TASKS) / sizeof(TASKS[0]));
+
+void loop() {
+	#if defined(DEBUG_SERIAL)
+	static uint32_t last_millis = millis();
+	uint32_t t1, t2;
+	t1 = micros();
+	#endif
+
+	wdt_reset(); // feed the dog
+
+	// before anything else gets the FRAM
+	#if defined(POWER_FAIL_CHANNEL)
+	if (unlikely(power_failed || power_fail.low()))
+		checkPowerFail();
+	#endif
+
+	scheduler.run();
 
 	// send the outputs only when needed
 	#if defined(DEBUG_SERIAL)
@@ -510,10 +1105,15 @@ void loop() {
 	#endif
 		if (do_send) {
 			do_send = false;
+			// whatever happened, the hoppers stay off during the load test.
+			if (unlikely(load_test.active())) {
+				out.port.ssr1 = false;
+				out.port.ssr2 = false;
+			}
 	        fastDigitalWrite(PIN_LATCH_OUT, LOW);
-	        spi::send(out.bytes[0]);
-	        spi::send(out.bytes[1]);
-	        spi::send(out.bytes[2]);
+	        unroll<IO_CHAIN_LENGTH>([](uint8_t const i) {
+	            spi::send(unlikely(power_failed) ? 0 : out.bytes[i]);
+	        });
 	        fastDigitalWrite(PIN_LATCH_OUT, HIGH);
 		}
 
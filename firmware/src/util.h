@@ -8,6 +8,31 @@
 #define likely(x)       __builtin_expect((x),1)
 #define unlikely(x)     __builtin_expect((x),0)
 
+// calls `f(0)`, `f(1)`, ..., `f(N - 1)`, unrolled at compile time so `i` is
+// a constant inside `f`.
+template <uint8_t N>
+struct Unroll {
+	template <typename FunctorT>
+	static inline __attribute__((always_inline))
+	void apply(FunctorT const & f) {
+		Unroll<N - 1>::apply(f);
+		f(N - 1);
+	}
+};
+
+template <>
+struct Unroll<0> {
+	template <typename FunctorT>
+	static inline __attribute__((always_inline))
+	void apply(FunctorT const &) { }
+};
+
+template <uint8_t N, typename FunctorT>
+static inline __attribute__((always_inline))
+void unroll(FunctorT const & f) {
+	Unroll<N>::apply(f);
+}
+
 // counter check
 void badCounter() __attribute__((error("counter index is not a constant, and this only applys to counter 0 ~ 3")));
 
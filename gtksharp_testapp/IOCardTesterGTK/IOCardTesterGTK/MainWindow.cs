@@ -1,9 +1,11 @@
 ﻿using System;
+using System.Collections.Concurrent;
 using System.Collections.Generic;
 using System.ComponentModel;
 using System.Diagnostics;
 using System.Text;
 using System.Text.RegularExpressions;
+using System.Threading;
 using Gtk;
 using Spark.Slot.IO;
 
@@ -22,6 +24,10 @@ public partial class MainWindow : Window
 	{
 		try
 		{
+			// a game setting outputs from several places would merge them into a single command per frame, sent by
+			// FlushOutputs() in Update(). not here, the tester sends SET_OUTPUT by hand too.
+			//mCardCache.Card.CoalesceOutputs = true;
+
 			// pass in the port and desired baudrate, for example "COM3" (on Windows) or "/dev/ttyUSB0" (on Linux)
 			mCardCache.Card.Connect(port, baudrate);
 
@@ -89,8 +95,11 @@ public partial class MainWindow : Window
 				mCardCache.Card.QueryEjectCoin(0, 5); // eject 5 coins from track 0
 			}
 
+			// or look at all the keys at once, a bit per key, pressed (or released) since the last
+			// <see cref="Spark.Slot.IO.IOCardStateCache.Processed()"/> call, even if it's released already.
+			//
 			// hit key 1 to tick the counters :-)
-			if (mCardCache.GetKey(1) == IOCardStateCache.KeyState.StateLow)
+			if ((mCardCache.PressedKeys & (1UL << 1)) != 0)
 			{
 				// tick audit counter 0 for 100 times, and this command placed in front of the queue.
 				mCardCache.Card.QueryTickAuditCounter(0, 100, CommandMessenger.SendQueue.InFrontQueue);
@@ -169,12 +178,31 @@ public partial class MainWindow : Window
 			// call this to tell the cache that all changes are processed.
 			mCardCache.Processed();
 		}
+
+		// the states above only tell how things are now, to count every tap and every coin drain the edges, once
+		// per frame, into a buffer allocated once.
+		int count;
+		while ((count = mCardCache.DrainEdges(mEdges)) > 0)
+		{
+			for (int i = 0; i < count; ++i)
+			{
+				if (mEdges[i].Kind == IOCardEdge.Kinds.Coin)
+					Debug.WriteLine("Got: {0} coin(s) on track {1}", mEdges[i].Coins, mEdges[i].Index);
+			}
+		}
+
+		// and at the end of the frame, send the outputs set during it, nothing if they didn't change. does nothing unless
+		// CoalesceOutputs is set.
+		mCardCache.Card.FlushOutputs();
 	}
+	readonly IOCardEdge[] mEdges = new IOCardEdge[64];
 
 	#endregion
 
 	#region "GTK# codes, safely ignores them if you're not interested."
 	IOCard mCard { get { return mCardCache.Card; } }
+	IOCardStorageTransfer mStorageTransfer;
+	DateTime mStorageTransferStarted;
 
 	int mLastCmdIndex;
 
@@ -231,17 +259,32 @@ public partial class MainWindow : Window
 	}
 
 	CommandProperty mCommandProperty_GetInfo;
+	CommandProperty mCommandProperty_SyncClock;
 	CommandProperty mCommandProperty_EjectCoin;
+	CommandProperty mCommandProperty_QueueEjectCoin;
 	CommandProperty mCommandProperty_GetCoinCounter;
 	CommandProperty mCommandProperty_ResetCoinCounter;
 	CommandProperty mCommandProperty_GetKeys;
 	CommandProperty mCommandProperty_GetKeyMasks;
 	CommandProperty mCommandProperty_SetEjectTimeout;
 	CommandProperty mCommandProperty_TickAuditCounter;
+	CommandProperty mCommandProperty_GetAuditBacklog;
 	CommandProperty mCommandProperty_SetOutputs;
 	CommandProperty mCommandProperty_SetTrackLevel;
 	CommandProperty mCommandProperty_WriteStorage;
 	CommandProperty mCommandProperty_ReadStorage;
+	CommandProperty mCommandProperty_StreamReadStorage;
+	CommandProperty mCommandProperty_GetIntegrityMap;
+	CommandProperty mCommandProperty_KvGet;
+	CommandProperty mCommandProperty_KvPut;
+	CommandProperty mCommandProperty_KvDelete;
+	CommandProperty mCommandProperty_KvFormat;
+	CommandProperty mCommandProperty_GetCmdStats;
+	CommandProperty mCommandProperty_GetPersistStats;
+	CommandProperty mCommandProperty_GetTaskStats;
+	CommandProperty mCommandProperty_LoadTest;
+	CommandProperty mCommandProperty_GetLoadTestStats;
+	CommandProperty mCommandProperty_GetEjectStats;
 	CommandProperty mCommandProperty_Reboot;
 	CommandProperty[] mCommandProperties;
 
@@ -253,8 +296,10 @@ public partial class MainWindow : Window
 
 		GLib.Timeout.Add(1000 / 60, delegate ()
 		{
+			_applyPosted();
 			if (checkbutton_update.Active)
 				Update();
+			_updateStats();
 			return true;
 		});
 
@@ -291,6 +336,25 @@ public partial class MainWindow : Window
 				mCard.QueryGetInfo();
 			}
 		);
+		mCommandProperty_SyncClock = new CommandProperty(
+			on_error_callback,
+			IOCard.Commands.CMD_SYNC_CLOCK, 0,
+			"Synchronize device clock (also sent automatically every second)",
+			"Params: N/A",
+			(command, parameters) =>
+			{
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						" => {0}: cmd = {1}\r\n",
+						DateTime.Now,
+						command
+					)
+				);
+				mCard.QuerySyncClock();
+			}
+		);
 		mCommandProperty_EjectCoin = new CommandProperty(
 			on_error_callback,
 			IOCard.Commands.CMD_EJECT_COIN, 2,
@@ -321,6 +385,37 @@ public partial class MainWindow : Window
 				mCard.QueryEjectCoin(track, count);
 			}
 		);
+		mCommandProperty_QueueEjectCoin = new CommandProperty(
+			on_error_callback,
+			IOCard.Commands.CMD_QUEUE_EJECT_COIN, 3,
+			"Queue a payout of N coins, paid out right after the previous ones.",
+			"Params: <track (byte)>, <request id (byte)>, <coins (byte)>",
+			new string[] {
+				"0, 1, 5 // request 1: eject 5 coins from track 0",
+				"0, 2, 3 // request 2: eject 3 coins from track 0"
+			},
+			(command, parameters) =>
+			{
+				var track = (byte)_getTfromString<uint>(parameters[0].Trim());
+				var id = (byte)_getTfromString<uint>(parameters[1].Trim());
+				var count = (byte)_getTfromString<uint>(parameters[2].Trim());
+
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						" => {0}: cmd = {1}, track = {2:X2}, id = {3}, count = {4}\r\n",
+						DateTime.Now,
+						command,
+						track,
+						id,
+						count
+					)
+				);
+
+				mCard.QueryQueueEjectCoin(track, id, count);
+			}
+		);
 		mCommandProperty_GetCoinCounter = new CommandProperty(
 			on_error_callback,
 			IOCard.Commands.CMD_GET_COIN_COUNTER, 1,
@@ -500,6 +595,26 @@ public partial class MainWindow : Window
 				mCard.QueryTickAuditCounter(counter, ticks);
 			}
 		);
+		mCommandProperty_GetAuditBacklog = new CommandProperty(
+			on_error_callback,
+			IOCard.Commands.CMD_GET_AUDIT_BACKLOG, 0,
+			"Get the audit counter ticks not pulsed yet",
+			"Params: N/A",
+			(command, parameters) =>
+			{
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						" => {0}: cmd = {1}\r\n",
+						DateTime.Now,
+						command
+					)
+				);
+
+				mCard.QueryGetAuditBacklog();
+			}
+		);
 		mCommandProperty_SetOutputs = new CommandProperty(
 			on_error_callback,
 			IOCard.Commands.CMD_SET_OUTPUT, 1,
@@ -616,10 +731,40 @@ public partial class MainWindow : Window
 				mCard.QueryReadStorage(address, length);
 			}
 		);
-		mCommandProperty_Reboot = new CommandProperty(
+		mCommandProperty_StreamReadStorage = new CommandProperty(
 			on_error_callback,
-			IOCard.Commands.CMD_REBOOT, 0,
-			"Reboot the device",
+			IOCard.Commands.CMD_STREAM_READ_STORAGE, 2,
+			"Stream a range of the onboard storage.",
+			"Params: <address (UInt16)>, <length (UInt16)>",
+			new string[] {
+				"0x200, 0x3500 // the whole user area",
+				"0x200, 1024"
+			},
+			(command, parameters) =>
+			{
+				var address = _getTfromString<ushort>(parameters[0].Trim());
+				var length = _getTfromString<ushort>(parameters[1].Trim());
+
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						" => {0}: cmd = {1}, address = 0x{2:X4}, length = {3}\r\n",
+						DateTime.Now,
+						command,
+						address,
+						length
+					)
+				);
+
+				mStorageTransferStarted = DateTime.Now;
+				mStorageTransfer.BeginRead(address, length);
+			}
+		);
+		mCommandProperty_GetIntegrityMap = new CommandProperty(
+			on_error_callback,
+			IOCard.Commands.CMD_GET_INTEGRITY_MAP, 0,
+			"Get the blocks of the onboard storage that failed the background check.",
 			"Params: N/A",
 			(command, parameters) =>
 			{
@@ -633,107 +778,473 @@ public partial class MainWindow : Window
 					)
 				);
 
-				mCard.QueueReboot();
+				mCard.QueryGetIntegrityMap();
 			}
 		);
+		mCommandProperty_KvGet = new CommandProperty(
+			on_error_callback,
+			IOCard.Commands.CMD_KV_GET, 1,
+			"Get a value from the key/value store.",
+			"Params: <key (UInt16)>",
+			new string[] {
+				"0x0001",
+				"0x0002"
+			},
+			(command, parameters) =>
+			{
+				var key = _getTfromString<ushort>(parameters[0].Trim());
 
-		mCommandProperties = new CommandProperty[] {
-			mCommandProperty_GetInfo,
-			mCommandProperty_SetTrackLevel,
-			mCommandProperty_EjectCoin,
-			mCommandProperty_GetCoinCounter,
-			mCommandProperty_ResetCoinCounter,
-			mCommandProperty_TickAuditCounter,
-			mCommandProperty_GetKeyMasks,
-			mCommandProperty_GetKeys,
-			mCommandProperty_SetOutputs,
-			mCommandProperty_SetEjectTimeout,
-			mCommandProperty_WriteStorage,
-			mCommandProperty_ReadStorage,
-			mCommandProperty_Reboot
-		};
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						" => {0}: cmd = {1}, key = 0x{2:X4}\r\n",
+						DateTime.Now,
+						command,
+						key
+					)
+				);
 
-		var cmds = new List<string>(mCommandProperties.Length);
-		foreach (var desc in mCommandProperties)
-			cmds.Add(string.Format("0x{0:X2} ({1})", (uint)desc.Command, desc.Command.ToString().Replace("CMD_", "")));
-		_populateComboBox(combobox_cmd, cmds);
-		mLastCmdIndex = combobox_cmd.Active;
-		label_cmd_desc.Text = mCommandProperties[mLastCmdIndex].CommandDescription;
-		label_params_desc.Text = mCommandProperties[mLastCmdIndex].ParamsDescription;
+				mCard.QueryKvGet(key);
+			}
+		);
+		mCommandProperty_KvPut = new CommandProperty(
+			on_error_callback,
+			IOCard.Commands.CMD_KV_PUT, 2,
+			"Put a value in the key/value store.",
+			"Params: <key (UInt16)>, <data (byte[])>",
+			new string[] {
+				"0x0001, 0x12 0x34 0x56 0x78",
+				"0x0002, 0xFE 0xDC 0xBA 0x09 0x87 0x65 0x43 0x21"
+			},
+			(command, parameters) =>
+			{
+				var key = _getTfromString<ushort>(parameters[0].Trim());
+				var data = Regex.Replace(parameters[1].Trim(), @"\s+", " ").Split(' ');
+				var bytes = new byte[data.Length];
+				for (int i = 0; i < data.Length; ++i)
+					bytes[i] = _getTfromString<byte>(data[i]);
 
-		_populateComboBox(comboboxentry_port, mPorts);
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						" => {0}: cmd = {1}, key = 0x{2:X4}, length = {3}\r\n",
+						DateTime.Now,
+						command,
+						key,
+						bytes.Length
+					)
+				);
 
-		_populateComboBox(comboboxentry_params, mCommandProperties[mLastCmdIndex].HistoryParams);
-		comboboxentry_params.Sensitive = mCommandProperties[mLastCmdIndex].Params != 0;
-		if (mCommandProperties[mLastCmdIndex].HistoryParams.Count > 2)
-		{
-			label_params_history_1.Text = mCommandProperties[mLastCmdIndex].HistoryParams[1];
-			button_send_1.Sensitive = true;
-		}
-		else {
-			label_params_history_1.Text = "";
-			button_send_1.Sensitive = false;
-		}
+				mCard.QueryKvPut(key, bytes);
+			}
+		);
+		mCommandProperty_KvDelete = new CommandProperty(
+			on_error_callback,
+			IOCard.Commands.CMD_KV_DELETE, 1,
+			"Delete a value from the key/value store.",
+			"Params: <key (UInt16)>",
+			new string[] {
+				"0x0001",
+				"0x0002"
+			},
+			(command, parameters) =>
+			{
+				var key = _getTfromString<ushort>(parameters[0].Trim());
 
-		mCard.OnConnected += (sender, e) =>
-		{
-			Application.Invoke(delegate
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						" => {0}: cmd = {1}, key = 0x{2:X4}\r\n",
+						DateTime.Now,
+						command,
+						key
+					)
+				);
+
+				mCard.QueryKvDelete(key);
+			}
+		);
+		mCommandProperty_KvFormat = new CommandProperty(
+			on_error_callback,
+			IOCard.Commands.CMD_KV_FORMAT, 1,
+			"Format the key/value store at the top of the FRAM, the user data there is lost.",
+			"Params: <format (byte)>",
+			new string[] {
+				"0 // just tell whether the store is there",
+				"1 // format it, erasing the keys"
+			},
+			(command, parameters) =>
 			{
-				button_send.Sensitive = true;
-				button_connect.Label = "_Disconnect";
-			});
-		};
-		mCard.OnDisconnected += (sender, e) =>
-		{
-			Application.Invoke(delegate
+				var format = _getTfromString<uint>(parameters[0].Trim()) != 0;
+
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						" => {0}: cmd = {1}, format = {2}\r\n",
+						DateTime.Now,
+						command,
+						format
+					)
+				);
+
+				mCard.QueryKvFormat(format);
+			}
+		);
+		mCommandProperty_GetCmdStats = new CommandProperty(
+			on_error_callback,
+			IOCard.Commands.CMD_GET_CMD_STATS, 1,
+			"Get command handler statistics",
+			"Params: <reset (byte)>",
+			new string[] {
+				"0 // just get the statistics",
+				"1 // get the statistics, and reset them"
+			},
+			(command, parameters) =>
 			{
-				button_send.Sensitive = false;
-				button_connect.Label = "_Connect";
-			});
-		};
-		mCard.OnError += (sender, e) =>
-		{
-			Application.Invoke(delegate
+				var reset = _getTfromString<uint>(parameters[0].Trim()) != 0;
+
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						" => {0}: cmd = {1}, reset = {2}\r\n",
+						DateTime.Now,
+						command,
+						reset
+					)
+				);
+
+				mCard.QueryGetCommandStats(reset);
+			}
+		);
+		mCommandProperty_GetPersistStats = new CommandProperty(
+			on_error_callback,
+			IOCard.Commands.CMD_GET_PERSIST_STATS, 1,
+			"Get the power-fail flush times and the counter write-backs",
+			"Params: <reset (byte)>",
+			new string[] {
+				"0 // just get the statistics",
+				"1 // get the statistics, and reset them"
+			},
+			(command, parameters) =>
 			{
-				switch (e.ErrorCode)
-				{
-					case IOCard.Errors.ERR_EJECT_INTERRUPTED:
-						{
-							var ev = (IOCard.ErrorEjectInterruptedEventArgs)e;
-							var iter = textview_received.Buffer.StartIter;
-							textview_received.Buffer.Insert(
-								ref iter,
-								string.Format(
-									"<=  {0}: error = {1}, Track = {2}, Coins Failed = {3}\r\n",
-									ev.DateTime,
-									ev.ErrorCode,
-									ev.Track,
-									ev.CoinsFailed
-								)
-							);
-						}
-						break;
-					case IOCard.Errors.ERR_EJECT_TIMEOUT:
-						{
-							var ev = (IOCard.ErrorEjectTimeoutEventArgs)e;
-							var iter = textview_received.Buffer.StartIter;
-							textview_received.Buffer.Insert(
-								ref iter,
-								string.Format(
-									"<=  {0}: error = {1}, Track = {2}, Coins Failed = {3}\r\n",
-									ev.DateTime,
-									ev.ErrorCode,
-									ev.Track,
-									ev.CoinsFailed
-								)
-							);
-						}
-						break;
-					case IOCard.Errors.ERR_NOT_A_TRACK:
-						{
-							var ev = (IOCard.ErrorTrackEventArgs)e;
-							var iter = textview_received.Buffer.StartIter;
-							textview_received.Buffer.Insert(
+				var reset = _getTfromString<uint>(parameters[0].Trim()) != 0;
+
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						" => {0}: cmd = {1}, reset = {2}\r\n",
+						DateTime.Now,
+						command,
+						reset
+					)
+				);
+
+				mCard.QueryGetPersistStats(reset);
+			}
+		);
+		mCommandProperty_GetTaskStats = new CommandProperty(
+			on_error_callback,
+			IOCard.Commands.CMD_GET_TASK_STATS, 1,
+			"Get the run times, overruns and misses of the main loop's tasks",
+			"Params: <reset (byte)>",
+			new string[] {
+				"0 // just get the statistics",
+				"1 // get the statistics, and reset them"
+			},
+			(command, parameters) =>
+			{
+				var reset = _getTfromString<uint>(parameters[0].Trim()) != 0;
+
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						" => {0}: cmd = {1}, reset = {2}\r\n",
+						DateTime.Now,
+						command,
+						reset
+					)
+				);
+
+				mCard.QueryGetTaskStats(reset);
+			}
+		);
+		mCommandProperty_LoadTest = new CommandProperty(
+			on_error_callback,
+			IOCard.Commands.CMD_LOAD_TEST, 5,
+			"Generate keys and coins on the card instead of reading them, the hoppers stay off.",
+			"Params: <mode (byte)> <keys/s (UInt16)> <coins/s (UInt16)> <duration in s (UInt16)> <seed (UInt16)>",
+			new string[] {
+				"1 100 10 60 1 // random keys, 100 changes/s and 10 coins/s for a minute",
+				"2 1000 30 10 1 // every key in order, as fast as it goes",
+				"0 0 0 0 0 // stop the test"
+			},
+			(command, parameters) =>
+			{
+				var mode = (IOCard.LoadTestMode)_getTfromString<uint>(parameters[0].Trim());
+				var keyRate = (ushort)_getTfromString<uint>(parameters[1].Trim());
+				var coinRate = (ushort)_getTfromString<uint>(parameters[2].Trim());
+				var duration = (ushort)_getTfromString<uint>(parameters[3].Trim());
+				var seed = (ushort)_getTfromString<uint>(parameters[4].Trim());
+
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						" => {0}: cmd = {1}, mode = {2}, keys = {3}/s, coins = {4}/s, duration = {5}s, seed = {6}\r\n",
+						DateTime.Now,
+						command,
+						mode,
+						keyRate,
+						coinRate,
+						duration,
+						seed
+					)
+				);
+
+				mCard.QueryLoadTest(mode, keyRate, coinRate, duration, seed);
+			}
+		);
+		mCommandProperty_GetLoadTestStats = new CommandProperty(
+			on_error_callback,
+			IOCard.Commands.CMD_GET_LOAD_TEST_STATS, 0,
+			"Get the counters of the load test running, or of the last one.",
+			"Params: N/A",
+			(command, parameters) =>
+			{
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						" => {0}: cmd = {1}\r\n",
+						DateTime.Now,
+						command
+					)
+				);
+
+				mCard.QueryGetLoadTestStats();
+			}
+		);
+		mCommandProperty_GetEjectStats = new CommandProperty(
+			on_error_callback,
+			IOCard.Commands.CMD_GET_EJECT_STATS, 2,
+			"Get coin rate statistics of an eject track",
+			"Params: <track (byte)> <reset (byte)>",
+			new string[] {
+				"0 0 // track 0, just get the statistics",
+				"1 0 // track 1, just get the statistics",
+				"0 1 // track 0, get the statistics, and reset them"
+			},
+			(command, parameters) =>
+			{
+				var track = (byte)_getTfromString<uint>(parameters[0].Trim());
+				var reset = _getTfromString<uint>(parameters[1].Trim()) != 0;
+
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						" => {0}: cmd = {1}, track = 0x{2:X2}, reset = {3}\r\n",
+						DateTime.Now,
+						command,
+						track,
+						reset
+					)
+				);
+
+				mCard.QueryGetEjectStats(track, reset);
+			}
+		);
+		mCommandProperty_Reboot = new CommandProperty(
+			on_error_callback,
+			IOCard.Commands.CMD_REBOOT, 0,
+			"Reboot the device",
+			"Params: N/A",
+			(command, parameters) =>
+			{
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						" => {0}: cmd = {1}\r\n",
+						DateTime.Now,
+						command
+					)
+				);
+
+				mCard.QueueReboot();
+			}
+		);
+
+		mCommandProperties = new CommandProperty[] {
+			mCommandProperty_GetInfo,
+			mCommandProperty_SyncClock,
+			mCommandProperty_SetTrackLevel,
+			mCommandProperty_EjectCoin,
+			mCommandProperty_QueueEjectCoin,
+			mCommandProperty_GetCoinCounter,
+			mCommandProperty_ResetCoinCounter,
+			mCommandProperty_TickAuditCounter,
+			mCommandProperty_GetAuditBacklog,
+			mCommandProperty_GetKeyMasks,
+			mCommandProperty_GetKeys,
+			mCommandProperty_SetOutputs,
+			mCommandProperty_SetEjectTimeout,
+			mCommandProperty_WriteStorage,
+			mCommandProperty_ReadStorage,
+			mCommandProperty_StreamReadStorage,
+			mCommandProperty_GetIntegrityMap,
+			mCommandProperty_KvGet,
+			mCommandProperty_KvPut,
+			mCommandProperty_KvDelete,
+			mCommandProperty_KvFormat,
+			mCommandProperty_GetCmdStats,
+			mCommandProperty_GetPersistStats,
+			mCommandProperty_GetTaskStats,
+			mCommandProperty_GetEjectStats,
+			mCommandProperty_LoadTest,
+			mCommandProperty_GetLoadTestStats,
+			mCommandProperty_Reboot
+		};
+
+		var cmds = new List<string>(mCommandProperties.Length);
+		foreach (var desc in mCommandProperties)
+			cmds.Add(string.Format("0x{0:X2} ({1})", (uint)desc.Command, desc.Command.ToString().Replace("CMD_", "")));
+		_populateComboBox(combobox_cmd, cmds);
+		mLastCmdIndex = combobox_cmd.Active;
+		label_cmd_desc.Text = mCommandProperties[mLastCmdIndex].CommandDescription;
+		label_params_desc.Text = mCommandProperties[mLastCmdIndex].ParamsDescription;
+
+		_populateComboBox(comboboxentry_port, mPorts);
+
+		_populateComboBox(comboboxentry_params, mCommandProperties[mLastCmdIndex].HistoryParams);
+		comboboxentry_params.Sensitive = mCommandProperties[mLastCmdIndex].Params != 0;
+		if (mCommandProperties[mLastCmdIndex].HistoryParams.Count > 2)
+		{
+			label_params_history_1.Text = mCommandProperties[mLastCmdIndex].HistoryParams[1];
+			button_send_1.Sensitive = true;
+		}
+		else {
+			label_params_history_1.Text = "";
+			button_send_1.Sensitive = false;
+		}
+
+		mCard.OnConnected += (sender, e) =>
+		{
+			_post(delegate
+			{
+				button_send.Sensitive = true;
+				button_connect.Label = "_Disconnect";
+			});
+		};
+		mCard.OnDisconnected += (sender, e) =>
+		{
+			_post(delegate
+			{
+				button_send.Sensitive = false;
+				button_connect.Label = "_Connect";
+			});
+		};
+		mCard.OnError += (sender, e) =>
+		{
+			_post(delegate
+			{
+				switch (e.ErrorCode)
+				{
+					case IOCard.Errors.ERR_EJECT_INTERRUPTED:
+						{
+							var ev = (IOCard.ErrorEjectInterruptedEventArgs)e;
+							var iter = textview_received.Buffer.StartIter;
+							textview_received.Buffer.Insert(
+								ref iter,
+								string.Format(
+									"<=  {0}: error = {1}, Track = {2}, Coins Failed = {3}\r\n",
+									ev.DateTime,
+									ev.ErrorCode,
+									ev.Track,
+									ev.CoinsFailed
+								)
+							);
+						}
+						break;
+					case IOCard.Errors.ERR_EJECT_TIMEOUT:
+						{
+							var ev = (IOCard.ErrorEjectTimeoutEventArgs)e;
+							var iter = textview_received.Buffer.StartIter;
+							textview_received.Buffer.Insert(
+								ref iter,
+								string.Format(
+									"<=  {0}: error = {1}, Track = {2}, Coins Failed = {3}\r\n",
+									ev.DateTime,
+									ev.ErrorCode,
+									ev.Track,
+									ev.CoinsFailed
+								)
+							);
+						}
+						break;
+					case IOCard.Errors.ERR_EJECT_SLOW:
+						{
+							var ev = (IOCard.ErrorEjectSlowEventArgs)e;
+							var iter = textview_received.Buffer.StartIter;
+							textview_received.Buffer.Insert(
+								ref iter,
+								string.Format(
+									"<=  {0}: error = {1}, Track = {2}, Elapsed = {3}us, Average = {4}us\r\n",
+									ev.DateTime,
+									ev.ErrorCode,
+									ev.Track,
+									ev.ElapsedMicros,
+									ev.AverageMicros
+								)
+							);
+						}
+						break;
+					case IOCard.Errors.ERR_EJECT_QUEUE_FULL:
+						{
+							var ev = (IOCard.ErrorEjectQueueFullEventArgs)e;
+							var iter = textview_received.Buffer.StartIter;
+							textview_received.Buffer.Insert(
+								ref iter,
+								string.Format(
+									"<=  {0}: error = {1}, Track = {2}, Request = {3}\r\n",
+									ev.DateTime,
+									ev.ErrorCode,
+									ev.Track,
+									ev.RequestId
+								)
+							);
+						}
+						break;
+					case IOCard.Errors.ERR_KV_FULL:
+					case IOCard.Errors.ERR_KV_INVALID:
+					case IOCard.Errors.ERR_KV_CORRUPTED:
+					case IOCard.Errors.ERR_KV_UNFORMATTED:
+						{
+							var ev = (IOCard.ErrorKvEventArgs)e;
+							var iter = textview_received.Buffer.StartIter;
+							textview_received.Buffer.Insert(
+								ref iter,
+								string.Format(
+									"<=  {0}: error = {1}, key = 0x{2:X4}\r\n",
+									ev.DateTime,
+									ev.ErrorCode,
+									ev.Key
+								)
+							);
+						}
+						break;
+					case IOCard.Errors.ERR_NOT_A_TRACK:
+						{
+							var ev = (IOCard.ErrorTrackEventArgs)e;
+							var iter = textview_received.Buffer.StartIter;
+							textview_received.Buffer.Insert(
 								ref iter,
 								string.Format(
 									"<=  {0}: error = {1}, Track = {2}\r\n",
@@ -759,6 +1270,21 @@ public partial class MainWindow : Window
 							);
 						}
 						break;
+					case IOCard.Errors.ERR_STORAGE_CORRUPTED:
+						{
+							var ev = (IOCard.ErrorStorageCorruptedEventArgs)e;
+							var iter = textview_received.Buffer.StartIter;
+							textview_received.Buffer.Insert(
+								ref iter,
+								string.Format(
+									"<=  {0}: error = {1}, address = 0x{2:X4}\r\n",
+									ev.DateTime,
+									ev.ErrorCode,
+									ev.Address
+								)
+							);
+						}
+						break;
 					case IOCard.Errors.ERR_PROTECTED_STORAGE:
 						{
 							var ev = (IOCard.ErrorProtectedStorageEventArgs)e;
@@ -806,6 +1332,21 @@ public partial class MainWindow : Window
 							);
 						}
 						break;
+					case IOCard.Errors.ERR_LOAD_TEST_DENIED:
+						{
+							var ev = (IOCard.ErrorLoadTestDeniedEventArgs)e;
+							var iter = textview_received.Buffer.StartIter;
+							textview_received.Buffer.Insert(
+								ref iter,
+								string.Format(
+									"<=  {0}: error = {1}, cmd = {2}\r\n",
+									ev.DateTime,
+									ev.ErrorCode,
+									ev.Command
+								)
+							);
+						}
+						break;
 					case IOCard.Errors.ERR_UNKNOWN_COMMAND:
 						{
 							var ev = (IOCard.ErrorUnknownCommandEventArgs)e;
@@ -841,7 +1382,7 @@ public partial class MainWindow : Window
 		};
 		mCard.OnBoot += (sender, e) =>
 		{
-			Application.Invoke(delegate
+			_post(delegate
 			{
 				var iter = textview_received.Buffer.StartIter;
 				textview_received.Buffer.Insert(
@@ -855,9 +1396,33 @@ public partial class MainWindow : Window
 				);
 			});
 		};
+		mCard.OnSyncClockResult += (sender, e) =>
+		{
+			// the driver syncs every second, only show one line per window.
+			if (e.Sequence % IOCardClock.SAMPLES_PER_WINDOW != 0)
+				return;
+
+			_post(delegate
+			{
+				var latency = mCard.Clock.Latency;
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						"<=  {0}: Clock: Device = {1}us, Round Trip = {2}us, Skew = {3:F6}, Latency avg = {4:F0}us, max = {5}us\r\n",
+						e.DateTime,
+						e.DeviceMicros,
+						e.RoundTrip,
+						e.Skew,
+						latency.Average,
+						latency.Max
+					)
+				);
+			});
+		};
 		mCard.OnGetInfoResult += (sender, e) =>
 		{
-			Application.Invoke(delegate
+			_post(delegate
 			{
 				var iter = textview_received.Buffer.StartIter;
 				textview_received.Buffer.Insert(
@@ -875,23 +1440,42 @@ public partial class MainWindow : Window
 		};
 		mCard.OnCoinCounterResult += (sender, e) =>
 		{
-			Application.Invoke(delegate
+			_post(delegate
 			{
 				var iter = textview_received.Buffer.StartIter;
 				textview_received.Buffer.Insert(
 					ref iter,
 					string.Format(
-						"<=  {0}: Track = {1}, Coins = {2}\r\n",
+						"<=  {0}: Track = {1}, Coins = {2}, Latency = {3}\r\n",
 						e.DateTime,
 						e.Track,
-						e.Coins
+						e.Coins,
+						e.HasLatency ? e.Latency + "us" : "unknown"
+					)
+				);
+			});
+		};
+		mCard.OnEjectResult += (sender, e) =>
+		{
+			_post(delegate
+			{
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						"<=  {0}: Track = {1}, Request = {2}, Requested = {3}, Remaining = {4}\r\n",
+						e.DateTime,
+						e.Track,
+						e.RequestId,
+						e.Requested,
+						e.Remaining
 					)
 				);
 			});
 		};
 		mCard.OnKeys += (sender, e) =>
 		{
-			Application.Invoke(delegate
+			_post(delegate
 			{
 				var builder = new StringBuilder(e.Keys.Length * 3);
 				foreach (var key in e.Keys)
@@ -901,35 +1485,40 @@ public partial class MainWindow : Window
 				textview_received.Buffer.Insert(
 					ref iter,
 					string.Format(
-						"<=  {0}: Keys:{1}\r\n",
+						"<=  {0}: Keys:{1}, Latency = {2}\r\n",
 						e.DateTime,
-						builder
+						builder,
+						e.HasLatency ? e.Latency + "us" : "unknown"
 					)
 				);
 			});
 		};
 		mCard.OnKeyMasks += (sender, e) =>
 		{
-			Application.Invoke(delegate
+			_post(delegate
 			{
 				var builder = new StringBuilder(e.KeyMasks.Length * 3);
 				foreach (var mask in e.KeyMasks)
 					builder.Append(string.Format(" {0:X2}", mask));
+				var outputBuilder = new StringBuilder(e.OutputMasks.Length * 3);
+				foreach (var mask in e.OutputMasks)
+					outputBuilder.Append(string.Format(" {0:X2}", mask));
 
 				var iter = textview_received.Buffer.StartIter;
 				textview_received.Buffer.Insert(
 					ref iter,
 					string.Format(
-						"<=  {0}: Key Masks:{1}\r\n",
+						"<=  {0}: Key Masks:{1}, Output Masks:{2}\r\n",
 						e.DateTime,
-						builder
+						builder,
+						outputBuilder
 					)
 				);
 			});
 		};
 		mCard.OnWriteStorageResult += (sender, e) =>
 		{
-			Application.Invoke(delegate
+			_post(delegate
 			{
 				var iter = textview_received.Buffer.StartIter;
 				textview_received.Buffer.Insert(
@@ -943,9 +1532,30 @@ public partial class MainWindow : Window
 				);
 			});
 		};
+		mStorageTransfer = new IOCardStorageTransfer(mCard);
+		mStorageTransfer.OnCompleted += (sender, e) =>
+		{
+			_post(delegate
+			{
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						"<=  {0}: Stream: Address = 0x{1:X4}, Length = {2}, Good = {3}, CRC = 0x{4:X4}, took {5:F0}ms{6}\r\n",
+						DateTime.Now,
+						e.Address,
+						e.Data.Length,
+						e.IsGood,
+						IOCardStorageTransfer.Crc16(e.Data, 0, e.Data.Length),
+						(DateTime.Now - mStorageTransferStarted).TotalMilliseconds,
+						e.Error == null ? "" : ", error = " + e.Error.ErrorCode
+					)
+				);
+			});
+		};
 		mCard.OnReadStorageResult += (sender, e) =>
 		{
-			Application.Invoke(delegate
+			_post(delegate
 			{
 				var builder = new StringBuilder(e.Data.Length * 3);
 				foreach (var data in e.Data)
@@ -963,9 +1573,264 @@ public partial class MainWindow : Window
 				);
 			});
 		};
+		mCard.OnIntegrityMapResult += (sender, e) =>
+		{
+			_post(delegate
+			{
+				var builder = new StringBuilder();
+				foreach (var address in e.CorruptedAddresses)
+					builder.AppendFormat(" 0x{0:X4}", address);
+
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						"<=  {0}: Integrity Map: Sealed = {1}, Passes = {2}, Corrupted ={3}\r\n",
+						e.DateTime,
+						e.IsSealed,
+						e.Passes,
+						builder.Length == 0 ? " none" : builder.ToString()
+					)
+				);
+			});
+		};
+		mCard.OnKvGetResult += (sender, e) =>
+		{
+			_post(delegate
+			{
+				var builder = new StringBuilder();
+				if (e.Value == null)
+					builder.Append(" not found");
+				else
+					foreach (var data in e.Value)
+						builder.Append(string.Format(" {0:X2}", data));
+
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						"<=  {0}: Key = 0x{1:X4}, Value ={2}\r\n",
+						e.DateTime,
+						e.Key,
+						builder
+					)
+				);
+			});
+		};
+		mCard.OnKvPutResult += (sender, e) =>
+		{
+			_post(delegate
+			{
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						"<=  {0}: Key = 0x{1:X4}, Length = {2}, Free = {3}\r\n",
+						e.DateTime,
+						e.Key,
+						e.Length,
+						e.Free
+					)
+				);
+			});
+		};
+		mCard.OnKvDeleteResult += (sender, e) =>
+		{
+			_post(delegate
+			{
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						"<=  {0}: Key = 0x{1:X4}, Found = {2}\r\n",
+						e.DateTime,
+						e.Key,
+						e.Found
+					)
+				);
+			});
+		};
+		mCard.OnKvFormatResult += (sender, e) =>
+		{
+			_post(delegate
+			{
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						"<=  {0}: Formatted = {1}, User End = 0x{2:X4}, Free = {3}\r\n",
+						e.DateTime,
+						e.IsFormatted,
+						e.UserEnd,
+						e.Free
+					)
+				);
+			});
+		};
+		mCard.OnEjectStatsResult += (sender, e) =>
+		{
+			_post(delegate
+			{
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						"<=  {0}: Eject Stats: Track = {1}, Samples = {2}, Avg = {3}us, Dev = {4}us, Min = {5}us, Max = {6}us, Slow = {7}, Cuts = {8}, Misses = {9}\r\n",
+						e.DateTime,
+						e.Track,
+						e.Samples,
+						e.AverageMicros,
+						e.DeviationMicros,
+						e.MinMicros,
+						e.MaxMicros,
+						e.SlowCoins,
+						e.Cuts,
+						e.Misses
+					)
+				);
+			});
+		};
+		mCard.OnLoadTestResult += (sender, e) =>
+		{
+			_post(delegate
+			{
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						"<=  {0}: Load Test: Mode = {1}, Elapsed = {2}us, Scans = {3}, Keys = {4}/{5}/{6}, Coins = {7}/{8}/{9}, " +
+						"Events = {10:F1}/s, Dropped = {11}, TX Stalls = {12}\r\n",
+						e.DateTime,
+						e.Mode,
+						e.Elapsed,
+						e.Loops,
+						e.KeyEdges,
+						e.KeyEvents,
+						e.KeysReceived,
+						e.Coins,
+						e.CoinEvents,
+						e.CoinsReceived,
+						e.EventsPerSecond,
+						e.DroppedFrames,
+						e.TxStalls
+					)
+				);
+			});
+		};
+		mCard.OnAuditBacklogResult += (sender, e) =>
+		{
+			_post(delegate
+			{
+				var builder = new StringBuilder();
+				for (int i = 0; i < e.Pending.Length; ++i)
+					builder.AppendFormat(" [{0}] {1}/{2}", i, e.Pending[i], e.Checkpointed[i]);
+
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						"<=  {0}: Audit Backlog (pending/checkpointed):{1}, Writes = {2}\r\n",
+						e.DateTime,
+						builder,
+						e.Writes
+					)
+				);
+			});
+		};
+		mCard.OnPersistStatsResult += (sender, e) =>
+		{
+			_post(delegate
+			{
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						"<=  {0}: Persist Stats: Enabled = {1}, Restored = {2}, Flushes = {3}, Last = {4}us, Max = {5}us, " +
+						"Changes = {6}, Write-backs = {7}, Power Failed = {8}\r\n",
+						e.DateTime,
+						e.IsEnabled,
+						e.IsRestored,
+						e.Flushes,
+						e.LastFlushMicros,
+						e.MaxFlushMicros,
+						e.Changes,
+						e.WriteBacks,
+						e.IsPowerFailed
+					)
+				);
+			});
+		};
+		mCard.OnTaskStatsResult += (sender, e) =>
+		{
+			_post(delegate
+			{
+				var builder = new StringBuilder();
+				foreach (var task in e.Tasks)
+				{
+					builder.AppendFormat(
+						"\r\n      task {0}{1}: period = {2}us, budget = {3}us, runs = {4}, avg = {5:F1}us, max = {6}us, " +
+						"overruns = {7}, misses = {8}",
+						task.Task,
+						task.IsRealtime ? " (realtime)" : "",
+						task.PeriodMicros,
+						task.BudgetMicros,
+						task.Runs,
+						task.AverageMicros,
+						task.MaxMicros,
+						task.Overruns,
+						task.Misses
+					);
+				}
+
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						"<=  {0}: Task Stats: Passes = {1}, Idle = {2}{3}\r\n",
+						e.DateTime,
+						e.Passes,
+						e.Idle,
+						builder
+					)
+				);
+			});
+		};
+		mCard.OnCommandStatsResult += (sender, e) =>
+		{
+			_post(delegate
+			{
+				var builder = new StringBuilder();
+				foreach (var stat in e.Stats)
+				{
+					if (stat.Count == 0)
+						continue;
+					builder.AppendFormat(
+						"\r\n      cmd 0x{0:X2}: count = {1}, avg = {2:F1}us, max = {3}us",
+						stat.Command,
+						stat.Count,
+						stat.AverageMicros,
+						stat.MaxMicros
+					);
+					if (stat.Histogram.Length != 0)
+						builder.Append(", histogram =");
+					foreach (var bucket in stat.Histogram)
+						builder.AppendFormat(" {0}", bucket);
+				}
+
+				var iter = textview_received.Buffer.StartIter;
+				textview_received.Buffer.Insert(
+					ref iter,
+					string.Format(
+						"<=  {0}: Command Stats:{1}\r\n",
+						e.DateTime,
+						builder
+					)
+				);
+			});
+		};
 		mCard.OnDebug += (sender, e) =>
 		{
-			Application.Invoke(delegate
+			_post(delegate
 			{
 				var iter = textview_received.Buffer.StartIter;
 				textview_received.Buffer.Insert(
@@ -980,7 +1845,7 @@ public partial class MainWindow : Window
 		};
 		mCard.OnUnknown += (sender, e) =>
 		{
-			Application.Invoke(delegate
+			_post(delegate
 			{
 				var iter = textview_received.Buffer.StartIter;
 				textview_received.Buffer.Insert(
@@ -1127,6 +1992,59 @@ public partial class MainWindow : Window
 		mCommandProperties[mLastCmdIndex].SendCommand(parameters_raw.Split(','));
 	}
 
+	// the card's events come in on the messenger's thread, their UI updates are queued here and run once per frame
+	// instead of waking the main loop for each of them, which can't keep up with a key or coin storm.
+	void _post(System.Action action)
+	{
+		Interlocked.Increment(ref mPostedCount);
+		mPosted.Enqueue(action);
+	}
+
+	void _applyPosted()
+	{
+		// only the ones queued so far, the next frame takes the rest.
+		var count = mPosted.Count;
+		if (count > mPostedMax)
+			mPostedMax = count;
+
+		System.Action action;
+		for (; count > 0 && mPosted.TryDequeue(out action); --count)
+			action();
+	}
+
+	void _updateStats()
+	{
+		var now = IOCardClock.Now;
+		var elapsed = now - mStatsTime;
+		if (elapsed < STATS_INTERVAL)
+			return;
+
+		var posted = Interlocked.Read(ref mPostedCount);
+		var ack = mCard.AckRoundTrip;
+		var latency = mCard.Clock.Latency;
+		label_stats.Text = string.Format(
+			"Events = {0:F0}/s, UI Queue = {1} (max {2}), Edges = {3}, ACK RTT avg = {4:F0}us, max = {5}us, Latency avg = {6:F0}us",
+			(posted - mStatsPosted) * 1000000.0 / elapsed,
+			mPosted.Count,
+			mPostedMax,
+			mCardCache.EdgeQueueCount,
+			ack.Average,
+			ack.Max,
+			latency.Average
+		);
+
+		mStatsTime = now;
+		mStatsPosted = posted;
+		mPostedMax = 0;
+	}
+
+	readonly ConcurrentQueue<System.Action> mPosted = new ConcurrentQueue<System.Action>();
+	long mPostedCount;
+	int mPostedMax;
+	long mStatsTime = IOCardClock.Now;
+	long mStatsPosted;
+	const long STATS_INTERVAL = 500000; // us
+
 	void _populateComboBox(ComboBox cb, List<string> contents)
 	{
 		var store = (ListStore)cb.Model;
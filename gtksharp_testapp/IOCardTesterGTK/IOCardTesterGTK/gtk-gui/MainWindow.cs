@@ -35,6 +35,8 @@ public partial class MainWindow
 
 	private global::Gtk.Label label_port;
 
+	private global::Gtk.Label label_stats;
+
 	protected virtual void Build()
 	{
 		global::Stetic.Gui.Initialize(this);
@@ -221,6 +223,17 @@ public partial class MainWindow
 		global::Gtk.Table.TableChild w15 = ((global::Gtk.Table.TableChild)(this.table1[this.label_port]));
 		w15.XOptions = ((global::Gtk.AttachOptions)(0));
 		w15.YOptions = ((global::Gtk.AttachOptions)(4));
+		// Container child table1.Gtk.Table+TableChild
+		this.label_stats = new global::Gtk.Label();
+		this.label_stats.Name = "label_stats";
+		this.label_stats.Xalign = 0F;
+		this.table1.Add(this.label_stats);
+		global::Gtk.Table.TableChild w16 = ((global::Gtk.Table.TableChild)(this.table1[this.label_stats]));
+		w16.TopAttach = ((uint)(2));
+		w16.BottomAttach = ((uint)(3));
+		w16.RightAttach = ((uint)(3));
+		w16.XOptions = ((global::Gtk.AttachOptions)(4));
+		w16.YOptions = ((global::Gtk.AttachOptions)(4));
 		this.Add(this.table1);
 		if ((this.Child != null))
 		{